@@ -23,8 +23,8 @@ SPBPQueue* spBPQueueCreate(int maxSize) {
     int totalSizeOfElements = maxSize * sizeof(*(newSPBPQueue->elementsBasePointer));
     BPQueueElement * newElementsAddress = malloc(totalSizeOfElements);
     if (newElementsAddress == NULL) {
-        // we created a new Queue but Create failed. free that queue
-        spBPQueueDestroy(newSPBPQueue); 
+        // we created a new Queue but Create failed. free that queue (it has no elements yet)
+        free(newSPBPQueue);
         return NULL; 
     }
     newSPBPQueue->elementsBasePointer = newElementsAddress;
@@ -46,7 +46,7 @@ SPBPQueue* spBPQueueCopy(SPBPQueue* source) {
 
     if (newElementsMemory == NULL) {
         /* we allocated for a queue already, but the second malloc failed. free the memory of the queue */
-        spBPQueueDestroy(newSPBPQueue); 
+        free(newSPBPQueue);
         return NULL; 
     }
 
@@ -194,3 +194,8 @@ bool spBPQueueIsFull(SPBPQueue * source) {
     return source->numOfElements == source->maxCapacity;
 }
 
+size_t spBPQueueGetMemoryUsage(int maxSize) {
+    assert(maxSize > 0);
+    return sizeof(SPBPQueue) + maxSize * sizeof(BPQueueElement);
+}
+
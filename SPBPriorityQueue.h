@@ -1,6 +1,7 @@
 #ifndef SPBPRIORITYQUEUE_H_
 #define SPBPRIORITYQUEUE_H_
 #include <stdbool.h>
+#include <stddef.h>
 
 
 /**
@@ -26,6 +27,7 @@
  * spBPQueueMaxValue - Returns the maximum value in the queue
  * spBPQueueIsEmpty - Returns true if the queue is empty
  * spBPQueueIsFull - Returns true if the queue is full
+ * spBPQueueGetMemoryUsage - Returns the memory a queue of a given capacity takes
  *
  */
 
@@ -222,4 +224,11 @@ bool spBPQueueIsEmpty(SPBPQueue* source);
  */
 bool spBPQueueIsFull(SPBPQueue* source);
 
+/**
+ * The memory a queue created by spBPQueueCreate(maxSize) takes, in bytes
+ * @param maxSize - the capacity of the queue
+ * @assert (maxSize > 0)
+ */
+size_t spBPQueueGetMemoryUsage(int maxSize);
+
 #endif
@@ -2,14 +2,42 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <stdbool.h>
 
+/* all arena allocations are rounded up to this alignment */
+#define SP_POINT_ARENA_ALIGNMENT 16
+#define SP_POINT_ARENA_ALIGN_UP(size) (((size) + SP_POINT_ARENA_ALIGNMENT - 1) & ~((size_t)SP_POINT_ARENA_ALIGNMENT - 1))
+
+/* blocks stop doubling in size once they reach this size */
+#define SP_POINT_ARENA_MAX_BLOCK_SIZE ((size_t)1 << 28)
 
 struct sp_point_t {
     double* data;
     int dim;
     int index;
+    /* true if the point was allocated from an arena (and is freed with it) */
+    bool isInArena;
 };
 
+typedef struct sp_point_arena_block_t {
+    /* the previously allocated block */
+    struct sp_point_arena_block_t* next;
+    /* size of the usable memory of the block */
+    size_t capacity;
+    /* number of bytes already handed out from the block */
+    size_t used;
+} SPPointArenaBlock;
+
+struct sp_point_arena_t {
+    /* the block allocations are currently served from */
+    SPPointArenaBlock* head;
+    /* the capacity of the next block to allocate */
+    size_t nextBlockSize;
+};
+
+/* the usable memory of a block starts right after its (aligned) header */
+#define SP_POINT_ARENA_BLOCK_DATA(block) ((char*)(block) + SP_POINT_ARENA_ALIGN_UP(sizeof(SPPointArenaBlock)))
+
 
 SPPoint* spPointCreate(double* data, int dim, int index) {
 
@@ -27,13 +55,14 @@ SPPoint* spPointCreate(double* data, int dim, int index) {
 
     double * newData = malloc(sizeOfCoords);
     if (newData == NULL) {
-        spPointDestroy(newPoint);
+        free(newPoint);
         return NULL;
     }
 
     newPoint-> index = index;
     newPoint-> dim = dim;
     newPoint->data = newData;
+    newPoint->isInArena = false;
     memcpy(newData, data, sizeOfCoords);
     return newPoint;
 }
@@ -50,7 +79,7 @@ SPPoint* spPointCopy(SPPoint* source) {
 
     double * newData = malloc(sizeOfCoords);
     if (newData == NULL) {
-        spPointDestroy(newPoint);
+        free(newPoint);
         return NULL;
     }
     
@@ -58,6 +87,7 @@ SPPoint* spPointCopy(SPPoint* source) {
     newPoint->dim = source->dim;
     newPoint->index = source->index;
     newPoint->data = newData;
+    newPoint->isInArena = false;
     memcpy(newData, source->data, sizeOfCoords);
 
     return newPoint;
@@ -65,7 +95,8 @@ SPPoint* spPointCopy(SPPoint* source) {
 }
 
 void spPointDestroy(SPPoint* point) {
-    if (point != NULL) {
+    /* points of an arena are released together with the arena */
+    if (point != NULL && !point->isInArena) {
        free(point->data);
        free(point);
     }
@@ -88,14 +119,178 @@ double spPointGetAxisCoor(SPPoint* point, int axis) {
     return point->data[axis];
 }
 
-double spPointL2SquaredDistance(SPPoint* p, SPPoint* q) {
-    assert(p != NULL && q != NULL && p->dim == q->dim);
-    double * pData = p->data;
-    double * qData = q->data;
+/* the L2-squared distance between two coordinate arrays of the same dimension */
+static double spPointCoorsL2SquaredDistance(const double* pData, const double* qData, int dim) {
     double distance = 0;
-    for (int i = 0; i < p->dim; i++) {
+    for (int i = 0; i < dim; i++) {
        distance += (pData[i] - qData[i])*(pData[i] - qData[i]);
     }
     return distance;
+}
+
+double spPointL2SquaredDistance(SPPoint* p, SPPoint* q) {
+    assert(p != NULL && q != NULL && p->dim == q->dim);
+    return spPointCoorsL2SquaredDistance(p->data, q->data, p->dim);
+}
+
+SPPointArena* spPointArenaCreate(int blockSize) {
+    if (blockSize <= 0) {
+        return NULL;
+    }
+
+    SPPointArena * newArena = malloc(sizeof(*newArena));
+    if (newArena == NULL) {
+        return NULL;
+    }
+
+    newArena->head = NULL;
+    newArena->nextBlockSize = SP_POINT_ARENA_ALIGN_UP((size_t)blockSize);
+    return newArena;
+}
 
+void* spPointArenaAlloc(SPPointArena* arena, size_t nBytes) {
+    if (arena == NULL || nBytes == 0) {
+        return NULL;
+    }
+
+    size_t alignedSize = SP_POINT_ARENA_ALIGN_UP(nBytes);
+    SPPointArenaBlock * block = arena->head;
+
+    /* the current block is full - chain a new one in front of it */
+    if (block == NULL || block->capacity - block->used < alignedSize) {
+        size_t capacity = arena->nextBlockSize;
+        if (capacity < alignedSize) {
+            capacity = alignedSize;
+        }
+
+        block = malloc(SP_POINT_ARENA_ALIGN_UP(sizeof(*block)) + capacity);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = arena->head;
+        block->capacity = capacity;
+        block->used = 0;
+        arena->head = block;
+
+        /* grow geometrically, so that the number of blocks stays logarithmic */
+        if (arena->nextBlockSize < SP_POINT_ARENA_MAX_BLOCK_SIZE) {
+            arena->nextBlockSize *= 2;
+        }
+    }
+
+    void * res = SP_POINT_ARENA_BLOCK_DATA(block) + block->used;
+    block->used += alignedSize;
+    return res;
+}
+
+SPPoint* spPointArenaCreatePoint(SPPointArena* arena, double* data, int dim, int index) {
+    if (arena == NULL || data == NULL || dim <= 0 || index < 0) {
+        return NULL;
+    }
+
+    size_t sizeOfCoords = sizeof(*data) * dim;
+
+    /* the point and its coordinates are allocated as one adjacent chunk */
+    SPPoint * newPoint = spPointArenaAlloc(arena, SP_POINT_ARENA_ALIGN_UP(sizeof(*newPoint)) + sizeOfCoords);
+    if (newPoint == NULL) {
+        return NULL;
+    }
+
+    newPoint->index = index;
+    newPoint->dim = dim;
+    newPoint->data = (double*)((char*)newPoint + SP_POINT_ARENA_ALIGN_UP(sizeof(*newPoint)));
+    newPoint->isInArena = true;
+    memcpy(newPoint->data, data, sizeOfCoords);
+    return newPoint;
+}
+
+SPPoint* spPointArenaCreatePointOver(SPPointArena* arena, const double* data, int dim, int index) {
+    if (arena == NULL || data == NULL || dim <= 0 || index < 0) {
+        return NULL;
+    }
+
+    SPPoint * newPoint = spPointArenaAlloc(arena, sizeof(*newPoint));
+    if (newPoint == NULL) {
+        return NULL;
+    }
+
+    /* points never write their coordinates, so they can be over read-only ones */
+    newPoint->index = index;
+    newPoint->dim = dim;
+    newPoint->data = (double*)data;
+    newPoint->isInArena = true;
+    return newPoint;
+}
+
+void spPointArenaDestroy(SPPointArena* arena) {
+    if (arena != NULL) {
+        SPPointArenaBlock * block = arena->head;
+        while (block != NULL) {
+            SPPointArenaBlock * next = block->next;
+            free(block);
+            block = next;
+        }
+        free(arena);
+    }
+}
+
+void spPointArenaGetMemoryUsage(const SPPointArena* arena, size_t* usedBytes, size_t* reservedBytes) {
+    assert(usedBytes != NULL && reservedBytes != NULL);
+    *usedBytes = 0;
+    *reservedBytes = 0;
+
+    if (arena != NULL) {
+        *reservedBytes += sizeof(*arena);
+        for (const SPPointArenaBlock * block = arena->head; block != NULL; block = block->next) {
+            *usedBytes += block->used;
+            *reservedBytes += SP_POINT_ARENA_ALIGN_UP(sizeof(*block)) + block->capacity;
+        }
+    }
+}
+
+size_t spPointArenaGetPointSize(int dim) {
+    return SP_POINT_ARENA_ALIGN_UP(SP_POINT_ARENA_ALIGN_UP(sizeof(SPPoint)) + sizeof(double) * dim);
+}
+
+size_t spPointArenaGetAllocationSize(size_t nBytes) {
+    return SP_POINT_ARENA_ALIGN_UP(nBytes);
+}
+
+SPPointView spPointViewCreate(const double* data, int dim, int index) {
+    assert(data != NULL && dim > 0 && index >= 0);
+    SPPointView view;
+    view.data = data;
+    view.dim = dim;
+    view.index = index;
+    return view;
+}
+
+SPPointView spPointGetView(SPPoint* point) {
+    assert(point != NULL);
+    return spPointViewCreate(point->data, point->dim, point->index);
+}
+
+int spPointViewGetDimension(const SPPointView* view) {
+    assert(view != NULL);
+    return view->dim;
+}
+
+int spPointViewGetIndex(const SPPointView* view) {
+    assert(view != NULL);
+    return view->index;
+}
+
+double spPointViewGetAxisCoor(const SPPointView* view, int axis) {
+    assert(view != NULL && axis < view->dim);
+    return view->data[axis];
+}
+
+double spPointViewL2SquaredDistance(const SPPointView* p, const SPPointView* q) {
+    assert(p != NULL && q != NULL && p->dim == q->dim);
+    return spPointCoorsL2SquaredDistance(p->data, q->data, p->dim);
+}
+
+double spPointL2SquaredDistanceToView(SPPoint* p, const SPPointView* q) {
+    assert(p != NULL && q != NULL && p->dim == q->dim);
+    return spPointCoorsL2SquaredDistance(p->data, q->data, p->dim);
 }
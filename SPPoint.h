@@ -16,12 +16,48 @@
  * spPointGetIndex			- A getter of the index of a point
  * spPointGetAxisCoor		- A getter of a given coordinate of the point
  * spPointL2SquaredDistance	- Calculates the L2 squared distance between two points
+ * spPointArenaCreate		- Creates a new arena from which points can be allocated
+ * spPointArenaCreatePoint	- Creates a new point inside an arena
+ * spPointArenaCreatePointOver	- Creates a new point inside an arena over existing coordinates
+ * spPointArenaAlloc		- Allocates raw memory inside an arena
+ * spPointArenaGetMemoryUsage	- The memory an arena holds, and how much of it is used
+ * spPointArenaGetPointSize	- The memory a point created in an arena takes from it
+ * spPointArenaGetAllocationSize	- The memory an allocation from an arena takes from it
+ * spPointArenaDestroy		- Free an arena and all the points that were allocated from it
+ * spPointViewCreate		- Creates a read-only view over existing coordinates
+ * spPointGetView			- Creates a read-only view of a point
+ * spPointViewGetDimension	- A getter of the dimension of a view
+ * spPointViewGetIndex		- A getter of the index of a view
+ * spPointViewGetAxisCoor	- A getter of a given coordinate of a view
+ * spPointViewL2SquaredDistance	- Calculates the L2 squared distance between two views
+ * spPointL2SquaredDistanceToView	- Calculates the L2 squared distance between a point and a view
  *
  */
 
+#include <stddef.h>
+
 /** Type for defining the point **/
 typedef struct sp_point_t  SPPoint;
 
+/** Type for defining an arena (region) of points **/
+typedef struct sp_point_arena_t SPPointArena;
+
+/**
+ * A non-owning, read-only view of a point.
+ * The view doesn't allocate or free anything - it wraps coordinates that
+ * live elsewhere (e.g. a row of a descriptors matrix, or the coordinates
+ * of an SPPoint), and is valid only as long as that memory is.
+ * Views are small and are meant to be passed around by value.
+ */
+typedef struct sp_point_view_t {
+	const double* data; /*The coordinates of the point, owned by someone else*/
+	int dim; /*The dimension of the point*/
+	int index; /*The index of the image the point belongs to*/
+} SPPointView;
+
+/** The default size in bytes of the first block of an arena **/
+#define SP_POINT_ARENA_DEFAULT_BLOCK_SIZE (1 << 20)
+
 /**
  * Allocates a new point in the memory.
  * Given data array, dimension dim and an index.
@@ -108,5 +144,151 @@ double spPointGetAxisCoor(SPPoint* point, int axis);
  */
 double spPointL2SquaredDistance(SPPoint* p, SPPoint* q);
 
+/**
+ * Allocates a new, empty arena of points.
+ *
+ * An arena hands out memory from large blocks, so that points created in it
+ * are laid out adjacently (the point and its coordinates in one chunk) and
+ * all of them are released at once by spPointArenaDestroy.
+ * Every new block is twice the size of the previous one (up to a fixed cap),
+ * so the number of blocks stays small even for very large databases.
+ *
+ * @param blockSize - The size in bytes of the first block of the arena
+ * @return
+ * NULL in case allocation failure ocurred OR blockSize <= 0
+ * Otherwise, the new arena is returned
+ */
+SPPointArena* spPointArenaCreate(int blockSize);
+
+/**
+ * Same as spPointCreate, but the point and its coordinates are allocated
+ * from the given arena.
+ *
+ * A point created by this function must not outlive its arena.
+ * Calling spPointDestroy on it does nothing - its memory is released
+ * only when the arena is destroyed.
+ *
+ * @return
+ * NULL in case allocation failure ocurred OR arena is NULL OR data is NULL OR dim <=0 OR index <0
+ * Otherwise, the new point is returned
+ */
+SPPoint* spPointArenaCreatePoint(SPPointArena* arena, double* data, int dim, int index);
+
+/**
+ * Same as spPointArenaCreatePoint, but only the point is allocated from the arena - its
+ * coordinates are data itself, which isn't copied (e.g. read-only shared memory).
+ * The coordinates must outlive the point and must not change while it is used.
+ *
+ * @return
+ * NULL in case allocation failure ocurred OR arena is NULL OR data is NULL OR dim <=0 OR index <0
+ * Otherwise, the new point is returned
+ */
+SPPoint* spPointArenaCreatePointOver(SPPointArena* arena, const double* data, int dim, int index);
+
+/**
+ * Allocates nBytes of raw memory from the arena (e.g. for arrays of points).
+ * The memory is aligned for any of the types used with points and is released
+ * only when the arena is destroyed.
+ *
+ * @return
+ * NULL in case allocation failure ocurred OR arena is NULL OR nBytes == 0
+ * Otherwise, a pointer to the allocated memory
+ */
+void* spPointArenaAlloc(SPPointArena* arena, size_t nBytes);
+
+/**
+ * Free all memory associated with an arena, including all the points that
+ * were created in it. The cost depends only on the number of blocks in the arena.
+ * If arena is NULL nothing happens.
+ */
+void spPointArenaDestroy(SPPointArena* arena);
+
+/**
+ * The memory an arena holds, in bytes.
+ *
+ * @param arena - The arena. If NULL, both sizes are 0
+ * @param usedBytes - OUTPUT parameter. The bytes handed out of the arena so far, alignment included
+ * @param reservedBytes - OUTPUT parameter. The bytes of all blocks of the arena, headers included
+ */
+void spPointArenaGetMemoryUsage(const SPPointArena* arena, size_t* usedBytes, size_t* reservedBytes);
+
+/**
+ * The bytes spPointArenaCreatePoint takes from an arena for a point of dimension dim
+ */
+size_t spPointArenaGetPointSize(int dim);
+
+/**
+ * The bytes spPointArenaAlloc takes from an arena for nBytes
+ */
+size_t spPointArenaGetAllocationSize(size_t nBytes);
+
+/**
+ * Creates a view over dim coordinates starting at data. Nothing is copied.
+ *
+ * @assert data != NULL && dim > 0 && index >= 0
+ * @return
+ * A view P = (data[0],...,data[dim-1]) with the index of P = index
+ */
+SPPointView spPointViewCreate(const double* data, int dim, int index);
+
+/**
+ * Creates a view over the coordinates of the given point. Nothing is copied,
+ * and the view is valid only as long as the point is.
+ *
+ * @assert point != NULL
+ * @return
+ * A view with the same coordinates, dimension and index as point
+ */
+SPPointView spPointGetView(SPPoint* point);
+
+/**
+ * A getter for the dimension of a view
+ *
+ * @assert view != NULL
+ * @return
+ * The dimension of the view
+ */
+int spPointViewGetDimension(const SPPointView* view);
+
+/**
+ * A getter for the index of a view
+ *
+ * @assert view != NULL
+ * @return
+ * The index of the view
+ */
+int spPointViewGetIndex(const SPPointView* view);
+
+/**
+ * A getter for specific coordinate value of a view
+ *
+ * @assert view != NULL && axis < dim(view)
+ * @return
+ * The value of the given coordinate
+ */
+double spPointViewGetAxisCoor(const SPPointView* view, int axis);
+
+/**
+ * Calculates the L2-squared distance between the views p and q.
+ * The result is identical to spPointL2SquaredDistance of points
+ * with the same coordinates.
+ *
+ * @assert p!=NULL AND q!=NULL AND dim(p) == dim(q)
+ * @return
+ * The L2-Squared distance between p and q
+ */
+double spPointViewL2SquaredDistance(const SPPointView* p, const SPPointView* q);
+
+/**
+ * Calculates the L2-squared distance between the point p and the view q.
+ * The result is identical to spPointL2SquaredDistance of points
+ * with the same coordinates.
+ *
+ * @assert p!=NULL AND q!=NULL AND dim(p) == dim(q)
+ * @return
+ * The L2-Squared distance between p and q
+ */
+double spPointL2SquaredDistanceToView(SPPoint* p, const SPPointView* q);
+
 
 #endif /* SPPOINT_H_ */
@@ -1,33 +1,195 @@
+#include "sp_search.h"
 #include "main_aux.h"
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
+/*Input instead of a query image, to terminate the program*/
+#define TERMINATING_SYMBOL "#"
 
-int main()
+/*Input instead of a query image, followed by the index of an image to delete*/
+#define DELETE_COMMAND "-delete"
+
+/*As instructed, an image that can't be loaded is reported with its path, and the program exits with ERROR_CODE*/
+#define UNREADABLE_IMAGE_FORMAT "Image cannot be loaded - %s\n"
+#define ERROR_CODE -1
+
+/*
+ * Reads the images of the database from the user, into the given buffers of MAX_IMG_PATH_LEGTH.
+ * Every number is validated as soon as it's input.
+ */
+static SPSearchError GetImagesFromUser(SPSearchImages* images, char* imgDirectory, char* imgPrefix, char* imgSuffix)
+{
+	images->imgDirectory = imgDirectory;
+	images->imgPrefix = imgPrefix;
+	images->imgSuffix = imgSuffix;
+
+	/*Get the directory path for the images.*/
+	PrintMsg(ENTER_DIRECTORY_MSG);
+	if (scanf("%s", imgDirectory) <= 0)
+		return SP_SEARCH_OUT_OF_MEMORY;
+
+	/*Get the image prefix for the images. */
+	PrintMsg(ENTER_PREFIX_MSG);
+	if (scanf("%s", imgPrefix) <= 0)
+		return SP_SEARCH_OUT_OF_MEMORY;
+
+	/*Get the number of images*/
+	PrintMsg(ENTER_NUM_OF_IMAGES_MSG);
+	if (scanf("%d", &images->nImages) <= 0)
+		return SP_SEARCH_OUT_OF_MEMORY;
+
+	if (images->nImages < 1) /*Validate the inputed number of images*/
+		return SP_SEARCH_INVALID_NUM_OF_IMAGES;
+
+	/*Get the image suffix for the images.*/
+	PrintMsg(ENTER_SUFFIX_MSG);
+	if (scanf("%s", imgSuffix) <= 0)
+		return SP_SEARCH_OUT_OF_MEMORY;
+
+	/*Get the number of bins*/
+	PrintMsg(ENTER_NUM_OF_BINS_MSG);
+	if (scanf("%d", &images->nBins) <= 0)
+		return SP_SEARCH_OUT_OF_MEMORY;
+
+	if (images->nBins < 1 || images->nBins > SP_SEARCH_MAX_NUM_OF_BINS) /*Validate the inputed number of bins*/
+		return SP_SEARCH_INVALID_NUM_OF_BINS;
+
+	/*Get the number of features to extract from each image*/
+	PrintMsg("Enter number of features:\n");
+	if (scanf("%d", &images->nFeaturesToExtract) <= 0)
+		return SP_SEARCH_OUT_OF_MEMORY;
+
+	if (images->nFeaturesToExtract < 1) /*Validate the inputed number of features*/
+		return SP_SEARCH_INVALID_NUM_OF_FEATURES;
+
+	return SP_SEARCH_SUCCESS;
+}
+
+/*
+ * Prints the closest images to the query image by RGB hists and by local descriptors,
+ * followed by the reports the options ask for.
+ */
+static SPSearchError AnswerQuery(SPSearchDatabase* database, const char* queryImagePath)
 {
-	/*Tracks the state of the program*/
-	PROGRAM_STATE programState = PROGRAM_STATE_RUNNING;
+	int indices[SP_SEARCH_MAX_RESULTS];
+	int nIndices = 0;
+
+	SPSearchQuery* query = NULL;
+	SPSearchError error = spSearchQueryCreate(database, queryImagePath, &query);
+
+	if (error == SP_SEARCH_SUCCESS)
+		error = spSearchQueryGetGlobalResults(query, indices, &nIndices);
+
+	if (error == SP_SEARCH_SUCCESS)
+	{
+		PrintMsg(NEAREST_IMAGES_GLOBAL_DESC_MSG);
+		PrintIndices(indices, nIndices);
+		error = spSearchQueryGetLocalResults(query, indices, &nIndices);
+	}
+
+	if (error == SP_SEARCH_SUCCESS)
+	{
+		PrintMsg(NEAREST_IMAGES_LOCAL_DESC_MSG);
+		PrintIndices(indices, nIndices);
+		error = spSearchQueryPrintReports(query);
+	}
+
+	if (error == SP_SEARCH_UNREADABLE_IMAGE)
+		printf(UNREADABLE_IMAGE_FORMAT, queryImagePath);
+
+	spSearchQueryDestroy(query);
+	return error;
+}
+
+/*
+ * Lets the user input the path of a query image and answers it, or deletes an image if
+ * DELETE_COMMAND is input followed by its index. Sets *isExit if the user input the terminating symbol.
+ */
+static SPSearchError AnswerUserInput(SPSearchDatabase* database, char* queryImagePath, bool* isExit)
+{
+	/*Ask user to input terminating symbol "#" or the path to a query image*/
+	PrintMsg(ENTER_QUERY_OR_TERMINATE_MSG);
+	if (scanf("%s", queryImagePath) <= 0)
+		return SP_SEARCH_OUT_OF_MEMORY;
+
+	if (strcmp(queryImagePath, TERMINATING_SYMBOL) == 0)
+	{
+		*isExit = true; /*The user requested to terminate the program*/
+		return SP_SEARCH_SUCCESS;
+	}
+
+	if (strcmp(queryImagePath, DELETE_COMMAND) != 0)
+		return AnswerQuery(database, queryImagePath);
+
+	/*Not a query - the user requested to delete an image*/
+	int imageIndex = -1;
+	if (scanf("%d", &imageIndex) <= 0)
+		return SP_SEARCH_OUT_OF_MEMORY;
+
+	SPSearchError error = spSearchDatabaseDeleteImage(database, imageIndex);
+	if (error == SP_SEARCH_IMAGE_NOT_DELETED)
+	{
+		printf(IMAGE_NOT_DELETED_FORMAT, imageIndex);
+		return SP_SEARCH_SUCCESS;
+	}
+
+	if (error == SP_SEARCH_SUCCESS)
+		printf(IMAGE_DELETED_FORMAT, imageIndex);
+	return error;
+}
+
+
+int main(int argc, char** argv)
+{
+	/*Create the database with the optional settings from the command line*/
+	SPSearchDatabase* database = NULL;
+	SPSearchError error = spSearchDatabaseCreate(argc - 1, argv + 1, &database);
+
+	/*Allocate memory for the user's input*/
+	char* imgDirectory = (char*)malloc(sizeof(*imgDirectory) * MAX_IMG_PATH_LEGTH);
+	char* imgPrefix = (char*)malloc(sizeof(*imgPrefix) * MAX_IMG_PATH_LEGTH);
+	char* imgSuffix = (char*)malloc(sizeof(*imgSuffix) * MAX_IMG_PATH_LEGTH);
+	char* queryImagePath = (char*)malloc(sizeof(*queryImagePath) * MAX_IMG_PATH_LEGTH);
+
+	if (error == SP_SEARCH_SUCCESS &&
+		(imgDirectory == NULL || imgPrefix == NULL || imgSuffix == NULL || queryImagePath == NULL))
+		error = SP_SEARCH_OUT_OF_MEMORY; /*Failed to allocate memory*/
 
-	/*Initialise and allocate memory for the database of images, zeroing all members*/
-	ImageDatabase* database = (ImageDatabase*)calloc(sizeof(*database), 1);
+	/*Fill the database with user's input, and calculate the features of all images*/
+	SPSearchImages images;
+	if (error == SP_SEARCH_SUCCESS)
+		error = GetImagesFromUser(&images, imgDirectory, imgPrefix, imgSuffix);
 
-	if (database == NULL)
-		programState = PROGRAM_STATE_MEMORY_ERROR; /*Failed to allocate memory*/
+	int unreadableImage = -1;
+	if (error == SP_SEARCH_SUCCESS)
+		error = spSearchDatabaseBuild(database, &images, &unreadableImage);
 
-	/*Fill the database with user's input*/
-	programState = GetImageDatabaseFromUser(database);
+	if (error == SP_SEARCH_UNREADABLE_IMAGE)
+	{
+		char* imgPath = GetImagePath(imgDirectory, imgPrefix, imgSuffix, unreadableImage);
+		if (imgPath != NULL)
+			printf(UNREADABLE_IMAGE_FORMAT, imgPath);
+		free(imgPath);
+	}
 
-	/*Calculate RGB histograms for all images*/
-	if (programState == PROGRAM_STATE_RUNNING)
-		programState = CalcImageDataBaseHistsAndDescriptors(database);
+	/*While the user hasn't entered the exit symbol or an error hasn't occurred, receive query image inputs.
+	  A database that reported near-duplicates instead answers none*/
+	bool isExit = error != SP_SEARCH_SUCCESS || !spSearchDatabaseIsQueryable(database);
+	while (!isExit && error == SP_SEARCH_SUCCESS)
+		error = AnswerUserInput(database, queryImagePath, &isExit);
 
-	/*While the user hasn't entered the exit symbol or an error hasn't occurred, receive query image inputs*/
-	while (programState == PROGRAM_STATE_RUNNING)
-		programState = CalcQueryImageClosestDatabaseResults(database);
+	/*Free all memory used by the image database and the input*/
+	spSearchDatabaseDestroy(database);
+	free(imgDirectory);
+	free(imgPrefix);
+	free(imgSuffix);
+	free(queryImagePath);
 
-	/*Free all memory used by the image database.*/
-	DestroyImageDataBase(database);
+	if (error == SP_SEARCH_UNREADABLE_IMAGE)
+		return ERROR_CODE;
 
-	/*Print the exit message of the program based on the last program state*/
-	PrintExitMessage(programState);
+	/*Print the exit message of the program based on the last error*/
+	PrintMsg(error == SP_SEARCH_SUCCESS ? EXIT_MSG : spSearchGetErrorMessage(error));
 	return 0;
 }
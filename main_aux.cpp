@@ -1,392 +1,2245 @@
 #include "main_aux.h"
 #include <cstdlib>
 #include <cstdio>
+#include <climits>
+#include <ctime>
+#include "sp_kernels.h"
+#include <thread>
+#include <atomic>
+#include <new>
+#include <system_error>
+#include <sys/stat.h>
 
 extern "C"{
 	#include "SPBPriorityQueue.h"
 }
 
-const char * TERMINATING_SYMBOL = "#";
+double GetMonotonicTime()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/*
+ * Parses str as a whole decimal int that is at least minValue.
+ * Returns false if str isn't such a number.
+ */
+static bool ParseIntArgument(const char* str, int minValue, int* res)
+{
+	char* end = NULL;
+	long value = strtol(str, &end, 10);
+
+	if (end == str || *end != '\0' || value < minValue || value > INT_MAX)
+		return false;
+
+	*res = (int)value;
+	return true;
+}
+
+PROGRAM_STATE ParseCommandLineOptions(int argc, char** argv, SearchOptions* options)
+{
+	/*Defaults - full resolution, no reports*/
+	options->extraction.decodeScale = 1;
+	options->extraction.maxImageSide = 0;
+	options->extraction.isSortedByResponse = false;
+	options->extraction.maxDescriptors = 0;
+	options->extraction.isRankedByScale = false;
+	options->extraction.nDetectedDescriptors = NULL;
+	options->extraction.encodedImage = NULL;
+	options->extraction.encodedImageSize = 0;
+	options->extraction.isUnreadable = NULL;
+	options->isResolutionReport = false;
+	options->shortlistSize = 0;
+	options->isShortlistReport = false;
+	options->isBowSearch = false;
+	options->bowBranchFactor = BOW_DEFAULT_BRANCH_FACTOR;
+	options->bowDepth = BOW_DEFAULT_DEPTH;
+	options->bowIndexPath = NULL;
+	options->pcaDimension = 0;
+	options->isPcaWhitening = false;
+	options->isPcaRerank = false;
+	options->isPcaReport = false;
+	options->streamPath = NULL;
+	options->streamBlockSize = SP_DESCRIPTOR_FILE_DEFAULT_BLOCK_SIZE;
+	options->nShards = 0;
+	options->isEarlyExit = false;
+	options->isEarlyExitReport = false;
+	options->deadlineMs = 0;
+	options->isStats = false;
+	options->memoryBudgetMB = 0;
+	options->sharedPublishName = NULL;
+	options->sharedAttachName = NULL;
+	options->duplicatesThreshold = 0;
+	options->compactAfter = 1;
+	options->archivePath = NULL;
+	options->descriptorBudget = 0;
+	options->descriptorCap = 0;
+	options->isDescriptorReport = false;
+	options->featureEngine = SP_FEATURE_ENGINE_SIFT;
+	options->sketchBits = 0;
+	options->sketchCandidates = SKETCH_DEFAULT_CANDIDATES;
+	options->isSketchReport = false;
+	options->recordPath = NULL;
+	options->nArguments = argc - 1;
+	options->arguments = argv + 1;
+
+	for(int i = 1; i < argc; ++i)
+	{
+		bool hasValue = i + 1 < argc; /*Whether there's another argument to serve as the option's value*/
+
+		if (strcmp(argv[i], OPTION_DECODE_SCALE) == 0 && hasValue)
+		{
+			int* scale = &options->extraction.decodeScale;
+			if (!ParseIntArgument(argv[++i], 1, scale) || (*scale != 1 && *scale != 2 && *scale != 4 && *scale != 8))
+				return PROGRAM_STATE_INVALID_ARGUMENTS;
+		}
+		else if (strcmp(argv[i], OPTION_MAX_IMAGE_SIDE) == 0 && hasValue)
+		{
+			if (!ParseIntArgument(argv[++i], 1, &options->extraction.maxImageSide))
+				return PROGRAM_STATE_INVALID_ARGUMENTS;
+		}
+		else if (strcmp(argv[i], OPTION_RESOLUTION_REPORT) == 0)
+			options->isResolutionReport = true;
+		else if (strcmp(argv[i], OPTION_SHORTLIST) == 0 && hasValue)
+		{
+			/*SIFT search needs at least two images to compare*/
+			if (!ParseIntArgument(argv[++i], 2, &options->shortlistSize))
+				return PROGRAM_STATE_INVALID_ARGUMENTS;
+		}
+		else if (strcmp(argv[i], OPTION_SHORTLIST_REPORT) == 0)
+			options->isShortlistReport = true;
+		else if (strcmp(argv[i], OPTION_BOW) == 0)
+			options->isBowSearch = true;
+		else if (strcmp(argv[i], OPTION_BOW_TREE) == 0 && i + 2 < argc)
+		{
+			options->isBowSearch = true;
+			if (!ParseIntArgument(argv[++i], 2, &options->bowBranchFactor) ||
+				!ParseIntArgument(argv[++i], 1, &options->bowDepth))
+				return PROGRAM_STATE_INVALID_ARGUMENTS;
+
+			/*The tree must not have more words than the index supports*/
+			long long nWords = 1;
+			for(int level = 0; level < options->bowDepth && nWords <= SP_BOW_INDEX_MAX_NUM_OF_WORDS; ++level)
+				nWords *= options->bowBranchFactor;
+			if (nWords > SP_BOW_INDEX_MAX_NUM_OF_WORDS)
+				return PROGRAM_STATE_INVALID_ARGUMENTS;
+		}
+		else if (strcmp(argv[i], OPTION_BOW_INDEX) == 0 && hasValue)
+		{
+			options->isBowSearch = true;
+			options->bowIndexPath = argv[++i];
+		}
+		else if (strcmp(argv[i], OPTION_PCA) == 0 && hasValue)
+		{
+			/*Whether it's lower than the descriptors' dimension is only known once they are extracted*/
+			if (!ParseIntArgument(argv[++i], 1, &options->pcaDimension))
+				return PROGRAM_STATE_INVALID_ARGUMENTS;
+		}
+		else if (strcmp(argv[i], OPTION_PCA_WHITEN) == 0)
+			options->isPcaWhitening = true;
+		else if (strcmp(argv[i], OPTION_PCA_RERANK) == 0)
+			options->isPcaRerank = true;
+		else if (strcmp(argv[i], OPTION_PCA_REPORT) == 0)
+			options->isPcaReport = true;
+		else if (strcmp(argv[i], OPTION_STREAM) == 0 && hasValue)
+			options->streamPath = argv[++i];
+		else if (strcmp(argv[i], OPTION_STREAM_BLOCK) == 0 && hasValue)
+		{
+			int blockSizeMB = 0;
+			if (!ParseIntArgument(argv[++i], 1, &blockSizeMB))
+				return PROGRAM_STATE_INVALID_ARGUMENTS;
+			options->streamBlockSize = (int64_t)blockSizeMB << 20;
+		}
+		else if (strcmp(argv[i], OPTION_EARLY_EXIT) == 0)
+			options->isEarlyExit = true;
+		else if (strcmp(argv[i], OPTION_EARLY_EXIT_REPORT) == 0)
+			options->isEarlyExitReport = true;
+		else if (strcmp(argv[i], OPTION_DEADLINE) == 0 && hasValue)
+		{
+			if (!ParseIntArgument(argv[++i], 1, &options->deadlineMs))
+				return PROGRAM_STATE_INVALID_ARGUMENTS;
+		}
+		else if (strcmp(argv[i], OPTION_STATS) == 0)
+			options->isStats = true;
+		else if (strcmp(argv[i], OPTION_MEMORY_BUDGET) == 0 && hasValue)
+		{
+			if (!ParseIntArgument(argv[++i], 1, &options->memoryBudgetMB))
+				return PROGRAM_STATE_INVALID_ARGUMENTS;
+		}
+		else if (strcmp(argv[i], OPTION_SHARED_PUBLISH) == 0 && hasValue)
+			options->sharedPublishName = argv[++i];
+		else if (strcmp(argv[i], OPTION_SHARED_ATTACH) == 0 && hasValue)
+			options->sharedAttachName = argv[++i];
+		else if (strcmp(argv[i], OPTION_RECORD) == 0 && hasValue)
+			options->recordPath = argv[++i];
+		else if (strcmp(argv[i], OPTION_ARCHIVE) == 0 && hasValue)
+			options->archivePath = argv[++i];
+		else if (strcmp(argv[i], OPTION_DESCRIPTOR_BUDGET) == 0 && hasValue)
+		{
+			if (!ParseIntArgument(argv[++i], 1, &options->descriptorBudget))
+				return PROGRAM_STATE_INVALID_ARGUMENTS;
+		}
+		else if (strcmp(argv[i], OPTION_DESCRIPTOR_CAP) == 0 && hasValue)
+		{
+			if (!ParseIntArgument(argv[++i], 1, &options->descriptorCap))
+				return PROGRAM_STATE_INVALID_ARGUMENTS;
+		}
+		else if (strcmp(argv[i], OPTION_DESCRIPTOR_RANK) == 0 && hasValue)
+		{
+			++i;
+			if (strcmp(argv[i], DESCRIPTOR_RANK_SCALE) == 0)
+				options->extraction.isRankedByScale = true;
+			else if (strcmp(argv[i], DESCRIPTOR_RANK_RESPONSE) == 0)
+				options->extraction.isRankedByScale = false;
+			else
+				return PROGRAM_STATE_INVALID_ARGUMENTS;
+		}
+		else if (strcmp(argv[i], OPTION_DESCRIPTOR_REPORT) == 0)
+			options->isDescriptorReport = true;
+		else if (strcmp(argv[i], OPTION_FEATURES) == 0 && hasValue)
+		{
+			++i;
+			if (strcmp(argv[i], FEATURES_SIFT) == 0)
+				options->featureEngine = SP_FEATURE_ENGINE_SIFT;
+			else if (strcmp(argv[i], FEATURES_ORB) == 0)
+				options->featureEngine = SP_FEATURE_ENGINE_ORB;
+			else if (strcmp(argv[i], FEATURES_AKAZE) == 0)
+				options->featureEngine = SP_FEATURE_ENGINE_AKAZE;
+			else
+				return PROGRAM_STATE_INVALID_ARGUMENTS;
+		}
+		else if (strcmp(argv[i], OPTION_SKETCH) == 0 && hasValue)
+		{
+			int* nBits = &options->sketchBits;
+			if (!ParseIntArgument(argv[++i], 1, nBits) || (*nBits != SP_SKETCH_INDEX_SMALL_BITS && *nBits != SP_SKETCH_INDEX_LARGE_BITS))
+				return PROGRAM_STATE_INVALID_ARGUMENTS;
+		}
+		else if (strcmp(argv[i], OPTION_SKETCH_CANDIDATES) == 0 && hasValue)
+		{
+			if (!ParseIntArgument(argv[++i], NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE, &options->sketchCandidates))
+				return PROGRAM_STATE_INVALID_ARGUMENTS;
+			if (options->sketchBits == 0)
+				options->sketchBits = SP_SKETCH_INDEX_SMALL_BITS;
+		}
+		else if (strcmp(argv[i], OPTION_SKETCH_REPORT) == 0)
+			options->isSketchReport = true;
+		else if (strcmp(argv[i], OPTION_COMPACT_AFTER) == 0 && hasValue)
+		{
+			if (!ParseIntArgument(argv[++i], 1, &options->compactAfter))
+				return PROGRAM_STATE_INVALID_ARGUMENTS;
+		}
+		else if (strcmp(argv[i], OPTION_DUPLICATES) == 0 && hasValue)
+		{
+			if (!ParseIntArgument(argv[++i], 1, &options->duplicatesThreshold) || options->duplicatesThreshold > 100)
+				return PROGRAM_STATE_INVALID_ARGUMENTS;
+		}
+		else if (strcmp(argv[i], OPTION_SHARDS) == 0 && hasValue)
+		{
+			if (!ParseIntArgument(argv[++i], 1, &options->nShards))
+				return PROGRAM_STATE_INVALID_ARGUMENTS;
+		}
+		else
+			return PROGRAM_STATE_INVALID_ARGUMENTS; /*Unknown option, or an option without its value*/
+	}
+
+	/*Streamed descriptors are never resident, so nothing that needs them in memory can be used*/
+	if (options->streamPath != NULL &&
+		(options->isBowSearch || options->pcaDimension > 0 || options->shortlistSize > 0 || options->isShortlistReport ||
+		 options->duplicatesThreshold > 0))
+		return PROGRAM_STATE_INVALID_ARGUMENTS;
+
+	/*A shared database holds descriptors in memory, and an attached one isn't extracted*/
+	if ((options->sharedPublishName != NULL || options->sharedAttachName != NULL) && options->streamPath != NULL)
+		return PROGRAM_STATE_INVALID_ARGUMENTS;
+	if (options->sharedAttachName != NULL && (options->memoryBudgetMB > 0 || options->descriptorBudget > 0 ||
+		options->descriptorCap > 0 || options->sharedPublishName != NULL))
+		return PROGRAM_STATE_INVALID_ARGUMENTS;
+
+	/*Binary descriptors are only kept in the binary index, and only searched by votes*/
+	if (options->featureEngine != SP_FEATURE_ENGINE_SIFT &&
+		(options->isBowSearch || options->pcaDimension > 0 || options->streamPath != NULL ||
+		 options->sharedPublishName != NULL || options->sharedAttachName != NULL ||
+		 options->memoryBudgetMB > 0 || options->duplicatesThreshold > 0))
+		return PROGRAM_STATE_INVALID_ARGUMENTS;
+
+	/*Sketches are of resident SIFT descriptors, and candidates are compared by the distances they're ranked by*/
+	if (options->sketchBits > 0 &&
+		(options->isBowSearch || options->streamPath != NULL || options->isPcaRerank ||
+		 options->featureEngine != SP_FEATURE_ENGINE_SIFT))
+		return PROGRAM_STATE_INVALID_ARGUMENTS;
+	if (options->isSketchReport && options->sketchBits == 0)
+		return PROGRAM_STATE_INVALID_ARGUMENTS;
+
+	/*Only the feature by feature search can stop at a deadline*/
+	if (options->deadlineMs > 0 && (options->streamPath != NULL || options->isBowSearch))
+		return PROGRAM_STATE_INVALID_ARGUMENTS;
+
+	/*Shards search ranges of the descriptor file*/
+	if (options->nShards > 0 && options->streamPath == NULL)
+		return PROGRAM_STATE_INVALID_ARGUMENTS;
+
+	return PROGRAM_STATE_RUNNING;
+}
+
+/*The bytes of a heap copy of str, or 0 if str is NULL*/
+static size_t GetStringMemoryUsage(const char* str)
+{
+	return str != NULL ? strlen(str) + 1 : 0;
+}
+
+void GetImageDatabaseMemoryUsage(const ImageDatabase* database, DatabaseMemoryUsage* usage)
+{
+	memset(usage, 0, sizeof(*usage));
+
+	usage->RGBHists = spHistMatrixGetMemoryUsage(database->RGBHistMatrix);
+
+	/*The arrays of every image's descriptors and counts are counted with the descriptors*/
+	size_t perImageArrays = 0;
+	if (database->SIFTDescriptors != NULL)
+		perImageArrays += sizeof(*database->SIFTDescriptors) * database->nImages;
+	if (database->nFeatures != NULL)
+		perImageArrays += sizeof(*database->nFeatures) * database->nImages;
+
+	spPointArenaGetMemoryUsage(database->pointArena, &usage->SIFTDescriptorsUsed, &usage->SIFTDescriptorsReserved);
+	usage->SIFTDescriptorsUsed += perImageArrays;
+	usage->SIFTDescriptorsReserved += perImageArrays;
+
+	spPointArenaGetMemoryUsage(database->fullPointArena, &usage->fullSIFTDescriptorsUsed, &usage->fullSIFTDescriptorsReserved);
+	if (database->fullSIFTDescriptors != NULL)
+	{
+		usage->fullSIFTDescriptorsUsed += sizeof(*database->fullSIFTDescriptors) * database->nImages;
+		usage->fullSIFTDescriptorsReserved += sizeof(*database->fullSIFTDescriptors) * database->nImages;
+	}
+
+	usage->pca = spPcaGetMemoryUsage(database->pca);
+	usage->bowIndex = spBowIndexGetMemoryUsage(database->bowIndex);
+	usage->binaryIndex = spBinaryIndexGetMemoryUsage(database->binaryIndex);
+	usage->sketchIndex = spSketchIndexGetMemoryUsage(database->sketchIndex);
+	usage->descriptorFile = spDescriptorFileGetMemoryUsage(database->descriptorFile);
+	if (database->sharedDatabase != NULL)
+		usage->sharedDatabase = spSharedDatabaseGetSize(database->sharedDatabase);
+
+	if (database->referenceDatabase != NULL)
+	{
+		DatabaseMemoryUsage referenceUsage;
+		GetImageDatabaseMemoryUsage(database->referenceDatabase, &referenceUsage);
+		usage->referenceDatabase = referenceUsage.total;
+	}
+
+	usage->other = sizeof(*database) + GetStringMemoryUsage(database->imgDirectory) +
+		GetStringMemoryUsage(database->imgPrefix) + GetStringMemoryUsage(database->imgSuffix);
+	if (database->isDeleted != NULL)
+		usage->other += sizeof(*database->isDeleted) * database->nImages;
+	if (database->imageIndices != NULL)
+		usage->other += sizeof(*database->imageIndices) * database->nImages;
+
+	usage->total = usage->RGBHists + usage->SIFTDescriptorsReserved + usage->fullSIFTDescriptorsReserved +
+		usage->pca + usage->bowIndex + usage->binaryIndex + usage->sketchIndex + usage->descriptorFile + usage->referenceDatabase + usage->other;
+}
+
+static void DestroyCompaction(struct database_compaction* compaction);
+
+void DestroyImageDataBase(ImageDatabase* database)
+{
+	/*First, as a running compaction reads the storage of the database*/
+	DestroyCompaction(database->compaction);
+	free(database->isDeleted);
+	free(database->imageIndices);
+
+	free(database->imgDirectory);
+	free(database->imgPrefix);
+	free(database->imgSuffix);
+
+	/*All SIFT descriptors live in the arena, so they are released all at once*/
+	spPointArenaDestroy(database->pointArena);
+	spHistMatrixDestroy(database->RGBHistMatrix);
+	spBowIndexDestroy(database->bowIndex);
+	spBinaryIndexDestroy(database->binaryIndex);
+	spSketchIndexDestroy(database->sketchIndex);
+	spWorkloadRecorderClose(database->workloadRecorder);
+	spPcaDestroy(database->pca);
+	spShardPoolDestroy(database->shardPool);
+	spDescriptorFileClose(database->descriptorFile);
+	spPointArenaDestroy(database->fullPointArena);
+	free(database->fullSIFTDescriptors);
+	spSharedDatabaseDetach(database->sharedDatabase); /*After the hists and points over it*/
+
+	free(database->nFeatures);
+	free(database->SIFTDescriptors);
+
+	if (database->referenceDatabase != NULL)
+		DestroyImageDataBase(database->referenceDatabase);
+
+	free(database); /*Free the database struct itself*/
+}
+
+
+/*Returns a heap copy of str, or NULL if failed to allocate memory*/
+static char* DuplicateString(const char* str)
+{
+	char* res = (char*)malloc(sizeof(*res) * (strlen(str) + 1));
+	if (res != NULL)
+		strcpy(res, str);
+	return res;
+}
+
+/*Folds nBytes of data into an FNV-1a hash*/
+static uint64_t HashBytes(uint64_t hash, const void* data, size_t nBytes)
+{
+	for(size_t i = 0; i < nBytes; ++i)
+		hash = (hash ^ ((const unsigned char*)data)[i]) * DATABASE_FINGERPRINT_PRIME;
+	return hash;
+}
+
+/*Folds a string, with its terminator, into an FNV-1a hash. A NULL string is hashed as an empty one*/
+static uint64_t HashString(uint64_t hash, const char* str)
+{
+	return HashBytes(hash, str != NULL ? str : "", str != NULL ? strlen(str) + 1 : 1);
+}
+
+/*
+ * Folds the size and modification time of a file into an FNV-1a hash, so a file replaced under
+ * the same name changes the hash. A file that can't be stat'ed (or a NULL path) is hashed as missing.
+ */
+static uint64_t HashFileStatus(uint64_t hash, const char* path)
+{
+	struct stat status;
+	int64_t values[] = { -1, -1, -1 };
+	if (path != NULL && stat(path, &status) == 0)
+	{
+		values[0] = (int64_t)status.st_size;
+		values[1] = (int64_t)status.st_mtim.tv_sec;
+		values[2] = (int64_t)status.st_mtim.tv_nsec;
+	}
+	return HashBytes(hash, values, sizeof(values));
+}
+
+/*
+ * Identifies the images of the database - their paths, and the size and modification time of
+ * every image file (or of the archive) - and the settings they're extracted with: what a shared
+ * segment must have been published from to be attached instead of extracting the images.
+ */
+static uint64_t GetImagesFingerprint(const ImageDatabase* database)
+{
+	const SearchOptions* options = &database->options;
+	int settings[] = { database->nImages, database->nFeaturesToExtract,
+		options->extraction.decodeScale, options->extraction.maxImageSide, options->extraction.isRankedByScale,
+		options->featureEngine };
+
+	uint64_t hash = DATABASE_FINGERPRINT_OFFSET_BASIS;
+	hash = HashString(hash, database->imgDirectory);
+	hash = HashString(hash, database->imgPrefix);
+	hash = HashString(hash, database->imgSuffix);
+	hash = HashString(hash, options->archivePath);
+	hash = HashBytes(hash, settings, sizeof(settings));
+
+	/*The images are read from the archive instead of their paths, if it's set*/
+	if (options->archivePath != NULL)
+		return HashFileStatus(hash, options->archivePath);
+
+	for(int i = 0; i < database->nImages; ++i)
+	{
+		char* imgPath = GetImagePath(database->imgDirectory, database->imgPrefix, database->imgSuffix, i);
+		hash = HashFileStatus(hash, imgPath);
+		free(imgPath);
+	}
+	return hash;
+}
+
+/*
+ * Identifies the images of the database (see GetImagesFingerprint) and the budgets that decide which
+ * of their local descriptors are kept - what a persisted index or descriptor file must have been
+ * built from to be used instead of extracting the images again.
+ */
+static uint64_t GetDatabaseFingerprint(const ImageDatabase* database)
+{
+	const SearchOptions* options = &database->options;
+
+	/*The hists only take part through the memory budget they share with the descriptors*/
+	int settings[] = { options->memoryBudgetMB > 0 ? database->nBins : 0,
+		options->memoryBudgetMB, options->descriptorBudget, options->descriptorCap };
+	return HashBytes(GetImagesFingerprint(database), settings, sizeof(settings));
+}
+
+/*
+ * Identifies what a persisted BoW index was trained on - the images and extraction settings of
+ * the database, the space its descriptors were projected to, and the shape of the vocabulary tree.
+ */
+static uint64_t GetBowIndexFingerprint(const ImageDatabase* database)
+{
+	const SearchOptions* options = &database->options;
+	int settings[] = { options->pcaDimension, options->isPcaWhitening, options->bowBranchFactor, options->bowDepth };
+	return HashBytes(GetDatabaseFingerprint(database), settings, sizeof(settings));
+}
+
+/*
+ * Builds database->referenceDatabase - the same images, extracted at full resolution.
+ */
+static PROGRAM_STATE CreateReferenceDatabase(ImageDatabase* database)
+{
+	ImageDatabase* reference = (ImageDatabase*)calloc(sizeof(*reference), 1);
+	if (reference == NULL)
+		return PROGRAM_STATE_MEMORY_ERROR;
+
+	database->referenceDatabase = reference; /*From now on, destroyed together with database*/
+
+	reference->nImages = database->nImages;
+	reference->nBins = database->nBins;
+	reference->nFeaturesToExtract = database->nFeaturesToExtract;
+	reference->imgDirectory = DuplicateString(database->imgDirectory);
+	reference->imgPrefix = DuplicateString(database->imgPrefix);
+	reference->imgSuffix = DuplicateString(database->imgSuffix);
+	reference->options.extraction.decodeScale = 1; /*Full resolution*/
+	reference->options.archivePath = database->options.archivePath;
+	reference->options.extraction.isRankedByScale = database->options.extraction.isRankedByScale;
+	reference->options.descriptorBudget = database->options.descriptorBudget; /*Only the resolution differs*/
+	reference->options.descriptorCap = database->options.descriptorCap;
+	reference->options.featureEngine = database->options.featureEngine;
+	reference->options.sketchBits = database->options.sketchBits;
+	reference->options.sketchCandidates = database->options.sketchCandidates;
+
+	if (reference->imgDirectory == NULL || reference->imgPrefix == NULL || reference->imgSuffix == NULL)
+		return PROGRAM_STATE_MEMORY_ERROR;
+
+	return CalcImageDataBaseHistsAndDescriptors(reference);
+}
+
+/*
+ * Trains database->pca on (a sample of) the database's descriptors, and replaces the
+ * descriptors with their projections. The full dimension descriptors are kept in
+ * fullSIFTDescriptors if re-ranking or reports need them, and freed otherwise.
+ */
+static PROGRAM_STATE ProjectDatabaseDescriptors(ImageDatabase* database)
+{
+	int dim = spPointGetDimension(database->SIFTDescriptors[0][0]);
+	if (database->options.pcaDimension >= dim)
+		return PROGRAM_STATE_INVALID_ARGUMENTS; /*Nothing to reduce*/
+
+	int nDescriptors = 0;
+	for(int i = 0; i < database->nImages; ++i)
+		nDescriptors += database->nFeatures[i];
+
+	/*Every stride-th descriptor is a training sample*/
+	int stride = (nDescriptors + PCA_MAX_TRAINING_DESCRIPTORS - 1) / PCA_MAX_TRAINING_DESCRIPTORS;
+	if (stride < 1)
+		stride = 1;
+	int nSamples = 0;
+	SPPointView* samples = (SPPointView*)malloc(sizeof(*samples) * (nDescriptors / stride + 1));
+	if (samples == NULL)
+		return PROGRAM_STATE_MEMORY_ERROR;
+
+	for(int i = 0, position = 0; i < database->nImages; ++i)
+		for(int j = 0; j < database->nFeatures[i]; ++j, ++position)
+			if (position % stride == 0)
+				samples[nSamples++] = spPointGetView(database->SIFTDescriptors[i][j]);
+
+	database->pca = spPcaTrain(samples, nSamples, database->options.pcaDimension, database->options.isPcaWhitening);
+	free(samples);
+
+	SPPoint*** projected = (SPPoint***)malloc(sizeof(*projected) * database->nImages);
+	SPPointArena* projectedArena = spPointArenaCreate(SP_POINT_ARENA_DEFAULT_BLOCK_SIZE);
+	double* coordinates = (double*)malloc(sizeof(*coordinates) * database->options.pcaDimension);
+
+	PROGRAM_STATE resProgramState = PROGRAM_STATE_RUNNING;
+	if (database->pca == NULL || projected == NULL || projectedArena == NULL || coordinates == NULL)
+		resProgramState = PROGRAM_STATE_MEMORY_ERROR;
+
+	for(int i = 0; i < database->nImages && resProgramState == PROGRAM_STATE_RUNNING; ++i)
+	{
+		projected[i] = (SPPoint**)spPointArenaAlloc(projectedArena, sizeof(*projected[i]) * database->nFeatures[i]);
+		if (projected[i] == NULL)
+			resProgramState = PROGRAM_STATE_MEMORY_ERROR;
+
+		for(int j = 0; j < database->nFeatures[i] && resProgramState == PROGRAM_STATE_RUNNING; ++j)
+		{
+			SPPointView descriptor = spPointGetView(database->SIFTDescriptors[i][j]);
+			spPcaProject(database->pca, descriptor.data, coordinates);
+
+			projected[i][j] = spPointArenaCreatePoint(projectedArena, coordinates, database->options.pcaDimension, i);
+			if (projected[i][j] == NULL)
+				resProgramState = PROGRAM_STATE_MEMORY_ERROR;
+		}
+	}
+
+	free(coordinates);
+
+	if (resProgramState != PROGRAM_STATE_RUNNING)
+	{
+		free(projected);
+		spPointArenaDestroy(projectedArena);
+		return resProgramState;
+	}
+
+	if (database->options.isPcaRerank || database->options.isPcaReport)
+	{
+		database->fullSIFTDescriptors = database->SIFTDescriptors;
+		database->fullPointArena = database->pointArena;
+	}
+	else
+	{
+		free(database->SIFTDescriptors);
+		spPointArenaDestroy(database->pointArena);
+	}
+
+	database->SIFTDescriptors = projected;
+	database->pointArena = projectedArena;
+
+	if (database->options.isPcaReport)
+		printf(PCA_TRAINING_REPORT_FORMAT, database->options.pcaDimension, dim,
+				100 * spPcaGetRetainedVariance(database->pca), 100.0 * database->options.pcaDimension / dim);
+
+	return PROGRAM_STATE_RUNNING;
+}
+
+/*
+ * Trains the vocabulary tree of database->bowIndex on (a sample of) the database's
+ * descriptors, then indexes the descriptors of every image.
+ */
+static PROGRAM_STATE TrainBowIndex(ImageDatabase* database)
+{
+	int nDescriptors = 0;
+	for(int i = 0; i < database->nImages; ++i)
+		nDescriptors += database->nFeatures[i];
+
+	/*Every stride-th descriptor is a training sample*/
+	int stride = (nDescriptors + BOW_MAX_TRAINING_DESCRIPTORS - 1) / BOW_MAX_TRAINING_DESCRIPTORS;
+	if (stride < 1)
+		stride = 1;
+	int nSamples = 0;
+	SPPointView* samples = (SPPointView*)malloc(sizeof(*samples) * (nDescriptors / stride + 1));
+	if (samples == NULL)
+		return PROGRAM_STATE_MEMORY_ERROR;
+
+	for(int i = 0, position = 0; i < database->nImages; ++i)
+		for(int j = 0; j < database->nFeatures[i]; ++j, ++position)
+			if (position % stride == 0)
+				samples[nSamples++] = spPointGetView(database->SIFTDescriptors[i][j]);
+
+	database->bowIndex = spBowIndexTrain(samples, nSamples, database->options.bowBranchFactor,
+							database->options.bowDepth, database->nImages);
+	free(samples);
+
+	if (database->bowIndex == NULL)
+		return PROGRAM_STATE_MEMORY_ERROR;
+
+	/*Index the images, one at a time, with views of their descriptors*/
+	PROGRAM_STATE resProgramState = PROGRAM_STATE_RUNNING;
+	for(int i = 0; i < database->nImages && resProgramState == PROGRAM_STATE_RUNNING; ++i)
+	{
+		SPPointView* descriptors = (SPPointView*)malloc(sizeof(*descriptors) * (database->nFeatures[i] + 1));
+		if (descriptors == NULL)
+			return PROGRAM_STATE_MEMORY_ERROR;
+
+		for(int j = 0; j < database->nFeatures[i]; ++j)
+			descriptors[j] = spPointGetView(database->SIFTDescriptors[i][j]);
+
+		if (!spBowIndexAddImage(database->bowIndex, i, descriptors, database->nFeatures[i]))
+			resProgramState = PROGRAM_STATE_MEMORY_ERROR;
+
+		free(descriptors);
+	}
+
+	if (resProgramState == PROGRAM_STATE_RUNNING)
+		spBowIndexFinalize(database->bowIndex);
+
+	return resProgramState;
+}
+
+/*
+ * Builds database->bowIndex - loads it from options.bowIndexPath if that file holds an index of
+ * the same images, extracted and projected the same way, with the same tree shape and of the same
+ * dimension, otherwise trains it (and saves it, if a path is set).
+ */
+static PROGRAM_STATE BuildBowIndex(ImageDatabase* database)
+{
+	const char* path = database->options.bowIndexPath;
+	uint64_t fingerprint = GetBowIndexFingerprint(database);
+
+	if (path != NULL)
+	{
+		database->bowIndex = spBowIndexLoad(path, fingerprint);
+
+		/*The dimension of the database's descriptors - all images have at least one*/
+		int dim = spPointGetDimension(database->SIFTDescriptors[0][0]);
+
+		if (database->bowIndex != NULL &&
+			spBowIndexGetNumOfImages(database->bowIndex) == database->nImages &&
+			spBowIndexGetDimension(database->bowIndex) == dim &&
+			spBowIndexGetBranchFactor(database->bowIndex) == database->options.bowBranchFactor &&
+			spBowIndexGetDepth(database->bowIndex) == database->options.bowDepth)
+			return PROGRAM_STATE_RUNNING;
+
+		spBowIndexDestroy(database->bowIndex); /*A missing or different index is trained again*/
+		database->bowIndex = NULL;
+	}
+
+	PROGRAM_STATE resProgramState = TrainBowIndex(database);
+
+	/*Failing to save only costs training again on the next run*/
+	if (resProgramState == PROGRAM_STATE_RUNNING && path != NULL)
+		spBowIndexSave(database->bowIndex, path, fingerprint);
+
+	return resProgramState;
+}
+
+/*
+ * Opens database->descriptorFile from options.streamPath, if it holds the descriptors of the
+ * same images, extracted the same way, and takes the number of descriptors of every image from it.
+ * Returns whether the file was opened.
+ */
+static bool OpenDescriptorFile(ImageDatabase* database)
+{
+	database->descriptorFile = spDescriptorFileOpen(database->options.streamPath);
+
+	if (database->descriptorFile != NULL &&
+		(spDescriptorFileGetNumOfImages(database->descriptorFile) != database->nImages ||
+		spDescriptorFileGetFingerprint(database->descriptorFile) != GetDatabaseFingerprint(database)))
+	{
+		spDescriptorFileClose(database->descriptorFile); /*A file of another database is written again*/
+		database->descriptorFile = NULL;
+	}
+
+	for(int i = 0; i < database->nImages && database->descriptorFile != NULL; ++i)
+		database->nFeatures[i] = (int)spDescriptorFileGetNumOfDescriptors(database->descriptorFile, i);
+
+	return database->descriptorFile != NULL;
+}
+
+/*
+ * Extracts the SIFT descriptors of an image and appends them to the descriptor file being
+ * written, which is created with the first image. The descriptors aren't kept in memory.
+ * Returns false if failed to allocate memory or to write the file.
+ */
+static bool AppendImageDescriptors(ImageDatabase* database, SPDescriptorFile** writer, const char* imgPath, int imgIndex,
+		const SPExtractionConfig* extraction)
+{
+	int dim = 0;
+	double* descriptors = spGetSiftDescriptorsData(imgPath, database->nFeaturesToExtract, &database->nFeatures[imgIndex],
+							&dim, extraction);
+	if (descriptors == NULL)
+		return false;
+
+	if (*writer == NULL)
+		*writer = spDescriptorFileCreate(database->options.streamPath, dim, database->nImages,
+					GetDatabaseFingerprint(database));
+
+	bool isAppended = *writer != NULL && spDescriptorFileAppendImage(*writer, descriptors, database->nFeatures[imgIndex]);
+
+	free(descriptors);
+	return isAppended;
+}
+
+/*
+ * Extracts the binary descriptors of an image and adds them to the binary index, which is
+ * created with the first image. Returns false if failed to allocate memory.
+ */
+static bool AddImageBinaryDescriptors(ImageDatabase* database, const char* imgPath, int imgIndex,
+		const SPExtractionConfig* extraction)
+{
+	int nBytes = 0;
+	unsigned char* descriptors = spGetBinaryDescriptorsData(imgPath, database->options.featureEngine,
+									database->nFeaturesToExtract, &database->nFeatures[imgIndex], &nBytes, extraction);
+	if (descriptors == NULL)
+		return false;
+
+	if (database->binaryIndex == NULL)
+		database->binaryIndex = spBinaryIndexCreate(database->nImages, nBytes);
+
+	bool isAdded = database->binaryIndex != NULL &&
+		spBinaryIndexGetNumOfWords(database->binaryIndex) == (nBytes + 7) / 8 && /*The same engine always gives the same size*/
+		spBinaryIndexAddImage(database->binaryIndex, descriptors, database->nFeatures[imgIndex]);
+
+	free(descriptors);
+	return isAdded;
+}
+
+/*
+ * The most descriptors image imgIndex may keep within the memory budget - an even share of what's
+ * left of it after the hists, the per-image arrays and the descriptors of the images before it.
+ * Returns 0 if there's no budget, and -1 if not even a single descriptor fits.
+ */
+static int GetBudgetedNumOfDescriptors(const ImageDatabase* database, int imgIndex)
+{
+	if (database->options.memoryBudgetMB <= 0)
+		return 0;
+
+	DatabaseMemoryUsage usage;
+	GetImageDatabaseMemoryUsage(database, &usage);
+
+	size_t budget = (size_t)database->options.memoryBudgetMB << 20;
+	size_t used = usage.RGBHists + usage.SIFTDescriptorsUsed + usage.other;
+	size_t share = used < budget ? (budget - used) / (database->nImages - imgIndex) : 0;
+
+	/*Every descriptor takes its point and its entry in the image's array, which is aligned as a whole*/
+	size_t descriptorSize = spPointArenaGetPointSize(SP_KERNEL_SIFT_DIMENSION) + sizeof(SPPoint*);
+	size_t alignment = spPointArenaGetAllocationSize(1);
+
+	if (share < alignment + descriptorSize)
+		return -1;
+
+	size_t nDescriptors = (share - alignment) / descriptorSize;
+	return nDescriptors > INT_MAX ? INT_MAX : (int)nDescriptors;
+}
+
+/*
+ * The most descriptors image imgIndex may keep by the descriptor budget and cap - the smaller of the
+ * budget and an even share of what's left of the cap after the nKept descriptors of the images
+ * before it. Returns 0 if there's neither.
+ */
+static int GetDescriptorBudget(const ImageDatabase* database, int imgIndex, long long nKept)
+{
+	int budget = database->options.descriptorBudget;
+	if (database->options.descriptorCap > 0)
+	{
+		long long share = (database->options.descriptorCap - nKept) / (database->nImages - imgIndex);
+		if (share < 1)
+			share = 1; /*Every image keeps a descriptor, and the cap is at least the number of images*/
+		if (budget == 0 || share < budget)
+			budget = (int)share;
+	}
+	return budget;
+}
+
+/*
+ * The size of the first block of the descriptors' arena. Within a memory budget, the block has
+ * room for all the descriptors the budget leaves room for, so the arena never reserves more.
+ */
+static int GetDescriptorsArenaBlockSize(const ImageDatabase* database)
+{
+	if (database->options.memoryBudgetMB <= 0)
+		return SP_POINT_ARENA_DEFAULT_BLOCK_SIZE;
+
+	DatabaseMemoryUsage usage;
+	GetImageDatabaseMemoryUsage(database, &usage);
+
+	size_t budget = (size_t)database->options.memoryBudgetMB << 20;
+	size_t used = usage.RGBHists + usage.SIFTDescriptorsUsed + usage.other;
+
+	if (used >= budget)
+		return SP_POINT_ARENA_DEFAULT_BLOCK_SIZE; /*Nothing fits - the first image is refused*/
+
+	return budget - used > INT_MAX ? INT_MAX : (int)(budget - used);
+}
+
+/*
+ * Attaches the database to the shared database segment named options.sharedAttachName, instead of
+ * extracting its images. Its hists and descriptors are used where they are, read-only - only the
+ * points over the descriptors are allocated, from database->pointArena.
+ */
+static PROGRAM_STATE AttachSharedDatabase(ImageDatabase* database)
+{
+	database->sharedDatabase = spSharedDatabaseAttach(database->options.sharedAttachName);
+
+	/*The segment must hold the very images the user gave - the same files, extracted the same way.
+	  Whatever budgets it was published within, which decided the descriptors it kept, it's searched as is*/
+	if (database->sharedDatabase == NULL ||
+		spSharedDatabaseGetNumOfImages(database->sharedDatabase) != database->nImages ||
+		spSharedDatabaseGetNumOfBins(database->sharedDatabase) != database->nBins ||
+		!spSharedDatabaseIsExtractedWith(database->sharedDatabase, database->nFeaturesToExtract, &database->options.extraction,
+				GetImagesFingerprint(database)))
+	{
+		printf(SHARED_DATABASE_ATTACH_ERROR_FORMAT, database->options.sharedAttachName);
+		return PROGRAM_STATE_INVALID_ARGUMENTS;
+	}
+
+	/*One block holds the points over the shared descriptors - a point over data takes no coordinates*/
+	size_t arenaSize = 0;
+	for(int i = 0; i < database->nImages; ++i)
+	{
+		int nDescriptors = spSharedDatabaseGetNumOfDescriptors(database->sharedDatabase, i);
+		arenaSize += spPointArenaGetAllocationSize(sizeof(SPPoint*) * nDescriptors) +
+			spPointArenaGetPointSize(0) * nDescriptors;
+	}
+
+	database->RGBHistMatrix = spHistMatrixCreateOver(spSharedDatabaseGetHists(database->sharedDatabase),
+									database->nImages, database->nBins);
+	database->SIFTDescriptors = (SPPoint***)malloc(sizeof(*database->SIFTDescriptors) * database->nImages);
+	database->nFeatures = (int*)malloc(sizeof(*database->nFeatures) * database->nImages);
+	database->pointArena = spPointArenaCreate(arenaSize > INT_MAX ? INT_MAX : (int)arenaSize);
+
+	if (database->RGBHistMatrix == NULL ||
+		database->SIFTDescriptors == NULL ||
+		database->nFeatures == NULL ||
+		database->pointArena == NULL)
+		return PROGRAM_STATE_MEMORY_ERROR; /*Failed to allocate memory*/
+
+	int dim = spSharedDatabaseGetDimension(database->sharedDatabase);
+	for(int i = 0; i < database->nImages; ++i)
+	{
+		database->nFeatures[i] = spSharedDatabaseGetNumOfDescriptors(database->sharedDatabase, i);
+		database->SIFTDescriptors[i] = (SPPoint**)spPointArenaAlloc(database->pointArena,
+											sizeof(*database->SIFTDescriptors[i]) * database->nFeatures[i]);
+		if (database->SIFTDescriptors[i] == NULL)
+			return PROGRAM_STATE_MEMORY_ERROR;
+
+		const double* descriptors = spSharedDatabaseGetDescriptors(database->sharedDatabase, i);
+		for(int j = 0; j < database->nFeatures[i]; ++j)
+		{
+			database->SIFTDescriptors[i][j] = spPointArenaCreatePointOver(database->pointArena,
+													descriptors + (size_t)j * dim, dim, i);
+			if (database->SIFTDescriptors[i][j] == NULL)
+				return PROGRAM_STATE_MEMORY_ERROR;
+		}
+	}
+
+	database->nRGBHistsExtracted = database->nImages;
+	database->nSIFTDescriptorsExtracted = database->nImages;
+	return PROGRAM_STATE_RUNNING;
+}
+
+/*
+ * Calculates the RGB hists and SIFT descriptors of every image of the database - into memory, or
+ * into the descriptor file when streaming.
+ */
+static PROGRAM_STATE ExtractImageDatabase(ImageDatabase* database)
+{
+	/*Create a matrix of hists, one row per image*/
+	database->RGBHistMatrix = spHistMatrixCreate(database->nImages, database->nBins);
+	database->SIFTDescriptors = (SPPoint***)malloc(sizeof(*database->SIFTDescriptors) * database->nImages);
+	database->nFeatures = (int*)malloc(sizeof(*database->nFeatures) * database->nImages);
+
+	/*All descriptors are allocated from one arena, to keep them adjacent and cheap to free*/
+	database->pointArena = spPointArenaCreate(GetDescriptorsArenaBlockSize(database));
+
+	if (database->RGBHistMatrix == NULL ||
+		database->SIFTDescriptors == NULL ||
+		database->nFeatures == NULL ||
+		database->pointArena == NULL)
+		return PROGRAM_STATE_MEMORY_ERROR; /*Failed to allocate memory*/
+
+	/*The images are read from the archive in index order - a sequential read of one file*/
+	SPImageArchive* archive = NULL;
+	if (database->options.archivePath != NULL)
+	{
+		archive = spImageArchiveOpen(database->options.archivePath);
+		if (archive == NULL || spImageArchiveGetNumOfImages(archive) < database->nImages)
+		{
+			printf(IMAGE_ARCHIVE_ERROR_FORMAT, database->options.archivePath, database->nImages);
+			spImageArchiveClose(archive);
+			return PROGRAM_STATE_INVALID_ARGUMENTS;
+		}
+	}
+
+	if (database->options.descriptorCap > 0 && database->options.descriptorCap < database->nImages)
+	{
+		printf(DESCRIPTOR_CAP_TOO_LOW_FORMAT, database->options.descriptorCap, database->nImages);
+		spImageArchiveClose(archive);
+		return PROGRAM_STATE_INVALID_ARGUMENTS;
+	}
+
+	/*When streaming, descriptors are only written to the descriptor file - unless it already holds them*/
+	bool isStreaming = database->options.streamPath != NULL;
+	bool hasDescriptorFile = isStreaming && OpenDescriptorFile(database);
+	SPDescriptorFile* writer = NULL;
+	PROGRAM_STATE resProgramState = PROGRAM_STATE_RUNNING;
 
-PROGRAM_STATE GetImageDatabaseFromUser(ImageDatabase* database)
+	/*The descriptors the images before the current one kept and detected, for the cap and the report*/
+	long long nKeptDescriptors = 0;
+	long long nDetectedDescriptors = 0;
+	int nDescriptorCappedImages = 0;
+
+	/*Go over each image and calculate the RGB hist and SIFT descriptors*/
+	for(int i=0; i < database->nImages && resProgramState == PROGRAM_STATE_RUNNING; ++i)
+	{
+		/*Get the full path of the image - from the archive, only shown in messages*/
+		char* imgPath = GetImagePath(database->imgDirectory, database->imgPrefix, database->imgSuffix, i);
+		if (imgPath == NULL)
+		{
+			resProgramState = PROGRAM_STATE_MEMORY_ERROR; /*Failed to allocate memory*/
+			break;
+		}
+
+		SPExtractionConfig extraction = database->options.extraction;
+		if (archive != NULL)
+			spImageArchiveGetImage(archive, i, &extraction.encodedImage, &extraction.encodedImageSize);
+
+		bool isUnreadable = false;
+		extraction.isUnreadable = &isUnreadable;
+
+		/*Calculate RGB hists straight into the image's row of the matrix*/
+		bool hasRGBHists = spGetRGBHistInto(imgPath, database->nBins, spHistMatrixGetRow(database->RGBHistMatrix, i), &extraction);
+		if (isUnreadable)
+		{
+			database->unreadableImage = i;
+			free(imgPath);
+			resProgramState = PROGRAM_STATE_UNREADABLE_IMAGE;
+			break;
+		}
+
+		/*Within a memory budget, keep only the strongest descriptors that fit*/
+		extraction.maxDescriptors = GetBudgetedNumOfDescriptors(database, i);
+		if (extraction.maxDescriptors < 0)
+		{
+			printf(MEMORY_BUDGET_REFUSED_FORMAT, i, database->options.memoryBudgetMB);
+			free(imgPath);
+			resProgramState = PROGRAM_STATE_MEMORY_BUDGET_EXCEEDED;
+			break;
+		}
+		if (extraction.maxDescriptors > 0 && extraction.maxDescriptors < database->nFeaturesToExtract)
+			database->nBudgetCappedImages++;
+
+		/*Keep only the top ranked descriptors within the descriptor budget and cap*/
+		int descriptorBudget = GetDescriptorBudget(database, i, nKeptDescriptors);
+		if (descriptorBudget > 0 && (extraction.maxDescriptors == 0 || descriptorBudget < extraction.maxDescriptors))
+			extraction.maxDescriptors = descriptorBudget;
+
+		int nDetected = 0;
+		extraction.nDetectedDescriptors = &nDetected;
+
+		/*Calculate SIFT descriptors - or binary ones, into the binary index*/
+		bool hasSIFTDescriptors = true;
+		database->SIFTDescriptors[i] = NULL;
+		if (isStreaming)
+		{
+			if (!hasDescriptorFile)
+				hasSIFTDescriptors = AppendImageDescriptors(database, &writer, imgPath, i, &extraction);
+		}
+		else if (database->options.featureEngine != SP_FEATURE_ENGINE_SIFT)
+		{
+			database->nFeatures[i] = 0; /*Initialise*/
+			hasSIFTDescriptors = AddImageBinaryDescriptors(database, imgPath, i, &extraction);
+		}
+		else
+		{
+			database->nFeatures[i] = 0; /*Initialise*/
+			database->SIFTDescriptors[i] = spGetSiftDescriptorsInArena(imgPath,i, database->nFeaturesToExtract, &(database->nFeatures[i]), database->pointArena, &extraction);
+			hasSIFTDescriptors = database->SIFTDescriptors[i] != NULL;
+		}
+
+		free(imgPath);
+
+		/*Update counters of the number of extracted RGB hists/sift features*/
+		if (hasRGBHists)
+			database->nRGBHistsExtracted++;
+		if (hasSIFTDescriptors)
+			database->nSIFTDescriptorsExtracted++;
+
+		/*A descriptor file that already holds the descriptors wasn't extracted, so it has nothing to report*/
+		if (hasSIFTDescriptors && !hasDescriptorFile)
+		{
+			bool isCapped = extraction.maxDescriptors > 0 && nDetected > extraction.maxDescriptors;
+			nKeptDescriptors += database->nFeatures[i];
+			nDetectedDescriptors += nDetected;
+			nDescriptorCappedImages += isCapped ? 1 : 0;
+
+			if (database->options.isDescriptorReport && isCapped)
+				printf(DESCRIPTOR_REPORT_CAPPED_FORMAT, i, database->nFeatures[i], nDetected, extraction.maxDescriptors);
+			else if (database->options.isDescriptorReport)
+				printf(DESCRIPTOR_REPORT_FORMAT, i, database->nFeatures[i], nDetected);
+		}
+
+		/*If reached this point in the program, then assume that nBins > 0, maxNFeatures > 0 and image path is valid*/
+		/*Therefore, if spGetRGBHist() or SIFTDescriptors() returns null, then it was a memory allocation error*/
+		if (isUnreadable)
+		{
+			database->unreadableImage = i;
+			resProgramState = PROGRAM_STATE_UNREADABLE_IMAGE;
+		}
+		else if (!hasRGBHists || !hasSIFTDescriptors)
+			resProgramState = PROGRAM_STATE_MEMORY_ERROR;
+	}
+
+	spImageArchiveClose(archive);
+
+	if (resProgramState == PROGRAM_STATE_RUNNING && database->options.isDescriptorReport && !hasDescriptorFile)
+		printf(DESCRIPTOR_REPORT_SUMMARY_FORMAT, nKeptDescriptors, nDetectedDescriptors, nDescriptorCappedImages);
+
+	if (resProgramState != PROGRAM_STATE_RUNNING)
+	{
+		spDescriptorFileClose(writer);
+		return resProgramState;
+	}
+
+	/*A newly written descriptor file is searched once it's complete*/
+	if (writer != NULL && (!spDescriptorFileFinish(writer) || !OpenDescriptorFile(database)))
+		return PROGRAM_STATE_MEMORY_ERROR;
+
+	return PROGRAM_STATE_RUNNING;
+}
+
+PROGRAM_STATE CalcImageDataBaseHistsAndDescriptors(ImageDatabase* database)
 {
-	/*Allocate memory*/
-	database->imgDirectory = (char*)malloc(sizeof(*database->imgDirectory) * MAX_IMG_PATH_LEGTH);
-	database->imgPrefix = (char*)malloc(sizeof(*database->imgPrefix) * MAX_IMG_PATH_LEGTH);
-	database->imgSuffix = (char*)malloc(sizeof(*database->imgSuffix) * MAX_IMG_PATH_LEGTH);
+	PROGRAM_STATE resProgramState = database->options.sharedAttachName != NULL ?
+		AttachSharedDatabase(database) : ExtractImageDatabase(database);
+	if (resProgramState != PROGRAM_STATE_RUNNING)
+		return resProgramState;
 
-	/*Validate that memory was successfully allocated*/
-	if (database->imgDirectory == NULL
-		|| database->imgPrefix == NULL
-		|| database->imgSuffix == NULL)
+	/*Coarse hists, to skip images by their lower bounds in the RGB search*/
+	if (!spHistMatrixBuildLowerBounds(database->RGBHistMatrix))
 		return PROGRAM_STATE_MEMORY_ERROR; /*Failed to allocate memory*/
 
-	/*Get the directory path for the images.*/
-	PrintMsg(ENTER_DIRECTORY_MSG);
-	if (scanf("%s", database->imgDirectory) <= 0) {
-	   return PROGRAM_STATE_MEMORY_ERROR;
-	};
+	/*Other processes can attach to the descriptors as they were extracted - a failure only affects them*/
+	if (database->options.sharedPublishName != NULL)
+	{
+		SPSharedDatabaseBudgets budgets;
+		budgets.memoryBudgetMB = database->options.memoryBudgetMB;
+		budgets.descriptorBudget = database->options.descriptorBudget;
+		budgets.descriptorCap = database->options.descriptorCap;
+
+		if (!spSharedDatabasePublish(database->options.sharedPublishName, database->RGBHistMatrix, database->SIFTDescriptors,
+				database->nFeatures, database->nFeaturesToExtract, &database->options.extraction, &budgets,
+				GetImagesFingerprint(database)))
+			printf(SHARED_DATABASE_PUBLISH_ERROR_FORMAT, database->options.sharedPublishName);
+	}
+
+	/*The shards are started while no other threads run, as fork requires*/
+	if (database->options.nShards > 0)
+	{
+		database->shardPool = spShardPoolCreate(database->options.streamPath, database->options.nShards,
+								database->options.streamBlockSize);
+		if (database->shardPool == NULL)
+			return PROGRAM_STATE_MEMORY_ERROR;
+	}
+
+	if (database->options.pcaDimension > 0)
+	{
+		resProgramState = ProjectDatabaseDescriptors(database);
+		if (resProgramState != PROGRAM_STATE_RUNNING)
+			return resProgramState;
+	}
+
+	/*Sketches of the descriptors as they're searched - projected, with a pca*/
+	if (database->options.sketchBits > 0)
+	{
+		database->sketchIndex = spSketchIndexCreate(database->SIFTDescriptors, database->nFeatures,
+									database->nImages, database->options.sketchBits);
+		if (database->sketchIndex == NULL)
+			return PROGRAM_STATE_MEMORY_ERROR;
+	}
+
+	if (database->options.isBowSearch)
+	{
+		resProgramState = BuildBowIndex(database);
+		if (resProgramState != PROGRAM_STATE_RUNNING)
+			return resProgramState;
+	}
+
+	/*Rankings of a reduced resolution database are reported against a full resolution copy of it*/
+	bool isReducedResolution = database->options.extraction.decodeScale > 1 || database->options.extraction.maxImageSide > 0;
+	if (database->options.isResolutionReport && isReducedResolution)
+		resProgramState = CreateReferenceDatabase(database);
+
+	if (resProgramState == PROGRAM_STATE_RUNNING && database->options.isStats)
+		PrintMemoryStats(database);
+
+	/*Queries are recorded from once the database can answer them*/
+	if (resProgramState == PROGRAM_STATE_RUNNING && database->options.recordPath != NULL)
+	{
+		SPWorkloadDatabase workloadDatabase = {database->imgDirectory, database->imgPrefix, database->nImages,
+											   database->imgSuffix, database->nBins, database->nFeaturesToExtract};
+		database->workloadRecorder = spWorkloadRecorderOpen(database->options.recordPath, &workloadDatabase,
+										database->options.nArguments, database->options.arguments, OPTION_RECORD,
+										GetMonotonicTime());
+		if (database->workloadRecorder == NULL)
+		{
+			printf(WORKLOAD_RECORD_ERROR_FORMAT, database->options.recordPath);
+			resProgramState = PROGRAM_STATE_INVALID_ARGUMENTS;
+		}
+	}
+
+	/*If all data was calculated successfully, keep running the main program*/
+	return resProgramState;
+}
+
+
+/*
+ * A rewrite of the hists and descriptors of the database without its deleted images. It's built by
+ * a background thread from a snapshot of the tombstones, while queries keep searching the current
+ * storage - which isn't changed until the rewrite is put in place.
+ */
+struct database_compaction {
+	std::thread thread;
+	std::atomic<bool> isDone; /*Set by the thread once the fields below are final*/
+	bool isOk; /*Whether the new storage was built*/
+
+	int nOldImages; /*The number of images in the current storage*/
+	int* newPositions; /*The position of every current image in the new storage, or -1 if it's removed*/
+
+	int nImages; /*The new storage, of the remaining images*/
+	int* imageIndices;
+	SPHistMatrix* RGBHistMatrix;
+	SPPoint*** SIFTDescriptors;
+	int* nFeatures;
+	SPPointArena* pointArena;
+	SPPoint*** fullSIFTDescriptors;
+	SPPointArena* fullPointArena;
+	SPSketchIndex* sketchIndex;
+};
+
+/*
+ * Copies the descriptors of the remaining images into a new arena, each point indexed by its new position.
+ * Returns NULL if failed to allocate memory.
+ */
+static SPPoint*** CompactDescriptors(SPPoint*** descriptors, const int* nFeatures,
+		const struct database_compaction* compaction, SPPointArena** resArena)
+{
+	/*One block holds them all - the memory the deleted images took is given back*/
+	size_t arenaSize = 0;
+	for(int i = 0; i < compaction->nOldImages; ++i)
+		if (compaction->newPositions[i] >= 0 && nFeatures[i] > 0)
+			arenaSize += spPointArenaGetAllocationSize(sizeof(SPPoint*) * nFeatures[i]) +
+				spPointArenaGetPointSize(spPointGetDimension(descriptors[i][0])) * nFeatures[i];
+
+	SPPoint*** compacted = (SPPoint***)calloc(sizeof(*compacted), compaction->nImages);
+	*resArena = spPointArenaCreate(arenaSize > INT_MAX ? INT_MAX : (int)(arenaSize > 0 ? arenaSize : 1));
+	if (compacted == NULL || *resArena == NULL)
+	{
+		free(compacted);
+		return NULL;
+	}
+
+	for(int i = 0; i < compaction->nOldImages; ++i)
+	{
+		int position = compaction->newPositions[i];
+		if (position < 0)
+			continue;
+
+		compacted[position] = (SPPoint**)spPointArenaAlloc(*resArena, sizeof(*compacted[position]) * nFeatures[i]);
+		if (compacted[position] == NULL)
+		{
+			free(compacted);
+			return NULL;
+		}
+
+		for(int j = 0; j < nFeatures[i]; ++j)
+		{
+			SPPointView descriptor = spPointGetView(descriptors[i][j]);
+			compacted[position][j] = spPointArenaCreatePoint(*resArena, (double*)descriptor.data, descriptor.dim, position);
+			if (compacted[position][j] == NULL)
+			{
+				free(compacted);
+				return NULL;
+			}
+		}
+	}
+
+	return compacted;
+}
+
+/*
+ * Builds the new storage of the compaction from the current storage of the database. Runs on the
+ * compaction's thread, and only reads the database.
+ */
+static void CompactImageDatabase(const ImageDatabase* database, struct database_compaction* compaction)
+{
+	compaction->imageIndices = (int*)malloc(sizeof(*compaction->imageIndices) * compaction->nImages);
+	compaction->nFeatures = (int*)malloc(sizeof(*compaction->nFeatures) * compaction->nImages);
+	compaction->RGBHistMatrix = spHistMatrixCreate(compaction->nImages, database->nBins);
+
+	compaction->isOk = compaction->imageIndices != NULL && compaction->nFeatures != NULL && compaction->RGBHistMatrix != NULL;
+
+	if (compaction->isOk)
+	{
+		size_t rowSize = sizeof(double) * compaction->RGBHistMatrix->rowLength;
+		for(int i = 0; i < compaction->nOldImages; ++i)
+		{
+			int position = compaction->newPositions[i];
+			if (position < 0)
+				continue;
+
+			compaction->imageIndices[position] = database->imageIndices != NULL ? database->imageIndices[i] : i;
+			compaction->nFeatures[position] = database->nFeatures[i];
+			memcpy(spHistMatrixGetRow(compaction->RGBHistMatrix, position), spHistMatrixGetRow(database->RGBHistMatrix, i), rowSize);
+		}
+		compaction->isOk = spHistMatrixBuildLowerBounds(compaction->RGBHistMatrix);
+
+	}
+
+	if (compaction->isOk)
+	{
+		compaction->SIFTDescriptors = CompactDescriptors(database->SIFTDescriptors, database->nFeatures, compaction,
+											&compaction->pointArena);
+		compaction->isOk = compaction->SIFTDescriptors != NULL;
+	}
+
+	if (compaction->isOk && database->fullSIFTDescriptors != NULL)
+	{
+		compaction->fullSIFTDescriptors = CompactDescriptors(database->fullSIFTDescriptors, database->nFeatures, compaction,
+												&compaction->fullPointArena);
+		compaction->isOk = compaction->fullSIFTDescriptors != NULL;
+	}
+
+	/*Sketched anew, around the mean of the remaining descriptors*/
+	if (compaction->isOk && database->sketchIndex != NULL)
+	{
+		compaction->sketchIndex = spSketchIndexCreate(compaction->SIFTDescriptors, compaction->nFeatures, compaction->nImages,
+										spSketchIndexGetNumOfBits(database->sketchIndex));
+		compaction->isOk = compaction->sketchIndex != NULL;
+	}
+
+	compaction->isDone = true;
+}
+
+/*
+ * Waits for the compaction, and frees it with the parts of the new storage that weren't put in place.
+ * If compaction is NULL nothing happens.
+ */
+static void DestroyCompaction(struct database_compaction* compaction)
+{
+	if (compaction == NULL)
+		return;
+
+	if (compaction->thread.joinable())
+		compaction->thread.join();
+
+	free(compaction->newPositions);
+	free(compaction->imageIndices);
+	free(compaction->nFeatures);
+	spHistMatrixDestroy(compaction->RGBHistMatrix);
+	free(compaction->SIFTDescriptors);
+	spPointArenaDestroy(compaction->pointArena);
+	free(compaction->fullSIFTDescriptors);
+	spPointArenaDestroy(compaction->fullPointArena);
+	spSketchIndexDestroy(compaction->sketchIndex);
+	delete compaction;
+}
+
+/*
+ * Starts compacting the database in the background, if enough images are deleted and it isn't
+ * compacting already. Failing to start is harmless - the tombstones keep the deleted images out
+ * of the search, and it's tried again on the next deletion.
+ */
+static void StartCompaction(ImageDatabase* database)
+{
+	if (database->compaction != NULL || database->nDeleted < database->options.compactAfter)
+		return;
+
+	/*The binary index isn't compacted - its deleted images stay tombstoned*/
+	if (database->binaryIndex != NULL)
+		return;
+
+	struct database_compaction* compaction = new (std::nothrow) struct database_compaction;
+	if (compaction == NULL)
+		return;
+
+	compaction->isDone = false;
+	compaction->isOk = false;
+	compaction->nOldImages = database->nImages;
+	compaction->newPositions = (int*)malloc(sizeof(*compaction->newPositions) * database->nImages);
+	compaction->nImages = 0;
+	compaction->imageIndices = NULL;
+	compaction->RGBHistMatrix = NULL;
+	compaction->SIFTDescriptors = NULL;
+	compaction->nFeatures = NULL;
+	compaction->pointArena = NULL;
+	compaction->fullSIFTDescriptors = NULL;
+	compaction->fullPointArena = NULL;
+	compaction->sketchIndex = NULL;
+
+	if (compaction->newPositions == NULL)
+	{
+		DestroyCompaction(compaction);
+		return;
+	}
+
+	/*The snapshot of the tombstones - images deleted from now on are carried over when it's put in place*/
+	for(int i = 0; i < database->nImages; ++i)
+		compaction->newPositions[i] = database->isDeleted[i] ? -1 : compaction->nImages++;
+
+	try {
+		compaction->thread = std::thread(CompactImageDatabase, database, compaction);
+	} catch (const std::system_error&) {
+		CompactImageDatabase(database, compaction); /*Couldn't start a thread - compact right away*/
+	}
+
+	database->compaction = compaction;
+}
+
+bool IsDatabaseCompactionDone(const ImageDatabase* database)
+{
+	return database->compaction != NULL && database->compaction->isDone;
+}
+
+/*
+ * Images deleted while the compaction ran are tombstoned in the new storage, and may start the
+ * next compaction. A compaction that failed is dropped.
+ */
+void FinishDatabaseCompaction(ImageDatabase* database)
+{
+	struct database_compaction* compaction = database->compaction;
+	if (compaction == NULL || !compaction->isDone)
+		return;
+
+	if (compaction->thread.joinable())
+		compaction->thread.join();
+
+	int nDeleted = 0;
+	bool* isDeleted = NULL;
+	for(int i = 0; i < compaction->nOldImages; ++i)
+		if (compaction->newPositions[i] >= 0 && database->isDeleted[i])
+			nDeleted++;
+
+	if (nDeleted > 0)
+		isDeleted = (bool*)calloc(sizeof(*isDeleted), compaction->nImages);
+
+	database->compaction = NULL;
+	if (!compaction->isOk || (nDeleted > 0 && isDeleted == NULL))
+	{
+		DestroyCompaction(compaction);
+		return;
+	}
+
+	for(int i = 0; i < compaction->nOldImages; ++i)
+		if (compaction->newPositions[i] >= 0 && database->isDeleted[i])
+			isDeleted[compaction->newPositions[i]] = true;
+
+	/*The old storage - the new one holds copies of everything, so a shared database isn't needed either*/
+	spPointArenaDestroy(database->pointArena);
+	free(database->SIFTDescriptors);
+	spPointArenaDestroy(database->fullPointArena);
+	free(database->fullSIFTDescriptors);
+	spSketchIndexDestroy(database->sketchIndex);
+	free(database->nFeatures);
+	spHistMatrixDestroy(database->RGBHistMatrix);
+	spSharedDatabaseDetach(database->sharedDatabase);
+	free(database->imageIndices);
+	free(database->isDeleted);
+
+	database->nImages = compaction->nImages;
+	database->nRGBHistsExtracted = compaction->nImages;
+	database->nSIFTDescriptorsExtracted = compaction->nImages;
+	database->imageIndices = compaction->imageIndices;
+	database->RGBHistMatrix = compaction->RGBHistMatrix;
+	database->SIFTDescriptors = compaction->SIFTDescriptors;
+	database->nFeatures = compaction->nFeatures;
+	database->pointArena = compaction->pointArena;
+	database->fullSIFTDescriptors = compaction->fullSIFTDescriptors;
+	database->fullPointArena = compaction->fullPointArena;
+	database->sketchIndex = compaction->sketchIndex;
+	database->sharedDatabase = NULL;
+	database->isDeleted = isDeleted;
+	database->nDeleted = nDeleted;
+
+	/*Now owned by the database*/
+	compaction->imageIndices = NULL;
+	compaction->RGBHistMatrix = NULL;
+	compaction->SIFTDescriptors = NULL;
+	compaction->nFeatures = NULL;
+	compaction->pointArena = NULL;
+	compaction->fullSIFTDescriptors = NULL;
+	compaction->fullPointArena = NULL;
+	compaction->sketchIndex = NULL;
+	DestroyCompaction(compaction);
+
+	if (database->options.isStats)
+		printf(DATABASE_COMPACTED_FORMAT, database->nImages);
+
+	StartCompaction(database);
+}
+
+/*The position of the image of the given index in the database, or -1 if it isn't there*/
+static int GetImagePosition(const ImageDatabase* database, int imageIndex)
+{
+	if (database->imageIndices == NULL)
+		return imageIndex >= 0 && imageIndex < database->nImages ? imageIndex : -1;
+
+	for(int i = 0; i < database->nImages; ++i)
+		if (database->imageIndices[i] == imageIndex)
+			return i;
+
+	return -1;
+}
+
+void GetDatabaseImageIndices(const ImageDatabase* database, const int* positions, int nPositions, int* resIndices)
+{
+	for(int i = 0; i < nPositions; ++i)
+		resIndices[i] = database->imageIndices != NULL ? database->imageIndices[positions[i]] : positions[i];
+}
+
+PROGRAM_STATE DeleteDatabaseImage(ImageDatabase* database, int imageIndex)
+{
+	/*The bag-of-words index, the descriptor file and the full resolution copy hold all images*/
+	if (database->bowIndex != NULL || database->descriptorFile != NULL || database->referenceDatabase != NULL)
+		return PROGRAM_STATE_INVALID_ARGUMENTS;
+
+	/*The local search needs at least 2 images*/
+	int position = GetImagePosition(database, imageIndex);
+	if (position < 0 || (database->isDeleted != NULL && database->isDeleted[position]) ||
+		database->nImages - database->nDeleted <= 2)
+		return PROGRAM_STATE_INVALID_ARGUMENTS;
+
+	if (database->isDeleted == NULL)
+	{
+		database->isDeleted = (bool*)calloc(sizeof(*database->isDeleted), database->nImages);
+		if (database->isDeleted == NULL)
+			return PROGRAM_STATE_MEMORY_ERROR;
+	}
+
+	/*From now on, every query skips it*/
+	database->isDeleted[position] = true;
+	database->nDeleted++;
+
+	StartCompaction(database);
+	return PROGRAM_STATE_RUNNING;
+}
+
+/*
+ * Extracts the binary descriptors of the query into features->binaryDescriptors, packed like
+ * the database's binaryIndex.
+ */
+static PROGRAM_STATE ExtractQueryBinaryDescriptors(const char* queryImagePath, const ImageDatabase* database,
+		const SPExtractionConfig* extraction, QueryFeatures* features)
+{
+	int nBytes = 0;
+	unsigned char* descriptors = spGetBinaryDescriptorsData(queryImagePath, database->options.featureEngine,
+									database->nFeaturesToExtract, &features->nFeatures, &nBytes, extraction);
+	if (descriptors == NULL)
+		return extraction->isUnreadable != NULL && *extraction->isUnreadable ?
+				PROGRAM_STATE_UNREADABLE_IMAGE : PROGRAM_STATE_MEMORY_ERROR;
+
+	int nWords = spBinaryIndexGetNumOfWords(database->binaryIndex);
+	features->binaryDescriptors = (uint64_t*)malloc(sizeof(*features->binaryDescriptors) * nWords * features->nFeatures);
+	if (features->binaryDescriptors != NULL)
+		spBinaryIndexPack(database->binaryIndex, descriptors, features->nFeatures, features->binaryDescriptors);
+
+	free(descriptors);
+	return features->binaryDescriptors != NULL ? PROGRAM_STATE_RUNNING : PROGRAM_STATE_MEMORY_ERROR;
+}
+
+PROGRAM_STATE ExtractQueryFeatures(const char* queryImagePath, const ImageDatabase* database, QueryFeatures* features)
+{
+	memset(features, 0, sizeof(*features));
+
+	PROGRAM_STATE resProgramState = ExtractQueryRGBHists(queryImagePath, database, features);
+	if (resProgramState == PROGRAM_STATE_RUNNING)
+		resProgramState = ExtractQueryLocalFeatures(queryImagePath, database, features);
+
+	return resProgramState;
+}
+
+PROGRAM_STATE ExtractQueryRGBHists(const char* queryImagePath, const ImageDatabase* database, QueryFeatures* features)
+{
+	SPExtractionConfig extraction = database->options.extraction;
+
+	bool isUnreadable = false;
+	extraction.isUnreadable = &isUnreadable;
+
+	features->RGBHists = spGetRGBHistData(queryImagePath, database->nBins, &extraction);
+	if (features->RGBHists == NULL)
+		return isUnreadable ? PROGRAM_STATE_UNREADABLE_IMAGE : PROGRAM_STATE_MEMORY_ERROR;
+
+	return PROGRAM_STATE_RUNNING;
+}
+
+PROGRAM_STATE ExtractQueryLocalFeatures(const char* queryImagePath, const ImageDatabase* database, QueryFeatures* features)
+{
+	/*With a deadline, the strongest features come first - they are the ones searched if time runs out*/
+	SPExtractionConfig extraction = database->options.extraction;
+	extraction.isSortedByResponse = database->options.deadlineMs > 0;
+
+	bool isUnreadable = false;
+	extraction.isUnreadable = &isUnreadable;
+
+	if (database->binaryIndex != NULL)
+		return ExtractQueryBinaryDescriptors(queryImagePath, database, &extraction, features);
+
+	features->SIFTDescriptorsData = spGetSiftDescriptorsData(queryImagePath, database->nFeaturesToExtract,
+										&features->nFeatures, &features->dim, &extraction);
+
+	if (features->SIFTDescriptorsData == NULL)
+		return isUnreadable ? PROGRAM_STATE_UNREADABLE_IMAGE : PROGRAM_STATE_MEMORY_ERROR;
+
+	/*Wrap the descriptors block with views - one per descriptor*/
+	features->SIFTDescriptors = (SPPointView*)malloc(sizeof(*features->SIFTDescriptors) * features->nFeatures);
+	if (features->SIFTDescriptors == NULL)
+		return PROGRAM_STATE_MEMORY_ERROR;
+
+	if (database->pca != NULL)
+	{
+		/*The extracted descriptors become the full dimension ones, and are replaced by their projections*/
+		features->fullSIFTDescriptorsData = features->SIFTDescriptorsData;
+		features->fullDim = features->dim;
+		features->dim = database->pca->nComponents;
+		features->SIFTDescriptorsData = (double*)malloc(sizeof(*features->SIFTDescriptorsData) * features->nFeatures * features->dim);
+
+		if (features->SIFTDescriptorsData == NULL)
+			return PROGRAM_STATE_MEMORY_ERROR;
+
+		for(int i = 0; i < features->nFeatures; ++i)
+			spPcaProject(database->pca, features->fullSIFTDescriptorsData + i * features->fullDim,
+					features->SIFTDescriptorsData + i * features->dim);
+
+		/*The options the database keeps its full dimension descriptors for*/
+		if (database->options.isPcaRerank || database->options.isPcaReport)
+		{
+			features->fullSIFTDescriptors = (SPPointView*)malloc(sizeof(*features->fullSIFTDescriptors) * features->nFeatures);
+			if (features->fullSIFTDescriptors == NULL)
+				return PROGRAM_STATE_MEMORY_ERROR;
+
+			for(int i = 0; i < features->nFeatures; ++i)
+				features->fullSIFTDescriptors[i] = spPointViewCreate(features->fullSIFTDescriptorsData + i * features->fullDim,
+														features->fullDim, QUERY_IMAGE_INDEX);
+		}
+	}
+
+	for(int i = 0; i < features->nFeatures; ++i)
+		features->SIFTDescriptors[i] = spPointViewCreate(features->SIFTDescriptorsData + i * features->dim,
+											features->dim, QUERY_IMAGE_INDEX);
+
+	return PROGRAM_STATE_RUNNING;
+}
+
+void DestroyQueryFeatures(QueryFeatures* features)
+{
+	free(features->RGBHists);
+	free(features->SIFTDescriptors);
+	free(features->SIFTDescriptorsData);
+	free(features->fullSIFTDescriptors);
+	free(features->fullSIFTDescriptorsData);
+	free(features->binaryDescriptors);
+	memset(features, 0, sizeof(*features));
+}
+
+PROGRAM_STATE PrintQueryReports(const char* queryImagePath, const QueryFeatures* queryFeatures,
+		const ImageDatabase* database, const QueryStats* queryStats, const int* globalIndices, int nGlobalIndices,
+		const int* localIndices, int nLocalIndices)
+{
+	PROGRAM_STATE resProgramState = PROGRAM_STATE_RUNNING;
+
+	if (database->options.isStats)
+		PrintQueryMemoryStats(queryFeatures, database);
+
+	if (queryStats->isPartial)
+		printf(PARTIAL_RESULTS_FORMAT, queryStats->fractionDone * 100);
+
+	if (database->options.isEarlyExitReport)
+		printf(EARLY_EXIT_REPORT_FORMAT, queryStats->nSkippedFeatures, queryFeatures->nFeatures);
+
+	if (resProgramState == PROGRAM_STATE_RUNNING && database->options.isPcaReport && database->pca != NULL)
+		resProgramState = PrintPcaReport(queryFeatures, database, localIndices, nLocalIndices);
+
+	if (resProgramState == PROGRAM_STATE_RUNNING && database->options.isSketchReport && database->sketchIndex != NULL)
+		resProgramState = PrintSketchReport(queryFeatures, database, queryStats, localIndices, nLocalIndices);
+
+	if (resProgramState == PROGRAM_STATE_RUNNING && database->options.isShortlistReport)
+		resProgramState = PrintShortlistReport(queryFeatures, database, localIndices, nLocalIndices);
+
+	if (resProgramState == PROGRAM_STATE_RUNNING && database->referenceDatabase != NULL)
+		resProgramState = PrintResolutionReport(queryImagePath, database,
+								globalIndices, nGlobalIndices, localIndices, nLocalIndices);
+
+	return resProgramState;
+}
+
+
+PROGRAM_STATE GetClosestDatabaseImagesByRGBHists(const double* queryRGBHists, const ImageDatabase* database,
+		int* resIndices, int* numOfIndices)
+{
+	/*Scan the contiguous hist matrix for the closest images based on L2 distances, skipping deleted images*/
+	*numOfIndices = spHistMatrixFindClosestExcluding(database->RGBHistMatrix, queryRGBHists,
+						NUM_OF_CLOSEST_IMAGES_TO_PRINT, database->isDeleted, resIndices);
+
+	if (*numOfIndices < 0)
+		return PROGRAM_STATE_MEMORY_ERROR; /*Memory allocation error in spHistMatrixFindClosest()*/
+
+	return PROGRAM_STATE_RUNNING;
+}
+
+/*
+ * Whether the ranking of the images by votes can no longer change, if every one of the
+ * remaining query features may still add up to NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE votes to any image.
+ *
+ * Checks that every image of the current top NUM_OF_CLOSEST_IMAGES_TO_PRINT stays ahead of the
+ * next one, with the most votes the next one may still get - and that the last one of them stays
+ * ahead of the best image outside them, and so of all images outside them.
+ * Deleted images hold -1 votes and never get more, so taking them as able to only makes the check stricter.
+ */
+static bool IsVoteRankingDecided(const int64_t* votes, int nImages, int64_t maxRemainingVotes)
+{
+	/*The top images, and the one after them, by votes - ties in favour of the lower index*/
+	int top[NUM_OF_CLOSEST_IMAGES_TO_PRINT + 1];
+	int nTop = 0;
+
+	for(int i = 0; i < nImages; ++i)
+	{
+		if (nTop == NUM_OF_CLOSEST_IMAGES_TO_PRINT + 1 && votes[i] <= votes[top[nTop - 1]])
+			continue;
+		if (nTop == NUM_OF_CLOSEST_IMAGES_TO_PRINT + 1)
+			nTop--;
+
+		int pos = nTop++;
+		for(; pos > 0 && votes[top[pos - 1]] < votes[i]; --pos)
+			top[pos] = top[pos - 1];
+		top[pos] = i;
+	}
+
+	for(int j = 0; j + 1 < nTop; ++j)
+	{
+		int64_t lead = votes[top[j]] - votes[top[j + 1]];
+
+		/*The next image could catch up - and win the tie if its index is lower*/
+		if (lead < maxRemainingVotes || (lead == maxRemainingVotes && top[j + 1] < top[j]))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * The images the local search goes over - the candidate images if given, otherwise the remaining
+ * images if some were deleted (put in *remainingImages, which the caller frees), otherwise NULL for all images.
+ * Returns false if failed to allocate memory.
+ */
+static bool GetSearchedImages(const ImageDatabase* database, const int** candidateImages, int* nCandidateImages,
+		int** remainingImages)
+{
+	*remainingImages = NULL;
+	if (database->nDeleted == 0 || *candidateImages != NULL)
+		return true;
+
+	*remainingImages = (int*)malloc(sizeof(**remainingImages) * (database->nImages - database->nDeleted));
+	if (*remainingImages == NULL)
+		return false;
+
+	*nCandidateImages = 0;
+	for(int i = 0; i < database->nImages; ++i)
+		if (!database->isDeleted[i])
+			(*remainingImages)[(*nCandidateImages)++] = i;
+	*candidateImages = *remainingImages;
+	return true;
+}
+
+/*
+ * Ranks the images by the votes of the query features. Every feature votes for the images of the
+ * NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE database descriptors closest to it, which findClosest(i, closestImages)
+ * stores for the i-th feature, returning how many it stored - or -1 if failed to allocate memory.
+ * Deleted images get -1 votes, which keeps them out of the ranking.
+ * Stops at the deadline of stats, and once the ranking is decided if database->options.isEarlyExit is set.
+ */
+template <typename FindClosest>
+static PROGRAM_STATE GetClosestDatabaseImagesByFeatureVotes(const ImageDatabase* database, int nQueryFeatures,
+		FindClosest findClosest, int* resIndices, int* numOfIndices, QueryStats* stats)
+{
+	/*The result of the program's state after this procedure*/
+	PROGRAM_STATE resProgramState = PROGRAM_STATE_RUNNING;
+
+	/*** Counts how many times each image had a descriptor that's close to a descriptor of the query
+	  closeDescriptorsCnt[i] = the number of times the i-th image had close descriptors  */
+	int64_t* closeDescriptorsCnt = (int64_t*)calloc(sizeof(*closeDescriptorsCnt) , database->nImages);
+	if (closeDescriptorsCnt == NULL)
+		return PROGRAM_STATE_MEMORY_ERROR;
+
+	for(int i = 0; i < database->nImages && database->nDeleted > 0; ++i)
+		if (database->isDeleted[i])
+			closeDescriptorsCnt[i] = -1;
+
+	int nSearchedFeatures = 0; /*The number of query features whose votes were counted*/
+
+	for(int i=0; i < nQueryFeatures; ++i) /*Go over each feature of the query image*/
+	{
+		/*Out of time - rank by the features searched so far, which always include the first one*/
+		if (i > 0 && stats != NULL && stats->deadline > 0 && GetMonotonicTime() >= stats->deadline)
+		{
+			stats->isPartial = true;
+			break;
+		}
+
+		/*The list of the images with closest features to the i-th feature of the query*/
+		int closetImgIndices[NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE];
+		int nClosetImgIndices = findClosest(i, closetImgIndices);
 
-	/*Get the image prefix for the images. */
-	PrintMsg(ENTER_PREFIX_MSG);
-	if (scanf("%s", database->imgPrefix) <= 0) {
-	   return PROGRAM_STATE_MEMORY_ERROR;
-	};
+		if (nClosetImgIndices < 0)
+		{
+			resProgramState = PROGRAM_STATE_MEMORY_ERROR; /*Memory allocation error in the search*/
+			break;
+		}
 
-	/*Get the number of images*/
+		/*Go over the indices of the closet images and add them to the total count*/
+		for(int j=0; j < nClosetImgIndices; ++j)
+			closeDescriptorsCnt[closetImgIndices[j]]++;
 
-	PrintMsg(ENTER_NUM_OF_IMAGES_MSG);
-	if (scanf("%d", &database->nImages) <= 0) {
-            return PROGRAM_STATE_MEMORY_ERROR;
-        }
+		nSearchedFeatures++;
 
-	if (database->nImages < 1) { /*Validate the inputed number of images*/
-	    return PROGRAM_STATE_INVALID_N_IMAGES;
-        }
+		/*Stop once the remaining features can't change the ranking anymore*/
+		int nRemainingFeatures = nQueryFeatures - i - 1;
+		if (database->options.isEarlyExit && nRemainingFeatures > 0 &&
+			IsVoteRankingDecided(closeDescriptorsCnt, database->nImages,
+					(int64_t)nRemainingFeatures * NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE))
+		{
+			if (stats != NULL)
+				stats->nSkippedFeatures = nRemainingFeatures;
+			break;
+		}
+	}
 
-	/*Get the image suffix for the images.*/
-	PrintMsg(ENTER_SUFFIX_MSG);
-	if (scanf("%s", database->imgSuffix) <= 0) {
-            return PROGRAM_STATE_MEMORY_ERROR;
-        }
+	if (stats != NULL && nQueryFeatures > 0)
+		stats->fractionDone = (double)nSearchedFeatures / nQueryFeatures;
 
-	/*Get the number of bins*/
-	PrintMsg(ENTER_NUM_OF_BINS_MSG);
-	if (scanf("%d", &database->nBins) <= 0) {
-            return PROGRAM_STATE_MEMORY_ERROR;
-        }
+	if (resProgramState == PROGRAM_STATE_RUNNING)
+		resProgramState = GetClosestDatabaseImagesByVotes(closeDescriptorsCnt, database->nImages, resIndices, numOfIndices);
 
-	if (database->nBins < 1 || database->nBins > 255) /*Validate the inputed number of bins*/
-		return PROGRAM_STATE_INVALID_N_BINS;
+	free(closeDescriptorsCnt);
+	return resProgramState;
+}
 
-	/*Get the number of features to extract from each image*/
-	PrintMsg("Enter number of features:\n");
-	if (scanf("%d", &database->nFeaturesToExtract) <= 0) {
-            return PROGRAM_STATE_MEMORY_ERROR;
-        }
+/*
+ * The number of images that appear in both a and b, each as many times as it appears in both.
+ * a holds at most NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE images.
+ */
+static int CountCommonImages(const int* a, int nA, const int* b, int nB)
+{
+	bool isMatched[NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE] = {false};
+	int nCommon = 0;
 
-	if (database->nFeaturesToExtract < 1) /*Validate the inputed number of features*/
-		return PROGRAM_STATE_INVALID_N_FEATURES;
+	for(int j = 0; j < nB; ++j)
+		for(int i = 0; i < nA; ++i)
+			if (!isMatched[i] && a[i] == b[j])
+			{
+				isMatched[i] = true;
+				nCommon++;
+				break;
+			}
 
-	/*All data was inputed successfully. Keep running the main program*/
-	return PROGRAM_STATE_RUNNING;
+	return nCommon;
 }
 
-
-void DestroyImageDataBase(ImageDatabase* database)
+PROGRAM_STATE GetClosestDatabaseImagesBySIFTDescriptors(const SPPointView* querySIFTDescriptors, int nQueryFeatures,
+		const SPPointView* queryFullSIFTDescriptors, const ImageDatabase* database, const int* candidateImages, int nCandidateImages,
+		int* resIndices, int* numOfIndices, QueryStats* stats)
 {
-	free(database->imgDirectory);
-	free(database->imgPrefix);
-	free(database->imgSuffix);
-
-	/*Free RGB hists*/
-	if (database->nRGBHistsExtracted > 0 && database->RGBHists != NULL)
+	/*Deleted images are left out - by searching the remaining images as the candidates*/
+	int* remainingImages = NULL;
+	if (!GetSearchedImages(database, &candidateImages, &nCandidateImages, &remainingImages))
+		return PROGRAM_STATE_MEMORY_ERROR;
+
+	/*The descriptors that are searched - of all images, or only of the candidate images*/
+	SPPoint*** searchedDescriptors = database->SIFTDescriptors;
+	SPPoint*** searchedFullDescriptors = database->fullSIFTDescriptors;
+	int* searchedNFeatures = database->nFeatures;
+	int nSearchedImages = database->nImages;
+	bool isSearchingCandidates = candidateImages != NULL;
+	bool isReranking = queryFullSIFTDescriptors != NULL && database->fullSIFTDescriptors != NULL;
+
+	if (isSearchingCandidates)
 	{
-		for(int i=0; i < database->nRGBHistsExtracted; ++i)
-		{
-			if (database->RGBHists[i] != NULL)
+		searchedDescriptors = (SPPoint***)malloc(sizeof(*searchedDescriptors) * nCandidateImages);
+		searchedFullDescriptors = (SPPoint***)malloc(sizeof(*searchedFullDescriptors) * nCandidateImages);
+		searchedNFeatures = (int*)malloc(sizeof(*searchedNFeatures) * nCandidateImages);
+		nSearchedImages = nCandidateImages;
+
+		/*The candidates are in increasing index order, so ties are still broken by the lower image index*/
+		if (searchedDescriptors != NULL && searchedFullDescriptors != NULL && searchedNFeatures != NULL)
+			for(int i = 0; i < nCandidateImages; ++i)
 			{
-				for(int j=0; j<NUM_OF_CHANNELS; ++j)
-					if (database->RGBHists[i][j] != NULL)
-						spPointDestroy(database->RGBHists[i][j]);
-
-				free(database->RGBHists[i]);
+				searchedDescriptors[i] = database->SIFTDescriptors[candidateImages[i]];
+				searchedFullDescriptors[i] = isReranking ? database->fullSIFTDescriptors[candidateImages[i]] : NULL;
+				searchedNFeatures[i] = database->nFeatures[candidateImages[i]];
 			}
-		}
 	}
-	free(database->RGBHists);
 
-	/*Free SIFT descriptors*/
-	if (database->nSIFTDescriptorsExtracted > 0 &&
-		database->SIFTDescriptors != NULL &&
-		database->nFeatures != NULL)
-	{
-		for(int i=0; i < database->nSIFTDescriptorsExtracted; ++i)
-		{
-			if (database->SIFTDescriptors[i] != NULL)
+	PROGRAM_STATE resProgramState = PROGRAM_STATE_RUNNING;
+	if (searchedDescriptors == NULL || searchedNFeatures == NULL ||
+		(isSearchingCandidates && searchedFullDescriptors == NULL))
+		resProgramState = PROGRAM_STATE_MEMORY_ERROR;
+
+	if (resProgramState == PROGRAM_STATE_RUNNING)
+		resProgramState = GetClosestDatabaseImagesByFeatureVotes(database, nQueryFeatures, [&](int feature, int* closestImages) {
+			int nSketchImages = 0;
+			if (database->sketchIndex != NULL)
 			{
-				for(int j=0; j<database->nFeatures[i]; ++j)
-					if (database->SIFTDescriptors[i][j] != NULL)
-						spPointDestroy(database->SIFTDescriptors[i][j]);
+				nSketchImages = spSketchIndexFindClosest(database->sketchIndex, database->SIFTDescriptors,
+									&querySIFTDescriptors[feature], NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE,
+									database->options.sketchCandidates, candidateImages, nCandidateImages, closestImages);
+				if (nSketchImages < 0)
+					return -1;
+				if (stats == NULL || !stats->isSketchRecall)
+					return nSketchImages;
+			}
+
+			int* closetImgIndices = NULL;
+			int nClosetImgIndices = 0; /*Fewer than NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE if the searched images have fewer descriptors*/
+			if (isReranking)
+				closetImgIndices = spBestSIFTL2SquaredDistanceRerankView(
+										NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE,
+										NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE * PCA_RERANK_CANDIDATES_FACTOR,
+										&querySIFTDescriptors[feature],
+										&queryFullSIFTDescriptors[feature],
+										searchedDescriptors,
+										searchedFullDescriptors,
+										nSearchedImages,
+										searchedNFeatures,
+										&nClosetImgIndices);
+			else
+				closetImgIndices = spBestSIFTL2SquaredDistanceView(
+										NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE,
+										&querySIFTDescriptors[feature],
+										searchedDescriptors,
+										nSearchedImages,
+										searchedNFeatures,
+										&nClosetImgIndices);
+
+			if (closetImgIndices == NULL)
+				return -1; /*Memory allocation error in spBestSIFTL2SquaredDistance()*/
+
+			/*From a position among the candidates to an image index*/
+			int exhaustiveImages[NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE];
+			for(int j = 0; j < nClosetImgIndices; ++j)
+				exhaustiveImages[j] = isSearchingCandidates ? candidateImages[closetImgIndices[j]] : closetImgIndices[j];
+			free(closetImgIndices);
 
-				free(database->SIFTDescriptors[i]);
+			/*The exhaustive search only measures what the sketches found - their results are the votes*/
+			if (database->sketchIndex != NULL)
+			{
+				stats->nSketchNeighbours += nClosetImgIndices;
+				stats->nSketchNeighboursFound += CountCommonImages(closestImages, nSketchImages,
+														exhaustiveImages, nClosetImgIndices);
+				return nSketchImages;
 			}
-		}
-	}
-	free(database->nFeatures);
-	free(database->SIFTDescriptors);
 
+			memcpy(closestImages, exhaustiveImages, sizeof(*exhaustiveImages) * nClosetImgIndices);
+			return nClosetImgIndices;
+		}, resIndices, numOfIndices, stats);
 
-	free(database); /*Free the database struct itself*/
+	if (isSearchingCandidates)
+	{
+		free(searchedDescriptors);
+		free(searchedFullDescriptors);
+		free(searchedNFeatures);
+	}
+	free(remainingImages);
+
+	return resProgramState;
 }
 
+PROGRAM_STATE GetClosestDatabaseImagesByBinaryDescriptors(const uint64_t* queryBinaryDescriptors, int nQueryFeatures,
+		const ImageDatabase* database, const int* candidateImages, int nCandidateImages,
+		int* resIndices, int* numOfIndices, QueryStats* stats)
+{
+	/*Deleted images are left out - by searching the remaining images as the candidates*/
+	int* remainingImages = NULL;
+	if (!GetSearchedImages(database, &candidateImages, &nCandidateImages, &remainingImages))
+		return PROGRAM_STATE_MEMORY_ERROR;
 
-PROGRAM_STATE CalcImageDataBaseHistsAndDescriptors(ImageDatabase* database)
+	int nWords = spBinaryIndexGetNumOfWords(database->binaryIndex);
+
+	/*The index searches the candidates in place, and stores image indices*/
+	PROGRAM_STATE resProgramState = GetClosestDatabaseImagesByFeatureVotes(database, nQueryFeatures, [&](int feature, int* closestImages) {
+		return spBinaryIndexFindClosest(database->binaryIndex, queryBinaryDescriptors + (size_t)feature * nWords,
+					NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE, candidateImages, nCandidateImages, closestImages);
+	}, resIndices, numOfIndices, stats);
+
+	free(remainingImages);
+	return resProgramState;
+}
+
+PROGRAM_STATE GetClosestDatabaseImagesByVotes(const int64_t* votes, int nImages, int* resIndices, int* numOfIndices)
 {
-	/*Create an array of hists*/
-	database->RGBHists = (SPPoint***)malloc(sizeof(*database->RGBHists) * database->nImages);
-	database->SIFTDescriptors = (SPPoint***)malloc(sizeof(*database->SIFTDescriptors) * database->nImages);
-	database->nFeatures = (int*)malloc(sizeof(*database->nFeatures) * database->nImages);
+	/*The result of the program's state after this procedure*/
+	PROGRAM_STATE resProgramState = PROGRAM_STATE_RUNNING;
 
-	if (database->RGBHists == NULL ||
-		database->SIFTDescriptors == NULL ||
-		database->nFeatures == NULL)
-		return PROGRAM_STATE_MEMORY_ERROR; /*Failed to allocate memory*/
+	/*A priority queue to find the closet images to the query, based on total SIFT feature count*/
+	SPBPQueue* imagesPriorityQueue = spBPQueueCreate(NUM_OF_CLOSEST_IMAGES_TO_PRINT);
+	if (imagesPriorityQueue == NULL)
+		return PROGRAM_STATE_MEMORY_ERROR;
 
-	/*Go over each image and calculate the RGB hist and SIFT descriptors*/
-	for(int i=0; i < database->nImages; ++i)
+	/*Insert the closeness count of each image into the priority queue*/
+	for(int i=0; i < nImages; ++i)
 	{
-		/*Get the full path of the image*/
-		char* imgPath = GetImagePath(database->imgDirectory, database->imgPrefix, database->imgSuffix, i);
-		if (imgPath == NULL)
-			return PROGRAM_STATE_MEMORY_ERROR; /*Failed to allocate memory*/
+		if (votes[i] < 0)
+			continue; /*A deleted image*/
 
-		/*Calculate RGB hists*/
-		database->RGBHists[i] = spGetRGBHist(imgPath,i, database->nBins);
+		/*Since this is a low priority queue, the images will be enqueued with negative count value*/
+		/*This way, the images with the highest scores will actually have "lowest priority" in the queue*/
+		SP_BPQUEUE_MSG msg = spBPQueueEnqueue(imagesPriorityQueue, i, -(double)votes[i]);
 
-		/*Calculate SIFT descriptors*/
-		database->nFeatures[i] = 0; /*Initialise*/
-		database->SIFTDescriptors[i] = spGetSiftDescriptors(imgPath,i, database->nFeaturesToExtract, &(database->nFeatures[i]));
+		if (msg == SP_BPQUEUE_OUT_OF_MEMORY)
+		{
+			resProgramState = PROGRAM_STATE_MEMORY_ERROR; /*Memory allocation error in spBPQueueEnqueue()*/
+			break;
+		}
+	}
 
-		free(imgPath);
+	if (resProgramState == PROGRAM_STATE_RUNNING)
+	{
+		int* closetImgIndices = GetBPQueueIndices(imagesPriorityQueue, numOfIndices);
 
-		/*Update counters of the number of extracted RGB hists/sift features*/
-		if (database->RGBHists[i] != NULL)
-			database->nRGBHistsExtracted++;
-		if (database->SIFTDescriptors[i] != NULL)
-			database->nSIFTDescriptorsExtracted++;
+		if (closetImgIndices == NULL)
+			resProgramState = PROGRAM_STATE_MEMORY_ERROR; /*Memory allocation error in GetBPQueueIndices()*/
+		else
+			memcpy(resIndices, closetImgIndices, sizeof(*resIndices) * (*numOfIndices));
 
-		/*If reached this point in the program, then assume that nBins > 0, maxNFeatures > 0 and image path is valid*/
-		/*Therefore, if spGetRGBHist() or SIFTDescriptors() returns null, then it was a memory allocation error*/
-		if (database->RGBHists[i] == NULL || database->SIFTDescriptors[i] == NULL)
-			return PROGRAM_STATE_MEMORY_ERROR;
+		free(closetImgIndices);
 	}
 
-	/*All data was calculated successfully. Keep running the main program*/
-	return PROGRAM_STATE_RUNNING;
+	spBPQueueDestroy(imagesPriorityQueue);
+	return resProgramState;
 }
 
-
-PROGRAM_STATE CalcQueryImageClosestDatabaseResults(const ImageDatabase* database)
+PROGRAM_STATE GetClosestDatabaseImagesByStream(const QueryFeatures* queryFeatures, const ImageDatabase* database,
+		int* resIndices, int* numOfIndices)
 {
-	/*The result of the program's state after this procedure*/
-	PROGRAM_STATE resProgramState = PROGRAM_STATE_RUNNING;
+	int k = NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE;
+	int nQueryFeatures = queryFeatures->nFeatures;
 
-	SPPoint** queryRGBHists = NULL; /*Query image RGB hists*/
-	SPPoint** querySIFTDescriptors = NULL; /*Query image descriptors*/
+	/*The images of the closest descriptors of every query feature, and how many were found*/
+	int* closestImages = (int*)malloc(sizeof(*closestImages) * ((size_t)nQueryFeatures * k + 1));
+	int* nClosestImages = (int*)malloc(sizeof(*nClosestImages) * (nQueryFeatures + 1));
+	int64_t* closeDescriptorsCnt = (int64_t*)calloc(sizeof(*closeDescriptorsCnt), database->nImages);
 
-	bool hasQueryRGBHists = false; /*Set to true if the query's RGB hists were successfully retrieved*/
-	bool hasQuerySIFTDescriptors = false; /*Set to true if the query's SIFT descriptors were successfully retrieved*/
+	PROGRAM_STATE resProgramState = PROGRAM_STATE_RUNNING;
+	if (closestImages == NULL || nClosestImages == NULL || closeDescriptorsCnt == NULL)
+		resProgramState = PROGRAM_STATE_MEMORY_ERROR;
 
-	int* queryNFeatures = (int*)malloc(sizeof(*queryNFeatures)); /*Num of retrieved features from  query image*/
+	/*One pass over the file serves all features of the query - split over the shards, if there are*/
+	if (resProgramState == PROGRAM_STATE_RUNNING && database->shardPool != NULL)
+	{
+		int nRestarts = spShardPoolGetNumOfRestarts(database->shardPool);
 
-	/*Allocate memory for the image path for user input*/
-	char* queryImagePath = (char*)malloc(sizeof(*queryImagePath) * MAX_IMG_PATH_LEGTH);
+		if (!spShardPoolFindClosest(database->shardPool, queryFeatures->SIFTDescriptors, nQueryFeatures, k,
+				closestImages, nClosestImages))
+			resProgramState = PROGRAM_STATE_MEMORY_ERROR;
 
-	if (queryNFeatures == NULL ||
-		queryImagePath == NULL)
-		resProgramState = PROGRAM_STATE_MEMORY_ERROR; /*Failed to allocate memory*/
+		if (spShardPoolGetNumOfRestarts(database->shardPool) > nRestarts)
+			printf(SHARDS_RESTARTED_FORMAT, spShardPoolGetNumOfRestarts(database->shardPool) - nRestarts);
+	}
+	else if (resProgramState == PROGRAM_STATE_RUNNING &&
+		!spDescriptorFileFindClosest(database->descriptorFile, queryFeatures->SIFTDescriptors, nQueryFeatures, k,
+				database->options.streamBlockSize, closestImages, nClosestImages))
+		resProgramState = PROGRAM_STATE_MEMORY_ERROR;
 
-	if (resProgramState == PROGRAM_STATE_RUNNING) /*If should keep running or skip to end*/
+	if (resProgramState == PROGRAM_STATE_RUNNING)
 	{
-		/*Ask user to input terminating symbol "#" or the path to a query image*/
-		PrintMsg(ENTER_QUERY_OR_TERMINATE_MSG);
-		if (scanf("%s", queryImagePath) <= 0) {
-                    resProgramState = PROGRAM_STATE_MEMORY_ERROR;
-                }
+		for(int i = 0; i < nQueryFeatures; ++i)
+			for(int j = 0; j < nClosestImages[i]; ++j)
+				closeDescriptorsCnt[closestImages[(size_t)i * k + j]]++;
 
-		if (strcmp(queryImagePath, TERMINATING_SYMBOL) == 0) {
-			resProgramState = PROGRAM_STATE_EXIT; /*The user requested to terminate the program*/
-                }
+		resProgramState = GetClosestDatabaseImagesByVotes(closeDescriptorsCnt, database->nImages, resIndices, numOfIndices);
 	}
 
-	if (resProgramState == PROGRAM_STATE_RUNNING) /*If should keep running or skip to end*/
-	{
-		queryRGBHists = spGetRGBHist(queryImagePath, QUERY_IMAGE_INDEX, database->nBins);
-		querySIFTDescriptors = spGetSiftDescriptors(queryImagePath, QUERY_IMAGE_INDEX, database->nFeaturesToExtract, queryNFeatures);
+	free(closestImages);
+	free(nClosestImages);
+	free(closeDescriptorsCnt);
+	return resProgramState;
+}
 
-		hasQueryRGBHists = queryRGBHists != NULL;
-		hasQuerySIFTDescriptors = querySIFTDescriptors != NULL;
+/*The full dimension descriptors of the query, if its projected ones should be re-ranked with them*/
+static const SPPointView* GetRerankDescriptors(const QueryFeatures* queryFeatures, const ImageDatabase* database)
+{
+	return database->options.isPcaRerank ? queryFeatures->fullSIFTDescriptors : NULL;
+}
 
-		if (queryRGBHists == NULL ||
-			querySIFTDescriptors == NULL)
-			resProgramState = PROGRAM_STATE_MEMORY_ERROR;
-	}
+/*Compares ints in increasing order, for qsort*/
+static int CompareInts(const void* a, const void* b)
+{
+	int x = *(const int*)a;
+	int y = *(const int*)b;
+	return (x > y) - (x < y);
+}
 
-	if (resProgramState == PROGRAM_STATE_RUNNING) /*If should keep running or skip to end*/
-		/*Calculate and print the indices of closest images based on RGB hists*/
-		resProgramState = CalcClosestDatabaseImagesByRGBHists(queryRGBHists, database);
+PROGRAM_STATE GetRGBHistsShortlist(const double* queryRGBHists, const ImageDatabase* database,
+		int shortlistSize, int* shortlist, int* nShortlist)
+{
+	*nShortlist = spHistMatrixFindClosestExcluding(database->RGBHistMatrix, queryRGBHists, shortlistSize,
+						database->isDeleted, shortlist);
 
-	if (resProgramState == PROGRAM_STATE_RUNNING) /*If should keep running or skip to end*/
-		/*Calculate and print the indices of closest images based on SIFT descriptors*/
-		resProgramState = CalcClosestDatabaseImagesBySIFTDescriptors(querySIFTDescriptors, *queryNFeatures, database);
+	if (*nShortlist < 0)
+		return PROGRAM_STATE_MEMORY_ERROR; /*Memory allocation error in spHistMatrixFindClosest()*/
 
-	/*Free all memory associated with the query image*/
-	free(queryImagePath);
+	qsort(shortlist, *nShortlist, sizeof(*shortlist), CompareInts);
+	return PROGRAM_STATE_RUNNING;
+}
 
-	if (hasQueryRGBHists) /*If retrieved RGB hists, then destroy all points*/
-		for(int i =0; i < NUM_OF_CHANNELS; ++i)
-			spPointDestroy(queryRGBHists[i]);
-	free(queryRGBHists);
+PROGRAM_STATE GetClosestDatabaseImagesByBow(const QueryFeatures* queryFeatures, const ImageDatabase* database,
+		int* resIndices, int* numOfIndices)
+{
+	*numOfIndices = spBowIndexQuery(database->bowIndex, queryFeatures->SIFTDescriptors, queryFeatures->nFeatures,
+						NUM_OF_CLOSEST_IMAGES_TO_PRINT, resIndices);
 
-	if (hasQuerySIFTDescriptors) /*If retrieved SIFT features, then destroy all points*/
-		for(int i =0; i < *queryNFeatures; ++i)
-			spPointDestroy(querySIFTDescriptors[i]);
-	free(querySIFTDescriptors);
-	free(queryNFeatures);
+	if (*numOfIndices < 0)
+		return PROGRAM_STATE_MEMORY_ERROR; /*Memory allocation error in spBowIndexQuery()*/
 
-	return resProgramState;
+	return PROGRAM_STATE_RUNNING;
 }
 
+/*
+ * The votes of the query's local features - binary ones if the database has a binaryIndex,
+ * otherwise SIFT ones - among the candidate images (all of them if NULL).
+ */
+static PROGRAM_STATE GetClosestDatabaseImagesByLocalFeatures(const QueryFeatures* queryFeatures, const ImageDatabase* database,
+		const int* candidateImages, int nCandidateImages, int* resIndices, int* numOfIndices, QueryStats* stats)
+{
+	if (database->binaryIndex != NULL)
+		return GetClosestDatabaseImagesByBinaryDescriptors(queryFeatures->binaryDescriptors, queryFeatures->nFeatures,
+					database, candidateImages, nCandidateImages, resIndices, numOfIndices, stats);
+
+	return GetClosestDatabaseImagesBySIFTDescriptors(queryFeatures->SIFTDescriptors, queryFeatures->nFeatures,
+				GetRerankDescriptors(queryFeatures, database), database, candidateImages, nCandidateImages,
+				resIndices, numOfIndices, stats);
+}
 
-PROGRAM_STATE CalcClosestDatabaseImagesByRGBHists(SPPoint** queryRGBHists, const ImageDatabase* database)
+PROGRAM_STATE GetClosestDatabaseImagesByCascade(const QueryFeatures* queryFeatures, const ImageDatabase* database,
+		int* resIndices, int* numOfIndices, QueryStats* stats)
 {
-	/*The result of the program's state after this procedure*/
-	PROGRAM_STATE resProgramState = PROGRAM_STATE_RUNNING;
+	if (database->bowIndex != NULL)
+		return GetClosestDatabaseImagesByBow(queryFeatures, database, resIndices, numOfIndices);
 
-	/*Use a priority queue to collect the closest images based on L2 distacnes.
-	 * The queue doesn't need to be any larger than the number of images to print.*/
-	SPBPQueue* imagesPriorityQueue = spBPQueueCreate(NUM_OF_CLOSEST_IMAGES_TO_PRINT);
+	if (database->descriptorFile != NULL)
+		return GetClosestDatabaseImagesByStream(queryFeatures, database, resIndices, numOfIndices);
 
-	if (imagesPriorityQueue == NULL)
-		resProgramState = PROGRAM_STATE_MEMORY_ERROR;
+	int shortlistSize = database->options.shortlistSize;
 
-	if (resProgramState == PROGRAM_STATE_RUNNING)
-	{
-		for(int i=0; i < database->nImages; ++i)
-		{
-			/*Calculate L2 distance between image i and the query image*/
-			double distance = spRGBHistL2Distance(queryRGBHists, database->RGBHists[i]);
+	/*A shortlist that covers the whole database is just the exhaustive search*/
+	if (shortlistSize <= 0 || shortlistSize >= database->nImages)
+		return GetClosestDatabaseImagesByLocalFeatures(queryFeatures, database, NULL, 0, resIndices, numOfIndices, stats);
 
-			/*Enqueue the L2 distance with the compared image's index*/
-			SP_BPQUEUE_MSG msg = spBPQueueEnqueue(imagesPriorityQueue, i, distance);
+	int* shortlist = (int*)malloc(sizeof(*shortlist) * shortlistSize);
+	int nShortlist = 0;
 
-			if (msg == SP_BPQUEUE_OUT_OF_MEMORY)
-			{
-				resProgramState = PROGRAM_STATE_MEMORY_ERROR; /*Memory allocation error in spBPQueueEnqueue()*/
-				break;
-			}
-		}
+	if (shortlist == NULL)
+		return PROGRAM_STATE_MEMORY_ERROR;
 
-		if (resProgramState == PROGRAM_STATE_RUNNING)
-		{
-			PrintMsg(NEAREST_IMAGES_GLOBAL_DESC_MSG);
+	/*Stage one - the images closest to the query by RGB hists*/
+	PROGRAM_STATE resProgramState = GetRGBHistsShortlist(queryFeatures->RGBHists, database, shortlistSize, shortlist, &nShortlist);
 
-			int* nearestImgIndices = NULL;
-			int* numOfIndices = (int*)malloc(sizeof(*numOfIndices));
+	/*Stage two - SIFT votes, only among the descriptors of the shortlisted images*/
+	if (resProgramState == PROGRAM_STATE_RUNNING)
+		resProgramState = GetClosestDatabaseImagesByLocalFeatures(queryFeatures, database, shortlist, nShortlist,
+								resIndices, numOfIndices, stats);
 
-			if (numOfIndices == NULL)
-				resProgramState = PROGRAM_STATE_MEMORY_ERROR; /*Memory allocation error*/
+	free(shortlist);
+	return resProgramState;
+}
 
-			if (resProgramState == PROGRAM_STATE_RUNNING) /*Continue only if successfully allocated*/
-			{
-				/*Get the indices of the closest images to the query image*/
-				nearestImgIndices = GetBPQueueIndices(imagesPriorityQueue, numOfIndices);
+PROGRAM_STATE PrintPcaReport(const QueryFeatures* queryFeatures, const ImageDatabase* database,
+		const int* localIndices, int nLocalIndices)
+{
+	/*The same database, searched by its full dimension descriptors*/
+	ImageDatabase fullDimensionDatabase = *database;
+	fullDimensionDatabase.SIFTDescriptors = database->fullSIFTDescriptors;
+	fullDimensionDatabase.fullSIFTDescriptors = NULL;
+	fullDimensionDatabase.pca = NULL;
+	fullDimensionDatabase.sketchIndex = NULL; /*Its sketches are of the projected descriptors*/
 
-				/*Print out the indices*/
-				PrintIndices(nearestImgIndices, *numOfIndices);
-			}
+	int fullIndices[NUM_OF_CLOSEST_IMAGES_TO_PRINT];
+	int nFullIndices = 0;
 
-			free(numOfIndices);
-			free(nearestImgIndices);
-		}
-	}
+	PROGRAM_STATE resProgramState = GetClosestDatabaseImagesBySIFTDescriptors(queryFeatures->fullSIFTDescriptors,
+							queryFeatures->nFeatures, NULL, &fullDimensionDatabase, NULL, 0, fullIndices, &nFullIndices, NULL);
 
-	/*Destroy the priority queue to free memory*/
-	spBPQueueDestroy(imagesPriorityQueue);
+	if (resProgramState == PROGRAM_STATE_RUNNING)
+	{
+		int nSameRank = 0;
+		for(int i = 0; i < nFullIndices && i < nLocalIndices; ++i)
+			if (fullIndices[i] == localIndices[i])
+				nSameRank++;
 
-	return PROGRAM_STATE_RUNNING;
+		printf(PCA_REPORT_FORMAT, CountCommonIndices(localIndices, nLocalIndices, fullIndices, nFullIndices), nFullIndices,
+				nSameRank, nFullIndices);
+	}
+
+	return resProgramState;
 }
 
-PROGRAM_STATE CalcClosestDatabaseImagesBySIFTDescriptors(SPPoint** querySIFTDescriptors, int nQueryFeatures, const ImageDatabase* database)
+PROGRAM_STATE PrintSketchReport(const QueryFeatures* queryFeatures, const ImageDatabase* database,
+		const QueryStats* stats, const int* localIndices, int nLocalIndices)
 {
-	/*The result of the program's state after this procedure*/
-	PROGRAM_STATE resProgramState = PROGRAM_STATE_RUNNING;
+	/*The same database, searched without its sketches*/
+	ImageDatabase exhaustiveDatabase = *database;
+	exhaustiveDatabase.sketchIndex = NULL;
 
-	/*** Counts how many times each image had a descriptor that's close to a descriptor of the query
-	  closeDescriptorsCnt[i] = the number of times the i-th image had close descriptors  */
-	int* closeDescriptorsCnt = (int*)calloc(sizeof(*closeDescriptorsCnt) , database->nImages);
-
-	/*A priority queue to find the closet images to the query, based on total SIFT feature count*/
-	SPBPQueue* imagesPriorityQueue = spBPQueueCreate(NUM_OF_CLOSEST_IMAGES_TO_PRINT);
+	int exhaustiveIndices[NUM_OF_CLOSEST_IMAGES_TO_PRINT];
+	int nExhaustiveIndices = 0;
 
-	if (closeDescriptorsCnt == NULL || imagesPriorityQueue == NULL)
-		resProgramState = PROGRAM_STATE_MEMORY_ERROR;
+	PROGRAM_STATE resProgramState = GetClosestDatabaseImagesByCascade(queryFeatures, &exhaustiveDatabase,
+							exhaustiveIndices, &nExhaustiveIndices, NULL);
 
 	if (resProgramState == PROGRAM_STATE_RUNNING)
 	{
-		for(int i=0; i < nQueryFeatures; ++i) /*Go over each feature of the query image*/
-		{
-			/*The list of the images with closest features to the i-th feature of the query*/
-			int* closetImgIndices = NULL;
-			closetImgIndices = spBestSIFTL2SquaredDistance(
-									NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE,
-									querySIFTDescriptors[i],
-									database->SIFTDescriptors,
-									database->nImages,
-									database->nFeatures);
+		int nSameRank = 0;
+		for(int i = 0; i < nExhaustiveIndices && i < nLocalIndices; ++i)
+			if (exhaustiveIndices[i] == localIndices[i])
+				nSameRank++;
+
+		printf(SKETCH_REPORT_FORMAT, stats->nSketchNeighboursFound, stats->nSketchNeighbours,
+				CountCommonIndices(localIndices, nLocalIndices, exhaustiveIndices, nExhaustiveIndices), nExhaustiveIndices,
+				nSameRank, nExhaustiveIndices);
+	}
 
+	return resProgramState;
+}
 
-			if (closetImgIndices == NULL)
-			{
-				resProgramState = PROGRAM_STATE_MEMORY_ERROR; /*Memory allocation error in spBestSIFTL2SquaredDistance()*/
-				break;
-			}
+PROGRAM_STATE PrintShortlistReport(const QueryFeatures* queryFeatures, const ImageDatabase* database,
+		const int* localIndices, int nLocalIndices)
+{
+	int shortlistSize = database->options.shortlistSize;
+	if (shortlistSize <= 0 || shortlistSize > database->nImages)
+		shortlistSize = database->nImages; /*No shortlist is the same as shortlisting every image*/
 
-			/*Go over the indices of the closet images and add them to the total count*/
-			for(int j=0; j<NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE;  ++j)
-			{
-				int closetIndex = closetImgIndices[j];
-				closeDescriptorsCnt[closetIndex]++;
-			}
+	int* shortlist = (int*)malloc(sizeof(*shortlist) * shortlistSize);
+	int nShortlist = 0;
 
-			free(closetImgIndices); /*Free memory for the list of indices before next iteration*/
-		}
-	}
+	/*The results of the exhaustive search*/
+	int exhaustiveIndices[NUM_OF_CLOSEST_IMAGES_TO_PRINT];
+	int nExhaustiveIndices = 0;
 
+	if (shortlist == NULL)
+		return PROGRAM_STATE_MEMORY_ERROR;
 
-	if (resProgramState == PROGRAM_STATE_RUNNING)
-	{
-		/*Insert the closeness count of each image into the priority queue*/
-		for(int i=0; i < database->nImages; ++i)
-		{
-			/*Since this is a low priority queue, the images will be enqueued with negative count value*/
-			/*This way, the images with the highest scores will actually have "lowest priority" in the queue*/
-			SP_BPQUEUE_MSG msg = spBPQueueEnqueue(imagesPriorityQueue, i, -closeDescriptorsCnt[i]);
+	PROGRAM_STATE resProgramState = GetRGBHistsShortlist(queryFeatures->RGBHists, database, shortlistSize, shortlist, &nShortlist);
 
-			if (msg == SP_BPQUEUE_OUT_OF_MEMORY)
-			{
-				resProgramState = PROGRAM_STATE_MEMORY_ERROR; /*Memory allocation error in spBPQueueEnqueue()*/
-				break;
-			}
-		}
-	}
+	if (resProgramState == PROGRAM_STATE_RUNNING)
+		resProgramState = GetClosestDatabaseImagesByLocalFeatures(queryFeatures, database, NULL, 0,
+								exhaustiveIndices, &nExhaustiveIndices, NULL);
 
 	if (resProgramState == PROGRAM_STATE_RUNNING)
-	{
-		int* numOfIndices = (int*)malloc(sizeof(*numOfIndices));
-		int* closetImgIndices = GetBPQueueIndices(imagesPriorityQueue, numOfIndices);
+		printf(SHORTLIST_REPORT_FORMAT, nShortlist,
+				CountCommonIndices(exhaustiveIndices, nExhaustiveIndices, shortlist, nShortlist), nExhaustiveIndices,
+				CountCommonIndices(exhaustiveIndices, nExhaustiveIndices, localIndices, nLocalIndices), nExhaustiveIndices);
 
-		if (closetImgIndices == NULL)
-			resProgramState = PROGRAM_STATE_MEMORY_ERROR; /*Memory allocation error in GetBPQueueIndices()*/
+	free(shortlist);
+	return resProgramState;
+}
 
-		if (resProgramState == PROGRAM_STATE_RUNNING)
-		{
-			PrintMsg(NEAREST_IMAGES_LOCAL_DESC_MSG);
-			PrintIndices(closetImgIndices, *numOfIndices);
-		}
 
-		free(numOfIndices);
-		free(closetImgIndices);
-	}
 
-	free(closeDescriptorsCnt);
-	spBPQueueDestroy(imagesPriorityQueue);
 
+PROGRAM_STATE PrintResolutionReport(const char* queryImagePath, const ImageDatabase* database,
+		const int* globalIndices, int nGlobalIndices, const int* localIndices, int nLocalIndices)
+{
+	const ImageDatabase* reference = database->referenceDatabase;
+
+	QueryFeatures referenceFeatures; /*The query's features at full resolution*/
+	int referenceGlobalIndices[NUM_OF_CLOSEST_IMAGES_TO_PRINT];
+	int referenceLocalIndices[NUM_OF_CLOSEST_IMAGES_TO_PRINT];
+	int nReferenceGlobalIndices = 0;
+	int nReferenceLocalIndices = 0;
+
+	PROGRAM_STATE resProgramState = ExtractQueryFeatures(queryImagePath, reference, &referenceFeatures);
+
+	if (resProgramState == PROGRAM_STATE_RUNNING)
+		resProgramState = GetClosestDatabaseImagesByRGBHists(referenceFeatures.RGBHists, reference,
+								referenceGlobalIndices, &nReferenceGlobalIndices);
+
+	if (resProgramState == PROGRAM_STATE_RUNNING)
+		resProgramState = GetClosestDatabaseImagesByLocalFeatures(&referenceFeatures, reference, NULL, 0,
+								referenceLocalIndices, &nReferenceLocalIndices, NULL);
+
+	if (resProgramState == PROGRAM_STATE_RUNNING)
+		printf(RESOLUTION_REPORT_FORMAT,
+				CountCommonIndices(globalIndices, nGlobalIndices, referenceGlobalIndices, nReferenceGlobalIndices),
+				nReferenceGlobalIndices,
+				CountCommonIndices(localIndices, nLocalIndices, referenceLocalIndices, nReferenceLocalIndices),
+				nReferenceLocalIndices);
+
+	DestroyQueryFeatures(&referenceFeatures);
 	return resProgramState;
 }
 
+int CountCommonIndices(const int* a, int nA, const int* b, int nB)
+{
+	int nCommon = 0;
+
+	for(int i = 0; i < nA; ++i)
+		for(int j = 0; j < nB; ++j)
+			if (a[i] == b[j])
+			{
+				nCommon++;
+				break;
+			}
 
+	return nCommon;
+}
 
 
 char* GetImagePath(char* imgDirectory, char* imgPrefix, char* imgSuffix, int imgIndex)
@@ -409,34 +2262,6 @@ char* GetImagePath(char* imgDirectory, char* imgPrefix, char* imgSuffix, int img
 	return res;
 }
 
-void PrintExitMessage(PROGRAM_STATE exitProgramState)
-{
-	switch(exitProgramState)
-	{
-		case PROGRAM_STATE_MEMORY_ERROR:
-			PrintMsg(MEMORY_ERROR_MSG);
-			break;
-
-		case PROGRAM_STATE_INVALID_N_IMAGES:
-			PrintMsg(INVALID_NUM_OF_IMAGES_MSG);
-			break;
-
-		case PROGRAM_STATE_INVALID_N_BINS:
-			PrintMsg(INVALID_NUM_OF_BINS_MSG);
-			break;
-
-		case PROGRAM_STATE_INVALID_N_FEATURES:
-			PrintMsg(INVALID_NUM_OF_FEATURES);
-			break;
-
-		case PROGRAM_STATE_EXIT:
-			PrintMsg(EXIT_MSG);
-			break;
-
-		case PROGRAM_STATE_RUNNING:
-			break; /*Shouldn't happen. Handled to avoid compilation warnings*/
-	}
-}
 
 
 int* GetBPQueueIndices(SPBPQueue* source, int* numOfIndices)
@@ -486,3 +2311,134 @@ void PrintMsg(const char* msg)
 {
 	printf("%s", msg);
 }
+
+PROGRAM_STATE PrintImageDatabaseDuplicates(const ImageDatabase* database)
+{
+	int* clusterOf = (int*)malloc(sizeof(*clusterOf) * database->nImages);
+	int* members = (int*)malloc(sizeof(*members) * database->nImages);
+	int nClusters = clusterOf != NULL && members != NULL ?
+		spNearDuplicatesFindClusters(database->SIFTDescriptors, database->nFeatures, database->nImages,
+				database->options.duplicatesThreshold / 100.0, clusterOf) : -1;
+
+	if (nClusters < 0)
+	{
+		free(clusterOf);
+		free(members);
+		return PROGRAM_STATE_MEMORY_ERROR;
+	}
+
+	PrintMsg(DUPLICATES_MSG);
+	int nDuplicates = 0;
+	for(int cluster = 0; cluster < nClusters; ++cluster)
+	{
+		int nMembers = 0;
+		for(int i = 0; i < database->nImages; ++i)
+			if (clusterOf[i] == cluster)
+				members[nMembers++] = i;
+
+		PrintIndices(members, nMembers);
+		nDuplicates += nMembers;
+	}
+	printf(DUPLICATES_SUMMARY_FORMAT, nClusters, nDuplicates, database->nImages);
+
+	free(clusterOf);
+	free(members);
+	return PROGRAM_STATE_EXIT;
+}
+
+void PrintMemoryStats(const ImageDatabase* database)
+{
+	DatabaseMemoryUsage usage;
+	GetImageDatabaseMemoryUsage(database, &usage);
+
+	PrintMsg(MEMORY_STATS_MSG);
+	printf(MEMORY_STATS_FORMAT, "RGB hists", usage.RGBHists);
+	printf(MEMORY_STATS_ARENA_FORMAT, "SIFT descriptors", usage.SIFTDescriptorsUsed, usage.SIFTDescriptorsReserved);
+	if (database->fullPointArena != NULL)
+		printf(MEMORY_STATS_ARENA_FORMAT, "Full dimension SIFT descriptors",
+				usage.fullSIFTDescriptorsUsed, usage.fullSIFTDescriptorsReserved);
+	if (database->pca != NULL)
+		printf(MEMORY_STATS_FORMAT, "PCA", usage.pca);
+	if (database->bowIndex != NULL)
+		printf(MEMORY_STATS_FORMAT, "BoW index", usage.bowIndex);
+	if (database->binaryIndex != NULL)
+		printf(MEMORY_STATS_FORMAT, "Binary descriptors", usage.binaryIndex);
+	if (database->sketchIndex != NULL)
+		printf(MEMORY_STATS_FORMAT, "SIFT sketches", usage.sketchIndex);
+	if (database->descriptorFile != NULL)
+		printf(MEMORY_STATS_FORMAT, "Descriptor file", usage.descriptorFile);
+	if (database->referenceDatabase != NULL)
+		printf(MEMORY_STATS_FORMAT, "Reference database", usage.referenceDatabase);
+	if (database->sharedDatabase != NULL)
+	{
+		printf(MEMORY_STATS_SHARED_FORMAT, "Shared database", usage.sharedDatabase);
+
+		SPSharedDatabaseBudgets budgets = spSharedDatabaseGetBudgets(database->sharedDatabase);
+		if (budgets.memoryBudgetMB > 0 || budgets.descriptorBudget > 0 || budgets.descriptorCap > 0)
+			printf(MEMORY_STATS_SHARED_BUDGETS_FORMAT, budgets.memoryBudgetMB, budgets.descriptorBudget,
+					budgets.descriptorCap);
+	}
+	printf(MEMORY_STATS_FORMAT, "Other", usage.other);
+	printf(MEMORY_STATS_FORMAT, "Total", usage.total);
+
+	if (database->options.memoryBudgetMB > 0)
+		printf(MEMORY_STATS_BUDGET_FORMAT, (size_t)database->options.memoryBudgetMB << 20, database->nBudgetCappedImages);
+}
+
+void PrintQueryMemoryStats(const QueryFeatures* queryFeatures, const ImageDatabase* database)
+{
+	int nFeatures = queryFeatures->nFeatures;
+	int k = NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE;
+
+	size_t featuresSize = sizeof(*queryFeatures->RGBHists) * NUM_OF_CHANNELS * database->nBins +
+		(sizeof(*queryFeatures->SIFTDescriptorsData) * queryFeatures->dim + sizeof(*queryFeatures->SIFTDescriptors)) * nFeatures;
+	if (queryFeatures->fullSIFTDescriptorsData != NULL)
+		featuresSize += sizeof(*queryFeatures->fullSIFTDescriptorsData) * queryFeatures->fullDim * nFeatures;
+	if (queryFeatures->fullSIFTDescriptors != NULL)
+		featuresSize += sizeof(*queryFeatures->fullSIFTDescriptors) * nFeatures;
+	if (queryFeatures->binaryDescriptors != NULL)
+		featuresSize += sizeof(*queryFeatures->binaryDescriptors) * spBinaryIndexGetNumOfWords(database->binaryIndex) * nFeatures;
+
+	size_t votesSize = sizeof(int64_t) * database->nImages;
+	size_t searchSize = 0;
+
+	if (database->bowIndex != NULL)
+	{
+		votesSize = 0; /*Ranked by similarity instead*/
+		searchSize = spBowIndexGetQueryMemoryUsage(database->bowIndex, nFeatures, NUM_OF_CLOSEST_IMAGES_TO_PRINT);
+	}
+	else if (database->descriptorFile != NULL)
+	{
+		/*The closest images of all features at once, and the scan - which the shards run, if there are*/
+		searchSize = sizeof(int) * ((size_t)nFeatures * k + 1) + sizeof(int) * ((size_t)nFeatures + 1);
+		if (database->shardPool == NULL)
+			searchSize += spDescriptorFileGetScanMemoryUsage(database->descriptorFile, database->options.streamBlockSize) +
+				sizeof(double) * ((size_t)nFeatures * k + 1);
+	}
+	else if (database->binaryIndex != NULL)
+	{
+		/*The binary index searches the shortlisted images in place, keeping the closest on the stack*/
+		if (database->options.shortlistSize > 0 && database->options.shortlistSize < database->nImages)
+			searchSize += sizeof(int) * database->options.shortlistSize;
+	}
+	else
+	{
+		/*The features are searched one at a time, among the shortlisted images if there's a shortlist*/
+		int nSearchedImages = database->nImages;
+		if (database->options.shortlistSize > 0 && database->options.shortlistSize < database->nImages)
+		{
+			nSearchedImages = database->options.shortlistSize;
+			searchSize += sizeof(int) * nSearchedImages +
+				(2 * sizeof(SPPoint**) + sizeof(int)) * nSearchedImages;
+		}
+
+		bool isReranking = GetRerankDescriptors(queryFeatures, database) != NULL;
+		if (database->sketchIndex != NULL)
+			searchSize += spSketchIndexGetQueryMemoryUsage(database->sketchIndex, database->options.sketchCandidates);
+		else
+			searchSize += spBestSIFTL2SquaredDistanceGetMemoryUsage(k, isReranking ? k * PCA_RERANK_CANDIDATES_FACTOR : 0,
+							queryFeatures->dim, nSearchedImages);
+	}
+
+	printf(QUERY_MEMORY_STATS_FORMAT, featuresSize, votesSize, searchSize);
+}
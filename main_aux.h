@@ -3,14 +3,23 @@
 
 #include <cstring>
 #include "sp_image_proc_util.h"
+#include "sp_hist_matrix.h"
+#include "sp_bow_index.h"
+#include "sp_pca.h"
+#include "sp_descriptor_file.h"
+#include "sp_shard_pool.h"
+#include "sp_shared_database.h"
+#include "sp_near_duplicates.h"
+#include "sp_image_archive.h"
+#include "sp_binary_index.h"
+#include "sp_sketch_index.h"
+#include "sp_workload.h"
 
 extern "C"{
 	#include "SPBPriorityQueue.h"
 }
 
 
-extern const char* TERMINATING_SYMBOL;
-
 /*The assumed max length of an image path, as instructed*/
 #define MAX_IMG_PATH_LEGTH 1024
 
@@ -44,6 +53,10 @@ extern const char* TERMINATING_SYMBOL;
 #define INVALID_NUM_OF_IMAGES_MSG "An error occurred - invalid number of images\n"
 #define INVALID_NUM_OF_BINS_MSG "An error occurred - invalid number of bins\n"
 #define INVALID_NUM_OF_FEATURES "An error occurred - invalid number of features\n"
+#define INVALID_ARGUMENTS_MSG "An error occurred - invalid command line arguments\n"
+#define MEMORY_BUDGET_EXCEEDED_MSG "An error occurred - the database doesn't fit in the memory budget\n"
+#define UNREADABLE_IMAGE_MSG "An error occurred - an image cannot be loaded\n"
+#define IMAGE_NOT_DELETED_MSG "An error occurred - the image can't be deleted\n"
 #define EXIT_MSG "Exiting...\n"
 
 /** State machine flags for main(), to trace its state through different sub-methods **/
@@ -53,10 +66,153 @@ typedef enum ProgramStateTypes {
 	PROGRAM_STATE_INVALID_N_IMAGES, /*An invalid number of images was inputed*/
 	PROGRAM_STATE_INVALID_N_BINS, /*An invalid number of bins was inputed*/
 	PROGRAM_STATE_INVALID_N_FEATURES, /*An invalid number of features was inputed*/
+	PROGRAM_STATE_INVALID_ARGUMENTS, /*The command line arguments are invalid*/
+	PROGRAM_STATE_MEMORY_BUDGET_EXCEEDED, /*The database doesn't fit in the memory budget*/
+	PROGRAM_STATE_UNREADABLE_IMAGE, /*An image couldn't be read or decoded*/
 	PROGRAM_STATE_EXIT, /*Normal program exit*/
 } PROGRAM_STATE;
 
 
+/*Command line options*/
+#define OPTION_DECODE_SCALE "-decode-scale"
+#define OPTION_MAX_IMAGE_SIDE "-max-side"
+#define OPTION_RESOLUTION_REPORT "-resolution-report"
+#define OPTION_SHORTLIST "-shortlist"
+#define OPTION_SHORTLIST_REPORT "-shortlist-report"
+#define OPTION_BOW "-bow"
+#define OPTION_BOW_TREE "-bow-tree"
+#define OPTION_BOW_INDEX "-bow-index"
+
+#define OPTION_PCA "-pca"
+#define OPTION_PCA_WHITEN "-pca-whiten"
+#define OPTION_PCA_RERANK "-pca-rerank"
+#define OPTION_PCA_REPORT "-pca-report"
+#define OPTION_STREAM "-stream"
+#define OPTION_STREAM_BLOCK "-stream-block"
+#define OPTION_SHARDS "-shards"
+#define OPTION_EARLY_EXIT "-early-exit"
+#define OPTION_EARLY_EXIT_REPORT "-early-exit-report"
+#define OPTION_DEADLINE "-deadline"
+#define OPTION_STATS "-stats"
+#define OPTION_MEMORY_BUDGET "-memory-budget"
+#define OPTION_SHARED_PUBLISH "-shm-publish"
+#define OPTION_SHARED_ATTACH "-shm-attach"
+#define OPTION_DUPLICATES "-duplicates"
+#define OPTION_COMPACT_AFTER "-compact-after"
+#define OPTION_ARCHIVE "-archive"
+#define OPTION_DESCRIPTOR_BUDGET "-descriptor-budget"
+#define OPTION_DESCRIPTOR_CAP "-descriptor-cap"
+#define OPTION_DESCRIPTOR_RANK "-descriptor-rank"
+#define OPTION_DESCRIPTOR_REPORT "-descriptor-report"
+#define OPTION_FEATURES "-features"
+#define OPTION_SKETCH "-sketch"
+#define OPTION_SKETCH_CANDIDATES "-sketch-candidates"
+#define OPTION_SKETCH_REPORT "-sketch-report"
+#define OPTION_RECORD "-record"
+
+/*The values of OPTION_DESCRIPTOR_RANK*/
+#define DESCRIPTOR_RANK_RESPONSE "response"
+#define DESCRIPTOR_RANK_SCALE "scale"
+
+/*The values of OPTION_FEATURES*/
+#define FEATURES_SIFT "sift"
+#define FEATURES_ORB "orb"
+#define FEATURES_AKAZE "akaze"
+
+/*The default shape of the vocabulary tree - 10^4 words*/
+#define BOW_DEFAULT_BRANCH_FACTOR 10
+#define BOW_DEFAULT_DEPTH 4
+
+/*The maximal number of database descriptors the vocabulary tree is trained on*/
+#define BOW_MAX_TRAINING_DESCRIPTORS 200000
+
+/*The maximal number of database descriptors the PCA is trained on*/
+#define PCA_MAX_TRAINING_DESCRIPTORS 50000
+
+/*With re-ranking, this many times NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE candidates are found
+ * for each query feature by projected distances, and re-ranked by full dimension ones*/
+#define PCA_RERANK_CANDIDATES_FACTOR 4
+
+/*With sketches, the default number of database descriptors compared exactly to each query feature*/
+#define SKETCH_DEFAULT_CANDIDATES 100
+
+/*The 64 bit FNV-1a parameters the fingerprints of persisted databases are hashed with*/
+#define DATABASE_FINGERPRINT_OFFSET_BASIS 14695981039346656037ULL
+#define DATABASE_FINGERPRINT_PRIME 1099511628211ULL
+
+/*Report messages*/
+#define SHORTLIST_REPORT_FORMAT "Shortlist of %d images - holds %d/%d, cascade found %d/%d of the exhaustive local results\n"
+#define PCA_TRAINING_REPORT_FORMAT "PCA to %d of %d dimensions retains %.1f%% of the variance - descriptors take %.0f%% of the memory\n"
+#define SKETCH_REPORT_FORMAT "Sketch search - found %d/%d images of the closest descriptors, local rankings: %d/%d images in common, %d/%d at the same rank as exhaustive\n"
+#define PCA_REPORT_FORMAT "PCA rankings - local: %d/%d images in common, %d/%d at the same rank as full dimension\n"
+#define EARLY_EXIT_REPORT_FORMAT "Local search skipped %d/%d query features\n"
+#define PARTIAL_RESULTS_FORMAT "Partial results - the deadline passed after %.0f%% of the query features\n"
+#define MEMORY_BUDGET_REFUSED_FORMAT "Image %d doesn't fit in the memory budget of %d MB, even with a single descriptor\n"
+#define MEMORY_STATS_MSG "Memory usage in bytes:\n"
+#define MEMORY_STATS_FORMAT "  %s: %zu\n"
+#define MEMORY_STATS_SHARED_FORMAT "  %s: %zu, shared with other processes - not in the total\n"
+#define MEMORY_STATS_SHARED_BUDGETS_FORMAT "    Published within - memory budget: %d MB, descriptor budget: %d, descriptor cap: %d (0 for none)\n"
+#define MEMORY_STATS_ARENA_FORMAT "  %s: %zu used, %zu reserved\n"
+#define MEMORY_STATS_BUDGET_FORMAT "  Budget: %zu - capped the descriptors of %d image(s)\n"
+#define QUERY_MEMORY_STATS_FORMAT "Query memory in bytes - features: %zu, votes: %zu, search buffers: %zu\n"
+#define SHARED_DATABASE_PUBLISH_ERROR_FORMAT "Couldn't publish the database to the shared memory segment %s\n"
+#define SHARED_DATABASE_ATTACH_ERROR_FORMAT "Couldn't attach to the shared memory segment %s, or it holds other images\n"
+#define WORKLOAD_RECORD_ERROR_FORMAT "Couldn't create the workload file %s\n"
+#define IMAGE_ARCHIVE_ERROR_FORMAT "Couldn't open the image archive %s, or it holds fewer than %d images\n"
+#define DESCRIPTOR_REPORT_FORMAT "Image %d kept %d/%d descriptors\n"
+#define DESCRIPTOR_REPORT_CAPPED_FORMAT "Image %d kept %d/%d descriptors - capped at %d\n"
+#define DESCRIPTOR_REPORT_SUMMARY_FORMAT "The database kept %lld/%lld descriptors, %d image(s) capped\n"
+#define DESCRIPTOR_CAP_TOO_LOW_FORMAT "The descriptor cap of %d is lower than the number of images %d\n"
+#define IMAGE_DELETED_FORMAT "Deleted image %d\n"
+#define IMAGE_NOT_DELETED_FORMAT "Image %d can't be deleted - it isn't in the database, it would leave fewer than 2 images, or the search options don't support deletion\n"
+#define DATABASE_COMPACTED_FORMAT "Compacted the database - %d images remain\n"
+#define DUPLICATES_MSG "Near-duplicate images:\n"
+#define DUPLICATES_SUMMARY_FORMAT "%d cluster(s) of near-duplicates hold %d/%d images\n"
+#define SHARDS_RESTARTED_FORMAT "Restarted %d shard(s) that failed to answer\n"
+#define RESOLUTION_REPORT_FORMAT "Reduced resolution rankings - global: %d/%d, local: %d/%d images in common with full resolution\n"
+
+/*
+ * Optional settings of the program, given as command line arguments.
+ * The defaults (all zeroed) keep the original behaviour.
+ */
+typedef struct search_options {
+	SPExtractionConfig extraction; /*The resolution images are decoded and extracted at*/
+	bool isResolutionReport; /*Compare every query's rankings with the ones of a full resolution database*/
+	int shortlistSize; /*If > 0, SIFT search runs only over this many images closest by RGB hists*/
+	bool isShortlistReport; /*Measure every query's shortlist against the exhaustive SIFT search*/
+	bool isBowSearch; /*Rank images by local descriptors through a bag-of-visual-words index*/
+	int bowBranchFactor; /*The number of children of each node of the vocabulary tree*/
+	int bowDepth; /*The number of levels of the vocabulary tree*/
+	const char* bowIndexPath; /*If not NULL, the index is loaded from this file, or saved to it once trained*/
+	int pcaDimension; /*If > 0, SIFT descriptors are projected to this many dimensions*/
+	bool isPcaWhitening; /*Scale the projected coordinates to unit variance*/
+	bool isPcaRerank; /*Re-rank the closest projected descriptors by their full dimension distances*/
+	bool isPcaReport; /*Compare every query's local ranking with a full dimension search*/
+	const char* streamPath; /*If not NULL, SIFT descriptors are kept in this file instead of in memory*/
+	int64_t streamBlockSize; /*The size of the blocks the descriptor file is streamed in, in bytes*/
+	int nShards; /*If > 0, the descriptor file is searched by this many worker processes*/
+	bool isEarlyExit; /*Stop counting SIFT votes once the remaining features can't change the ranking*/
+	bool isEarlyExitReport; /*Report how many query features the local search skipped*/
+	int deadlineMs; /*If > 0, the time budget of every query in milliseconds*/
+	bool isStats; /*Print the memory usage of the database, and of every query*/
+	int memoryBudgetMB; /*If > 0, the memory the database may take at ingest, in megabytes*/
+	const char* sharedPublishName; /*If not NULL, the built database is published to this shared memory segment*/
+	const char* sharedAttachName; /*If not NULL, the database is attached to this shared memory segment instead of built*/
+	int duplicatesThreshold; /*If > 0, the similarity percentage from which images are reported as near-duplicates*/
+	int compactAfter; /*The number of deleted images from which the database is compacted*/
+	const char* archivePath; /*If not NULL, the images are read from this image archive instead of their files*/
+	int descriptorBudget; /*If > 0, the most descriptors every database image keeps*/
+	int descriptorCap; /*If > 0, the most descriptors all database images keep together*/
+	bool isDescriptorReport; /*Report how many descriptors every database image kept*/
+	SPFeatureEngine featureEngine; /*The local features of the images - SIFT, or binary descriptors*/
+	int sketchBits; /*If > 0, SIFT descriptors are prefiltered by sketches of this many bits*/
+	int sketchCandidates; /*The number of descriptors the sketches keep for every query feature*/
+	bool isSketchReport; /*Compare every query's local search with an exhaustive one*/
+	const char* recordPath; /*If not NULL, the queries are recorded to this workload file*/
+	int nArguments; /*The command line arguments the options were parsed from, without the program name*/
+	char** arguments;
+} SearchOptions;
+
 /*
  * Contains all the info the user inputed for the image database
  */
@@ -71,76 +227,589 @@ typedef struct image_database {
 	char* imgDirectory; /*The directory of the images*/
 	char* imgPrefix; /*The prefix of the images*/
 	char* imgSuffix; /*The suffix of the images*/
-	SPPoint*** RGBHists; /*The RGB histograms of the images*/
+	SPHistMatrix* RGBHistMatrix; /*The RGB histograms of the images, one contiguous row per image*/
 	SPPoint*** SIFTDescriptors; /*The SIFT descriptors of the images*/
 	int* nFeatures; /*The actual number of features that was extracted for each image*/
+	SPPointArena* pointArena; /*The arena all SIFT descriptors of the database are allocated from*/
+	SPBowIndex* bowIndex; /*The bag-of-visual-words index of the SIFT descriptors. NULL if not used*/
+	SPPca* pca; /*The projection of SIFTDescriptors to fewer dimensions. NULL if not used*/
+	SPPoint*** fullSIFTDescriptors; /*With a pca, the SIFT descriptors before projection, if kept for re-ranking or reports*/
+	SPPointArena* fullPointArena; /*The arena fullSIFTDescriptors are allocated from*/
+	SPDescriptorFile* descriptorFile; /*When streaming, the file that holds the SIFT descriptors (instead of SIFTDescriptors)*/
+	SPShardPool* shardPool; /*The worker processes that search descriptorFile. NULL if it's searched in process*/
+	SPSharedDatabase* sharedDatabase; /*The shared memory segment the hists and descriptors are read from. NULL if not attached*/
+	SPBinaryIndex* binaryIndex; /*With a binary feature engine, the descriptors of the images - instead of SIFTDescriptors*/
+	SPSketchIndex* sketchIndex; /*The sketches of SIFTDescriptors, that prefilter the local search. NULL if not used*/
+	int nBudgetCappedImages; /*The number of images that kept fewer descriptors to fit in the memory budget*/
+	int unreadableImage; /*After PROGRAM_STATE_UNREADABLE_IMAGE at ingest, the index of the image that couldn't be read*/
+
+	/*Deleted images are tombstoned, and removed from the storage above by a background compaction.
+	  Once compacted, nImages and every per-image array are of the remaining images only*/
+	bool* isDeleted; /*Whether the image at every position is deleted. NULL if none was since the last compaction*/
+	int nDeleted; /*The number of tombstoned images*/
+	int* imageIndices; /*The index of the image at every position. NULL while no image was compacted away*/
+	struct database_compaction* compaction; /*The compaction running in the background. NULL if none*/
+
+	SearchOptions options; /*The optional settings the database is built and searched with*/
+	struct image_database* referenceDatabase; /*A full resolution copy, used for reports. NULL if not needed*/
+	SPWorkloadRecorder* workloadRecorder; /*Records the queries asked of the database. NULL if not recording*/
 } ImageDatabase;
 
+/*
+ * The features of a query image.
+ * The features are kept in contiguous blocks and accessed through views, so nothing is copied
+ */
+typedef struct query_features {
+	double* RGBHists; /*The RGB hists, laid out like a row of ImageDatabase's RGBHistMatrix*/
+	double* SIFTDescriptorsData; /*The SIFT descriptors, one row after the other*/
+	SPPointView* SIFTDescriptors; /*A view of each row of SIFTDescriptorsData*/
+	int nFeatures; /*The number of SIFT descriptors*/
+	int dim; /*The dimension of each SIFT descriptor*/
+	double* fullSIFTDescriptorsData; /*If the database has a pca, the SIFT descriptors before projection*/
+	SPPointView* fullSIFTDescriptors; /*A view of each row of fullSIFTDescriptorsData*/
+	int fullDim; /*The dimension of each SIFT descriptor before projection*/
+	uint64_t* binaryDescriptors; /*With a binary feature engine, the descriptors packed like the database's - instead of SIFT ones*/
+} QueryFeatures;
+
 
 
+/*
+ * The time budget of the local search of a query, and what the search did, for reports
+ */
+typedef struct query_stats {
+	double deadline; /*If > 0, the GetMonotonicTime() by which the search should stop - input*/
+	int nSkippedFeatures; /*The number of query features whose votes weren't needed to decide the ranking*/
+	bool isPartial; /*Whether the deadline passed before all needed query features were searched*/
+	double fractionDone; /*The fraction of the query features that were searched*/
+	bool isSketchRecall; /*Whether to measure the recall of the sketches below - input*/
+	int nSketchNeighbours; /*The number of closest descriptors of the searched features, found exhaustively*/
+	int nSketchNeighboursFound; /*How many of them the sketches found*/
+} QueryStats;
+
+
+/*
+ * The memory an image database takes, by subsystem, in bytes.
+ * Arenas hand out memory from blocks they reserve ahead, so both are counted.
+ */
+typedef struct database_memory_usage {
+	size_t RGBHists; /*The hist matrix*/
+	size_t SIFTDescriptorsUsed; /*The (projected, with a pca) descriptors, their per-image arrays and counts*/
+	size_t SIFTDescriptorsReserved; /*Same, with the whole blocks of their arena*/
+	size_t fullSIFTDescriptorsUsed; /*With a pca, the descriptors before projection, if kept*/
+	size_t fullSIFTDescriptorsReserved; /*Same, with the whole blocks of their arena*/
+	size_t pca; /*The PCA*/
+	size_t bowIndex; /*The bag-of-visual-words index*/
+	size_t binaryIndex; /*The binary descriptors*/
+	size_t sketchIndex; /*The sketches of the SIFT descriptors*/
+	size_t descriptorFile; /*The resident part of the descriptor file*/
+	size_t referenceDatabase; /*The full resolution copy used for reports*/
+	size_t sharedDatabase; /*The attached shared memory segment - shared, so not in the total*/
+	size_t other; /*The database struct and its paths*/
+	size_t total; /*All of the above, with arenas counted by what they reserved*/
+} DatabaseMemoryUsage;
+
+
+/**
+ * The time in seconds since an arbitrary fixed point, unaffected by changes of the system clock
+ */
+double GetMonotonicTime();
+
 
 /**
- * Fill the database of images based on the user's input.
+ * Parses the optional command line arguments of the program into options.
+ * Options that aren't given keep their zeroed default.
  *
- * @param database - pointer to the database to fill.
+ * Supported options:
+ * - OPTION_DECODE_SCALE <1|2|4|8>: decode images at 1/scale of their size.
+ * - OPTION_MAX_IMAGE_SIDE <n>: scale images down so their longer side is at most n pixels.
+ * - OPTION_RESOLUTION_REPORT: also build a full resolution database, and report for every
+ *   query how its rankings differ from the reduced resolution ones.
+ * - OPTION_SHORTLIST <n>: cascade search - SIFT votes are counted only among the n images
+ *   closest to the query by RGB hists (n >= 2).
+ * - OPTION_SHORTLIST_REPORT: also run the exhaustive SIFT search on every query, and report
+ *   the shortlist's recall of its results.
+ * - OPTION_BOW: rank images by local descriptors with a bag-of-visual-words index (TF-IDF
+ *   similarity over a vocabulary tree) instead of voting with every descriptor.
+ * - OPTION_BOW_TREE <branch factor> <depth>: the shape of the vocabulary tree. Implies OPTION_BOW.
+ * - OPTION_BOW_INDEX <path>: load the index from path if it holds one for this database,
+ *   otherwise train it and save it there. Implies OPTION_BOW.
+ * - OPTION_PCA <n>: project SIFT descriptors to n dimensions (e.g. 32, 48 or 64) with a PCA
+ *   trained on the database's descriptors, at ingest and at query time.
+ * - OPTION_PCA_WHITEN: scale every projected coordinate to unit variance.
+ * - OPTION_PCA_RERANK: re-rank the closest projected descriptors of each query feature by
+ *   their full dimension distances. Keeps the full dimension descriptors.
+ * - OPTION_PCA_REPORT: report the PCA's retained variance, and for every query how its local
+ *   ranking differs from a full dimension search. Keeps the full dimension descriptors.
+ * - OPTION_STREAM <path>: out-of-core search - SIFT descriptors are written to the descriptor file
+ *   at path (or taken from it, if it already holds this database's descriptors, of image files
+ *   that weren't modified since) and streamed from it for every query, instead of being kept in
+ *   memory. Can't be combined with OPTION_BOW,
+ *   OPTION_PCA, OPTION_SHORTLIST or OPTION_SHORTLIST_REPORT.
+ * - OPTION_STREAM_BLOCK <MB>: the size of the blocks the descriptor file is streamed in.
+ * - OPTION_SHARDS <n>: search the descriptor file with n worker processes, each owning a contiguous
+ *   range of images. A shard that dies is restarted on the next query. Requires OPTION_STREAM.
+ * - OPTION_EARLY_EXIT: stop counting SIFT votes of a query once the remaining features can't change
+ *   its ranking. The results are exactly the same. Doesn't apply to OPTION_STREAM, which answers all
+ *   features in one pass, nor to OPTION_BOW.
+ * - OPTION_EARLY_EXIT_REPORT: report how many features of every query the local search skipped.
+ * - OPTION_STATS: print the memory usage of the database by subsystem once it's built, and the
+ *   memory of the buffers of every query.
+ * - OPTION_MEMORY_BUDGET <MB>: the memory the hists and descriptors of the database may take. While
+ *   the images are read, each one may keep an even share of what's left of the budget, and keeps
+ *   only its top ranked descriptors that fit (see OPTION_DESCRIPTOR_RANK). An image that can't keep a
+ *   single descriptor stops the program with PROGRAM_STATE_MEMORY_BUDGET_EXCEEDED. The descriptors'
+ *   arena reserves a single block of what the budget leaves, so only its headers come on top. Doesn't limit
+ *   what's built from the descriptors afterwards (OPTION_PCA, OPTION_BOW, OPTION_RESOLUTION_REPORT).
+ * - OPTION_SHARED_PUBLISH <name>: once the images are extracted, publish their hists and descriptors to
+ *   the POSIX shared memory segment name (e.g. /ex3db), replacing a segment of that name.
+ * - OPTION_SHARED_ATTACH <name>: instead of extracting the images, attach read-only to the segment
+ *   name, published for the same images with the same number of bins and features and the same
+ *   resolution options - within whatever budgets it was published, which OPTION_STATS shows. Its
+ *   hists and descriptors are searched where they are, one copy for all processes. Can't be
+ *   combined with OPTION_STREAM, OPTION_MEMORY_BUDGET, OPTION_DESCRIPTOR_BUDGET,
+ *   OPTION_DESCRIPTOR_CAP or OPTION_SHARED_PUBLISH.
+ * - OPTION_DESCRIPTOR_BUDGET <n>: every database image keeps at most its n top ranked SIFT descriptors,
+ *   whatever SIFT detects in it (which may be more than the number of features to extract).
+ * - OPTION_DESCRIPTOR_CAP <n>: all database images keep at most n SIFT descriptors together. While the
+ *   images are read, each one may keep an even share of what's left of the cap - at least one, so the
+ *   cap can't be lower than the number of images.
+ * - OPTION_DESCRIPTOR_RANK <response|scale>: how OPTION_DESCRIPTOR_BUDGET, OPTION_DESCRIPTOR_CAP and
+ *   OPTION_MEMORY_BUDGET rank the descriptors they keep - by the strongest keypoint response (the default),
+ *   or by the largest keypoint scale, ties by response.
+ * - OPTION_DESCRIPTOR_REPORT: report how many of its detected descriptors every database image kept, and
+ *   whether a budget capped it. Queries always keep all their descriptors.
+ * - OPTION_FEATURES <sift|orb|akaze>: the local features the images are searched by - SIFT descriptors
+ *   (the default), or ORB or AKAZE binary descriptors, packed as bit-vectors and compared by Hamming
+ *   distance, voting like SIFT ones. Binary descriptors are much cheaper to extract and search, and
+ *   less accurate. Binary ones can't be combined with OPTION_BOW, OPTION_PCA, OPTION_STREAM,
+ *   OPTION_SHARED_PUBLISH, OPTION_SHARED_ATTACH, OPTION_MEMORY_BUDGET or OPTION_DUPLICATES, and
+ *   deleted images stay tombstoned instead of being compacted away.
+ * - OPTION_SKETCH <64|128>: keep a sketch of this many bits of every SIFT descriptor (see sp_sketch_index.h),
+ *   and search every query feature by Hamming distance over the sketches first - only the candidates with the
+ *   closest sketches are compared exactly. Approximate: a close descriptor whose sketch isn't a candidate is missed.
+ *   Can't be combined with OPTION_BOW, OPTION_STREAM, OPTION_PCA_RERANK or binary OPTION_FEATURES.
+ * - OPTION_SKETCH_CANDIDATES <n>: the number of candidates of every query feature (at least
+ *   NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE). The default is SKETCH_DEFAULT_CANDIDATES. Implies OPTION_SKETCH 64
+ *   if it isn't given.
+ * - OPTION_SKETCH_REPORT: also search every query exhaustively, and report how many of the closest
+ *   descriptors of its features the sketches found, and how its local ranking differs. Requires OPTION_SKETCH.
+ * - OPTION_ARCHIVE <path>: read the images of the database from the image archive at path (built by
+ *   ex3-pack from the same directory, prefix and suffix), image index i from its i-th image - one
+ *   sequential read of a single file, instead of opening a file per image.
+ * - OPTION_RECORD <path>: record the workload - the database, the other options and every query and
+ *   deletion with the time it arrived at - to the workload file at path (see sp_workload.h), to be
+ *   replayed by ex3-load. A query that can't be recorded is still answered.
+ * - OPTION_COMPACT_AFTER <n>: compact the database in the background once n images are deleted
+ *   (see DeleteDatabaseImage). The default is 1.
+ * - OPTION_DUPLICATES <percent>: instead of answering queries, compare every pair of database images
+ *   and print the clusters of near-duplicates - images sharing at least percent of their SIFT
+ *   descriptors as matches (see sp_near_duplicates.h). Can't be combined with OPTION_STREAM.
+ * - OPTION_DEADLINE <ms>: the time budget of every query, from when its path is read. Query features
+ *   are searched from the strongest keypoint response down, and once the budget is spent the local
+ *   ranking of the features searched so far is printed, reported as partial. The strongest feature is
+ *   always searched, and the global ranking - a single pass over the histograms - is always complete.
+ *   Doesn't apply to OPTION_STREAM, which answers all features in one pass, nor to OPTION_BOW.
  *
- * @return:
- * - PROGRAM_STATE_MEMORY_ERROR: Failed to allocate memory at some point.
- * - PROGRAM_STATE_INVALID_N_IMAGES: If num of images < 1
- * - PROGRAM_STATE_INVALID_N_BINS: if num of bins < 1 or > 255
- * - PROGRAM_STATE_INVALID_N_FEATURES: if num of features to extract < 1
+ * @param argc - the number of arguments, including the program name
+ * @param argv - the arguments
+ * @param options - OUTPUT parameter. The parsed options.
+ * @return
+ * - PROGRAM_STATE_INVALID_ARGUMENTS: An unknown option, an option with an invalid value,
+ *   or options that can't be combined.
  * - PROGRAM_STATE_RUNNING: No errors. Continue running the program.
  */
-PROGRAM_STATE GetImageDatabaseFromUser(ImageDatabase* database);
+PROGRAM_STATE ParseCommandLineOptions(int argc, char** argv, SearchOptions* options);
 
 /**
- * Calculates the RGB hists and SIFT descriptors for the database.
+ * Calculates the RGB hists and SIFT descriptors for the database, projects the
+ * descriptors if database->options.pcaDimension is set, and builds its
+ * bag-of-visual-words index if database->options.isBowSearch is set.
  *
  * @param database - pointer to the database to fill.
  * @return
  * - PROGRAM_STATE_MEMORY_ERROR: Failed to allocate memory at some point.
+ * - PROGRAM_STATE_INVALID_ARGUMENTS: The PCA dimension isn't lower than the descriptors' dimension,
+ *   the image archive can't be opened or holds fewer images than the database, or the descriptor
+ *   cap is lower than the number of images.
+ * - PROGRAM_STATE_MEMORY_BUDGET_EXCEEDED: An image doesn't fit in database->options.memoryBudgetMB.
+ * - PROGRAM_STATE_UNREADABLE_IMAGE: An image couldn't be read or decoded. Its index is in database->unreadableImage.
  * - PROGRAM_STATE_RUNNING: No errors. Continue running the program.
  */
 PROGRAM_STATE CalcImageDataBaseHistsAndDescriptors(ImageDatabase* database);
 
 /**
- * Lets user input the relative URL of a query image.
- * Calculates the closest images in database to the query image, based
- * on RGB hists and SIFT descriptors.
+ * Prints the clusters of near-duplicate images of the database, by database->options.duplicatesThreshold,
+ * one cluster of image indices per line, followed by how many images they hold.
+ *
+ * @param database - the database, with its descriptors calculated.
+ * @return
+ * - PROGRAM_STATE_MEMORY_ERROR: Failed to allocate memory at some point.
+ * - PROGRAM_STATE_EXIT: No errors. The program is done.
+ */
+PROGRAM_STATE PrintImageDatabaseDuplicates(const ImageDatabase* database);
+
+/**
+ * Calculates the memory the database takes, by subsystem.
+ *
+ * @param database - the database.
+ * @param usage - OUTPUT parameter. Receives the memory usage.
+ */
+void GetImageDatabaseMemoryUsage(const ImageDatabase* database, DatabaseMemoryUsage* usage);
+
+/**
+ * Prints the memory usage of the database, by subsystem, and how the memory budget was applied.
+ *
+ * @param database - the database.
+ */
+void PrintMemoryStats(const ImageDatabase* database);
+
+/**
+ * Prints the memory of the buffers the search of a query takes: its features, the vote counts
+ * of all images, and the queues and result buffers of the local search.
+ *
+ * @param queryFeatures - the features of the query image.
+ * @param database - the database of images the query is compared with.
+ */
+void PrintQueryMemoryStats(const QueryFeatures* queryFeatures, const ImageDatabase* database);
+
+/**
+ * Prints the reports the database's options ask for about a query, after its results:
+ * its memory, whether it's partial, how many features it skipped, and how its local ranking
+ * compares with a full dimension, an exhaustive and a full resolution search.
+ *
+ * @param queryImagePath - the path of the query image.
+ * @param queryFeatures - the features of the query image.
+ * @param database - the database of images the query was compared with.
+ * @param queryStats - what the local search of the query did.
+ * @param globalIndices - the positions of the closest images by RGB hists
+ * @param nGlobalIndices - the number of positions in globalIndices
+ * @param localIndices - the positions of the closest images by local descriptors
+ * @param nLocalIndices - the number of positions in localIndices
+ * @return
+ * - PROGRAM_STATE_MEMORY_ERROR: Failed to allocate memory at some point.
+ * - PROGRAM_STATE_RUNNING: No errors. Continue running the program.
+ */
+PROGRAM_STATE PrintQueryReports(const char* queryImagePath, const QueryFeatures* queryFeatures,
+		const ImageDatabase* database, const QueryStats* queryStats, const int* globalIndices, int nGlobalIndices,
+		const int* localIndices, int nLocalIndices);
+
+/**
+ * Whether a background compaction of the database is done, and waits to be put in place
+ * by FinishDatabaseCompaction.
+ *
+ * @param database - the database of images.
+ */
+bool IsDatabaseCompactionDone(const ImageDatabase* database);
+
+/**
+ * Puts a background compaction of the database that's done in place of its storage, which
+ * changes the positions of its images. Doesn't wait for a compaction that isn't done.
+ * No query may be searching the database meanwhile.
+ *
+ * @param database - the database of images.
+ */
+void FinishDatabaseCompaction(ImageDatabase* database);
+
+/**
+ * Gets the indices of the images at the given positions of the database - the same, unless
+ * images were compacted away.
  *
  * @param database - the database of images.
+ * @param positions - the positions
+ * @param nPositions - the number of positions
+ * @param resIndices - OUTPUT parameter. An array of at least nPositions indices.
+ */
+void GetDatabaseImageIndices(const ImageDatabase* database, const int* positions, int nPositions, int* resIndices);
+
+/**
+ * Deletes an image from the database. The image is tombstoned, so every following query
+ * skips it - by RGB hists and by SIFT descriptors, with the same results as if it wasn't in
+ * the database. Once database->options.compactAfter images are tombstoned, a background thread
+ * rewrites the hists and descriptors without them while queries keep going, and the rewrite is
+ * put in place by FinishDatabaseCompaction. Images keep their index through the compaction.
+ *
+ * Deletion isn't supported with OPTION_BOW, OPTION_STREAM or OPTION_RESOLUTION_REPORT, whose
+ * index, file and full resolution copy hold the deleted images.
+ *
+ * @param database - the database of images.
+ * @param imageIndex - the index of the image, as it was input.
+ * @return
+ * - PROGRAM_STATE_INVALID_ARGUMENTS: The image isn't in the database, it would leave fewer than 2 images in it,
+ *   or the database's options don't support deletion.
+ * - PROGRAM_STATE_MEMORY_ERROR: Failed to allocate memory at some point.
+ * - PROGRAM_STATE_RUNNING: The image was deleted.
+ */
+PROGRAM_STATE DeleteDatabaseImage(ImageDatabase* database, int imageIndex);
+
+/**
+ * Extracts the RGB hists and SIFT descriptors of a query image, with the settings
+ * the database was built with. If the database has a pca, the descriptors are projected
+ * with it, and the full dimension ones are kept too if the database keeps them.
+ *
+ * @param queryImagePath - the path of the query image.
+ * @param database - the database the query will be compared with.
+ * @param features - OUTPUT parameter. The features of the query. Should be destroyed
+ * 					 with DestroyQueryFeatures, even if the extraction failed.
+ * @return
+ * - PROGRAM_STATE_MEMORY_ERROR: Failed to allocate memory at some point.
+ * - PROGRAM_STATE_UNREADABLE_IMAGE: The query image couldn't be read or decoded.
+ * - PROGRAM_STATE_RUNNING: No errors. Continue running the program.
+ */
+PROGRAM_STATE ExtractQueryFeatures(const char* queryImagePath, const ImageDatabase* database, QueryFeatures* features);
+
+/**
+ * Extracts only the RGB hists of a query image, with the settings the database was built with -
+ * the first part of ExtractQueryFeatures. It only writes features->RGBHists, so it may run
+ * alongside ExtractQueryLocalFeatures of the same query.
+ *
+ * @param queryImagePath - the path of the query image.
+ * @param database - the database the query will be compared with.
+ * @param features - OUTPUT parameter. The features of the query, zeroed before either part runs.
  * @return
- * - PROGRAM_STATE_EXIT: User inputed an exit symbol "#" to terminate the program.
  * - PROGRAM_STATE_MEMORY_ERROR: Failed to allocate memory at some point.
- * - PROGRAM_STATE_RUNNING: Closest images were successfully calculated and printed.
- * 							Keep running program for another user input.
+ * - PROGRAM_STATE_UNREADABLE_IMAGE: The query image couldn't be read or decoded.
+ * - PROGRAM_STATE_RUNNING: No errors. Continue running the program.
+ */
+PROGRAM_STATE ExtractQueryRGBHists(const char* queryImagePath, const ImageDatabase* database, QueryFeatures* features);
+
+/**
+ * Extracts only the local descriptors of a query image - the second part of ExtractQueryFeatures.
+ * It writes every field of features but RGBHists. It only reads the settings of the database, its
+ * PCA and its binary index, which a compaction never replaces - so it may run alongside one.
+ *
+ * @return the same as ExtractQueryRGBHists
  */
-PROGRAM_STATE CalcQueryImageClosestDatabaseResults(const ImageDatabase* database);
+PROGRAM_STATE ExtractQueryLocalFeatures(const char* queryImagePath, const ImageDatabase* database, QueryFeatures* features);
+
+/**
+ * Free all memory associated with the features of a query image.
+ *
+ * @param features - the features to free.
+ */
+void DestroyQueryFeatures(QueryFeatures* features);
 
 /***
- * Calculates and prints the closest NUM_OF_CLOSEST_IMAGES_TO_PRINT images to the query image
+ * Calculates the closest NUM_OF_CLOSEST_IMAGES_TO_PRINT images to the query image
  * based on L2 distances of RGB hists.
  *
- * @param queryRGBHists - the RGB hists of the query image.
+ * @param queryRGBHists - the RGB hists of the query image, laid out like a row of database->RGBHistMatrix.
  * @param database - the database of images with which the query image will be compared.
- *
+ * @param resIndices - OUTPUT parameter. Has room for NUM_OF_CLOSEST_IMAGES_TO_PRINT indices, and receives
+ * 					   the indices of the closest images, from the closest to the farthest.
+ * @param numOfIndices - OUTPUT parameter. The number of indices in resIndices.
  */
-PROGRAM_STATE CalcClosestDatabaseImagesByRGBHists(SPPoint** queryRGBHists, const ImageDatabase* database);
-
+PROGRAM_STATE GetClosestDatabaseImagesByRGBHists(const double* queryRGBHists, const ImageDatabase* database,
+		int* resIndices, int* numOfIndices);
 
 /***
- * Calculates and prints the closest NUM_OF_CLOSEST_IMAGES_TO_PRINT images to the query image
+ * Calculates the closest NUM_OF_CLOSEST_IMAGES_TO_PRINT images to the query image
  * based on L2 distances of SIFT descriptors.
  *
  * The closest images will be the ones which have the highest total number of closest
  * SIFT descriptors
  *
- * @param querySIFTDescriptors - all the SIFT descriptors of the query.
+ * @param querySIFTDescriptors - views of all the SIFT descriptors of the query.
  * @param nQueryFeatures - the number of SIFT descriptors the query has
+ * @param queryFullSIFTDescriptors - if not NULL, and the database keeps fullSIFTDescriptors, the closest
+ * 									 descriptors of each query feature are re-ranked by their distances
+ * 									 to these (the query's descriptors before projection).
+ * @param database - the database of images with which the query image will be compared.
+ * @param candidateImages - if not NULL, only the descriptors of these images are searched.
+ * 							Must be in increasing order and hold at least 2 images, none deleted.
+ * 							If NULL, all images but the deleted ones are searched.
+ * @param nCandidateImages - the number of images in candidateImages
+ * @param resIndices - OUTPUT parameter. Has room for NUM_OF_CLOSEST_IMAGES_TO_PRINT indices, and receives
+ * 					   the indices of the closest images, from the closest to the farthest.
+ * @param numOfIndices - OUTPUT parameter. The number of indices in resIndices.
+ * @param stats - If not NULL, its deadline bounds the search, and it receives what the search did.
+ * 				  Should be zeroed by the caller, but for the deadline.
+ *
+ * Once stats->deadline passed, the remaining query features are skipped and the ranking of the ones
+ * searched so far is returned. If database->options.isEarlyExit is set, the votes of the remaining query features are skipped once
+ * they can no longer change the ranking - they can add at most NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE
+ * votes each - so the results are the same as if all were counted.
+ *
+ * If the database has a sketchIndex, the closest descriptors of each query feature are found among
+ * the candidates of its sketches. If stats->isSketchRecall is set, every searched feature is also
+ * searched exhaustively, and stats receives how many of its closest descriptors the sketches found.
+ */
+PROGRAM_STATE GetClosestDatabaseImagesBySIFTDescriptors(const SPPointView* querySIFTDescriptors, int nQueryFeatures,
+		const SPPointView* queryFullSIFTDescriptors, const ImageDatabase* database, const int* candidateImages, int nCandidateImages,
+		int* resIndices, int* numOfIndices, QueryStats* stats);
+
+/***
+ * Calculates the closest NUM_OF_CLOSEST_IMAGES_TO_PRINT images to the query image by Hamming
+ * distances of binary descriptors, if the database has a binaryIndex - voting exactly like
+ * GetClosestDatabaseImagesBySIFTDescriptors does, with the same deadline and early exit.
+ *
+ * @param queryBinaryDescriptors - the binary descriptors of the query, packed by spBinaryIndexPack.
+ * @param nQueryFeatures - the number of binary descriptors the query has
+ * @param database - the database of images, which has a binaryIndex.
+ * @param candidateImages - if not NULL, only the descriptors of these images are searched.
+ * 							Must be in increasing order, none deleted.
+ * 							If NULL, all images but the deleted ones are searched.
+ * @param nCandidateImages - the number of images in candidateImages
+ * @param resIndices - OUTPUT parameter. Has room for NUM_OF_CLOSEST_IMAGES_TO_PRINT indices, and receives
+ * 					   the indices of the closest images, from the closest to the farthest.
+ * @param numOfIndices - OUTPUT parameter. The number of indices in resIndices.
+ * @param stats - If not NULL, its deadline bounds the search, and it receives what the search did.
+ * 				  Should be zeroed by the caller, but for the deadline.
+ */
+PROGRAM_STATE GetClosestDatabaseImagesByBinaryDescriptors(const uint64_t* queryBinaryDescriptors, int nQueryFeatures,
+		const ImageDatabase* database, const int* candidateImages, int nCandidateImages,
+		int* resIndices, int* numOfIndices, QueryStats* stats);
+
+/***
+ * Calculates the closest NUM_OF_CLOSEST_IMAGES_TO_PRINT images by their votes - the images with
+ * the most votes first, ties broken in favour of the lower image index.
+ *
+ * @param votes - the number of votes of each image. Images with negative votes (deleted images) are left out.
+ * @param nImages - the number of images
+ * @param resIndices - OUTPUT parameter. Has room for NUM_OF_CLOSEST_IMAGES_TO_PRINT indices, and receives
+ * 					   the indices of the images with the most votes, in decreasing order of votes.
+ * @param numOfIndices - OUTPUT parameter. The number of indices in resIndices.
+ */
+PROGRAM_STATE GetClosestDatabaseImagesByVotes(const int64_t* votes, int nImages, int* resIndices, int* numOfIndices);
+
+/***
+ * Calculates the closest NUM_OF_CLOSEST_IMAGES_TO_PRINT images to the query image by SIFT
+ * descriptors, exactly as GetClosestDatabaseImagesBySIFTDescriptors would, by streaming the
+ * database's descriptorFile once for all features of the query - in process, or scattered
+ * over the database's shardPool.
+ *
+ * @param queryFeatures - the features of the query image.
+ * @param database - the database of images, which has a descriptorFile.
+ * @param resIndices - OUTPUT parameter. Has room for NUM_OF_CLOSEST_IMAGES_TO_PRINT indices, and receives
+ * 					   the indices of the closest images, from the closest to the farthest.
+ * @param numOfIndices - OUTPUT parameter. The number of indices in resIndices.
+ * @return
+ * - PROGRAM_STATE_MEMORY_ERROR: Failed to allocate memory or to read the descriptor file.
+ * - PROGRAM_STATE_RUNNING: No errors. Continue running the program.
+ */
+PROGRAM_STATE GetClosestDatabaseImagesByStream(const QueryFeatures* queryFeatures, const ImageDatabase* database,
+		int* resIndices, int* numOfIndices);
+
+/***
+ * Calculates the shortlist of a cascade search - the shortlistSize images closest to
+ * the query image by RGB hists.
+ *
+ * @param queryRGBHists - the RGB hists of the query image, laid out like a row of database->RGBHistMatrix.
+ * @param database - the database of images with which the query image will be compared.
+ * @param shortlistSize - the maximal number of images in the shortlist
+ * @param shortlist - OUTPUT parameter. Has room for shortlistSize indices, and receives the
+ * 					  indices of the shortlisted images, in increasing order.
+ * @param nShortlist - OUTPUT parameter. The number of indices in shortlist.
+ */
+PROGRAM_STATE GetRGBHistsShortlist(const double* queryRGBHists, const ImageDatabase* database,
+		int shortlistSize, int* shortlist, int* nShortlist);
+
+/***
+ * Calculates the closest NUM_OF_CLOSEST_IMAGES_TO_PRINT images to the query image by
+ * its bag-of-visual-words similarity, if the database has a bowIndex.
+ *
+ * @param queryFeatures - the features of the query image.
+ * @param database - the database of images with which the query image will be compared.
+ * @param resIndices - OUTPUT parameter. Has room for NUM_OF_CLOSEST_IMAGES_TO_PRINT indices, and receives
+ * 					   the indices of the closest images, from the most similar to the least.
+ * @param numOfIndices - OUTPUT parameter. The number of indices in resIndices.
+ */
+PROGRAM_STATE GetClosestDatabaseImagesByBow(const QueryFeatures* queryFeatures, const ImageDatabase* database,
+		int* resIndices, int* numOfIndices);
+
+/***
+ * Calculates the closest NUM_OF_CLOSEST_IMAGES_TO_PRINT images to the query image by
+ * SIFT descriptors. If the database has a bowIndex, by GetClosestDatabaseImagesByBow.
+ * If it has a descriptorFile, by GetClosestDatabaseImagesByStream. Otherwise, as a cascade if database->options.shortlistSize is set:
+ * first a shortlist by RGB hists (GetRGBHistsShortlist), then SIFT votes only among
+ * the descriptors of the shortlisted images. Otherwise, the search is exhaustive.
+ * With a binaryIndex, the votes are by its binary descriptors (GetClosestDatabaseImagesByBinaryDescriptors).
+ *
+ * @param queryFeatures - the features of the query image.
  * @param database - the database of images with which the query image will be compared.
+ * @param resIndices - OUTPUT parameter. Has room for NUM_OF_CLOSEST_IMAGES_TO_PRINT indices, and receives
+ * 					   the indices of the closest images, from the closest to the farthest.
+ * @param numOfIndices - OUTPUT parameter. The number of indices in resIndices.
+ * @param stats - If not NULL, its deadline bounds the search, and it receives what the search did.
+ * 				  Should be zeroed by the caller, but for the deadline.
+ */
+PROGRAM_STATE GetClosestDatabaseImagesByCascade(const QueryFeatures* queryFeatures, const ImageDatabase* database,
+		int* resIndices, int* numOfIndices, QueryStats* stats);
+
+/**
+ * Prints how the rankings of a query differ between the database, which was built at a
+ * reduced resolution, and its full resolution reference database.
+ * The query is extracted again at full resolution and searched in the reference database.
+ *
+ * @param queryImagePath - the path of the query image.
+ * @param database - the database, which has a referenceDatabase.
+ * @param globalIndices - the closest images to the query by RGB hists in database
+ * @param nGlobalIndices - the number of indices in globalIndices
+ * @param localIndices - the closest images to the query by SIFT descriptors in database
+ * @param nLocalIndices - the number of indices in localIndices
+ * @return
+ * - PROGRAM_STATE_MEMORY_ERROR: Failed to allocate memory at some point.
+ * - PROGRAM_STATE_RUNNING: No errors. Continue running the program.
+ */
+PROGRAM_STATE PrintResolutionReport(const char* queryImagePath, const ImageDatabase* database,
+		const int* globalIndices, int nGlobalIndices, const int* localIndices, int nLocalIndices);
+
+/**
+ * Prints how the local ranking of a query differs between the projected descriptors
+ * and an exhaustive search with the full dimension ones.
+ *
+ * @param queryFeatures - the features of the query image, with fullSIFTDescriptors.
+ * @param database - the database, which keeps fullSIFTDescriptors.
+ * @param localIndices - the closest images to the query by the projected SIFT descriptors
+ * @param nLocalIndices - the number of indices in localIndices
+ * @return
+ * - PROGRAM_STATE_MEMORY_ERROR: Failed to allocate memory at some point.
+ * - PROGRAM_STATE_RUNNING: No errors. Continue running the program.
+ */
+PROGRAM_STATE PrintPcaReport(const QueryFeatures* queryFeatures, const ImageDatabase* database,
+		const int* localIndices, int nLocalIndices);
+
+/**
+ * Prints how the local search of a query with the database's sketches differs from an exhaustive
+ * one: how many of the images of the closest descriptors of its features the sketches found, and
+ * how its local ranking differs.
+ *
+ * @param queryFeatures - the features of the query image.
+ * @param database - the database, which has a sketchIndex.
+ * @param stats - what the local search of the query did, with the recall of the sketches measured.
+ * @param localIndices - the closest images to the query found with the sketches
+ * @param nLocalIndices - the number of indices in localIndices
+ * @return
+ * - PROGRAM_STATE_MEMORY_ERROR: Failed to allocate memory at some point.
+ * - PROGRAM_STATE_RUNNING: No errors. Continue running the program.
  */
-PROGRAM_STATE CalcClosestDatabaseImagesBySIFTDescriptors(SPPoint** querySIFTDescriptors, int nQueryFeatures, const ImageDatabase* database);
+PROGRAM_STATE PrintSketchReport(const QueryFeatures* queryFeatures, const ImageDatabase* database,
+		const QueryStats* stats, const int* localIndices, int nLocalIndices);
 
+/**
+ * Prints the recall of a cascade search: how many of the exhaustive SIFT search's results
+ * are in the query's shortlist, and how many of them the cascade found.
+ *
+ * @param queryFeatures - the features of the query image.
+ * @param database - the database of images with which the query image was compared.
+ * @param localIndices - the closest images to the query found by the cascade
+ * @param nLocalIndices - the number of indices in localIndices
+ * @return
+ * - PROGRAM_STATE_MEMORY_ERROR: Failed to allocate memory at some point.
+ * - PROGRAM_STATE_RUNNING: No errors. Continue running the program.
+ */
+PROGRAM_STATE PrintShortlistReport(const QueryFeatures* queryFeatures, const ImageDatabase* database,
+		const int* localIndices, int nLocalIndices);
+
+/**
+ * Counts how many indices appear in both a and b.
+ *
+ * @param a - the first array of indices (without duplicates)
+ * @param nA - the size of a
+ * @param b - the second array of indices (without duplicates)
+ * @param nB - the size of b
+ * @return the number of common indices
+ */
+int CountCommonIndices(const int* a, int nA, const int* b, int nB);
 
 /**
  * Destroy the image database and free all allocated memory for it
@@ -160,12 +829,6 @@ void DestroyImageDataBase(ImageDatabase* database);
  */
 char* GetImagePath(char* imgDirectory, char* imgPrefix, char* imgSuffix, int imgIndex);
 
-/**
- * Print the exit message of  main(), depending on its state
- *
- * @param programState - The prgram's state on exit
- */
-void PrintExitMessage(PROGRAM_STATE exitProgramState);
 
 
 /**
@@ -0,0 +1,371 @@
+#include "sp_search.h"
+#include "main_aux.h"
+#include "sp_parallel.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <climits>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+/*The usage of the tool, printed on invalid arguments*/
+#define LOAD_USAGE_MSG "Usage: ex3-load <workload path> [-concurrency <n>] [-rate <queries/s>] [-requests <n>] [-expected-ms <ms>]\n"
+#define LOAD_WORKLOAD_ERROR_FORMAT "Couldn't read the workload %s\n"
+#define LOAD_NO_QUERIES_MSG "The workload holds no queries\n"
+#define LOAD_UNSUPPORTED_OPTIONS_MSG "The workload's options answer no queries - near-duplicates aren't supported\n"
+#define LOAD_UNREADABLE_IMAGE_FORMAT "Image cannot be loaded - %s\n"
+#define LOAD_DELETIONS_SKIPPED_FORMAT "Skipped %d recorded deletion(s) - only queries are replayed\n"
+#define LOAD_CLOSED_LOOP_FORMAT "Closed loop with %d concurrent queries: %d requests (%d failed) in %.3f s - %.1f queries/s\n"
+#define LOAD_OPEN_LOOP_FORMAT "Open loop at %.1f queries/s with %d workers: %d requests (%d failed) in %.3f s - %.1f queries/s\n"
+#define LOAD_LATENCY_FORMAT "%s latency in ms - mean: %.3f, p50: %.3f, p90: %.3f, p99: %.3f, p99.9: %.3f, max: %.3f\n"
+#define LOAD_OPEN_LOOP_CORRECTION_MSG "Corrected latencies are from the time every request was scheduled to arrive\n"
+#define LOAD_CLOSED_LOOP_CORRECTION_FORMAT "Corrected latencies add the requests a stalled query held back, expected every %.3f ms\n"
+
+#define LOAD_OPTION_CONCURRENCY "-concurrency"
+#define LOAD_OPTION_RATE "-rate"
+#define LOAD_OPTION_REQUESTS "-requests"
+#define LOAD_OPTION_EXPECTED_MS "-expected-ms"
+
+/*The settings of a load run*/
+typedef struct load_options {
+	int concurrency; /*The number of queries in flight - closed loop - or of workers - open loop*/
+	double rate; /*If > 0, requests arrive at this many per second (open loop) instead of one per finished request*/
+	int nRequests; /*The number of requests to send, cycling over the workload's queries*/
+	double expectedMs; /*If > 0, the expected interval between the requests of a closed loop worker*/
+} LoadOptions;
+
+/*The times of every request of a run, in GetMonotonicTime() seconds*/
+typedef struct load_samples {
+	double* scheduled; /*When the request was meant to be sent - its arrival in an open loop, its start in a closed one*/
+	double* started;
+	double* finished;
+	bool* isFailed;
+} LoadSamples;
+
+/*Parses the tool's arguments after the workload path. Returns false if one is invalid*/
+static bool ParseLoadOptions(int argc, char** argv, LoadOptions* options)
+{
+	options->concurrency = 1;
+	options->rate = 0;
+	options->nRequests = 0;
+	options->expectedMs = 0;
+
+	for(int i = 2; i < argc; ++i)
+	{
+		if (i + 1 == argc)
+			return false; /*Every option has a value*/
+
+		char* end = NULL;
+		const char* value = argv[++i];
+		if (strcmp(argv[i - 1], LOAD_OPTION_CONCURRENCY) == 0)
+			options->concurrency = (int)strtol(value, &end, 10);
+		else if (strcmp(argv[i - 1], LOAD_OPTION_REQUESTS) == 0)
+			options->nRequests = (int)strtol(value, &end, 10);
+		else if (strcmp(argv[i - 1], LOAD_OPTION_RATE) == 0)
+			options->rate = strtod(value, &end);
+		else if (strcmp(argv[i - 1], LOAD_OPTION_EXPECTED_MS) == 0)
+			options->expectedMs = strtod(value, &end);
+		else
+			return false;
+
+		if (*end != '\0')
+			return false;
+	}
+
+	return options->concurrency >= 1 && options->concurrency <= 4096 && options->nRequests >= 0 &&
+		options->rate >= 0 && options->expectedMs >= 0;
+}
+
+/*
+ * Builds the database a workload was recorded on, with its options.
+ */
+static SPSearchError BuildWorkloadDatabase(const SPWorkload* workload, SPSearchDatabase** resDatabase)
+{
+	SPSearchError error = spSearchDatabaseCreate(workload->nArguments, (const char* const*)workload->arguments,
+			resDatabase);
+	if (error != SP_SEARCH_SUCCESS)
+		return error;
+
+	const SPWorkloadDatabase* recorded = &workload->database;
+	SPSearchImages images;
+	images.imgDirectory = recorded->imgDirectory;
+	images.imgPrefix = recorded->imgPrefix;
+	images.nImages = recorded->nImages;
+	images.imgSuffix = recorded->imgSuffix;
+	images.nBins = recorded->nBins;
+	images.nFeaturesToExtract = recorded->nFeaturesToExtract;
+
+	int unreadableImage = -1;
+	error = spSearchDatabaseBuild(*resDatabase, &images, &unreadableImage);
+	if (error == SP_SEARCH_UNREADABLE_IMAGE)
+	{
+		char* imgPath = GetImagePath(recorded->imgDirectory, recorded->imgPrefix, recorded->imgSuffix, unreadableImage);
+		if (imgPath != NULL)
+			printf(LOAD_UNREADABLE_IMAGE_FORMAT, imgPath);
+		free(imgPath);
+	}
+
+	/*Near-duplicates are reported instead of answering queries*/
+	if (error == SP_SEARCH_SUCCESS && !spSearchDatabaseIsQueryable(*resDatabase))
+	{
+		printf(LOAD_UNSUPPORTED_OPTIONS_MSG);
+		error = SP_SEARCH_INVALID_ARGUMENT;
+	}
+	return error;
+}
+
+/*
+ * Answers a query the way ex3 does (see sp_search.h) - its global and local results - without
+ * printing them or its reports.
+ * Returns false if it failed.
+ */
+static bool RunQuery(SPSearchDatabase* database, const char* queryImagePath)
+{
+	int indices[SP_SEARCH_MAX_RESULTS];
+	int nIndices = 0;
+
+	SPSearchQuery* query = NULL;
+	SPSearchError error = spSearchQueryCreate(database, queryImagePath, &query);
+	if (error == SP_SEARCH_SUCCESS)
+		error = spSearchQueryGetGlobalResults(query, indices, &nIndices);
+	if (error == SP_SEARCH_SUCCESS)
+		error = spSearchQueryGetLocalResults(query, indices, &nIndices);
+
+	spSearchQueryDestroy(query);
+	return error == SP_SEARCH_SUCCESS;
+}
+
+/*
+ * Sends the requests - the queries of the workload in order, cycling - and records their times.
+ * In a closed loop, every worker sends its next request once its last one finished. In an open loop,
+ * request i is scheduled i/rate seconds after the start, and sent by the next free worker - late, if
+ * none was free on time.
+ */
+static void RunLoad(SPSearchDatabase* database, const char** queries, int nQueries, const LoadOptions* options,
+		LoadSamples* samples)
+{
+	std::atomic<int> nextRequest(0);
+	double startTime = GetMonotonicTime();
+
+	spParallelFor(options->concurrency, options->concurrency, [&](int) {
+		for(int i = nextRequest++; i < options->nRequests; i = nextRequest++)
+		{
+			if (options->rate > 0)
+			{
+				samples->scheduled[i] = startTime + i / options->rate;
+				double wait = samples->scheduled[i] - GetMonotonicTime();
+				if (wait > 0)
+					std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+			}
+
+			samples->started[i] = GetMonotonicTime();
+			if (options->rate <= 0)
+				samples->scheduled[i] = samples->started[i];
+
+			samples->isFailed[i] = !RunQuery(database, queries[i % nQueries]);
+			samples->finished[i] = GetMonotonicTime();
+		}
+	});
+}
+
+static int CompareDoubles(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/*The value at percentile p of the sorted latencies - the nearest rank*/
+static double Percentile(const double* sorted, int n, double p)
+{
+	int rank = (int)ceil(p / 100 * n);
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+/*Sorts the latencies (in seconds) and prints their mean and percentiles in milliseconds*/
+static void PrintLatencies(const char* name, double* latencies, int n)
+{
+	qsort(latencies, n, sizeof(*latencies), CompareDoubles);
+
+	double sum = 0;
+	for(int i = 0; i < n; ++i)
+		sum += latencies[i];
+
+	printf(LOAD_LATENCY_FORMAT, name, 1000 * sum / n, 1000 * Percentile(latencies, n, 50),
+			1000 * Percentile(latencies, n, 90), 1000 * Percentile(latencies, n, 99),
+			1000 * Percentile(latencies, n, 99.9), 1000 * latencies[n - 1]);
+}
+
+/*
+ * The latencies of a closed loop, corrected for coordinated omission the way HdrHistogram does: a
+ * worker stalled by a query of latency L didn't send the requests it would have sent every expected
+ * interval meanwhile, so latencies of L - interval, L - 2 * interval, ... down to the interval are added.
+ * Returns the number of latencies in corrected (NULL on allocation failure, and then it's -1).
+ */
+static int CorrectClosedLoopLatencies(const double* latencies, int n, double interval, double** corrected)
+{
+	int64_t nCorrected = n;
+	for(int i = 0; i < n; ++i)
+		nCorrected += latencies[i] > interval ? (int64_t)(latencies[i] / interval) - 1 : 0;
+
+	*corrected = nCorrected <= INT_MAX ? (double*)malloc(sizeof(**corrected) * nCorrected) : NULL;
+	if (*corrected == NULL)
+		return -1;
+
+	int k = 0;
+	for(int i = 0; i < n; ++i)
+	{
+		(*corrected)[k++] = latencies[i];
+		for(double missed = latencies[i] - interval; missed >= interval && k < nCorrected; missed -= interval)
+			(*corrected)[k++] = missed;
+	}
+	return k;
+}
+
+/*Prints the throughput and latencies of a run. Returns false on allocation failure*/
+static bool PrintLoadReport(const LoadOptions* options, const LoadSamples* samples)
+{
+	int n = options->nRequests;
+	double* latencies = (double*)malloc(sizeof(*latencies) * n);
+	double* delays = (double*)malloc(sizeof(*delays) * n);
+	if (latencies == NULL || delays == NULL)
+	{
+		free(latencies);
+		free(delays);
+		return false;
+	}
+
+	int nFailed = 0;
+	double firstStart = samples->scheduled[0];
+	double lastFinish = samples->finished[0];
+	for(int i = 0; i < n; ++i)
+	{
+		latencies[i] = samples->finished[i] - samples->started[i];
+		delays[i] = samples->finished[i] - samples->scheduled[i];
+		nFailed += samples->isFailed[i] ? 1 : 0;
+		firstStart = fmin(firstStart, samples->scheduled[i]);
+		lastFinish = fmax(lastFinish, samples->finished[i]);
+	}
+
+	double elapsed = lastFinish - firstStart;
+	if (options->rate > 0)
+		printf(LOAD_OPEN_LOOP_FORMAT, options->rate, options->concurrency, n, nFailed, elapsed, n / elapsed);
+	else
+		printf(LOAD_CLOSED_LOOP_FORMAT, options->concurrency, n, nFailed, elapsed, n / elapsed);
+
+	PrintLatencies("Service", latencies, n);
+
+	bool isOk = true;
+	if (options->rate > 0)
+	{
+		PrintLatencies("Corrected", delays, n);
+		PrintMsg(LOAD_OPEN_LOOP_CORRECTION_MSG);
+	}
+	else
+	{
+		/*Without an expected interval, the median service time is what a request takes when nothing stalls*/
+		double interval = options->expectedMs > 0 ? options->expectedMs / 1000 : Percentile(latencies, n, 50);
+		double* corrected = NULL;
+		int nCorrected = interval > 0 ? CorrectClosedLoopLatencies(latencies, n, interval, &corrected) : -1;
+		isOk = interval <= 0 || corrected != NULL;
+
+		if (corrected != NULL)
+		{
+			PrintLatencies("Corrected", corrected, nCorrected);
+			printf(LOAD_CLOSED_LOOP_CORRECTION_FORMAT, 1000 * interval);
+		}
+		free(corrected);
+	}
+
+	free(latencies);
+	free(delays);
+	return isOk;
+}
+
+/*
+ * Replays the queries of a workload recorded by ex3 (OPTION_RECORD) against the same database, built
+ * with the same options, and reports the throughput and latency percentiles. In a closed loop a fixed
+ * number of queries is in flight; in an open loop (-rate) they arrive at a fixed rate whether or not the
+ * previous ones finished. Queries are answered like ex3 answers them, without printing the results.
+ * Recorded deletions aren't replayed, so the database is the same for every request.
+ */
+int main(int argc, char** argv)
+{
+	LoadOptions options;
+	if (argc < 2 || !ParseLoadOptions(argc, argv, &options))
+	{
+		printf(LOAD_USAGE_MSG);
+		return 1;
+	}
+
+	SPWorkload* workload = spWorkloadLoad(argv[1]);
+	if (workload == NULL)
+	{
+		printf(LOAD_WORKLOAD_ERROR_FORMAT, argv[1]);
+		return 1;
+	}
+
+	SPSearchError error = SP_SEARCH_SUCCESS;
+	SPSearchDatabase* database = NULL;
+	const char** queries = (const char**)malloc(sizeof(*queries) * (workload->nQueries + 1));
+	if (queries == NULL)
+		error = SP_SEARCH_OUT_OF_MEMORY;
+
+	int nQueries = 0;
+	if (error == SP_SEARCH_SUCCESS)
+	{
+		for(int i = 0; i < workload->nEntries; ++i)
+			if (workload->entries[i].type == SP_WORKLOAD_QUERY)
+				queries[nQueries++] = workload->entries[i].queryPath;
+
+		if (nQueries == 0)
+		{
+			printf(LOAD_NO_QUERIES_MSG);
+			error = SP_SEARCH_INVALID_ARGUMENT;
+		}
+		else if (nQueries < workload->nEntries)
+			printf(LOAD_DELETIONS_SKIPPED_FORMAT, workload->nEntries - nQueries);
+
+		if (options.nRequests == 0)
+			options.nRequests = nQueries; /*The recorded queries, once each*/
+	}
+
+	if (error == SP_SEARCH_SUCCESS)
+		error = BuildWorkloadDatabase(workload, &database);
+
+	LoadSamples samples;
+	memset(&samples, 0, sizeof(samples));
+	if (error == SP_SEARCH_SUCCESS)
+	{
+		samples.scheduled = (double*)malloc(sizeof(*samples.scheduled) * options.nRequests);
+		samples.started = (double*)malloc(sizeof(*samples.started) * options.nRequests);
+		samples.finished = (double*)malloc(sizeof(*samples.finished) * options.nRequests);
+		samples.isFailed = (bool*)malloc(sizeof(*samples.isFailed) * options.nRequests);
+		if (samples.scheduled == NULL || samples.started == NULL || samples.finished == NULL || samples.isFailed == NULL)
+			error = SP_SEARCH_OUT_OF_MEMORY;
+	}
+
+	if (error == SP_SEARCH_SUCCESS)
+	{
+		RunLoad(database, queries, nQueries, &options, &samples);
+		if (!PrintLoadReport(&options, &samples))
+			error = SP_SEARCH_OUT_OF_MEMORY;
+	}
+
+	free(samples.scheduled);
+	free(samples.started);
+	free(samples.finished);
+	free(samples.isFailed);
+	spSearchDatabaseDestroy(database);
+	free(queries);
+	spWorkloadDestroy(workload);
+
+	if (error != SP_SEARCH_SUCCESS)
+	{
+		PrintMsg(spSearchGetErrorMessage(error));
+		return 1;
+	}
+	return 0;
+}
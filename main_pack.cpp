@@ -0,0 +1,38 @@
+#include "sp_image_archive.h"
+#include <cstdio>
+#include <cstdlib>
+
+/*The usage of the tool, printed on invalid arguments*/
+#define PACK_USAGE_MSG "Usage: ex3-pack <images directory path> <images prefix> <number of images> <images suffix> <archive path>\n"
+#define PACK_ERROR_MSG "An error occurred - couldn't read the images or write the archive\n"
+#define PACK_DONE_FORMAT "Packed %d images into %s\n"
+
+/*
+ * Packs the images of a database into an image archive (see sp_image_archive.h), to be
+ * ingested with ex3's -archive option. The images are given like ex3 asks for them.
+ */
+int main(int argc, char** argv)
+{
+	if (argc != 6)
+	{
+		printf(PACK_USAGE_MSG);
+		return 1;
+	}
+
+	char* end = NULL;
+	long nImages = strtol(argv[3], &end, 10);
+	if (*end != '\0' || nImages < 1 || nImages > 100000000)
+	{
+		printf(PACK_USAGE_MSG);
+		return 1;
+	}
+
+	if (!spImageArchiveBuild(argv[5], argv[1], argv[2], (int)nImages, argv[4]))
+	{
+		printf(PACK_ERROR_MSG);
+		return 1;
+	}
+
+	printf(PACK_DONE_FORMAT, (int)nImages, argv[5]);
+	return 0;
+}
@@ -0,0 +1,190 @@
+#include "sp_binary_index.h"
+#include "sp_kernels.h"
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+
+/*The number of words of ORB's 256 bits, and of AKAZE's 486 bits padded*/
+#define BINARY_INDEX_ORB_WORDS 4
+#define BINARY_INDEX_AKAZE_WORDS 8
+
+/*The number of descriptors the block of packed descriptors has room for at first*/
+#define BINARY_INDEX_INITIAL_CAPACITY 1024
+
+struct sp_binary_index_t {
+	int nImages; /*The number of images the index was created for*/
+	int nAddedImages; /*The number of images added so far*/
+	int nBytes; /*The number of bytes of a descriptor*/
+	int nWords; /*The number of words of a packed descriptor*/
+	int64_t* firstDescriptor; /*The first descriptor of every image, and the end of the last one*/
+	uint64_t* data; /*The packed descriptors of all images, image after image*/
+	int64_t capacity; /*The number of descriptors data has room for*/
+};
+
+SPBinaryIndex* spBinaryIndexCreate(int nImages, int nBytes)
+{
+	if (nImages <= 0 || nBytes <= 0)
+		return NULL;
+
+	SPBinaryIndex* index = (SPBinaryIndex*)malloc(sizeof(*index));
+	if (index == NULL)
+		return NULL;
+
+	index->nImages = nImages;
+	index->nAddedImages = 0;
+	index->nBytes = nBytes;
+	index->nWords = (nBytes + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+	index->firstDescriptor = (int64_t*)malloc(sizeof(*index->firstDescriptor) * ((size_t)nImages + 1));
+	index->capacity = BINARY_INDEX_INITIAL_CAPACITY;
+	index->data = (uint64_t*)malloc(sizeof(*index->data) * index->nWords * index->capacity);
+
+	if (index->firstDescriptor == NULL || index->data == NULL)
+	{
+		spBinaryIndexDestroy(index);
+		return NULL;
+	}
+
+	index->firstDescriptor[0] = 0;
+	return index;
+}
+
+void spBinaryIndexPack(const SPBinaryIndex* index, const unsigned char* descriptors, int nDescriptors, uint64_t* packed)
+{
+	assert(index != NULL && ((descriptors != NULL && packed != NULL) || nDescriptors == 0));
+
+	/*The padding of the last word is zero in every descriptor, so it never adds to a distance*/
+	memset(packed, 0, sizeof(*packed) * index->nWords * nDescriptors);
+	for(int i = 0; i < nDescriptors; ++i)
+		memcpy(packed + (size_t)i * index->nWords, descriptors + (size_t)i * index->nBytes, index->nBytes);
+}
+
+bool spBinaryIndexAddImage(SPBinaryIndex* index, const unsigned char* descriptors, int nDescriptors)
+{
+	if (index == NULL || (descriptors == NULL && nDescriptors > 0) || nDescriptors < 0 ||
+		index->nAddedImages == index->nImages)
+		return false;
+
+	int64_t first = index->firstDescriptor[index->nAddedImages];
+	if (first + nDescriptors > index->capacity)
+	{
+		int64_t capacity = index->capacity;
+		while (first + nDescriptors > capacity)
+			capacity *= 2;
+
+		uint64_t* data = (uint64_t*)realloc(index->data, sizeof(*data) * index->nWords * capacity);
+		if (data == NULL)
+			return false;
+		index->data = data;
+		index->capacity = capacity;
+	}
+
+	spBinaryIndexPack(index, descriptors, nDescriptors, index->data + first * index->nWords);
+	index->firstDescriptor[++index->nAddedImages] = first + nDescriptors;
+	return true;
+}
+
+/*
+ * Offers the descriptors of an image to the closest found so far - for a number of words
+ * known at compile time, or of nWords words for WORDS 0
+ */
+template <int WORDS, typename TopK>
+static inline void offerImage(const SPBinaryIndex* index, const uint64_t* query, int image, TopK& closest)
+{
+	const uint64_t* descriptor = index->data + index->firstDescriptor[image] * index->nWords;
+	const uint64_t* end = index->data + index->firstDescriptor[image + 1] * index->nWords;
+
+	for(; descriptor != end; descriptor += index->nWords)
+		closest.offer(image, WORDS > 0 ? spKernelHammingDistance<WORDS>(descriptor, query) :
+									spKernelHammingDistance(descriptor, query, index->nWords));
+}
+
+/*Offers the searched images (all of them, or the candidates) to closest*/
+template <int WORDS, typename TopK>
+static void findClosest(const SPBinaryIndex* index, const uint64_t* query, const int* candidateImages,
+		int nCandidateImages, TopK& closest)
+{
+	if (candidateImages == NULL)
+		for(int i = 0; i < index->nAddedImages; ++i)
+			offerImage<WORDS>(index, query, i, closest);
+	else
+		for(int i = 0; i < nCandidateImages; ++i)
+			offerImage<WORDS>(index, query, candidateImages[i], closest);
+}
+
+/*spBinaryIndexFindClosest for k known at compile time - the closest K are kept in registers*/
+template <int K>
+static int findClosestFixed(const SPBinaryIndex* index, const uint64_t* query, const int* candidateImages,
+		int nCandidateImages, int* resImages)
+{
+	SPKernelTopK<K> closest;
+
+	if (index->nWords == BINARY_INDEX_ORB_WORDS)
+		findClosest<BINARY_INDEX_ORB_WORDS>(index, query, candidateImages, nCandidateImages, closest);
+	else if (index->nWords == BINARY_INDEX_AKAZE_WORDS)
+		findClosest<BINARY_INDEX_AKAZE_WORDS>(index, query, candidateImages, nCandidateImages, closest);
+	else
+		findClosest<0>(index, query, candidateImages, nCandidateImages, closest);
+
+	for(int i = 0; i < closest.size; ++i)
+		resImages[i] = closest.indices[i];
+	return closest.size;
+}
+
+int spBinaryIndexFindClosest(const SPBinaryIndex* index, const uint64_t* query, int kClosest,
+		const int* candidateImages, int nCandidateImages, int* resImages)
+{
+	if (index == NULL || query == NULL || kClosest <= 0 || resImages == NULL)
+		return -1;
+
+	/*The common case of the local search has its own kernel*/
+	if (kClosest == SP_KERNEL_SIFT_K)
+		return findClosestFixed<SP_KERNEL_SIFT_K>(index, query, candidateImages, nCandidateImages, resImages);
+
+	int* distances = (int*)malloc(sizeof(*distances) * kClosest);
+	if (distances == NULL)
+		return -1;
+
+	SPKernelTopKList<int> closest(distances, resImages, kClosest);
+	findClosest<0>(index, query, candidateImages, nCandidateImages, closest);
+
+	free(distances);
+	return closest.size;
+}
+
+int spBinaryIndexGetNumOfImages(const SPBinaryIndex* index)
+{
+	assert(index != NULL);
+	return index->nAddedImages;
+}
+
+int spBinaryIndexGetNumOfWords(const SPBinaryIndex* index)
+{
+	assert(index != NULL);
+	return index->nWords;
+}
+
+int spBinaryIndexGetNumOfDescriptors(const SPBinaryIndex* index, int imageIndex)
+{
+	assert(index != NULL && imageIndex >= 0 && imageIndex < index->nAddedImages);
+	return (int)(index->firstDescriptor[imageIndex + 1] - index->firstDescriptor[imageIndex]);
+}
+
+size_t spBinaryIndexGetMemoryUsage(const SPBinaryIndex* index)
+{
+	if (index == NULL)
+		return 0;
+
+	return sizeof(*index) +
+		sizeof(*index->firstDescriptor) * ((size_t)index->nImages + 1) +
+		sizeof(*index->data) * index->nWords * (size_t)index->capacity;
+}
+
+void spBinaryIndexDestroy(SPBinaryIndex* index)
+{
+	if (index == NULL)
+		return;
+
+	free(index->firstDescriptor);
+	free(index->data);
+	free(index);
+}
@@ -0,0 +1,123 @@
+#ifndef SP_BINARY_INDEX_H_
+#define SP_BINARY_INDEX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * SPBinaryIndex Summary
+ * The binary local descriptors (ORB or AKAZE) of a database of images, packed as
+ * bit-vectors, and searched for the descriptors closest to a query descriptor by
+ * Hamming distance.
+ *
+ * Every descriptor is packed into whole 64-bit words, zero padded, and all the
+ * descriptors of all images are kept one after the other in a single block, image
+ * after image. A search scans the block (or the ranges of some of its images) with
+ * a popcount kernel - a few instructions per descriptor, instead of the 128
+ * multiply-adds of a SIFT descriptor.
+ *
+ * The following functions are supported:
+ *
+ * spBinaryIndexCreate				- Creates a new, empty index
+ * spBinaryIndexAddImage			- Packs and adds the descriptors of an image
+ * spBinaryIndexPack				- Packs descriptors (e.g. of a query) like the index does
+ * spBinaryIndexFindClosest			- Finds the images of the descriptors closest to a query descriptor
+ * spBinaryIndexGetNumOfImages		- A getter of the number of images added to an index
+ * spBinaryIndexGetNumOfWords		- A getter of the number of words of a packed descriptor
+ * spBinaryIndexGetNumOfDescriptors	- A getter of the number of descriptors of an image
+ * spBinaryIndexGetMemoryUsage		- The memory an index takes
+ * spBinaryIndexDestroy				- Free all resources associated with an index
+ *
+ */
+
+/** Type for defining the index **/
+typedef struct sp_binary_index_t SPBinaryIndex;
+
+/**
+ * Creates a new, empty index for nImages images of descriptors of nBytes bytes.
+ *
+ * @return
+ * NULL in case allocation failure ocurred, or nImages <= 0, or nBytes <= 0.
+ * Otherwise, the new index.
+ */
+SPBinaryIndex* spBinaryIndexCreate(int nImages, int nBytes);
+
+/**
+ * Packs the descriptors of the next image and adds them to the index.
+ * Images must be added in increasing index order, from 0, and each image only once.
+ *
+ * @param index - The index
+ * @param descriptors - The descriptors of the image, nBytes bytes each, one after the other
+ * @param nDescriptors - The number of descriptors (>= 0)
+ * @return
+ * false in case of allocation failure, invalid argument, or if all images were added. Otherwise true.
+ */
+bool spBinaryIndexAddImage(SPBinaryIndex* index, const unsigned char* descriptors, int nDescriptors);
+
+/**
+ * Packs descriptors the way the index does, so they can be searched.
+ *
+ * @param index - The index
+ * @param descriptors - The descriptors, nBytes bytes each, one after the other
+ * @param nDescriptors - The number of descriptors
+ * @param packed - OUTPUT parameter. Receives the packed descriptors, spBinaryIndexGetNumOfWords
+ * words each - an array of nDescriptors times as many words.
+ * @assert index != NULL && (descriptors != NULL && packed != NULL || nDescriptors == 0)
+ */
+void spBinaryIndexPack(const SPBinaryIndex* index, const unsigned char* descriptors, int nDescriptors, uint64_t* packed);
+
+/**
+ * Finds the kClosest descriptors to a query descriptor by Hamming distance, and stores the
+ * index of the image of each in resImages, from the closest. Ties are broken by the lower
+ * image index, and an image may appear more than once.
+ *
+ * @param index - The index, with all its images added
+ * @param query - The packed query descriptor
+ * @param kClosest - The number of descriptors to find
+ * @param candidateImages - If not NULL, only the descriptors of these images are searched,
+ * given in increasing order
+ * @param nCandidateImages - The number of candidate images
+ * @param resImages - OUTPUT parameter. An array of at least kClosest images.
+ * @return
+ * -1 if index/query/resImages is NULL, kClosest <= 0 or allocation error occurred.
+ * Otherwise, the number of images stored in resImages (fewer than kClosest only if the
+ * searched images hold fewer descriptors)
+ */
+int spBinaryIndexFindClosest(const SPBinaryIndex* index, const uint64_t* query, int kClosest,
+		const int* candidateImages, int nCandidateImages, int* resImages);
+
+/**
+ * A getter for the number of images added to the index
+ *
+ * @assert index != NULL
+ */
+int spBinaryIndexGetNumOfImages(const SPBinaryIndex* index);
+
+/**
+ * A getter for the number of 64-bit words of a packed descriptor
+ *
+ * @assert index != NULL
+ */
+int spBinaryIndexGetNumOfWords(const SPBinaryIndex* index);
+
+/**
+ * A getter for the number of descriptors of an image
+ *
+ * @assert index != NULL && 0 <= imageIndex < the number of images added
+ */
+int spBinaryIndexGetNumOfDescriptors(const SPBinaryIndex* index, int imageIndex);
+
+/**
+ * The memory the index takes, in bytes - its struct and every array it owns.
+ * Returns 0 if index is NULL.
+ */
+size_t spBinaryIndexGetMemoryUsage(const SPBinaryIndex* index);
+
+/**
+ * Free all memory associated with the index.
+ * If index is NULL nothing happens.
+ */
+void spBinaryIndexDestroy(SPBinaryIndex* index);
+
+#endif /* SP_BINARY_INDEX_H_ */
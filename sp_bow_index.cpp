@@ -0,0 +1,545 @@
+#include "sp_bow_index.h"
+#include "sp_parallel.h"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+#include <new>
+#include <vector>
+#include <algorithm>
+
+/*The maximal number of Lloyd iterations of each k-means run*/
+#define BOW_KMEANS_MAX_ITERATIONS 10
+
+/*k-means assignment steps over more samples than this are spread over threads*/
+#define BOW_PARALLEL_ASSIGN_MIN_SAMPLES 4096
+
+/*The number of samples each thread assigns at a time*/
+#define BOW_ASSIGN_CHUNK_SIZE 1024
+
+/*Identifies files written by spBowIndexSave*/
+#define BOW_INDEX_FILE_MAGIC "SPBOWIX2"
+#define BOW_INDEX_FILE_MAGIC_LENGTH 8
+
+/*An entry of a posting list - an image a word appears in*/
+typedef struct bow_posting_t {
+	int imageIndex; /*The image the word appears in*/
+	int count; /*The number of descriptors of the image that were quantized to the word*/
+} BowPosting;
+
+struct sp_bow_index_t {
+	int branchFactor; /*The number of children of each node*/
+	int depth; /*The number of levels below the root*/
+	int dim; /*The dimension of the descriptors*/
+	int nImages; /*The number of images the index is built for*/
+	int nNodes; /*The number of nodes in the (complete) tree*/
+	int nWords; /*The number of leaves of the tree*/
+	int lastAddedImage; /*The index of the last image added, -1 if none*/
+
+	/*The centers of the nodes, nNodes x dim. The children of node n are n*branchFactor+1 ... n*branchFactor+branchFactor,
+	 * and the leaves are the last nWords nodes*/
+	std::vector<double> centers;
+	std::vector<std::vector<BowPosting> > postings; /*The inverted file - the posting list of every word*/
+	std::vector<double> idf; /*The inverse document frequency of every word*/
+	std::vector<double> imageNorms; /*The L2 norm of the weighted word vector of every image*/
+	std::vector<int> nImageDescriptors; /*The number of descriptors of every image*/
+};
+
+/*The L2-squared distance between two descriptors*/
+static inline double bowL2SquaredDistance(const double* a, const double* b, int dim)
+{
+	double distance = 0;
+	for(int i = 0; i < dim; ++i)
+		distance += (a[i] - b[i]) * (a[i] - b[i]);
+	return distance;
+}
+
+/*Returns the child (0 ... branchFactor-1) of node whose center is closest to descriptor*/
+static inline int bowClosestChild(const SPBowIndex* index, int node, const double* descriptor)
+{
+	const double* childCenters = &index->centers[(size_t)(node * index->branchFactor + 1) * index->dim];
+	int best = 0;
+	double bestDistance = bowL2SquaredDistance(childCenters, descriptor, index->dim);
+
+	for(int c = 1; c < index->branchFactor; ++c)
+	{
+		double distance = bowL2SquaredDistance(childCenters + (size_t)c * index->dim, descriptor, index->dim);
+		if (distance < bestDistance)
+		{
+			bestDistance = distance;
+			best = c;
+		}
+	}
+
+	return best;
+}
+
+/*Descends the tree to the leaf closest to descriptor and returns its word*/
+static int bowQuantize(const SPBowIndex* index, const double* descriptor)
+{
+	int node = 0;
+	for(int level = 0; level < index->depth; ++level)
+		node = node * index->branchFactor + 1 + bowClosestChild(index, node, descriptor);
+
+	return node - (index->nNodes - index->nWords);
+}
+
+/*
+ * Trains the subtree below node with k-means over the given members (sample indices).
+ * Nodes that have fewer members than branchFactor give all their children their own center,
+ * so every descriptor that reaches them ends up in the same word.
+ */
+static void bowTrainNode(SPBowIndex* index, const SPPointView* samples, const std::vector<int>& members,
+		int node, int level, bool isParallel)
+{
+	if (level == index->depth)
+		return;
+
+	int k = index->branchFactor;
+	int dim = index->dim;
+	int firstChild = node * k + 1;
+	double* childCenters = &index->centers[(size_t)firstChild * dim];
+	std::vector<std::vector<int> > childMembers(k);
+
+	if ((int)members.size() < k)
+	{
+		for(int c = 0; c < k; ++c)
+			memcpy(childCenters + (size_t)c * dim, &index->centers[(size_t)node * dim], sizeof(double) * dim);
+		if (!members.empty())
+			childMembers[0] = members;
+	}
+	else
+	{
+		int nMembers = (int)members.size();
+		std::vector<int> assignment(nMembers, -1);
+		std::vector<double> sums((size_t)k * dim);
+		std::vector<int> counts(k);
+
+		/*Deterministic initialisation - members spread evenly over the list*/
+		for(int c = 0; c < k; ++c)
+			memcpy(childCenters + (size_t)c * dim, samples[members[(size_t)c * nMembers / k]].data, sizeof(double) * dim);
+
+		for(int iteration = 0; iteration < BOW_KMEANS_MAX_ITERATIONS; ++iteration)
+		{
+			/*Assignment step - each thread handles whole chunks of members*/
+			std::atomic<int> nChanged(0);
+			int nChunks = (nMembers + BOW_ASSIGN_CHUNK_SIZE - 1) / BOW_ASSIGN_CHUNK_SIZE;
+			auto assignChunk = [&](int chunk) {
+				int end = std::min(nMembers, (chunk + 1) * BOW_ASSIGN_CHUNK_SIZE);
+				int chunkChanged = 0;
+				for(int i = chunk * BOW_ASSIGN_CHUNK_SIZE; i < end; ++i)
+				{
+					int closest = bowClosestChild(index, node, samples[members[i]].data);
+					if (closest != assignment[i])
+					{
+						assignment[i] = closest;
+						chunkChanged++;
+					}
+				}
+				nChanged += chunkChanged;
+			};
+
+			if (isParallel && nMembers >= BOW_PARALLEL_ASSIGN_MIN_SAMPLES)
+				spParallelFor(nChunks, 0, assignChunk);
+			else
+				for(int chunk = 0; chunk < nChunks; ++chunk)
+					assignChunk(chunk);
+
+			if (nChanged == 0)
+				break;
+
+			/*Update step - every center moves to the mean of its members. Empty clusters keep their center*/
+			std::fill(sums.begin(), sums.end(), 0.0);
+			std::fill(counts.begin(), counts.end(), 0);
+			for(int i = 0; i < nMembers; ++i)
+			{
+				const double* sample = samples[members[i]].data;
+				double* sum = &sums[(size_t)assignment[i] * dim];
+				for(int j = 0; j < dim; ++j)
+					sum[j] += sample[j];
+				counts[assignment[i]]++;
+			}
+			for(int c = 0; c < k; ++c)
+				if (counts[c] > 0)
+					for(int j = 0; j < dim; ++j)
+						childCenters[(size_t)c * dim + j] = sums[(size_t)c * dim + j] / counts[c];
+		}
+
+		for(int i = 0; i < nMembers; ++i)
+			childMembers[assignment[i]].push_back(members[i]);
+	}
+
+	/*The subtrees of the children are disjoint parts of the tree, so they can be trained concurrently*/
+	auto trainChild = [&](int c) {
+		bowTrainNode(index, samples, childMembers[c], firstChild + c, level + 1, false);
+	};
+
+	if (isParallel)
+		spParallelFor(k, 0, trainChild);
+	else
+		for(int c = 0; c < k; ++c)
+			trainChild(c);
+}
+
+/*Allocates an index with an untrained tree of the given shape. Returns NULL on failure*/
+static SPBowIndex* bowCreate(int branchFactor, int depth, int dim, int nImages)
+{
+	if (branchFactor < 2 || depth < 1 || dim <= 0 || nImages <= 0)
+		return NULL;
+
+	long long nWords = 1;
+	long long nNodes = 1;
+	for(int level = 0; level < depth; ++level)
+	{
+		nWords *= branchFactor;
+		nNodes += nWords;
+		if (nWords > SP_BOW_INDEX_MAX_NUM_OF_WORDS)
+			return NULL;
+	}
+
+	SPBowIndex* index = new (std::nothrow) SPBowIndex;
+	if (index == NULL)
+		return NULL;
+
+	try {
+		index->branchFactor = branchFactor;
+		index->depth = depth;
+		index->dim = dim;
+		index->nImages = nImages;
+		index->nNodes = (int)nNodes;
+		index->nWords = (int)nWords;
+		index->lastAddedImage = -1;
+		index->centers.assign((size_t)nNodes * dim, 0.0);
+		index->postings.resize(nWords);
+		index->idf.assign(nWords, 0.0);
+		index->imageNorms.assign(nImages, 0.0);
+		index->nImageDescriptors.assign(nImages, 0);
+	} catch (const std::bad_alloc&) {
+		delete index;
+		return NULL;
+	}
+
+	return index;
+}
+
+SPBowIndex* spBowIndexTrain(const SPPointView* samples, int nSamples, int branchFactor, int depth, int nImages)
+{
+	if (samples == NULL || nSamples <= 0)
+		return NULL;
+
+	SPBowIndex* index = bowCreate(branchFactor, depth, samples[0].dim, nImages);
+	if (index == NULL)
+		return NULL;
+
+	try {
+		std::vector<int> members(nSamples);
+		for(int i = 0; i < nSamples; ++i)
+			members[i] = i;
+
+		bowTrainNode(index, samples, members, 0, 0, true);
+	} catch (const std::bad_alloc&) {
+		spBowIndexDestroy(index);
+		return NULL;
+	}
+
+	return index;
+}
+
+bool spBowIndexAddImage(SPBowIndex* index, int imageIndex, const SPPointView* descriptors, int nDescriptors)
+{
+	if (index == NULL || descriptors == NULL || nDescriptors < 0 ||
+		imageIndex <= index->lastAddedImage || imageIndex >= index->nImages)
+		return false;
+
+	try {
+		std::vector<int> words(nDescriptors);
+		for(int i = 0; i < nDescriptors; ++i)
+		{
+			if (descriptors[i].dim != index->dim)
+				return false;
+			words[i] = bowQuantize(index, descriptors[i].data);
+		}
+
+		/*One posting per distinct word, with the number of times it appears*/
+		std::sort(words.begin(), words.end());
+		for(int i = 0; i < nDescriptors; )
+		{
+			int end = i;
+			while (end < nDescriptors && words[end] == words[i])
+				end++;
+
+			BowPosting posting;
+			posting.imageIndex = imageIndex;
+			posting.count = end - i;
+			index->postings[words[i]].push_back(posting);
+			i = end;
+		}
+	} catch (const std::bad_alloc&) {
+		return false;
+	}
+
+	index->nImageDescriptors[imageIndex] = nDescriptors;
+	index->lastAddedImage = imageIndex;
+	return true;
+}
+
+/*The TF-IDF weight of a word that appears count times among nDescriptors descriptors*/
+static inline double bowWeight(const SPBowIndex* index, int word, int count, int nDescriptors)
+{
+	return ((double)count / nDescriptors) * index->idf[word];
+}
+
+void spBowIndexFinalize(SPBowIndex* index)
+{
+	assert(index != NULL);
+
+	std::fill(index->imageNorms.begin(), index->imageNorms.end(), 0.0);
+
+	for(int word = 0; word < index->nWords; ++word)
+	{
+		const std::vector<BowPosting>& postingList = index->postings[word];
+		index->idf[word] = postingList.empty() ? 0 : log((double)index->nImages / postingList.size());
+
+		for(size_t i = 0; i < postingList.size(); ++i)
+		{
+			double weight = bowWeight(index, word, postingList[i].count, index->nImageDescriptors[postingList[i].imageIndex]);
+			index->imageNorms[postingList[i].imageIndex] += weight * weight;
+		}
+	}
+
+	for(int i = 0; i < index->nImages; ++i)
+		index->imageNorms[i] = sqrt(index->imageNorms[i]);
+}
+
+/*Whether image a (with similarity simA) ranks before image b (with similarity simB)*/
+static inline bool bowRanksBefore(double simA, int a, double simB, int b)
+{
+	return simA > simB || (simA == simB && a < b);
+}
+
+int spBowIndexQuery(const SPBowIndex* index, const SPPointView* descriptors, int nDescriptors,
+		int kClosest, int* resIndices)
+{
+	if (index == NULL || descriptors == NULL || nDescriptors <= 0 || kClosest <= 0 || resIndices == NULL)
+		return -1;
+
+	int nRes = 0;
+
+	try {
+		/*The words of the query, with their counts*/
+		std::vector<int> words(nDescriptors);
+		for(int i = 0; i < nDescriptors; ++i)
+		{
+			if (descriptors[i].dim != index->dim)
+				return -1;
+			words[i] = bowQuantize(index, descriptors[i].data);
+		}
+		std::sort(words.begin(), words.end());
+
+		/*Accumulate dot products over the posting lists of the query's words only*/
+		std::vector<double> scores(index->nImages, 0.0);
+		std::vector<int> touchedImages;
+		double queryNorm = 0;
+
+		for(int i = 0; i < nDescriptors; )
+		{
+			int end = i;
+			while (end < nDescriptors && words[end] == words[i])
+				end++;
+
+			int word = words[i];
+			double queryWeight = bowWeight(index, word, end - i, nDescriptors);
+			queryNorm += queryWeight * queryWeight;
+
+			const std::vector<BowPosting>& postingList = index->postings[word];
+			for(size_t j = 0; j < postingList.size() && queryWeight > 0; ++j)
+			{
+				int image = postingList[j].imageIndex;
+				if (scores[image] == 0)
+					touchedImages.push_back(image);
+				scores[image] += queryWeight * bowWeight(index, word, postingList[j].count, index->nImageDescriptors[image]);
+			}
+
+			i = end;
+		}
+		queryNorm = sqrt(queryNorm);
+
+		/*Keep the kClosest touched images by cosine similarity, sorted*/
+		std::vector<double> resSimilarities(kClosest);
+		for(size_t i = 0; i < touchedImages.size(); ++i)
+		{
+			int image = touchedImages[i];
+			double similarity = scores[image] / (queryNorm * index->imageNorms[image]);
+
+			if (nRes == kClosest && !bowRanksBefore(similarity, image, resSimilarities[nRes - 1], resIndices[nRes - 1]))
+				continue;
+			if (nRes == kClosest)
+				nRes--;
+
+			int pos = nRes;
+			for(; pos > 0 && bowRanksBefore(similarity, image, resSimilarities[pos - 1], resIndices[pos - 1]); --pos)
+			{
+				resSimilarities[pos] = resSimilarities[pos - 1];
+				resIndices[pos] = resIndices[pos - 1];
+			}
+			resSimilarities[pos] = similarity;
+			resIndices[pos] = image;
+			nRes++;
+		}
+
+		/*All other images have a similarity of 0, and follow in increasing index order*/
+		for(int image = 0; image < index->nImages && nRes < kClosest; ++image)
+			if (scores[image] == 0)
+				resIndices[nRes++] = image;
+	} catch (const std::bad_alloc&) {
+		return -1;
+	}
+
+	return nRes;
+}
+
+bool spBowIndexSave(const SPBowIndex* index, const char* path, uint64_t fingerprint)
+{
+	if (index == NULL || path == NULL)
+		return false;
+
+	FILE* file = fopen(path, "wb");
+	if (file == NULL)
+		return false;
+
+	int header[] = { index->branchFactor, index->depth, index->dim, index->nImages };
+	bool isWritten =
+		fwrite(BOW_INDEX_FILE_MAGIC, 1, BOW_INDEX_FILE_MAGIC_LENGTH, file) == BOW_INDEX_FILE_MAGIC_LENGTH &&
+		fwrite(header, sizeof(header), 1, file) == 1 &&
+		fwrite(&fingerprint, sizeof(fingerprint), 1, file) == 1 &&
+		fwrite(index->centers.data(), sizeof(double), index->centers.size(), file) == index->centers.size() &&
+		fwrite(index->nImageDescriptors.data(), sizeof(int), index->nImages, file) == (size_t)index->nImages;
+
+	for(int word = 0; word < index->nWords && isWritten; ++word)
+	{
+		int nPostings = (int)index->postings[word].size();
+		isWritten = fwrite(&nPostings, sizeof(nPostings), 1, file) == 1 &&
+			fwrite(index->postings[word].data(), sizeof(BowPosting), nPostings, file) == (size_t)nPostings;
+	}
+
+	/*fclose flushes, so it may fail too*/
+	if (fclose(file) != 0)
+		isWritten = false;
+
+	return isWritten;
+}
+
+SPBowIndex* spBowIndexLoad(const char* path, uint64_t fingerprint)
+{
+	if (path == NULL)
+		return NULL;
+
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+		return NULL;
+
+	char magic[BOW_INDEX_FILE_MAGIC_LENGTH];
+	int header[4];
+	uint64_t fileFingerprint = 0;
+	SPBowIndex* index = NULL;
+
+	/*An index of other images, or of images extracted otherwise, isn't loaded*/
+	if (fread(magic, 1, BOW_INDEX_FILE_MAGIC_LENGTH, file) == BOW_INDEX_FILE_MAGIC_LENGTH &&
+		memcmp(magic, BOW_INDEX_FILE_MAGIC, BOW_INDEX_FILE_MAGIC_LENGTH) == 0 &&
+		fread(header, sizeof(header), 1, file) == 1 &&
+		fread(&fileFingerprint, sizeof(fileFingerprint), 1, file) == 1 &&
+		fileFingerprint == fingerprint)
+		index = bowCreate(header[0], header[1], header[2], header[3]);
+
+	bool isRead = index != NULL &&
+		fread(index->centers.data(), sizeof(double), index->centers.size(), file) == index->centers.size() &&
+		fread(index->nImageDescriptors.data(), sizeof(int), index->nImages, file) == (size_t)index->nImages;
+
+	try {
+		for(int word = 0; isRead && word < index->nWords; ++word)
+		{
+			int nPostings = 0;
+			isRead = fread(&nPostings, sizeof(nPostings), 1, file) == 1 && nPostings >= 0 && nPostings <= index->nImages;
+			if (isRead)
+			{
+				index->postings[word].resize(nPostings);
+				isRead = fread(index->postings[word].data(), sizeof(BowPosting), nPostings, file) == (size_t)nPostings;
+			}
+
+			for(int i = 0; isRead && i < nPostings; ++i)
+			{
+				int image = index->postings[word][i].imageIndex;
+				isRead = image >= 0 && image < index->nImages && index->nImageDescriptors[image] > 0;
+			}
+		}
+	} catch (const std::bad_alloc&) {
+		isRead = false;
+	}
+
+	fclose(file);
+
+	if (!isRead)
+	{
+		spBowIndexDestroy(index);
+		return NULL;
+	}
+
+	index->lastAddedImage = index->nImages - 1;
+	spBowIndexFinalize(index); /*The weights are derived from the inverted file*/
+	return index;
+}
+
+int spBowIndexGetNumOfImages(const SPBowIndex* index)
+{
+	assert(index != NULL);
+	return index->nImages;
+}
+
+int spBowIndexGetDimension(const SPBowIndex* index)
+{
+	assert(index != NULL);
+	return index->dim;
+}
+
+int spBowIndexGetBranchFactor(const SPBowIndex* index)
+{
+	assert(index != NULL);
+	return index->branchFactor;
+}
+
+int spBowIndexGetDepth(const SPBowIndex* index)
+{
+	assert(index != NULL);
+	return index->depth;
+}
+
+size_t spBowIndexGetMemoryUsage(const SPBowIndex* index)
+{
+	if (index == NULL)
+		return 0;
+
+	size_t nBytes = sizeof(*index) +
+		sizeof(double) * (index->centers.capacity() + index->idf.capacity() + index->imageNorms.capacity()) +
+		sizeof(int) * index->nImageDescriptors.capacity() +
+		sizeof(std::vector<BowPosting>) * index->postings.capacity();
+
+	for(size_t w = 0; w < index->postings.size(); ++w)
+		nBytes += sizeof(BowPosting) * index->postings[w].capacity();
+
+	return nBytes;
+}
+
+size_t spBowIndexGetQueryMemoryUsage(const SPBowIndex* index, int nDescriptors, int kClosest)
+{
+	assert(index != NULL);
+
+	/*The query's words, the scores of all images, the touched images - a vector grown up to
+	 * twice its size - and the similarities of the results*/
+	return sizeof(int) * (size_t)nDescriptors + sizeof(double) * (size_t)index->nImages +
+		2 * sizeof(int) * (size_t)index->nImages + sizeof(double) * (size_t)kClosest;
+}
+
+void spBowIndexDestroy(SPBowIndex* index)
+{
+	delete index;
+}
@@ -0,0 +1,170 @@
+#ifndef SP_BOW_INDEX_H_
+#define SP_BOW_INDEX_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+extern "C"{
+	#include "SPPoint.h"
+}
+
+/**
+ * SPBowIndex Summary
+ * A bag-of-visual-words index of the local descriptors of a database of images.
+ *
+ * A vocabulary tree (hierarchical k-means with branchFactor children per node and
+ * depth levels) quantizes every descriptor to a visual word - a leaf of the tree.
+ * Each image is indexed as the words of its descriptors in an inverted file
+ * (word -> the images it appears in, and how many times), and images are ranked
+ * against a query by the cosine similarity of their TF-IDF weighted word vectors.
+ *
+ * A query only touches the posting lists of its own words, so its cost depends on
+ * the lengths of these lists rather than on the total number of descriptors.
+ *
+ * The following functions are supported:
+ *
+ * spBowIndexTrain			- Trains the vocabulary of a new, empty index
+ * spBowIndexAddImage		- Indexes the descriptors of an image
+ * spBowIndexFinalize		- Calculates the TF-IDF weights, once all images were added
+ * spBowIndexQuery			- Finds the images most similar to a query
+ * spBowIndexSave			- Saves an index to a file
+ * spBowIndexLoad			- Loads an index from a file
+ * spBowIndexGetNumOfImages	- A getter of the number of images the index was built for
+ * spBowIndexGetDimension	- A getter of the descriptor dimension of the index
+ * spBowIndexGetBranchFactor	- A getter of the branch factor of the vocabulary tree
+ * spBowIndexGetDepth		- A getter of the depth of the vocabulary tree
+ * spBowIndexGetMemoryUsage	- The memory an index takes
+ * spBowIndexGetQueryMemoryUsage	- The memory a query of an index takes
+ * spBowIndexDestroy		- Free all resources associated with an index
+ *
+ */
+
+/** The maximal number of words (leaves) a vocabulary tree may have **/
+#define SP_BOW_INDEX_MAX_NUM_OF_WORDS (1 << 20)
+
+/** Type for defining the index **/
+typedef struct sp_bow_index_t SPBowIndex;
+
+/**
+ * Trains the vocabulary tree of a new index for nImages images with hierarchical
+ * k-means over the given sample descriptors. The subtrees of the first level are
+ * trained in parallel.
+ *
+ * @param samples - The descriptors to train the vocabulary on, all of the same dimension
+ * @param nSamples - The number of samples
+ * @param branchFactor - The number of children of each node of the tree (>= 2)
+ * @param depth - The number of levels below the root (>= 1)
+ * @param nImages - The number of images that will be added to the index
+ * @return
+ * NULL in case allocation failure ocurred, or samples is NULL, or nSamples <= 0,
+ * or branchFactor < 2, or depth < 1, or the tree has more than SP_BOW_INDEX_MAX_NUM_OF_WORDS leaves,
+ * or nImages <= 0.
+ * Otherwise, the new index, with no images in it yet.
+ */
+SPBowIndex* spBowIndexTrain(const SPPointView* samples, int nSamples, int branchFactor, int depth, int nImages);
+
+/**
+ * Quantizes the descriptors of an image and adds them to the inverted file.
+ * Images must be added in increasing index order, and each image only once.
+ *
+ * @param index - The index
+ * @param imageIndex - The index of the image, 0 <= imageIndex < nImages
+ * @param descriptors - The descriptors of the image, of the dimension of the index
+ * @param nDescriptors - The number of descriptors
+ * @return
+ * false in case of allocation failure or invalid argument, otherwise true.
+ */
+bool spBowIndexAddImage(SPBowIndex* index, int imageIndex, const SPPointView* descriptors, int nDescriptors);
+
+/**
+ * Calculates the IDF of every word and the norm of every image's weighted word vector.
+ * Must be called after all images were added, and before the index is queried or saved.
+ *
+ * @param index - The index
+ */
+void spBowIndexFinalize(SPBowIndex* index);
+
+/**
+ * Finds the kClosest images with the highest TF-IDF similarity to the query descriptors.
+ * The indices are ordered from the most similar image, ties broken in favour of the
+ * lower image index. Images that share no word with the query have a similarity of 0.
+ *
+ * @param index - The (finalized) index
+ * @param descriptors - The descriptors of the query image
+ * @param nDescriptors - The number of descriptors
+ * @param kClosest - The number of images to find
+ * @param resIndices - OUTPUT parameter. Has room for at least kClosest indices.
+ * @return
+ * -1 in case of allocation failure or invalid argument.
+ * Otherwise, the number of indices stored in resIndices (min(kClosest, nImages))
+ */
+int spBowIndexQuery(const SPBowIndex* index, const SPPointView* descriptors, int nDescriptors,
+		int kClosest, int* resIndices);
+
+/**
+ * Saves the (finalized) index - its vocabulary, weights and inverted file - to a file.
+ *
+ * @param fingerprint - Identifies the images and the settings the index was built from.
+ * Only a load with the same fingerprint accepts the file.
+ * @return
+ * false if the file couldn't be written, otherwise true.
+ */
+bool spBowIndexSave(const SPBowIndex* index, const char* path, uint64_t fingerprint);
+
+/**
+ * Loads an index that was saved by spBowIndexSave, with the given fingerprint.
+ *
+ * @return
+ * NULL if the file doesn't exist, isn't a valid index, was saved with another fingerprint,
+ * or allocation failure ocurred. Otherwise, the loaded index.
+ */
+SPBowIndex* spBowIndexLoad(const char* path, uint64_t fingerprint);
+
+/**
+ * A getter for the number of images the index was built for
+ *
+ * @assert index != NULL
+ */
+int spBowIndexGetNumOfImages(const SPBowIndex* index);
+
+/**
+ * A getter for the dimension of the descriptors of the index
+ *
+ * @assert index != NULL
+ */
+int spBowIndexGetDimension(const SPBowIndex* index);
+
+/**
+ * A getter for the number of children of each node of the vocabulary tree
+ *
+ * @assert index != NULL
+ */
+int spBowIndexGetBranchFactor(const SPBowIndex* index);
+
+/**
+ * A getter for the number of levels of the vocabulary tree below its root
+ *
+ * @assert index != NULL
+ */
+int spBowIndexGetDepth(const SPBowIndex* index);
+
+/**
+ * The memory the index takes, in bytes - the vocabulary tree, the posting lists and the weights.
+ * If index is NULL, 0.
+ */
+size_t spBowIndexGetMemoryUsage(const SPBowIndex* index);
+
+/**
+ * The most memory spBowIndexQuery takes while it runs for nDescriptors query descriptors, in bytes.
+ *
+ * @assert index != NULL
+ */
+size_t spBowIndexGetQueryMemoryUsage(const SPBowIndex* index, int nDescriptors, int kClosest);
+
+/**
+ * Free all memory associated with the index.
+ * If index is NULL nothing happens.
+ */
+void spBowIndexDestroy(SPBowIndex* index);
+
+#endif /* SP_BOW_INDEX_H_ */
@@ -0,0 +1,486 @@
+#include "sp_descriptor_file.h"
+#include "sp_parallel.h"
+#include "sp_kernels.h"
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/*Identifies finished descriptor files. An unfinished file has a zeroed magic*/
+#define DESCRIPTOR_FILE_MAGIC "SPDESC02"
+#define DESCRIPTOR_FILE_MAGIC_LENGTH 8
+
+/*The descriptors start at a multiple of this offset, so blocks are page aligned on disk*/
+#define DESCRIPTOR_FILE_DATA_ALIGNMENT 4096
+
+/*The header at the start of the file*/
+typedef struct descriptor_file_header_t {
+	char magic[DESCRIPTOR_FILE_MAGIC_LENGTH];
+	int32_t dim; /*The dimension of the descriptors*/
+	int32_t nImages; /*The number of images*/
+	int64_t nDescriptors; /*The total number of descriptors*/
+	int64_t dataOffset; /*The offset of the first descriptor in the file*/
+	uint64_t fingerprint; /*Identifies the images and settings the descriptors were extracted from*/
+} DescriptorFileHeader;
+
+struct sp_descriptor_file_t {
+	int fd; /*The file descriptor of the open file*/
+	bool isWriting; /*Whether the file was created for writing (or opened for reading)*/
+	int dim; /*The dimension of the descriptors*/
+	int nImages; /*The number of images*/
+	int nAppended; /*The number of images written so far, when writing*/
+	int64_t dataOffset; /*The offset of the first descriptor in the file*/
+	uint64_t fingerprint; /*Identifies the images and settings the descriptors were extracted from*/
+	int64_t* firstDescriptor; /*The position of the first descriptor of every image, and the total at [nImages]*/
+};
+
+/*The offset of the first descriptor in a file of nImages images*/
+static int64_t dataOffsetOf(int nImages)
+{
+	int64_t headerSize = (int64_t)sizeof(DescriptorFileHeader) + (int64_t)sizeof(int64_t) * nImages;
+	return (headerSize + DESCRIPTOR_FILE_DATA_ALIGNMENT - 1) / DESCRIPTOR_FILE_DATA_ALIGNMENT * DESCRIPTOR_FILE_DATA_ALIGNMENT;
+}
+
+/*Writes size bytes at offset, resuming after partial writes. Returns false on error*/
+static bool writeAll(int fd, const void* buffer, int64_t size, int64_t offset)
+{
+	const char* bytes = (const char*)buffer;
+	while (size > 0)
+	{
+		ssize_t written = pwrite(fd, bytes, (size_t)size, (off_t)offset);
+		if (written <= 0)
+			return false;
+		bytes += written;
+		offset += written;
+		size -= written;
+	}
+	return true;
+}
+
+/*Reads size bytes at offset, resuming after partial reads. Returns false on error or end of file*/
+static bool readAll(int fd, void* buffer, int64_t size, int64_t offset)
+{
+	char* bytes = (char*)buffer;
+	while (size > 0)
+	{
+		ssize_t nRead = pread(fd, bytes, (size_t)size, (off_t)offset);
+		if (nRead <= 0)
+			return false;
+		bytes += nRead;
+		offset += nRead;
+		size -= nRead;
+	}
+	return true;
+}
+
+/*Allocates a file struct with room for the counts of nImages images. Returns NULL on failure*/
+static SPDescriptorFile* allocFile(int fd, int dim, int nImages)
+{
+	SPDescriptorFile* file = (SPDescriptorFile*)malloc(sizeof(*file));
+	if (file == NULL)
+		return NULL;
+
+	file->firstDescriptor = (int64_t*)calloc((size_t)nImages + 1, sizeof(*file->firstDescriptor));
+	if (file->firstDescriptor == NULL)
+	{
+		free(file);
+		return NULL;
+	}
+
+	file->fd = fd;
+	file->isWriting = false;
+	file->dim = dim;
+	file->nImages = nImages;
+	file->nAppended = 0;
+	file->dataOffset = dataOffsetOf(nImages);
+	return file;
+}
+
+SPDescriptorFile* spDescriptorFileCreate(const char* path, int dim, int nImages, uint64_t fingerprint)
+{
+	if (path == NULL || dim <= 0 || nImages <= 0)
+		return NULL;
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return NULL;
+
+	SPDescriptorFile* file = allocFile(fd, dim, nImages);
+	if (file == NULL)
+	{
+		close(fd);
+		return NULL;
+	}
+	file->isWriting = true;
+	file->fingerprint = fingerprint;
+
+	/*A zeroed header marks the file as unfinished until spDescriptorFileFinish*/
+	DescriptorFileHeader header;
+	memset(&header, 0, sizeof(header));
+	if (!writeAll(fd, &header, sizeof(header), 0))
+	{
+		spDescriptorFileClose(file);
+		return NULL;
+	}
+
+	return file;
+}
+
+bool spDescriptorFileAppendImage(SPDescriptorFile* file, const double* descriptors, int64_t nDescriptors)
+{
+	if (file == NULL || !file->isWriting || file->nAppended == file->nImages ||
+		nDescriptors < 0 || (descriptors == NULL && nDescriptors > 0))
+		return false;
+
+	int64_t first = file->firstDescriptor[file->nAppended];
+	int64_t rowSize = (int64_t)sizeof(double) * file->dim;
+
+	if (!writeAll(file->fd, descriptors, nDescriptors * rowSize, file->dataOffset + first * rowSize))
+		return false;
+
+	file->nAppended++;
+	file->firstDescriptor[file->nAppended] = first + nDescriptors;
+	return true;
+}
+
+bool spDescriptorFileFinish(SPDescriptorFile* file)
+{
+	if (file == NULL || !file->isWriting)
+		return false;
+
+	bool isFinished = file->nAppended == file->nImages;
+
+	/*The counts, and then the header - the file is valid only once its magic is written*/
+	for(int i = 0; i < file->nImages && isFinished; ++i)
+	{
+		int64_t count = file->firstDescriptor[i + 1] - file->firstDescriptor[i];
+		isFinished = writeAll(file->fd, &count, sizeof(count), (int64_t)sizeof(DescriptorFileHeader) + (int64_t)sizeof(count) * i);
+	}
+
+	if (isFinished)
+	{
+		DescriptorFileHeader header;
+		memcpy(header.magic, DESCRIPTOR_FILE_MAGIC, DESCRIPTOR_FILE_MAGIC_LENGTH);
+		header.dim = file->dim;
+		header.nImages = file->nImages;
+		header.nDescriptors = file->firstDescriptor[file->nImages];
+		header.dataOffset = file->dataOffset;
+		header.fingerprint = file->fingerprint;
+		isFinished = writeAll(file->fd, &header, sizeof(header), 0);
+	}
+
+	if (close(file->fd) != 0)
+		isFinished = false;
+
+	file->fd = -1;
+	spDescriptorFileClose(file);
+	return isFinished;
+}
+
+SPDescriptorFile* spDescriptorFileOpen(const char* path)
+{
+	if (path == NULL)
+		return NULL;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	DescriptorFileHeader header;
+	SPDescriptorFile* file = NULL;
+
+	if (readAll(fd, &header, sizeof(header), 0) &&
+		memcmp(header.magic, DESCRIPTOR_FILE_MAGIC, DESCRIPTOR_FILE_MAGIC_LENGTH) == 0 &&
+		header.dim > 0 && header.nImages > 0 && header.dataOffset == dataOffsetOf(header.nImages))
+		file = allocFile(fd, header.dim, header.nImages);
+
+	if (file == NULL)
+	{
+		close(fd);
+		return NULL;
+	}
+	file->fingerprint = header.fingerprint;
+
+	/*The counts, accumulated into the position of every image's first descriptor*/
+	bool isValid = true;
+	for(int i = 0; i < file->nImages && isValid; ++i)
+	{
+		int64_t count = 0;
+		isValid = readAll(fd, &count, sizeof(count), (int64_t)sizeof(header) + (int64_t)sizeof(count) * i) && count >= 0;
+		file->firstDescriptor[i + 1] = file->firstDescriptor[i] + count;
+	}
+
+	/*The file must hold all the descriptors its header promises*/
+	struct stat fileStat;
+	isValid = isValid && file->firstDescriptor[file->nImages] == header.nDescriptors &&
+		fstat(fd, &fileStat) == 0 &&
+		(int64_t)fileStat.st_size >= file->dataOffset + header.nDescriptors * (int64_t)sizeof(double) * file->dim;
+
+	if (!isValid)
+	{
+		spDescriptorFileClose(file);
+		return NULL;
+	}
+
+	return file;
+}
+
+int spDescriptorFileGetNumOfImages(const SPDescriptorFile* file)
+{
+	assert(file != NULL);
+	return file->nImages;
+}
+
+int spDescriptorFileGetDimension(const SPDescriptorFile* file)
+{
+	assert(file != NULL);
+	return file->dim;
+}
+
+uint64_t spDescriptorFileGetFingerprint(const SPDescriptorFile* file)
+{
+	assert(file != NULL);
+	return file->fingerprint;
+}
+
+int64_t spDescriptorFileGetNumOfDescriptors(const SPDescriptorFile* file, int imageIndex)
+{
+	assert(file != NULL && imageIndex >= 0 && imageIndex < file->nImages);
+	return file->firstDescriptor[imageIndex + 1] - file->firstDescriptor[imageIndex];
+}
+
+int64_t spDescriptorFileGetTotalNumOfDescriptors(const SPDescriptorFile* file)
+{
+	assert(file != NULL);
+	return file->firstDescriptor[file->nImages];
+}
+
+/*
+ * Reads the descriptors [first, first + n) into data, and the image of each into imageIndices.
+ */
+static bool readBlock(const SPDescriptorFile* file, int64_t first, int64_t n, double* data, int* imageIndices)
+{
+	int64_t rowSize = (int64_t)sizeof(double) * file->dim;
+	if (!readAll(file->fd, data, n * rowSize, file->dataOffset + first * rowSize))
+		return false;
+
+	/*The image of the first descriptor - the last image that starts at or before it*/
+	int image = (int)(std::upper_bound(file->firstDescriptor, file->firstDescriptor + file->nImages + 1, first) -
+			file->firstDescriptor) - 1;
+
+	for(int64_t i = 0; i < n; ++i)
+	{
+		while (file->firstDescriptor[image + 1] <= first + i)
+			++image;
+		imageIndices[i] = image;
+	}
+
+	return true;
+}
+
+/*The number of descriptors in each block of a scan of total descriptors, in blocks of blockSize bytes*/
+static int64_t blockDescriptorsOf(const SPDescriptorFile* file, int64_t blockSize, int64_t total)
+{
+	int64_t blockDescriptors = std::max((int64_t)1, blockSize / ((int64_t)sizeof(double) * file->dim));
+	return std::min(blockDescriptors, std::max((int64_t)1, total));
+}
+
+/*Hints the kernel about how the descriptors [first, first + n) will be accessed*/
+static void adviseRange(const SPDescriptorFile* file, int64_t first, int64_t n, int advice)
+{
+	int64_t rowSize = (int64_t)sizeof(double) * file->dim;
+	if (n > 0)
+		posix_fadvise(file->fd, (off_t)(file->dataOffset + first * rowSize), (off_t)(n * rowSize), advice);
+}
+
+bool spDescriptorFileScan(const SPDescriptorFile* file, int64_t blockSize,
+		SPDescriptorBlockCallback callback, void* context)
+{
+	if (file == NULL)
+		return false;
+
+	return spDescriptorFileScanRange(file, 0, file->nImages, blockSize, callback, context);
+}
+
+bool spDescriptorFileScanRange(const SPDescriptorFile* file, int firstImage, int endImage, int64_t blockSize,
+		SPDescriptorBlockCallback callback, void* context)
+{
+	if (file == NULL || file->isWriting || callback == NULL ||
+		firstImage < 0 || endImage > file->nImages || firstImage > endImage)
+		return false;
+
+	/*The descriptors of the range are [start, start + total)*/
+	int64_t start = file->firstDescriptor[firstImage];
+	int64_t total = file->firstDescriptor[endImage] - start;
+	int64_t blockDescriptors = blockDescriptorsOf(file, blockSize, total);
+
+	/*Two buffers - the callback reads one while the next block is read into the other*/
+	double* data[2];
+	int* imageIndices[2];
+	bool isAllocated = true;
+	for(int i = 0; i < 2; ++i)
+	{
+		data[i] = (double*)malloc(sizeof(double) * (size_t)(blockDescriptors * file->dim));
+		imageIndices[i] = (int*)malloc(sizeof(int) * (size_t)blockDescriptors);
+		isAllocated = isAllocated && data[i] != NULL && imageIndices[i] != NULL;
+	}
+
+	bool isOk = isAllocated;
+	adviseRange(file, start, total, POSIX_FADV_SEQUENTIAL);
+
+	if (isOk && total > 0)
+		isOk = readBlock(file, start, std::min(blockDescriptors, total), data[0], imageIndices[0]);
+
+	/*first is relative to start*/
+	for(int64_t first = 0, current = 0; isOk && first < total; first += blockDescriptors, current = 1 - current)
+	{
+		int64_t next = first + blockDescriptors;
+		int64_t nNext = std::min(blockDescriptors, total - next);
+		bool isNextRead = true;
+		std::thread reader;
+
+		if (nNext > 0)
+		{
+			/*The block after the next one is read ahead by the kernel in the meantime*/
+			adviseRange(file, start + next + blockDescriptors, std::min(blockDescriptors, total - next - blockDescriptors), POSIX_FADV_WILLNEED);
+
+			try {
+				reader = std::thread([&]() {
+					isNextRead = readBlock(file, start + next, nNext, data[1 - current], imageIndices[1 - current]);
+				});
+			} catch (const std::system_error&) {
+				isNextRead = readBlock(file, start + next, nNext, data[1 - current], imageIndices[1 - current]);
+			}
+		}
+
+		SPDescriptorBlock block;
+		block.data = data[current];
+		block.imageIndices = imageIndices[current];
+		block.firstDescriptor = start + first;
+		block.nDescriptors = std::min(blockDescriptors, total - first);
+		block.dim = file->dim;
+
+		isOk = callback(&block, context);
+
+		if (reader.joinable())
+			reader.join();
+		isOk = isOk && isNextRead;
+
+		/*The block won't be needed again - don't let it push other pages out of the cache*/
+		adviseRange(file, start + first, block.nDescriptors, POSIX_FADV_DONTNEED);
+	}
+
+	for(int i = 0; i < 2; ++i)
+	{
+		free(data[i]);
+		free(imageIndices[i]);
+	}
+
+	return isOk;
+}
+
+/*The state of spDescriptorFileFindClosest, shared by all blocks of the scan*/
+typedef struct find_closest_context_t {
+	const SPPointView* queries;
+	int nQueries;
+	int kClosest;
+	double* values; /*The distances of the closest descriptors found so far, kClosest per query*/
+	int* images; /*The images of the closest descriptors found so far, kClosest per query*/
+	int* sizes; /*The number of closest descriptors found so far for each query*/
+} FindClosestContext;
+
+static bool findClosestInBlock(const SPDescriptorBlock* block, void* contextPtr)
+{
+	FindClosestContext* context = (FindClosestContext*)contextPtr;
+
+	/*Every query keeps its own list, so the queries can be spread over threads.
+	 * Each list is offered the descriptors in file order, as a sequential scan would*/
+	spParallelFor(context->nQueries, 0, [&](int q) {
+		int k = context->kClosest;
+		double* values = context->values + (size_t)q * k;
+		int* images = context->images + (size_t)q * k;
+
+		for(int64_t i = 0; i < block->nDescriptors; ++i)
+		{
+			SPPointView descriptor = spPointViewCreate(block->data + i * block->dim, block->dim, block->imageIndices[i]);
+			double distance = spPointViewL2SquaredDistance(&descriptor, &context->queries[q]);
+			spKernelTopKOffer(values, images, &context->sizes[q], k, block->imageIndices[i], distance);
+		}
+	});
+
+	return true;
+}
+
+bool spDescriptorFileFindClosest(const SPDescriptorFile* file, const SPPointView* queries, int nQueries,
+		int kClosest, int64_t blockSize, int* resImages, int* resSizes)
+{
+	if (file == NULL)
+		return false;
+
+	return spDescriptorFileFindClosestInRange(file, 0, file->nImages, queries, nQueries, kClosest, blockSize,
+			NULL, resImages, resSizes);
+}
+
+bool spDescriptorFileFindClosestInRange(const SPDescriptorFile* file, int firstImage, int endImage,
+		const SPPointView* queries, int nQueries, int kClosest, int64_t blockSize,
+		double* resDistances, int* resImages, int* resSizes)
+{
+	if (file == NULL || queries == NULL || nQueries < 0 || kClosest <= 0 || resImages == NULL || resSizes == NULL)
+		return false;
+
+	for(int q = 0; q < nQueries; ++q)
+		if (queries[q].dim != file->dim)
+			return false;
+
+	FindClosestContext context;
+	context.queries = queries;
+	context.nQueries = nQueries;
+	context.kClosest = kClosest;
+	context.values = resDistances;
+	context.images = resImages;
+	context.sizes = resSizes;
+
+	if (resDistances == NULL)
+		context.values = (double*)malloc(sizeof(*context.values) * ((size_t)nQueries * kClosest + 1));
+
+	if (context.values == NULL)
+		return false;
+
+	memset(resSizes, 0, sizeof(*resSizes) * nQueries);
+	bool isOk = spDescriptorFileScanRange(file, firstImage, endImage, blockSize, findClosestInBlock, &context);
+
+	if (resDistances == NULL)
+		free(context.values);
+	return isOk;
+}
+
+size_t spDescriptorFileGetMemoryUsage(const SPDescriptorFile* file)
+{
+	if (file == NULL)
+		return 0;
+
+	return sizeof(*file) + sizeof(*file->firstDescriptor) * ((size_t)file->nImages + 1);
+}
+
+size_t spDescriptorFileGetScanMemoryUsage(const SPDescriptorFile* file, int64_t blockSize)
+{
+	assert(file != NULL);
+	int64_t blockDescriptors = blockDescriptorsOf(file, blockSize, file->firstDescriptor[file->nImages]);
+
+	/*The two buffers of spDescriptorFileScanRange*/
+	return 2 * (sizeof(double) * (size_t)(blockDescriptors * file->dim) + sizeof(int) * (size_t)blockDescriptors);
+}
+
+void spDescriptorFileClose(SPDescriptorFile* file)
+{
+	if (file != NULL)
+	{
+		if (file->fd >= 0)
+			close(file->fd);
+		free(file->firstDescriptor);
+		free(file);
+	}
+}
@@ -0,0 +1,222 @@
+#ifndef SP_DESCRIPTOR_FILE_H_
+#define SP_DESCRIPTOR_FILE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+extern "C"{
+	#include "SPPoint.h"
+}
+
+/**
+ * SPDescriptorFile Summary
+ * Keeps the local descriptors of a database of images on disk, so they can be
+ * searched without ever being resident in memory all at once.
+ *
+ * The file holds a header, the number of descriptors of every image, and then
+ * all descriptors of all images, image after image, as rows of doubles. Only the
+ * header and the per-image counts are kept in memory - the descriptors are
+ * streamed in fixed-size blocks. All descriptor counts and offsets are 64-bit.
+ *
+ * A file is written once, image after image, and only becomes valid when it is
+ * finished - an interrupted write leaves a file that spDescriptorFileOpen rejects.
+ *
+ * The following functions are supported:
+ *
+ * spDescriptorFileCreate			- Creates a new file to write descriptors to
+ * spDescriptorFileAppendImage		- Writes the descriptors of the next image
+ * spDescriptorFileFinish			- Completes a written file and closes it
+ * spDescriptorFileOpen				- Opens a finished file for reading
+ * spDescriptorFileGetNumOfImages	- A getter of the number of images in a file
+ * spDescriptorFileGetDimension		- A getter of the descriptor dimension of a file
+ * spDescriptorFileGetFingerprint	- A getter of the fingerprint a file was created with
+ * spDescriptorFileGetNumOfDescriptors	- A getter of the number of descriptors of an image
+ * spDescriptorFileGetTotalNumOfDescriptors	- A getter of the number of descriptors of all images
+ * spDescriptorFileScan				- Streams all descriptors of a file through a callback, block by block
+ * spDescriptorFileScanRange		- Streams the descriptors of a range of images through a callback
+ * spDescriptorFileFindClosest		- Finds the closest descriptors to each of a set of queries
+ * spDescriptorFileFindClosestInRange	- Same, among the descriptors of a range of images only
+ * spDescriptorFileGetMemoryUsage	- The memory a file keeps resident
+ * spDescriptorFileGetScanMemoryUsage	- The memory a scan of a file takes while it runs
+ * spDescriptorFileClose			- Free all resources associated with a file
+ *
+ */
+
+/** The default size of the blocks descriptors are streamed in **/
+#define SP_DESCRIPTOR_FILE_DEFAULT_BLOCK_SIZE (64 << 20)
+
+/** Type for defining the descriptor file **/
+typedef struct sp_descriptor_file_t SPDescriptorFile;
+
+/** A block of consecutive descriptors, as handed to a scan callback **/
+typedef struct sp_descriptor_block_t {
+	const double* data; /*The descriptors of the block, one row of dim values after the other*/
+	const int* imageIndices; /*The image each descriptor of the block belongs to*/
+	int64_t firstDescriptor; /*The position of the block's first descriptor among all descriptors of the file*/
+	int64_t nDescriptors; /*The number of descriptors in the block*/
+	int dim; /*The dimension of the descriptors*/
+} SPDescriptorBlock;
+
+/**
+ * A callback that receives every block of a scan, in file order.
+ * Returns false to stop the scan.
+ */
+typedef bool (*SPDescriptorBlockCallback)(const SPDescriptorBlock* block, void* context);
+
+/**
+ * Creates a new file for the descriptors of nImages images, replacing any existing file.
+ *
+ * @param fingerprint - Identifies the images and extraction settings the descriptors are of,
+ * so a reader can tell whether the file holds the descriptors it needs
+ * @return
+ * NULL if the file can't be created, dim <= 0, nImages <= 0 or allocation failure ocurred.
+ * Otherwise, the file, ready for spDescriptorFileAppendImage.
+ */
+SPDescriptorFile* spDescriptorFileCreate(const char* path, int dim, int nImages, uint64_t fingerprint);
+
+/**
+ * Writes the descriptors of the next image - images are appended in increasing index order.
+ *
+ * @param file - A file returned by spDescriptorFileCreate
+ * @param descriptors - nDescriptors rows of dim values
+ * @param nDescriptors - The number of descriptors of the image
+ * @return
+ * false if writing failed or all nImages images were already appended, otherwise true.
+ */
+bool spDescriptorFileAppendImage(SPDescriptorFile* file, const double* descriptors, int64_t nDescriptors);
+
+/**
+ * Writes the header and per-image counts of a file all of whose images were appended,
+ * and frees it. The file must then be opened with spDescriptorFileOpen to be read.
+ *
+ * @return
+ * false if not all images were appended or writing failed, otherwise true.
+ */
+bool spDescriptorFileFinish(SPDescriptorFile* file);
+
+/**
+ * Opens a finished descriptor file for reading.
+ *
+ * @return
+ * NULL if the file doesn't exist, isn't a finished descriptor file, or allocation failure ocurred.
+ * Otherwise, the file.
+ */
+SPDescriptorFile* spDescriptorFileOpen(const char* path);
+
+/**
+ * A getter for the number of images in the file
+ *
+ * @assert file != NULL
+ */
+int spDescriptorFileGetNumOfImages(const SPDescriptorFile* file);
+
+/**
+ * A getter for the dimension of the descriptors in the file
+ *
+ * @assert file != NULL
+ */
+int spDescriptorFileGetDimension(const SPDescriptorFile* file);
+
+/**
+ * A getter for the fingerprint the file was created with
+ *
+ * @assert file != NULL
+ */
+uint64_t spDescriptorFileGetFingerprint(const SPDescriptorFile* file);
+
+/**
+ * A getter for the number of descriptors of an image
+ *
+ * @assert file != NULL && 0 <= imageIndex < the number of images
+ */
+int64_t spDescriptorFileGetNumOfDescriptors(const SPDescriptorFile* file, int imageIndex);
+
+/**
+ * A getter for the number of descriptors of all images in the file
+ *
+ * @assert file != NULL
+ */
+int64_t spDescriptorFileGetTotalNumOfDescriptors(const SPDescriptorFile* file);
+
+/**
+ * Streams all descriptors of an opened file through callback, in blocks of up to blockSize bytes,
+ * in file order. While the callback processes a block, the next one is already being read,
+ * and the kernel is asked to read ahead the one after it.
+ *
+ * @param file - A file returned by spDescriptorFileOpen
+ * @param blockSize - The size of each block in bytes. Holds at least one descriptor.
+ * @param callback - Called with every block, until it returns false
+ * @param context - Passed to callback as is
+ * @return
+ * false if reading failed, allocation failure ocurred, or callback stopped the scan. Otherwise true.
+ */
+bool spDescriptorFileScan(const SPDescriptorFile* file, int64_t blockSize,
+		SPDescriptorBlockCallback callback, void* context);
+
+/**
+ * Same as spDescriptorFileScan, for the descriptors of the images [firstImage, endImage) only.
+ *
+ * @return
+ * false if reading failed, allocation failure ocurred, the range is invalid, or callback stopped the scan.
+ * Otherwise true.
+ */
+bool spDescriptorFileScanRange(const SPDescriptorFile* file, int firstImage, int endImage, int64_t blockSize,
+		SPDescriptorBlockCallback callback, void* context);
+
+/**
+ * Finds the kClosest descriptors of the file to each query, by L2-squared distance, in a single
+ * scan of the file. The query descriptors are spread over threads for every block.
+ *
+ * The result of each query is exactly that of spBestSIFTL2SquaredDistance over the same
+ * descriptors: the image indices of the closest descriptors, from the closest, with ties broken
+ * in favour of the lower image index.
+ *
+ * @param file - A file returned by spDescriptorFileOpen
+ * @param queries - The query descriptors, of the file's dimension
+ * @param nQueries - The number of queries
+ * @param kClosest - The number of closest descriptors to find for each query
+ * @param blockSize - The size of the blocks the file is streamed in, in bytes
+ * @param resImages - OUTPUT parameter. Has room for nQueries * kClosest indices. Receives the
+ * 					  image indices of the closest descriptors of query q at q * kClosest.
+ * @param resSizes - OUTPUT parameter. Has room for nQueries counts. Receives the number of
+ * 					 indices found for each query (less than kClosest only if the file has fewer descriptors).
+ * @return
+ * false if reading failed, allocation failure ocurred or any argument is invalid. Otherwise true.
+ */
+bool spDescriptorFileFindClosest(const SPDescriptorFile* file, const SPPointView* queries, int nQueries,
+		int kClosest, int64_t blockSize, int* resImages, int* resSizes);
+
+/**
+ * Same as spDescriptorFileFindClosest, among the descriptors of the images [firstImage, endImage) only,
+ * with the distances of the closest descriptors too.
+ *
+ * @param resDistances - OUTPUT parameter. If not NULL, has room for nQueries * kClosest values, and receives
+ * 						 the distances of the closest descriptors, laid out like resImages.
+ * @return
+ * false if reading failed, allocation failure ocurred or any argument is invalid. Otherwise true.
+ */
+bool spDescriptorFileFindClosestInRange(const SPDescriptorFile* file, int firstImage, int endImage,
+		const SPPointView* queries, int nQueries, int kClosest, int64_t blockSize,
+		double* resDistances, int* resImages, int* resSizes);
+
+/**
+ * The memory the file keeps resident between scans - its header and per-image counts - in bytes.
+ * If file is NULL, 0.
+ */
+size_t spDescriptorFileGetMemoryUsage(const SPDescriptorFile* file);
+
+/**
+ * The memory of the buffers a scan of all descriptors of the file in blocks of blockSize bytes
+ * takes while it runs, in bytes.
+ *
+ * @assert file != NULL
+ */
+size_t spDescriptorFileGetScanMemoryUsage(const SPDescriptorFile* file, int64_t blockSize);
+
+/**
+ * Free all resources associated with the file, and close it.
+ * If file is NULL nothing happens.
+ */
+void spDescriptorFileClose(SPDescriptorFile* file);
+
+#endif /* SP_DESCRIPTOR_FILE_H_ */
@@ -0,0 +1,296 @@
+#include "sp_hist_matrix.h"
+#include "sp_kernels.h"
+#include <cstdlib>
+#include <cassert>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*The proportion each channel contributes toward the total L2 distance calculated based on RGB hists.
+ * Must match the one spRGBHistL2Distance uses*/
+#define CHANNEL_L2_DISTANCE_PROPORTION 0.33
+
+
+SPHistMatrix* spHistMatrixCreate(int nImages, int nBins)
+{
+	if (nImages <= 0 || nBins <= 0)
+		return NULL;
+
+	SPHistMatrix* matrix = (SPHistMatrix*)malloc(sizeof(*matrix));
+	if (matrix == NULL)
+		return NULL;
+
+	matrix->nImages = nImages;
+	matrix->nBins = nBins;
+	matrix->rowLength = SP_HIST_MATRIX_NUM_OF_CHANNELS * nBins;
+	matrix->data = (double*)calloc((size_t)nImages * matrix->rowLength, sizeof(*matrix->data));
+	matrix->isOwningData = true;
+	matrix->nLevels = 0;
+
+	if (matrix->data == NULL)
+	{
+		free(matrix);
+		return NULL;
+	}
+
+	return matrix;
+}
+
+SPHistMatrix* spHistMatrixCreateOver(const double* data, int nImages, int nBins)
+{
+	if (data == NULL || nImages <= 0 || nBins <= 0)
+		return NULL;
+
+	SPHistMatrix* matrix = (SPHistMatrix*)malloc(sizeof(*matrix));
+	if (matrix == NULL)
+		return NULL;
+
+	matrix->nImages = nImages;
+	matrix->nBins = nBins;
+	matrix->rowLength = SP_HIST_MATRIX_NUM_OF_CHANNELS * nBins;
+	matrix->data = (double*)data; /*Only read through the matrix*/
+	matrix->isOwningData = false;
+	matrix->nLevels = 0;
+	return matrix;
+}
+
+void spHistMatrixDestroy(SPHistMatrix* matrix)
+{
+	if (matrix != NULL)
+	{
+		if (matrix->isOwningData)
+			free(matrix->data);
+		for(int level = 0; level < matrix->nLevels; ++level)
+			free(matrix->levelData[level]);
+		free(matrix);
+	}
+}
+
+size_t spHistMatrixGetMemoryUsage(const SPHistMatrix* matrix)
+{
+	if (matrix == NULL)
+		return 0;
+
+	size_t usage = sizeof(*matrix);
+	if (matrix->isOwningData)
+		usage += sizeof(*matrix->data) * (size_t)matrix->nImages * matrix->rowLength;
+
+	for(int level = 0; level < matrix->nLevels; ++level)
+		usage += sizeof(*matrix->levelData[level]) * (size_t)matrix->nImages * SP_HIST_MATRIX_NUM_OF_CHANNELS * matrix->levelBins[level];
+
+	return usage;
+}
+
+double* spHistMatrixGetRow(const SPHistMatrix* matrix, int imageIndex)
+{
+	assert(matrix != NULL && imageIndex >= 0 && imageIndex < matrix->nImages);
+	return matrix->data + (size_t)imageIndex * matrix->rowLength;
+}
+
+/*
+ * The L2-squared distance between two channel hists of n bins.
+ *
+ * The sum is accumulated in several independent lanes, so it is not added in the
+ * same order as spPointL2SquaredDistance. Hist bins hold integer pixel counts, so every
+ * square and partial sum is an integer that a double represents exactly (for any image
+ * below ~40 megapixels), and the order of additions doesn't change the result.
+ */
+static inline double channelL2SquaredDistance(const double* a, const double* b, int n)
+{
+	int i = 0;
+	double distance = 0;
+
+#ifdef __SSE2__
+	__m128d acc0 = _mm_setzero_pd();
+	__m128d acc1 = _mm_setzero_pd();
+
+	for(; i + 4 <= n; i += 4)
+	{
+		__m128d diff0 = _mm_sub_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i));
+		__m128d diff1 = _mm_sub_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2));
+		acc0 = _mm_add_pd(acc0, _mm_mul_pd(diff0, diff0));
+		acc1 = _mm_add_pd(acc1, _mm_mul_pd(diff1, diff1));
+	}
+
+	double lanes[2];
+	_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+	distance = lanes[0] + lanes[1];
+#else
+	double acc[4] = {0, 0, 0, 0};
+
+	for(; i + 4 <= n; i += 4)
+		for(int lane = 0; lane < 4; ++lane)
+			acc[lane] += (a[i + lane] - b[i + lane]) * (a[i + lane] - b[i + lane]);
+
+	distance = (acc[0] + acc[1]) + (acc[2] + acc[3]);
+#endif
+
+	for(; i < n; ++i) /*The bins that don't fill a whole lane*/
+		distance += (a[i] - b[i]) * (a[i] - b[i]);
+
+	return distance;
+}
+
+double spHistMatrixDistance(const SPHistMatrix* matrix, const double* queryHist, int imageIndex)
+{
+	assert(matrix != NULL && queryHist != NULL);
+	const double* row = spHistMatrixGetRow(matrix, imageIndex);
+	double averageDistance = 0;
+
+	/*One pass over the contiguous row - all channels of the image, one after the other.
+	 * The channels are weighted and added in the same order as spRGBHistL2Distance*/
+	for(int c = 0; c < SP_HIST_MATRIX_NUM_OF_CHANNELS; ++c)
+		averageDistance += CHANNEL_L2_DISTANCE_PROPORTION *
+			channelL2SquaredDistance(row + c * matrix->nBins, queryHist + c * matrix->nBins, matrix->nBins);
+
+	return averageDistance;
+}
+
+/*The number of bins of the full hists that are merged into one at a level of coarse hists*/
+static inline int levelGroupSize(int level)
+{
+	int group = SP_HIST_MATRIX_LEVEL_FACTOR;
+	for(int i = 0; i < level; ++i)
+		group *= SP_HIST_MATRIX_LEVEL_FACTOR;
+	return group;
+}
+
+/*Merges every group adjacent bins of the channel hists of a row (of nBins bins per channel) into one*/
+static void mergeBins(const double* row, int nBins, int group, int levelBins, double* levelRow)
+{
+	for(int c = 0; c < SP_HIST_MATRIX_NUM_OF_CHANNELS; ++c)
+	{
+		double* levelHist = levelRow + c * levelBins;
+		for(int b = 0; b < levelBins; ++b)
+			levelHist[b] = 0;
+		for(int b = 0; b < nBins; ++b)
+			levelHist[b / group] += row[c * nBins + b];
+	}
+}
+
+/*
+ * Whether the distance of an image can't be below kthValue, by the lower bounds of the levels of
+ * coarse hists - from the coarsest, which is the cheapest and loosest, to the finest.
+ *
+ * A level's bound is the distance of its hists over its group size, weighted and added like
+ * spHistMatrixDistance. The merged counts are exact integers and the group size a power of 2,
+ * so the bound is computed exactly and never exceeds the computed distance.
+ */
+static inline bool isBoundedOut(const SPHistMatrix* matrix, const double* queryLevels, int imageIndex, double kthValue)
+{
+	if (matrix->nLevels == 0)
+		return false;
+
+	/*The query's levels are one after the other, from the finest - start from the end of them*/
+	const double* queryLevel = queryLevels;
+	for(int level = 0; level < matrix->nLevels; ++level)
+		queryLevel += SP_HIST_MATRIX_NUM_OF_CHANNELS * matrix->levelBins[level];
+
+	for(int level = matrix->nLevels - 1; level >= 0; --level)
+	{
+		int levelBins = matrix->levelBins[level];
+		int levelRowLength = SP_HIST_MATRIX_NUM_OF_CHANNELS * levelBins;
+		double group = levelGroupSize(level);
+		queryLevel -= levelRowLength;
+
+		const double* levelRow = matrix->levelData[level] + (size_t)imageIndex * levelRowLength;
+		double bound = 0;
+		for(int c = 0; c < SP_HIST_MATRIX_NUM_OF_CHANNELS; ++c)
+			bound += CHANNEL_L2_DISTANCE_PROPORTION *
+				(channelL2SquaredDistance(levelRow + c * levelBins, queryLevel + c * levelBins, levelBins) / group);
+
+		if (bound >= kthValue)
+			return true;
+	}
+
+	return false;
+}
+
+int spHistMatrixFindClosest(const SPHistMatrix* matrix, const double* queryHist, int kClosest, int* resIndices)
+{
+	return spHistMatrixFindClosestExcluding(matrix, queryHist, kClosest, NULL, resIndices);
+}
+
+int spHistMatrixFindClosestExcluding(const SPHistMatrix* matrix, const double* queryHist, int kClosest,
+		const bool* isExcluded, int* resIndices)
+{
+	if (matrix == NULL || queryHist == NULL || kClosest <= 0 || resIndices == NULL)
+		return -1;
+
+	double* values = (double*)malloc(sizeof(*values) * kClosest);
+	if (values == NULL)
+		return -1;
+
+	/*The query's hists at every level of coarse hists, one after the other*/
+	size_t queryLevelsLength = 0;
+	for(int level = 0; level < matrix->nLevels; ++level)
+		queryLevelsLength += SP_HIST_MATRIX_NUM_OF_CHANNELS * matrix->levelBins[level];
+
+	double* queryLevels = NULL;
+	if (queryLevelsLength > 0)
+	{
+		queryLevels = (double*)malloc(sizeof(*queryLevels) * queryLevelsLength);
+		if (queryLevels == NULL)
+		{
+			free(values);
+			return -1;
+		}
+
+		double* queryLevel = queryLevels;
+		for(int level = 0; level < matrix->nLevels; ++level)
+		{
+			mergeBins(queryHist, matrix->nBins, levelGroupSize(level), matrix->levelBins[level], queryLevel);
+			queryLevel += SP_HIST_MATRIX_NUM_OF_CHANNELS * matrix->levelBins[level];
+		}
+	}
+
+	int size = 0;
+	for(int i = 0; i < matrix->nImages; ++i)
+	{
+		if (isExcluded != NULL && isExcluded[i])
+			continue;
+
+		/*Once k images were found, those that can't get closer than the k-th are skipped*/
+		if (size == kClosest && isBoundedOut(matrix, queryLevels, i, values[kClosest - 1]))
+			continue;
+
+		spKernelTopKOffer(values, resIndices, &size, kClosest, i, spHistMatrixDistance(matrix, queryHist, i));
+	}
+
+	free(queryLevels);
+	free(values);
+	return size;
+}
+
+bool spHistMatrixBuildLowerBounds(SPHistMatrix* matrix)
+{
+	if (matrix == NULL)
+		return false;
+
+	for(int level = 0; level < matrix->nLevels; ++level)
+		free(matrix->levelData[level]);
+	matrix->nLevels = 0;
+
+	for(int level = 0; level < SP_HIST_MATRIX_MAX_LEVELS; ++level)
+	{
+		int group = levelGroupSize(level);
+		int levelBins = (matrix->nBins + group - 1) / group;
+		if (levelBins < SP_HIST_MATRIX_MIN_LEVEL_BINS)
+			break;
+
+		int levelRowLength = SP_HIST_MATRIX_NUM_OF_CHANNELS * levelBins;
+		double* levelData = (double*)malloc(sizeof(*levelData) * (size_t)matrix->nImages * levelRowLength);
+		if (levelData == NULL)
+			return false; /*The levels built so far are still used*/
+
+		for(int i = 0; i < matrix->nImages; ++i)
+			mergeBins(spHistMatrixGetRow(matrix, i), matrix->nBins, group, levelBins, levelData + (size_t)i * levelRowLength);
+
+		matrix->levelBins[level] = levelBins;
+		matrix->levelData[level] = levelData;
+		matrix->nLevels++;
+	}
+
+	return true;
+}
@@ -0,0 +1,153 @@
+#ifndef SP_HIST_MATRIX_H_
+#define SP_HIST_MATRIX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * SPHistMatrix Summary
+ * Stores the RGB histograms of all images in the database in one contiguous,
+ * row-major matrix of nImages x (NUM_OF_CHANNELS * nBins) doubles.
+ * Row i holds the red, green and blue histograms of image i, one after the other,
+ * in the same layout spGetRGBHistData returns.
+ *
+ * Searching the matrix is a single sequential scan with a vectorized kernel,
+ * instead of chasing three SPPoint pointers per image.
+ *
+ * The scan can skip most images without their full distance: levels of coarse hists,
+ * each merging SP_HIST_MATRIX_LEVEL_FACTOR adjacent bins of the one before, give lower
+ * bounds on the distance - by Cauchy-Schwarz, the squared distance of hists with g bins
+ * merged is at most g times the full one. An image whose bound isn't below the distance
+ * of the k-th closest image so far can't be among the k closest, and is skipped. Bins hold
+ * integer pixel counts and g is a power of 2, so the bounds are computed exactly and the
+ * results are the same as without them.
+ *
+ * The following functions are supported:
+ *
+ * spHistMatrixCreate		- Creates a new, zeroed matrix
+ * spHistMatrixCreateOver	- Creates a matrix over existing values
+ * spHistMatrixDestroy		- Free all resources associated with a matrix
+ * spHistMatrixGetRow		- A getter of the row (all channel hists) of an image
+ * spHistMatrixDistance		- Calculates the RGB hist distance between a query and an image
+ * spHistMatrixFindClosest	- Finds the images closest to a query hist
+ * spHistMatrixFindClosestExcluding	- Finds the images closest to a query hist, skipping some
+ * spHistMatrixBuildLowerBounds	- Precomputes the coarse hists that prune the search
+ * spHistMatrixGetMemoryUsage	- The memory a matrix takes
+ *
+ */
+
+/** The number of channels each row of the matrix holds hists for (R,G,B) **/
+#define SP_HIST_MATRIX_NUM_OF_CHANNELS 3
+
+/** The number of adjacent bins merged into one, from one level of coarse hists to the next **/
+#define SP_HIST_MATRIX_LEVEL_FACTOR 4
+
+/** The fewest bins a level of coarse hists has - fewer don't tell images apart **/
+#define SP_HIST_MATRIX_MIN_LEVEL_BINS 2
+
+/** The most levels of coarse hists a matrix has **/
+#define SP_HIST_MATRIX_MAX_LEVELS 4
+
+/** Type for defining the hist matrix **/
+typedef struct sp_hist_matrix_t {
+	int nImages; /*The number of rows (images) in the matrix*/
+	int nBins; /*The number of bins in each channel hist*/
+	int rowLength; /*The number of values in a row - SP_HIST_MATRIX_NUM_OF_CHANNELS * nBins*/
+	double* data; /*The values of the matrix, row after row*/
+	bool isOwningData; /*Whether data is freed with the matrix*/
+	int nLevels; /*The number of levels of coarse hists, from the finest. 0 until they're built*/
+	int levelBins[SP_HIST_MATRIX_MAX_LEVELS]; /*The number of bins of each channel hist, at every level*/
+	double* levelData[SP_HIST_MATRIX_MAX_LEVELS]; /*The coarse hists of every level, laid out like data*/
+} SPHistMatrix;
+
+/**
+ * Allocates a new matrix for nImages images with nBins bins per channel.
+ * All values are initialised to 0.
+ *
+ * @return
+ * NULL in case allocation failure ocurred OR nImages <= 0 OR nBins <= 0
+ * Otherwise, the new matrix is returned
+ */
+SPHistMatrix* spHistMatrixCreate(int nImages, int nBins);
+
+/**
+ * Creates a matrix for nImages images with nBins bins per channel over existing values,
+ * laid out row after row, which aren't copied (e.g. read-only shared memory).
+ * The values must outlive the matrix, and the matrix must not be written to.
+ *
+ * @return
+ * NULL in case allocation failure ocurred OR data is NULL OR nImages <= 0 OR nBins <= 0
+ * Otherwise, the new matrix is returned
+ */
+SPHistMatrix* spHistMatrixCreateOver(const double* data, int nImages, int nBins);
+
+/**
+ * Free all memory associated with the matrix.
+ * If matrix is NULL nothing happens.
+ */
+void spHistMatrixDestroy(SPHistMatrix* matrix);
+
+/**
+ * A getter for the row of the given image.
+ *
+ * @assert matrix != NULL && 0 <= imageIndex < matrix->nImages
+ * @return
+ * A pointer to the rowLength values of the image's hists (red, then green, then blue)
+ */
+double* spHistMatrixGetRow(const SPHistMatrix* matrix, int imageIndex);
+
+/**
+ * Calculates the RGB hist distance between queryHist and the hists of the given image.
+ * The result is identical to spRGBHistL2Distance of the same hists.
+ *
+ * @param queryHist - rowLength values laid out like a row of the matrix
+ * @assert matrix != NULL && queryHist != NULL && 0 <= imageIndex < matrix->nImages
+ * @return
+ * The average L2-squared distance over all channels
+ */
+double spHistMatrixDistance(const SPHistMatrix* matrix, const double* queryHist, int imageIndex);
+
+/**
+ * Finds the kClosest images to queryHist by RGB hist distance.
+ * The indices are returned ordered from the closest image to the farthest.
+ * Ties are broken in favour of the lower image index, exactly as
+ * enqueueing all images in order into an SPBPQueue of size kClosest would.
+ *
+ * @param matrix - The hists of the database
+ * @param queryHist - rowLength values laid out like a row of the matrix
+ * @param kClosest - The number of images to find
+ * @param resIndices - OUTPUT parameter. Has room for at least kClosest indices.
+ * @return
+ * -1 if matrix/queryHist/resIndices is NULL, kClosest <= 0 or allocation error occurred.
+ * Otherwise, the number of indices stored in resIndices (min(kClosest, nImages))
+ */
+int spHistMatrixFindClosest(const SPHistMatrix* matrix, const double* queryHist, int kClosest, int* resIndices);
+
+/**
+ * Same as spHistMatrixFindClosest, but images whose isExcluded entry is true are skipped.
+ *
+ * @param isExcluded - An entry per image, or NULL to exclude none
+ * @return
+ * -1 if matrix/queryHist/resIndices is NULL, kClosest <= 0 or allocation error occurred.
+ * Otherwise, the number of indices stored in resIndices (at most kClosest)
+ */
+int spHistMatrixFindClosestExcluding(const SPHistMatrix* matrix, const double* queryHist, int kClosest,
+		const bool* isExcluded, int* resIndices);
+
+/**
+ * Precomputes the levels of coarse hists from the rows of the matrix, so the closest images
+ * are found without the full distance of most images. Must be called again after the rows
+ * are written - until then, a matrix is searched without them.
+ *
+ * @return
+ * false if matrix is NULL or allocation failure occurred (the matrix is then searched without
+ * coarse hists). Otherwise true.
+ */
+bool spHistMatrixBuildLowerBounds(SPHistMatrix* matrix);
+
+/**
+ * The memory the matrix takes, in bytes - without the values it doesn't own. If matrix is NULL, 0.
+ */
+size_t spHistMatrixGetMemoryUsage(const SPHistMatrix* matrix);
+
+#endif /* SP_HIST_MATRIX_H_ */
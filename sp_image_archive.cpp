@@ -0,0 +1,199 @@
+#include "sp_image_archive.h"
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <cassert>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*Identifies finished archives. An unfinished archive has a zeroed magic*/
+#define IMAGE_ARCHIVE_MAGIC "SPIMGAR1"
+#define IMAGE_ARCHIVE_MAGIC_LENGTH 8
+
+/*The header at the start of the archive*/
+typedef struct image_archive_header_t {
+	char magic[IMAGE_ARCHIVE_MAGIC_LENGTH];
+	int32_t nImages; /*The number of images*/
+	int32_t reserved;
+	int64_t dataOffset; /*The offset of the first image, right after the index*/
+} ImageArchiveHeader;
+
+/*The position of an image in the archive*/
+typedef struct image_archive_entry_t {
+	int64_t offset; /*From the start of the archive*/
+	int64_t length;
+} ImageArchiveEntry;
+
+struct sp_image_archive_t {
+	const unsigned char* base; /*The start of the mapped archive*/
+	size_t size; /*The size of the archive*/
+	int nImages;
+	const ImageArchiveEntry* entries; /*The index, an entry per image*/
+};
+
+/*Writes size bytes at offset, resuming after partial writes. Returns false on error*/
+static bool writeAll(int fd, const void* buffer, int64_t size, int64_t offset)
+{
+	const char* bytes = (const char*)buffer;
+	while (size > 0)
+	{
+		ssize_t written = pwrite(fd, bytes, (size_t)size, (off_t)offset);
+		if (written <= 0)
+			return false;
+		bytes += written;
+		offset += written;
+		size -= written;
+	}
+	return true;
+}
+
+/*
+ * Appends the file at imagePath to the archive at offset, through buffer (of bufferSize bytes).
+ * Returns the number of bytes appended, or -1 on error.
+ */
+static int64_t appendFile(int fd, const char* imagePath, int64_t offset, char* buffer, size_t bufferSize)
+{
+	int imageFd = open(imagePath, O_RDONLY);
+	if (imageFd < 0)
+		return -1;
+
+	int64_t length = 0;
+	ssize_t nRead = 0;
+	while ((nRead = read(imageFd, buffer, bufferSize)) > 0)
+	{
+		if (!writeAll(fd, buffer, nRead, offset + length))
+		{
+			nRead = -1;
+			break;
+		}
+		length += nRead;
+	}
+
+	close(imageFd);
+	return nRead < 0 ? -1 : length;
+}
+
+/*The size of the buffer images are copied into the archive through*/
+#define IMAGE_ARCHIVE_COPY_BUFFER_SIZE (1 << 20)
+
+bool spImageArchiveBuild(const char* path, const char* directory, const char* prefix, int nImages, const char* suffix)
+{
+	if (path == NULL || directory == NULL || prefix == NULL || suffix == NULL || nImages < 1)
+		return false;
+
+	/*Room for the layout, and any index*/
+	size_t imagePathSize = strlen(directory) + strlen(prefix) + strlen(suffix) + 16;
+	char* imagePath = (char*)malloc(imagePathSize);
+	char* buffer = (char*)malloc(IMAGE_ARCHIVE_COPY_BUFFER_SIZE);
+	ImageArchiveEntry* entries = (ImageArchiveEntry*)calloc(sizeof(*entries), nImages);
+	int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+
+	bool isOk = imagePath != NULL && buffer != NULL && entries != NULL && fd >= 0;
+
+	ImageArchiveHeader header;
+	memset(&header, 0, sizeof(header));
+	header.nImages = nImages;
+	header.dataOffset = (int64_t)sizeof(header) + (int64_t)sizeof(*entries) * nImages;
+
+	int64_t offset = header.dataOffset;
+	for(int i = 0; isOk && i < nImages; ++i)
+	{
+		snprintf(imagePath, imagePathSize, "%s%s%d%s", directory, prefix, i, suffix);
+
+		int64_t length = appendFile(fd, imagePath, offset, buffer, IMAGE_ARCHIVE_COPY_BUFFER_SIZE);
+		entries[i].offset = offset;
+		entries[i].length = length;
+		isOk = length > 0 && length <= INT_MAX; /*Decoded from a single buffer*/
+		offset += length;
+	}
+
+	/*The header with its magic is written last - the archive is valid only once it's complete*/
+	isOk = isOk && writeAll(fd, entries, (int64_t)sizeof(*entries) * nImages, sizeof(header));
+	memcpy(header.magic, IMAGE_ARCHIVE_MAGIC, IMAGE_ARCHIVE_MAGIC_LENGTH);
+	isOk = isOk && fsync(fd) == 0 && writeAll(fd, &header, sizeof(header), 0);
+
+	if (fd >= 0 && close(fd) != 0)
+		isOk = false;
+	if (!isOk && fd >= 0)
+		unlink(path);
+
+	free(imagePath);
+	free(buffer);
+	free(entries);
+	return isOk;
+}
+
+SPImageArchive* spImageArchiveOpen(const char* path)
+{
+	if (path == NULL)
+		return NULL;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	struct stat status;
+	void* mapped = MAP_FAILED;
+	if (fstat(fd, &status) == 0 && status.st_size >= (off_t)sizeof(ImageArchiveHeader))
+		mapped = mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); /*The mapping stays valid*/
+
+	if (mapped == MAP_FAILED)
+		return NULL;
+
+	const unsigned char* base = (const unsigned char*)mapped;
+	const ImageArchiveHeader* header = (const ImageArchiveHeader*)base;
+	const ImageArchiveEntry* entries = (const ImageArchiveEntry*)(base + sizeof(*header));
+	int64_t size = status.st_size;
+
+	/*Only a complete archive, whose images are all inside it*/
+	bool isValid = memcmp(header->magic, IMAGE_ARCHIVE_MAGIC, IMAGE_ARCHIVE_MAGIC_LENGTH) == 0 && header->nImages > 0 &&
+		header->dataOffset == (int64_t)sizeof(*header) + (int64_t)sizeof(*entries) * header->nImages &&
+		header->dataOffset <= size;
+
+	for(int i = 0; isValid && i < header->nImages; ++i)
+		isValid = entries[i].offset >= header->dataOffset && entries[i].length > 0 && entries[i].length <= INT_MAX &&
+			entries[i].offset <= size - entries[i].length;
+
+	SPImageArchive* archive = isValid ? (SPImageArchive*)malloc(sizeof(*archive)) : NULL;
+	if (archive == NULL)
+	{
+		munmap(mapped, status.st_size);
+		return NULL;
+	}
+
+	/*The images are read once, in order - read ahead of them, and drop them once read*/
+	madvise(mapped, status.st_size, MADV_SEQUENTIAL);
+
+	archive->base = base;
+	archive->size = status.st_size;
+	archive->nImages = header->nImages;
+	archive->entries = entries;
+	return archive;
+}
+
+int spImageArchiveGetNumOfImages(const SPImageArchive* archive)
+{
+	assert(archive != NULL);
+	return archive->nImages;
+}
+
+void spImageArchiveGetImage(const SPImageArchive* archive, int imageIndex, const unsigned char** data, size_t* length)
+{
+	assert(archive != NULL && imageIndex >= 0 && imageIndex < archive->nImages && data != NULL && length != NULL);
+	*data = archive->base + archive->entries[imageIndex].offset;
+	*length = (size_t)archive->entries[imageIndex].length;
+}
+
+void spImageArchiveClose(SPImageArchive* archive)
+{
+	if (archive != NULL)
+	{
+		munmap((void*)archive->base, archive->size);
+		free(archive);
+	}
+}
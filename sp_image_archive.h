@@ -0,0 +1,72 @@
+#ifndef SP_IMAGE_ARCHIVE_H_
+#define SP_IMAGE_ARCHIVE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * SPImageArchive Summary
+ * Packs the encoded image files of a database into one file, so ingest reads a
+ * single file sequentially instead of opening and reading a file per image.
+ *
+ * An archive is a header, an index of the offset and length of every image, and
+ * the encoded images themselves (as they were in their files), one after the
+ * other in image index order. It's mapped read-only, and its images are decoded
+ * straight from the mapping.
+ *
+ * The following functions are supported:
+ *
+ * spImageArchiveBuild			- Packs the images of a directory/prefix/suffix layout into an archive
+ * spImageArchiveOpen			- Maps an archive read-only
+ * spImageArchiveGetNumOfImages	- A getter of the number of images in an archive
+ * spImageArchiveGetImage		- A getter of the encoded bytes of an image
+ * spImageArchiveClose			- Unmaps an archive
+ *
+ */
+
+/** Type for defining an opened image archive **/
+typedef struct sp_image_archive_t SPImageArchive;
+
+/**
+ * Packs the images directory + prefix + index + suffix, for every index in [0, nImages),
+ * into a new archive at path (replacing a file there).
+ *
+ * @return
+ * false if an image can't be read, the archive can't be written, or any argument is invalid.
+ * Otherwise true.
+ */
+bool spImageArchiveBuild(const char* path, const char* directory, const char* prefix, int nImages, const char* suffix);
+
+/**
+ * Maps an archive read-only, to be read from the first image to the last.
+ *
+ * @return
+ * NULL if the file can't be mapped, it isn't a valid archive, or allocation failure occurred.
+ * Otherwise, the archive.
+ */
+SPImageArchive* spImageArchiveOpen(const char* path);
+
+/**
+ * A getter for the number of images in the archive
+ *
+ * @assert archive != NULL
+ */
+int spImageArchiveGetNumOfImages(const SPImageArchive* archive);
+
+/**
+ * A getter for the encoded bytes of an image, as they were in its file.
+ * They point into the archive, and are valid until it's closed.
+ *
+ * @param data - OUTPUT parameter. The first byte of the image.
+ * @param length - OUTPUT parameter. The number of bytes of the image.
+ * @assert archive != NULL && 0 <= imageIndex < the number of images && data != NULL && length != NULL
+ */
+void spImageArchiveGetImage(const SPImageArchive* archive, int imageIndex, const unsigned char** data, size_t* length);
+
+/**
+ * Unmaps the archive and frees all its resources.
+ * If archive is NULL nothing happens.
+ */
+void spImageArchiveClose(SPImageArchive* archive);
+
+#endif /* SP_IMAGE_ARCHIVE_H_ */
@@ -2,8 +2,14 @@
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
+#include <opencv2/features2d.hpp>
 #include <opencv2/xfeatures2d.hpp>
 
+#include <algorithm>
+#include <cstring>
+#include "sp_parallel.h"
+#include "sp_kernels.h"
+
 using namespace cv;
 
 extern "C"{
@@ -13,68 +19,292 @@ extern "C"{
 /*The number of channels that are expected on input (R,G,B)*/
 #define NUM_OF_CHANNELS 3
 
-/* Error message in case we loaded an empty image */
-#define EMPTY_IMAGE_LOADED_ERROR "Image cannot be loaded"
-#define EMPTY_IMAGE_LOADED_ERROR_FORMAT "%s - %s\n"
-
 /* Error code for */
 #define ERROR_CODE -1
 
 /*The proportion each channel contributes toward the total L2 distance calculated based on RGB hists*/
 #define CHANNEL_L2_DISTANCE_PROPORTION 0.33
 
+/* Allocates a points array either from the arena, or from the heap if arena is NULL */
+static SPPoint** allocPointsArray(int nPoints, SPPointArena* arena) {
+    if (arena != NULL) {
+        return (SPPoint**)spPointArenaAlloc(arena, sizeof(SPPoint*) * nPoints);
+    }
+    return (SPPoint**)malloc(sizeof(SPPoint*) * nPoints);
+}
 
-SPPoint** spGetRGBHist(const char* str,int imageIndex, int nBins) {
-    if (str == NULL || nBins <= 0) {
-        return NULL;
+/* Creates a point either in the arena, or on the heap if arena is NULL */
+static SPPoint* createPoint(double* data, int dim, int index, SPPointArena* arena) {
+    if (arena != NULL) {
+        return spPointArenaCreatePoint(arena, data, dim, index);
+    }
+    return spPointCreate(data, dim, index);
+}
+
+/* Frees a points array that was allocated by allocPointsArray. Points of an arena are freed with it */
+static void destroyPointsArray(SPPoint** pointsArray, int nPoints, SPPointArena* arena) {
+    if (arena != NULL) {
+        return;
+    }
+    for (int i = 0; i < nPoints; ++i) {
+        spPointDestroy(pointsArray[i]);
+    }
+    free(pointsArray);
+}
+
+
+/*
+ * Loads the image given by str, as color (BGR) or gray scale, applying the resolution
+ * settings of config (full resolution if config is NULL).
+ * Returns an empty image if it can't be read or decoded, and tells so through config->isUnreadable.
+ */
+static Mat loadImage(const char* str, bool isColor, const SPExtractionConfig* config) {
+    int decodeScale = config != NULL ? config->decodeScale : 1;
+    int maxImageSide = config != NULL ? config->maxImageSide : 0;
+    int flags = isColor ? CV_LOAD_IMAGE_COLOR : CV_LOAD_IMAGE_GRAYSCALE;
+    bool isDecodedReduced = false;
+
+#if CV_VERSION_MAJOR > 3 || (CV_VERSION_MAJOR == 3 && CV_VERSION_MINOR >= 2)
+    /* Let the decoder skip the work of the full resolution (e.g. JPEG DCT scaling) */
+    if (decodeScale == 2) {
+        flags = isColor ? IMREAD_REDUCED_COLOR_2 : IMREAD_REDUCED_GRAYSCALE_2;
+        isDecodedReduced = true;
+    } else if (decodeScale == 4) {
+        flags = isColor ? IMREAD_REDUCED_COLOR_4 : IMREAD_REDUCED_GRAYSCALE_4;
+        isDecodedReduced = true;
+    } else if (decodeScale == 8) {
+        flags = isColor ? IMREAD_REDUCED_COLOR_8 : IMREAD_REDUCED_GRAYSCALE_8;
+        isDecodedReduced = true;
     }
+#endif
+
     Mat src;
+    if (config != NULL && config->encodedImage != NULL) {
+        /* Decoded from memory - the bytes are only read, though Mat takes them as non-const */
+        Mat encoded(1, (int)config->encodedImageSize, CV_8U, (void*)config->encodedImage);
+        src = imdecode(encoded, flags);
+    } else {
+        src = imread(str, flags);
+    }
 
-    /* Load image */
-    src = imread(str, CV_LOAD_IMAGE_COLOR);
+    /* The caller decides what an unreadable image means - nothing is extracted from it */
+    if (config != NULL && config->isUnreadable != NULL) {
+        *config->isUnreadable = src.empty();
+    }
+    if (src.empty()) {
+        return src;
+    }
+
+    /* This OpenCV can't decode at a reduced size - scale down after a full decode instead */
+    if (decodeScale > 1 && !isDecodedReduced) {
+        Mat reduced;
+        resize(src, reduced, Size(std::max(1, src.cols / decodeScale), std::max(1, src.rows / decodeScale)), 0, 0, INTER_AREA);
+        src = reduced;
+    }
+
+    /* Pre-extraction downscale of images that are still larger than maxImageSide */
+    int longerSide = std::max(src.rows, src.cols);
+    if (maxImageSide > 0 && longerSide > maxImageSide) {
+        double scale = (double)maxImageSide / longerSide;
+        Mat downscaled;
+        resize(src, downscaled, Size(std::max(1, (int)(src.cols * scale)), std::max(1, (int)(src.rows * scale))), 0, 0, INTER_AREA);
+        src = downscaled;
+    }
+
+    return src;
+}
+
+/* The number of sub-histograms each channel is counted into. Consecutive pixels go to
+ * different sub-histograms, so that runs of equal pixels don't stall on the same counter */
+#define HIST_NUM_OF_LANES 4
+
+/* Images with more pixels than this are split into row strips that are counted in parallel */
+#define HIST_PIXELS_PER_STRIP (1 << 20)
+
+/* The number of possible values of an 8-bit channel */
+#define HIST_NUM_OF_VALUES 256
+
+/*
+ * Counts the pixels of rows [rowStart, rowEnd) of the 8-bit, 3 channel (BGR) image src,
+ * in a single pass over the interleaved buffer.
+ * laneHists holds HIST_NUM_OF_LANES * NUM_OF_CHANNELS sub-histograms of nBins counters each,
+ * which are zeroed first. binOf maps a channel value to its bin.
+ */
+static void countBGRHistStrip(const Mat& src, int rowStart, int rowEnd, int nBins,
+        const int* binOf, unsigned int* laneHists) {
+    memset(laneHists, 0, sizeof(*laneHists) * HIST_NUM_OF_LANES * NUM_OF_CHANNELS * nBins);
+
+    /* sub-histogram of (lane, channel) */
+    unsigned int * hists[HIST_NUM_OF_LANES][NUM_OF_CHANNELS];
+    for (int lane = 0; lane < HIST_NUM_OF_LANES; ++lane) {
+        for (int c = 0; c < NUM_OF_CHANNELS; ++c) {
+            hists[lane][c] = laneHists + (lane * NUM_OF_CHANNELS + c) * nBins;
+        }
+    }
 
-    /* As instructed, print err msg and exit in case the image is empty */
+    for (int r = rowStart; r < rowEnd; ++r) {
+        const uchar * pixel = src.ptr<uchar>(r);
+        const uchar * rowEndPixel = pixel + src.cols * NUM_OF_CHANNELS;
+        const uchar * unrolledEnd = pixel + (src.cols - src.cols % HIST_NUM_OF_LANES) * NUM_OF_CHANNELS;
+
+        /* HIST_NUM_OF_LANES pixels per iteration, each to its own lane */
+        for (; pixel < unrolledEnd; pixel += HIST_NUM_OF_LANES * NUM_OF_CHANNELS) {
+            for (int lane = 0; lane < HIST_NUM_OF_LANES; ++lane) {
+                const uchar * lanePixel = pixel + lane * NUM_OF_CHANNELS;
+                hists[lane][0][binOf[lanePixel[0]]]++;
+                hists[lane][1][binOf[lanePixel[1]]]++;
+                hists[lane][2][binOf[lanePixel[2]]]++;
+            }
+        }
+        for (; pixel < rowEndPixel; pixel += NUM_OF_CHANNELS) {
+            hists[0][0][binOf[pixel[0]]]++;
+            hists[0][1][binOf[pixel[1]]]++;
+            hists[0][2][binOf[pixel[2]]]++;
+        }
+    }
+}
+
+/* Calculates the RGB hists of the image given by str into histData, which has room for
+ * NUM_OF_CHANNELS * nBins values. The red channel hist is first, then green, then blue.
+ *
+ * All channels are counted in one pass over the decoded interleaved BGR buffer.
+ * The result is identical to calling calcHist on each plane with a [0, 256) range.
+ * Returns false if the image can't be loaded. */
+static bool calcRGBHistData(const char* str, int nBins, double* histData, const SPExtractionConfig* config) {
+    /* Load image */
+    Mat src = loadImage(str, true, config);
     if (src.empty()) {
-        printf(EMPTY_IMAGE_LOADED_ERROR_FORMAT,EMPTY_IMAGE_LOADED_ERROR, str);
-        exit(ERROR_CODE);
+        return false;
+    }
 
+    /* The bin of each value - calcHist maps a value v of a uniform [0, 256) range with
+     * nBins bins to floor(v * nBins / 256) */
+    int binOf[HIST_NUM_OF_VALUES];
+    for (int v = 0; v < HIST_NUM_OF_VALUES; ++v) {
+        binOf[v] = (v * nBins) / HIST_NUM_OF_VALUES;
+    }
+
+    /* Split large images into row strips, each counted into its own lane hists */
+    long long nPixels = (long long)src.rows * src.cols;
+    int nStrips = (int)((nPixels + HIST_PIXELS_PER_STRIP - 1) / HIST_PIXELS_PER_STRIP);
+    if (nStrips > src.rows) {
+        nStrips = src.rows;
+    }
+    if (nStrips < 1) {
+        nStrips = 1;
+    }
+    int rowsPerStrip = (src.rows + nStrips - 1) / nStrips;
+    int stripHistsSize = HIST_NUM_OF_LANES * NUM_OF_CHANNELS * nBins;
+
+    std::vector<unsigned int> stripHists((size_t)nStrips * stripHistsSize);
+    unsigned int * stripHistsData = stripHists.data();
+
+    spParallelFor(nStrips, 0, [&](int strip) {
+        int rowStart = strip * rowsPerStrip;
+        int rowEnd = std::min(src.rows, rowStart + rowsPerStrip);
+        countBGRHistStrip(src, rowStart, rowEnd, nBins, binOf, stripHistsData + (size_t)strip * stripHistsSize);
+    });
+
+    /* Merge all strips and lanes. calcHist counts in integers and returns CV_32F (float)
+     * counts, which we cast to double - so do the same */
+    for (int c = 0; c < NUM_OF_CHANNELS; ++c) {
+        /* flip BGR to RGB */
+        double * channelData = histData + (NUM_OF_CHANNELS - c - 1) * nBins;
+        for (int j = 0; j < nBins; ++j) {
+            unsigned int count = 0;
+            for (int strip = 0; strip < nStrips; ++strip) {
+                for (int lane = 0; lane < HIST_NUM_OF_LANES; ++lane) {
+                    count += stripHistsData[(size_t)strip * stripHistsSize + (lane * NUM_OF_CHANNELS + c) * nBins + j];
+                }
+            }
+            channelData[j] = (float)count;
+        }
     }
+    return true;
+}
 
-    /* Separate the image in 3 places ( B, G and R ) */
-    std::vector<Mat> bgr_planes;
-    split(src, bgr_planes);
+/* Detects the keypoints of src with detector, keeps the top ranked ones by config (and at most maxKept,
+ * if > 0), and computes their descriptors into ds1, one row per descriptor.
+ * Returns false if no descriptors were extracted. */
+static bool calcDescriptorsData(const cv::Mat& src, cv::Feature2D& detector, int maxKept, cv::Mat& ds1,
+        const SPExtractionConfig* config) {
+    /* Key points will be stored in kp1; */
+    std::vector<cv::KeyPoint> kp1;
+    detector.detect(src, kp1, cv::Mat());
+    if (config != NULL && config->nDetectedDescriptors != NULL) {
+        *config->nDetectedDescriptors = (int)kp1.size();
+    }
 
-    /* Set the ranges ( for B,G,R) */
-    float range[] = { 0, 256 };
-    const float* histRange = { range };
+    int maxDescriptors = config != NULL ? config->maxDescriptors : 0;
+    if (maxKept > 0 && (maxDescriptors <= 0 || maxKept < maxDescriptors)) {
+        maxDescriptors = maxKept;
+    }
 
-    /* Set the other parameters: */
-    int nImages = 1;
+    if (maxDescriptors > 0 && config != NULL && config->isRankedByScale) {
+        std::stable_sort(kp1.begin(), kp1.end(), [](const cv::KeyPoint& a, const cv::KeyPoint& b) {
+            return a.size > b.size || (a.size == b.size && a.response > b.response);
+        });
+    } else if (maxDescriptors > 0 || (config != NULL && config->isSortedByResponse)) {
+        std::stable_sort(kp1.begin(), kp1.end(), [](const cv::KeyPoint& a, const cv::KeyPoint& b) {
+            return a.response > b.response;
+        });
+    }
+    /* Detectors may keep more keypoints than asked for (ties and extra orientations) - cap them exactly */
+    if (maxDescriptors > 0 && (int)kp1.size() > maxDescriptors) {
+        kp1.resize(maxDescriptors);
+    }
+    detector.compute(src, kp1, ds1);
+    return !ds1.empty();
+}
 
-    /* red histogram, green histogram, blue histogram */
-    Mat hists [NUM_OF_CHANNELS];
+/* Extracts the SIFT descriptors of the image given by str into ds1 (one row per descriptor, CV_32F).
+ * Returns false if no descriptors were extracted. */
+static bool calcSiftDescriptorsData(const char* str, int nFeaturesToExtract, cv::Mat& ds1, const SPExtractionConfig* config) {
+    /* Load img - gray scale mode! */
+    cv::Mat src = loadImage(str, false, config);
+    if (src.empty()) {
+        return false;
+    }
+
+    /* Creating  a Sift Descriptor extractor */
+    cv::Ptr<cv::xfeatures2d::SiftDescriptorExtractor> detect =
+        cv::xfeatures2d::SIFT::create(nFeaturesToExtract);
+
+    /* Extracting features */
+    /* The features will be stored in ds1 */
+    /* The output type of ds1 is CV_32F (float) */
+    return calcDescriptorsData(src, *detect, 0, ds1, config);
+}
+
+SPPoint** spGetRGBHist(const char* str,int imageIndex, int nBins) {
+    return spGetRGBHistInArena(str, imageIndex, nBins, NULL);
+}
+
+SPPoint** spGetRGBHistInArena(const char* str, int imageIndex, int nBins, SPPointArena* arena) {
+    if (str == NULL || nBins <= 0) {
+        return NULL;
+    }
+
+    double * histData = spGetRGBHistData(str, nBins, NULL);
+    if (histData == NULL) {
+        return NULL;
+    }
 
     /* allocate our point pointers array (to store histograms in) */
-    SPPoint ** pointsArray = (SPPoint**)malloc(sizeof(*pointsArray) * NUM_OF_CHANNELS);
+    SPPoint ** pointsArray = allocPointsArray(NUM_OF_CHANNELS, arena);
     if (pointsArray == NULL) {
+        free(histData);
         return NULL;
     }
+    for (int i = 0; i < NUM_OF_CHANNELS; ++i) {
+        pointsArray[i] = NULL;
+    }
 
-    /* Compute the histograms, and store their data in a point */ 
-    /* The output type of the matrices is CV_32F (float), we cast it to double */
+    /* store the data of each channel histogram in a point */
     bool pointsCreateFailure = false;
-    double * histData = (double*)malloc(sizeof(*histData) * nBins);
-    if (histData == NULL) {
-        pointsCreateFailure = true;
-    }
     for (int i = 0; i < NUM_OF_CHANNELS && !pointsCreateFailure; ++i) {
-        calcHist(&bgr_planes[i], nImages, 0, Mat(), hists[i], 1, &nBins, &histRange);
-        for (int j = 0; j < nBins; ++j) {
-           histData[j] = hists[i].at<float>(j);
-        }
-        /* flip BGR to RGB */
-        pointsArray[NUM_OF_CHANNELS - i - 1] = spPointCreate(histData, nBins, imageIndex);
-        if (pointsArray[NUM_OF_CHANNELS - i - 1] == NULL) {
+        pointsArray[i] = createPoint(histData + i * nBins, nBins, imageIndex, arena);
+        if (pointsArray[i] == NULL) {
             pointsCreateFailure = true;
         }
     }
@@ -82,105 +312,226 @@ SPPoint** spGetRGBHist(const char* str,int imageIndex, int nBins) {
     /* free memory */
     free(histData);
     if (pointsCreateFailure) {
-        for (int i = 0; i < NUM_OF_CHANNELS; ++i) {
-            spPointDestroy(pointsArray[i]); 
-        }
-        free(pointsArray);
+        destroyPointsArray(pointsArray, NUM_OF_CHANNELS, arena);
         return NULL;
     }
     return pointsArray;
 }
 
+double* spGetRGBHistData(const char* str, int nBins, const SPExtractionConfig* config) {
+    if (str == NULL || nBins <= 0) {
+        return NULL;
+    }
+
+    double * histData = (double*)malloc(sizeof(*histData) * NUM_OF_CHANNELS * nBins);
+    if (histData == NULL) {
+        return NULL;
+    }
+
+    if (!calcRGBHistData(str, nBins, histData, config)) {
+        free(histData);
+        return NULL;
+    }
+    return histData;
+}
+
+bool spGetRGBHistInto(const char* str, int nBins, double* histData, const SPExtractionConfig* config) {
+    if (str == NULL || nBins <= 0 || histData == NULL) {
+        return false;
+    }
+
+    return calcRGBHistData(str, nBins, histData, config);
+}
+
 double spRGBHistL2Distance(SPPoint** rgbHistA, SPPoint** rgbHistB) {
+	if (rgbHistA == NULL)
+		return ERROR_CODE;
+
+	SPPointView viewsA[NUM_OF_CHANNELS];
+
+	for(int i=0; i < NUM_OF_CHANNELS; ++i)
+	{
+		if (rgbHistA[i] == NULL)
+			return ERROR_CODE;//A null pointer in one of the channels. Distance can't be calculated. */
+
+		viewsA[i] = spPointGetView(rgbHistA[i]);
+	}
+
+	return spRGBHistL2DistanceView(viewsA, rgbHistB);
+}
+
+double spRGBHistL2DistanceView(const SPPointView* rgbHistA, SPPoint** rgbHistB) {
 	double averageDistance = 0;
 
+	if (rgbHistA == NULL || rgbHistB == NULL)
+		return ERROR_CODE;
+
 	//Go over each channel and calculate the L2 distance between hist vectors in A and B
 	//Add all distances multiplied by 0.33 to get the average distance
 	for(int i=0; i < NUM_OF_CHANNELS; ++i)
 	{
-		if (rgbHistA[i] == NULL || rgbHistB[i] == NULL)
+		if (rgbHistB[i] == NULL)
 			return ERROR_CODE;//A null pointer in one of the channels. Distance can't be calculated. */
 
-		averageDistance += CHANNEL_L2_DISTANCE_PROPORTION * spPointL2SquaredDistance(rgbHistA[i], rgbHistB[i]);
+		averageDistance += CHANNEL_L2_DISTANCE_PROPORTION * spPointL2SquaredDistanceToView(rgbHistB[i], &rgbHistA[i]);
 	}
 
 	return averageDistance;
 }
 
 SPPoint** spGetSiftDescriptors(const char* str, int imageIndex, int nFeaturesToExtract, int *nFeatures) {
+    return spGetSiftDescriptorsInArena(str, imageIndex, nFeaturesToExtract, nFeatures, NULL, NULL);
+}
+
+SPPoint** spGetSiftDescriptorsInArena(const char* str, int imageIndex, int nFeaturesToExtract, int *nFeatures, SPPointArena* arena, const SPExtractionConfig* config) {
     if (str == NULL || nFeaturesToExtract <= 0 || nFeatures == NULL) {
         return NULL;
     }
     SPPoint ** pointsArray = NULL;
-    cv::Mat src;
-
-    /* Load img - gray scale mode! */
-    src = cv::imread(str, CV_LOAD_IMAGE_GRAYSCALE);
-    
-    /* As instructed, print err msg and exit in case the image is empty */
-    if (src.empty()) {
-        printf(EMPTY_IMAGE_LOADED_ERROR_FORMAT,EMPTY_IMAGE_LOADED_ERROR, str);
-        exit(ERROR_CODE);
-
-    }
-
-    /* Key points will be stored in kp1; */
-    std::vector<cv::KeyPoint> kp1;
 
     /* Feature values will be stored in ds1; */
     cv::Mat ds1;
-
-    /* Creating  a Sift Descriptor extractor */
-    cv::Ptr<cv::xfeatures2d::SiftDescriptorExtractor> detect =
-        cv::xfeatures2d::SIFT::create(nFeaturesToExtract);
-
-    /* Extracting features */
-    /* The features will be stored in ds1 */
-    /* The output type of ds1 is CV_32F (float) */
-    detect->detect(src, kp1, cv::Mat());
-    detect->compute(src, kp1, ds1);
-    if (ds1.empty()) {
+    if (!calcSiftDescriptorsData(str, nFeaturesToExtract, ds1, config)) {
         return NULL;
     }
 
+    /* The output type of ds1 is CV_32F (float), convert it to double in a single pass */
+    cv::Mat ds;
+    ds1.convertTo(ds, CV_64F);
+
     /* number of features we actually extracted */
-    *nFeatures = ds1.rows;
+    *nFeatures = ds.rows;
 
     /* allocate nFeatures points */
-    pointsArray = (SPPoint**)malloc(sizeof(*pointsArray) * *nFeatures);
+    pointsArray = allocPointsArray(*nFeatures, arena);
     if (pointsArray == NULL) {
         return NULL;
     }
+    for (int i = 0; i < *nFeatures; ++i) {
+        pointsArray[i] = NULL;
+    }
 
     /* create an array of nFeatures points, each containing the corresponding descriptor */
     bool pointsCreateFailure = false;
-    double * featuresData = (double*)malloc(sizeof(*featuresData) * ds1.cols);
-    if (featuresData == NULL) {
-       pointsCreateFailure = true;
-    }
     for (int i = 0; i < *nFeatures && !pointsCreateFailure; ++i) {
-        for (int j = 0; j < ds1.cols; ++j) {
-            featuresData[j] = ds1.at<float>(i,j);
-        }
-        pointsArray[i] = spPointCreate(featuresData, ds1.cols, imageIndex);
+        pointsArray[i] = createPoint(ds.ptr<double>(i), ds.cols, imageIndex, arena);
         if (pointsArray[i] == NULL) {
             pointsCreateFailure = true;
         }
     }
 
-    free(featuresData);
     if (pointsCreateFailure) {
-        for (int i = 0; i < *nFeatures; ++i) {
-            spPointDestroy(pointsArray[i]); 
-        }
-        free(pointsArray);
+        destroyPointsArray(pointsArray, *nFeatures, arena);
         return NULL;
     }
 
     return pointsArray;
 }
 
+double* spGetSiftDescriptorsData(const char* str, int nFeaturesToExtract, int* nFeatures, int* dim, const SPExtractionConfig* config) {
+    if (str == NULL || nFeaturesToExtract <= 0 || nFeatures == NULL || dim == NULL) {
+        return NULL;
+    }
+
+    cv::Mat ds1;
+    if (!calcSiftDescriptorsData(str, nFeaturesToExtract, ds1, config)) {
+        return NULL;
+    }
+
+    double * descriptorsData = (double*)malloc(sizeof(*descriptorsData) * ds1.rows * ds1.cols);
+    if (descriptorsData == NULL) {
+        return NULL;
+    }
+
+    /* The descriptors are converted straight into the output block, which the caller owns.
+     * dst already has the right size and type, so convertTo writes into its memory */
+    cv::Mat dst(ds1.rows, ds1.cols, CV_64F, descriptorsData);
+    ds1.convertTo(dst, CV_64F);
+
+    *nFeatures = ds1.rows;
+    *dim = ds1.cols;
+    return descriptorsData;
+}
+
+unsigned char* spGetBinaryDescriptorsData(const char* str, SPFeatureEngine engine, int nFeaturesToExtract,
+        int* nFeatures, int* nBytes, const SPExtractionConfig* config) {
+    if (str == NULL || nFeaturesToExtract <= 0 || nFeatures == NULL || nBytes == NULL ||
+        (engine != SP_FEATURE_ENGINE_ORB && engine != SP_FEATURE_ENGINE_AKAZE)) {
+        return NULL;
+    }
+
+    /* Load img - gray scale mode! */
+    cv::Mat src = loadImage(str, false, config);
+    if (src.empty()) {
+        return NULL;
+    }
+
+    /* The output type of ds1 is CV_8U, one bit per binary test. AKAZE has no feature count,
+     * so its strongest keypoints are kept, like ORB's */
+    cv::Mat ds1;
+    bool isExtracted = false;
+    if (engine == SP_FEATURE_ENGINE_ORB) {
+        cv::Ptr<cv::ORB> detect = cv::ORB::create(nFeaturesToExtract);
+        isExtracted = calcDescriptorsData(src, *detect, nFeaturesToExtract, ds1, config);
+    } else {
+        cv::Ptr<cv::AKAZE> detect = cv::AKAZE::create();
+        isExtracted = calcDescriptorsData(src, *detect, nFeaturesToExtract, ds1, config);
+    }
+    if (!isExtracted || ds1.type() != CV_8U) {
+        return NULL;
+    }
+
+    unsigned char* descriptorsData = (unsigned char*)malloc((size_t)ds1.rows * ds1.cols);
+    if (descriptorsData == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < ds1.rows; ++i) {
+        memcpy(descriptorsData + (size_t)i * ds1.cols, ds1.ptr<uchar>(i), ds1.cols);
+    }
+
+    *nFeatures = ds1.rows;
+    *nBytes = ds1.cols;
+    return descriptorsData;
+}
+
 int* spBestSIFTL2SquaredDistance(int kClosest, SPPoint* queryFeature, SPPoint*** databaseFeatures, int numberOfImages, int* nFeaturesPerImage)
+{
+	if (queryFeature == NULL)
+		return NULL;
+
+	SPPointView queryView = spPointGetView(queryFeature);
+	return spBestSIFTL2SquaredDistanceView(kClosest, &queryView, databaseFeatures, numberOfImages, nFeaturesPerImage, NULL);
+}
+
+/* spBestSIFTL2SquaredDistanceView for a dimension and kClosest known at compile time -
+ * the distance loop is unrolled and the closest K are kept in registers */
+template <int DIM, int K>
+static int* bestSIFTL2SquaredDistanceFixed(const SPPointView* queryFeature, SPPoint*** databaseFeatures,
+		int numberOfImages, int* nFeaturesPerImage, int* resNumOfIndices)
+{
+	int* closestImgIndices = (int*)malloc(K * sizeof(*closestImgIndices));
+	if (closestImgIndices == NULL)
+		return NULL;
+
+	const double* queryData = queryFeature->data;
+	SPKernelTopK<K> closest;
+
+	for (int i = 0; i < numberOfImages; ++i) /*Go over each image*/
+		for (int j = 0; j < nFeaturesPerImage[i]; ++j) /*Go over each feature in image*/
+		{
+			SPPointView feature = spPointGetView(databaseFeatures[i][j]);
+			closest.offer(i, spKernelL2SquaredDistance<DIM>(feature.data, queryData));
+		}
+
+	for (int i = 0; i < closest.size; ++i)
+		closestImgIndices[i] = closest.indices[i];
+	if (resNumOfIndices != NULL)
+		*resNumOfIndices = closest.size;
+	return closestImgIndices;
+}
+
+int* spBestSIFTL2SquaredDistanceView(int kClosest, const SPPointView* queryFeature, SPPoint*** databaseFeatures, int numberOfImages, int* nFeaturesPerImage,
+		int* resNumOfIndices)
 {
 	/*Input validation*/
 	if (queryFeature == NULL ||
@@ -189,6 +540,11 @@ int* spBestSIFTL2SquaredDistance(int kClosest, SPPoint* queryFeature, SPPoint***
 		nFeaturesPerImage == NULL)
 		return NULL;
 
+	/*The common case of full SIFT descriptors has its own kernel*/
+	if (queryFeature->dim == SP_KERNEL_SIFT_DIMENSION && kClosest == SP_KERNEL_SIFT_K)
+		return bestSIFTL2SquaredDistanceFixed<SP_KERNEL_SIFT_DIMENSION, SP_KERNEL_SIFT_K>(
+				queryFeature, databaseFeatures, numberOfImages, nFeaturesPerImage, resNumOfIndices);
+
 	/*Whether the procedure should keep running or encountered a memory allocation error and should exit*/
 	bool isKeepRunning = true;
 
@@ -210,7 +566,7 @@ int* spBestSIFTL2SquaredDistance(int kClosest, SPPoint* queryFeature, SPPoint***
 			for(int j = 0; j < nFeaturesPerImage[i]; ++j) /*Go over each feature in image*/
 			{
 				/*Calculate the L2 distance between the feature and queryFeature*/
-				double distance = spPointL2SquaredDistance(databaseFeatures[i][j], queryFeature);
+				double distance = spPointL2SquaredDistanceToView(databaseFeatures[i][j], queryFeature);
 
 				/*Enqueue the L2 distance to the priority queue, with the image's index*/
 				msg = spBPQueueEnqueue(priorityQueue, i, distance);
@@ -249,6 +605,9 @@ int* spBestSIFTL2SquaredDistance(int kClosest, SPPoint* queryFeature, SPPoint***
                            break;
                         }
 		}
+
+		if (resNumOfIndices != NULL)
+			*resNumOfIndices = queueSize;
 	}
 
 	/*Free all allocated memory for the queue*/
@@ -262,3 +621,111 @@ int* spBestSIFTL2SquaredDistance(int kClosest, SPPoint* queryFeature, SPPoint***
         }
 	return closestImgIndices;
 }
+
+int* spBestSIFTL2SquaredDistanceRerankView(int kClosest, int nCandidates,
+		const SPPointView* queryFeature, const SPPointView* fullQueryFeature,
+		SPPoint*** databaseFeatures, SPPoint*** fullDatabaseFeatures,
+		int numberOfImages, int* nFeaturesPerImage, int* resNumOfIndices)
+{
+	/*Input validation*/
+	if (queryFeature == NULL || fullQueryFeature == NULL ||
+		databaseFeatures == NULL || fullDatabaseFeatures == NULL ||
+		numberOfImages <= 1 || nFeaturesPerImage == NULL ||
+		kClosest <= 0 || nCandidates < kClosest)
+		return NULL;
+
+	/*The position of the first feature of each image among all features, so a candidate
+	 * can be queued by its position and found again*/
+	int* firstFeature = (int*)malloc(sizeof(*firstFeature) * (numberOfImages + 1));
+	int* candidates = (int*)malloc(sizeof(*candidates) * nCandidates);
+	int* closestImgIndices = (int*)malloc(sizeof(*closestImgIndices) * kClosest);
+	SPBPQueue* candidatesQueue = spBPQueueCreate(nCandidates);
+	SPBPQueue* priorityQueue = spBPQueueCreate(kClosest);
+
+	bool isKeepRunning = firstFeature != NULL && candidates != NULL && closestImgIndices != NULL &&
+		candidatesQueue != NULL && priorityQueue != NULL;
+	int nFound = 0;
+
+	if (isKeepRunning)
+	{
+		firstFeature[0] = 0;
+		for(int i = 0; i < numberOfImages; ++i)
+			firstFeature[i + 1] = firstFeature[i] + nFeaturesPerImage[i];
+
+		/*Stage one - the closest candidates by projected coordinates*/
+		for(int i = 0; i < numberOfImages && isKeepRunning; ++i)
+			for(int j = 0; j < nFeaturesPerImage[i]; ++j)
+				if (spBPQueueEnqueue(candidatesQueue, firstFeature[i] + j,
+						spPointL2SquaredDistanceToView(databaseFeatures[i][j], queryFeature)) == SP_BPQUEUE_OUT_OF_MEMORY)
+				{
+					isKeepRunning = false;
+					break;
+				}
+	}
+
+	if (isKeepRunning)
+	{
+		BPQueueElement queueElem;
+		for(nFound = 0; spBPQueuePeek(candidatesQueue, &queueElem) == SP_BPQUEUE_SUCCESS; ++nFound)
+		{
+			candidates[nFound] = queueElem.index;
+			spBPQueueDequeue(candidatesQueue);
+		}
+
+		/*Stage two - the candidates are enqueued in database order, so equal full distances
+		 * are still broken in favour of the smaller image index*/
+		std::sort(candidates, candidates + nFound);
+
+		for(int c = 0, i = 0; c < nFound && isKeepRunning; ++c)
+		{
+			while (firstFeature[i + 1] <= candidates[c])
+				++i; /*The image of the candidate*/
+
+			double distance = spPointL2SquaredDistanceToView(fullDatabaseFeatures[i][candidates[c] - firstFeature[i]], fullQueryFeature);
+			if (spBPQueueEnqueue(priorityQueue, i, distance) == SP_BPQUEUE_OUT_OF_MEMORY)
+				isKeepRunning = false;
+		}
+	}
+
+	if (isKeepRunning)
+	{
+		BPQueueElement queueElem;
+		int i = 0;
+		for(; spBPQueuePeek(priorityQueue, &queueElem) == SP_BPQUEUE_SUCCESS; ++i)
+		{
+			closestImgIndices[i] = queueElem.index;
+			spBPQueueDequeue(priorityQueue);
+		}
+
+		if (resNumOfIndices != NULL)
+			*resNumOfIndices = i;
+	}
+
+	free(firstFeature);
+	free(candidates);
+	spBPQueueDestroy(candidatesQueue);
+	spBPQueueDestroy(priorityQueue);
+
+	if (!isKeepRunning)
+	{
+		free(closestImgIndices);
+		return NULL;
+	}
+
+	return closestImgIndices;
+}
+
+size_t spBestSIFTL2SquaredDistanceGetMemoryUsage(int kClosest, int nCandidates, int dim, int numberOfImages)
+{
+	size_t nBytes = sizeof(int) * kClosest; /*The result*/
+
+	if (nCandidates > 0)
+		return nBytes + spBPQueueGetMemoryUsage(kClosest) + spBPQueueGetMemoryUsage(nCandidates) +
+			sizeof(int) * nCandidates + sizeof(int) * ((size_t)numberOfImages + 1);
+
+	/*The specialized kernel keeps its closest features on the stack*/
+	if (dim == SP_KERNEL_SIFT_DIMENSION && kClosest == SP_KERNEL_SIFT_K)
+		return nBytes;
+
+	return nBytes + spBPQueueGetMemoryUsage(kClosest);
+}
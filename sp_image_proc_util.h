@@ -9,6 +9,37 @@ extern "C"{
 	#include "SPPoint.h"
 }
 
+/**
+ * Settings for the resolution images are decoded and extracted at.
+ * A NULL config everywhere below means full resolution (decodeScale 1, no maxImageSide).
+ * If encodedImage is set, the image is decoded from it, and the path is only used in messages.
+ * An image that can't be read or decoded is never fatal - nothing is extracted from it (NULL or
+ * false is returned), and isUnreadable tells it apart from an allocation failure.
+ *
+ * Histograms count pixels, so a database and its queries must always use the same config.
+ */
+typedef struct sp_extraction_config_t {
+	int decodeScale; /*Decode images at 1/decodeScale of their size. One of 1, 2, 4, 8*/
+	int maxImageSide; /*If > 0, images whose longer side is larger are scaled down to it before extraction*/
+	bool isSortedByResponse; /*Order SIFT descriptors by decreasing keypoint response, the strongest first*/
+	int maxDescriptors; /*If > 0, only this many SIFT descriptors with the strongest keypoint response are kept*/
+	bool isRankedByScale; /*With maxDescriptors, keep the keypoints of the largest scale (size) instead, ties by response*/
+	int* nDetectedDescriptors; /*If not NULL, set to the number of keypoints detected, before maxDescriptors - output*/
+	const unsigned char* encodedImage; /*If not NULL, the encoded image (e.g. from an image archive), read instead of the file*/
+	size_t encodedImageSize; /*The number of bytes of encodedImage*/
+	bool* isUnreadable; /*If not NULL, set to whether the image couldn't be read or decoded - output*/
+} SPExtractionConfig;
+
+/**
+ * The local feature engines - SIFT descriptors of doubles compared by L2 distance, or
+ * binary descriptors compared by Hamming distance.
+ */
+typedef enum sp_feature_engine_t {
+	SP_FEATURE_ENGINE_SIFT,
+	SP_FEATURE_ENGINE_ORB,
+	SP_FEATURE_ENGINE_AKAZE,
+} SPFeatureEngine;
+
 /**
  * Calculates the RGB channels histogram. The histogram will be stored in an array of 
  * of points, each point has the index imageIndex. The array has three entries,
@@ -18,11 +49,18 @@ extern "C"{
  * @param str - The path of the image for which the histogram will be calculated
  * @param nBins - The number of subdivision for the intensity histogram
  * @param imageIndex - The index of the given image
- * @return NULL if str is NULL or nBins <= 0 or allocation error occurred,
+ * @return NULL if str is NULL or nBins <= 0 or the image can't be loaded or allocation error occurred,
  *  otherwise a two dimensional array representing the histogram.
  */
 SPPoint** spGetRGBHist(const char* str,int imageIndex, int nBins);
 
+/**
+ * Same as spGetRGBHist, but the histogram points and the array holding them are
+ * allocated from the given arena (and are released only when it is destroyed).
+ * If arena is NULL, this behaves exactly like spGetRGBHist.
+ */
+SPPoint** spGetRGBHistInArena(const char* str, int imageIndex, int nBins, SPPointArena* arena);
+
 /**
  * Returns the average L2-squared distance between rgbHistA and rgbHistB. 
  * Both histograms must have the same number of channels (in the case of RGB histogram its 3).
@@ -35,6 +73,38 @@ SPPoint** spGetRGBHist(const char* str,int imageIndex, int nBins);
  */
 double spRGBHistL2Distance(SPPoint** rgbHistA, SPPoint** rgbHistB);
 
+/**
+ * Calculates the RGB channels histogram of the image given by str into one contiguous
+ * block of 3 * nBins values: the red channel histogram first, then green, then blue.
+ * Views over the block (one per channel) can be used with spRGBHistL2DistanceView,
+ * so no point has to be created for a query image.
+ *
+ * @param str - The path of the image for which the histogram will be calculated
+ * @param nBins - The number of subdivision for the intensity histogram
+ * @param config - The resolution to calculate the histogram at (NULL for full resolution)
+ * @return NULL if str is NULL or nBins <= 0 or the image can't be loaded or allocation error occurred,
+ *  otherwise the histograms block, which the caller should free.
+ */
+double* spGetRGBHistData(const char* str, int nBins, const SPExtractionConfig* config);
+
+/**
+ * Same as spGetRGBHistData, but the 3 * nBins values are written into histData,
+ * which is owned by the caller (e.g. a row of an SPHistMatrix).
+ *
+ * @return false if str or histData is NULL or nBins <= 0 or the image can't be loaded, otherwise true.
+ */
+bool spGetRGBHistInto(const char* str, int nBins, double* histData, const SPExtractionConfig* config);
+
+/**
+ * Same as spRGBHistL2Distance, but the first histogram is given as an array of
+ * NUM_OF_CHANNELS views (e.g. over a block returned by spGetRGBHistData).
+ * @return
+ *		  -1 if:
+ *			rgbHistA/rgbHistB is null,
+ *		  otherwise the average L2-squared distance.
+ */
+double spRGBHistL2DistanceView(const SPPointView* rgbHistA, SPPoint** rgbHistB);
+
 /**
  * Tries to extract SIFT descriptors from the image given by the string str (the number of features 
  * to retain is given by the integer nFeaturesToExtract).
@@ -62,6 +132,63 @@ double spRGBHistL2Distance(SPPoint** rgbHistA, SPPoint** rgbHistB);
  */
 SPPoint** spGetSiftDescriptors(const char* str, int imageIndex, int nFeaturesToExtract, int *nFeatures);
 
+/**
+ * Same as spGetSiftDescriptors, but the descriptor points and the array holding them are
+ * allocated from the given arena (and are released only when it is destroyed),
+ * and the image is extracted at the resolution given by config.
+ * If arena and config are NULL, this behaves exactly like spGetSiftDescriptors.
+ */
+SPPoint** spGetSiftDescriptorsInArena(const char* str, int imageIndex, int nFeaturesToExtract, int *nFeatures, SPPointArena* arena, const SPExtractionConfig* config);
+
+/**
+ * Extracts SIFT descriptors like spGetSiftDescriptors, but returns them as one contiguous
+ * row-major block of (*nFeatures) x (*dim) doubles, written directly by the extractor's
+ * conversion pass. Views over its rows (spPointViewCreate) can be used as query features
+ * without creating or copying any point.
+ *
+ * @param str - A string representing the path of the image
+ * @param nFeaturesToExtract - The number of features to retain
+ * @param nFeatures - A pointer in which the actual number of features retained will be stored.
+ * @param dim - A pointer in which the dimension of each descriptor will be stored.
+ * @param config - The resolution to extract the descriptors at (NULL for full resolution)
+ * @return
+ *         NULL if:
+ * 		   	- str is NULL
+ * 		   	- the image given by str didn't open
+ * 		   	- nFeatures or dim is NULL
+ * 		   	- nFeaturesToExtract <= 0
+ * 		   	- no descriptor was extracted
+ * 		   	- Memory allocation failure
+ *
+ *		   Otherwise, the descriptors block, which the caller should free.
+ */
+double* spGetSiftDescriptorsData(const char* str, int nFeaturesToExtract, int* nFeatures, int* dim, const SPExtractionConfig* config);
+
+/**
+ * Extracts binary descriptors (ORB or AKAZE) of an image, as one contiguous block of
+ * (*nFeatures) x (*nBytes) bytes, one descriptor after the other, each byte holding 8 of its bits.
+ * At most nFeaturesToExtract descriptors are kept, those with the strongest keypoint response
+ * (or as config ranks them).
+ *
+ * @param str - A string representing the path of the image
+ * @param engine - SP_FEATURE_ENGINE_ORB or SP_FEATURE_ENGINE_AKAZE
+ * @param nFeaturesToExtract - The number of features to retain
+ * @param nFeatures - A pointer in which the actual number of features retained will be stored.
+ * @param nBytes - A pointer in which the number of bytes of each descriptor will be stored.
+ * @param config - The resolution to extract the descriptors at (NULL for full resolution)
+ * @return
+ *         NULL if:
+ * 		   	- str/nFeatures/nBytes is NULL, or engine isn't a binary one
+ * 		   	- the image given by str didn't open
+ * 		   	- nFeaturesToExtract <= 0
+ * 		   	- no descriptor was extracted
+ * 		   	- Memory allocation failure
+ *
+ *		   Otherwise, the descriptors block, which the caller should free.
+ */
+unsigned char* spGetBinaryDescriptorsData(const char* str, SPFeatureEngine engine, int nFeaturesToExtract,
+		int* nFeatures, int* nBytes, const SPExtractionConfig* config);
+
 /**
  * Given sift descriptors of the images in the database (databaseFeatures), finds the
  * closest kClosest to a given SIFT feature (queryFeature). The function returns the
@@ -106,6 +233,60 @@ int* spBestSIFTL2SquaredDistance(int kClosest, SPPoint* queryFeature,
 		SPPoint*** databaseFeatures, int numberOfImages,
 		int* nFeaturesPerImage);
 
+/**
+ * Same as spBestSIFTL2SquaredDistance, but the query feature is given as a read-only view,
+ * so it doesn't have to be copied into a point.
+ * Full SIFT descriptors with kClosest of NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE are searched by
+ * a kernel specialized for them at compile time (see sp_kernels.h), with the same results.
+ *
+ * @param resNumOfIndices - OUTPUT parameter. If not NULL, receives the number of indices stored in
+ * the returned array - fewer than kClosest if the database has fewer features.
+ */
+int* spBestSIFTL2SquaredDistanceView(int kClosest, const SPPointView* queryFeature,
+		SPPoint*** databaseFeatures, int numberOfImages,
+		int* nFeaturesPerImage, int* resNumOfIndices);
+
+/**
+ * Same as spBestSIFTL2SquaredDistanceView, for features that were projected to fewer dimensions:
+ * the nCandidates closest features are found by their projected (reduced) coordinates, and the
+ * kClosest of them are then chosen by their L2-squared distances in the full dimension.
+ * Among candidates at the same full distance, the one found first in the database
+ * (the smallest image index) is closer.
+ *
+ * @param kClosest          - The kClosest features to the queryFeature
+ * @param nCandidates       - The number of features to re-rank, nCandidates >= kClosest
+ * @param queryFeature      - The projected query feature
+ * @param fullQueryFeature  - The query feature in the full dimension
+ * @param databaseFeatures  - All projected SIFT features in the database
+ * @param fullDatabaseFeatures - All SIFT features in the database, in the full dimension, laid out
+ * 							  like databaseFeatures
+ * @param numberOfImages    - The number of images in the database. (Number of entries in databaseFeatures)
+ * @param nFeaturesPerImage - The number of features per each image.
+ * @param resNumOfIndices   - OUTPUT parameter. If not NULL, receives the number of indices stored in
+ * 							  the returned array - fewer than kClosest if the database has fewer features.
+ *
+ * @return - NULL if either the following occurs:
+ * 			   * any of the pointers is NULL
+ * 			   * numberOfImages <= 1 or nCandidates < kClosest
+ * 			   * allocation error occurred
+ *         - Otherwise- an array of size kClosest with the image indices of the closest features,
+ * 			 of which the first *resNumOfIndices are set.
+ */
+int* spBestSIFTL2SquaredDistanceRerankView(int kClosest, int nCandidates,
+		const SPPointView* queryFeature, const SPPointView* fullQueryFeature,
+		SPPoint*** databaseFeatures, SPPoint*** fullDatabaseFeatures,
+		int numberOfImages, int* nFeaturesPerImage, int* resNumOfIndices);
+
+/**
+ * The memory a call to spBestSIFTL2SquaredDistanceView, or to spBestSIFTL2SquaredDistanceRerankView
+ * if nCandidates > 0, takes while it runs - its queues and its result - in bytes.
+ *
+ * @param kClosest          - The kClosest features to the queryFeature
+ * @param nCandidates       - The number of features to re-rank, or 0 without re-ranking
+ * @param dim               - The dimension of the query feature
+ * @param numberOfImages    - The number of images in the database
+ */
+size_t spBestSIFTL2SquaredDistanceGetMemoryUsage(int kClosest, int nCandidates, int dim, int numberOfImages);
 
 
 #endif /* SP_IMAGE_PROC_UTIL_H_ */
@@ -0,0 +1,144 @@
+#ifndef SP_KERNELS_H_
+#define SP_KERNELS_H_
+
+#include <stdint.h>
+
+/**
+ * Compile-time specialized kernels for the innermost loop of the local search -
+ * the L2-squared distance between two descriptors, the Hamming distance between
+ * two binary descriptors, and the list of the k closest descriptors found so far.
+ *
+ * With the dimension and k known at compile time, the distance loop has a constant
+ * trip count and is fully unrolled, and the top-k list is a small fixed array the
+ * compiler keeps in registers - no calls and no loop bounds read from memory.
+ *
+ * Both compute exactly what their generic counterparts do: the distance sums the
+ * squared differences in the same order as spPointL2SquaredDistance, and the top-k
+ * list has the semantics of spBPQueueEnqueue, so results and ties are unchanged.
+ * spKernelTopKOffer and SPKernelTopKList keep the same list for a k known only at run time.
+ */
+
+/** The dimension of a SIFT descriptor **/
+#define SP_KERNEL_SIFT_DIMENSION 128
+
+/** The k the local search uses - NUM_OF_CLOSET_IMAGES_TO_SIFT_FEATURE **/
+#define SP_KERNEL_SIFT_K 5
+
+/**
+ * The L2-squared distance between two arrays of DIM coordinates
+ */
+template <int DIM>
+inline double spKernelL2SquaredDistance(const double* p, const double* q)
+{
+	double distance = 0;
+	for (int i = 0; i < DIM; ++i)
+		distance += (p[i] - q[i]) * (p[i] - q[i]);
+	return distance;
+}
+
+/**
+ * The Hamming distance between two bit-vectors of WORDS 64-bit words - the number of bits
+ * they differ in. The compiler's popcount becomes a single instruction on CPUs that have one.
+ */
+template <int WORDS>
+inline int spKernelHammingDistance(const uint64_t* p, const uint64_t* q)
+{
+	int distance = 0;
+	for (int i = 0; i < WORDS; ++i)
+		distance += __builtin_popcountll(p[i] ^ q[i]);
+	return distance;
+}
+
+/**
+ * The Hamming distance between two bit-vectors of nWords 64-bit words
+ */
+inline int spKernelHammingDistance(const uint64_t* p, const uint64_t* q, int nWords)
+{
+	int distance = 0;
+	for (int i = 0; i < nWords; ++i)
+		distance += __builtin_popcountll(p[i] ^ q[i]);
+	return distance;
+}
+
+/**
+ * The K smallest values offered so far, with the index of each, from the smallest.
+ */
+template <int K>
+struct SPKernelTopK {
+	double values[K];
+	int indices[K];
+	int size;
+
+	SPKernelTopK() : size(0) {}
+
+	/**
+	 * Offers a value, with the semantics of spBPQueueEnqueue: equal values keep their
+	 * insertion order, and a full list rejects a value that isn't lower than its last.
+	 */
+	inline void offer(int index, double value)
+	{
+		if (size == K && value >= values[K - 1])
+			return;
+
+		int pos = size < K ? size++ : K - 1;
+		for (; pos > 0 && values[pos - 1] > value; --pos)
+		{
+			values[pos] = values[pos - 1];
+			indices[pos] = indices[pos - 1];
+		}
+		values[pos] = value;
+		indices[pos] = index;
+	}
+};
+
+/**
+ * Offers a value to a list of the k smallest values offered so far, kept sorted in values, with
+ * the index of each in indices - for a k known only at run time. The semantics are SPKernelTopK's.
+ * Once the list is full, almost all values are rejected by the first comparison.
+ *
+ * @param values - The values of the list, with room for k
+ * @param indices - The index of every value of the list, with room for k
+ * @param size - The number of values in the list, updated
+ */
+template <typename T>
+inline void spKernelTopKOffer(T* values, int* indices, int* size, int k, int index, T value)
+{
+	if (*size == k)
+	{
+		if (value >= values[k - 1])
+			return;
+		--(*size); /*Drop the current last element*/
+	}
+
+	int pos = *size;
+	for (; pos > 0 && values[pos - 1] > value; --pos)
+	{
+		values[pos] = values[pos - 1];
+		indices[pos] = indices[pos - 1];
+	}
+
+	values[pos] = value;
+	indices[pos] = index;
+	++(*size);
+}
+
+/**
+ * The k smallest values offered so far, like SPKernelTopK for a k known only at run time,
+ * kept by spKernelTopKOffer in arrays owned by the caller.
+ */
+template <typename T>
+struct SPKernelTopKList {
+	T* values;
+	int* indices;
+	int size;
+	int k;
+
+	SPKernelTopKList(T* values, int* indices, int k) : values(values), indices(indices), size(0), k(k) {}
+
+	inline void offer(int index, T value)
+	{
+		spKernelTopKOffer(values, indices, &size, k, index, value);
+	}
+};
+
+#endif /* SP_KERNELS_H_ */
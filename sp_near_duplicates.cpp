@@ -0,0 +1,245 @@
+#include "sp_near_duplicates.h"
+#include "sp_parallel.h"
+#include "sp_kernels.h"
+#include <cstdlib>
+#include <cassert>
+#include <cfloat>
+#include <mutex>
+#include <algorithm>
+
+/*The nearest and second nearest descriptors found so far for a descriptor of one image in the other*/
+typedef struct near_duplicates_neighbours_t {
+	double* nearest;
+	double* second;
+	int* nearestIndex;
+} NearDuplicatesNeighbours;
+
+/*
+ * The L2-squared distance between two descriptors - specialized for a dimension known at compile time,
+ * or of dim coordinates for DIM 0
+ */
+template <int DIM>
+static inline double descriptorDistance(const double* p, const double* q, int dim)
+{
+	(void)dim;
+	return spKernelL2SquaredDistance<DIM>(p, q);
+}
+
+template <>
+inline double descriptorDistance<0>(const double* p, const double* q, int dim)
+{
+	double distance = 0;
+	for(int i = 0; i < dim; ++i)
+		distance += (p[i] - q[i]) * (p[i] - q[i]);
+	return distance;
+}
+
+/*Offers the distance to descriptor index as a neighbour of descriptor d*/
+static inline void offerNeighbour(NearDuplicatesNeighbours* neighbours, int d, int index, double distance)
+{
+	if (distance < neighbours->nearest[d])
+	{
+		neighbours->second[d] = neighbours->nearest[d];
+		neighbours->nearest[d] = distance;
+		neighbours->nearestIndex[d] = index;
+	}
+	else if (distance < neighbours->second[d])
+		neighbours->second[d] = distance;
+}
+
+/*Whether the nearest neighbour of descriptor d passes the ratio test (on squared distances)*/
+static inline bool isDistinctNeighbour(const NearDuplicatesNeighbours* neighbours, int d)
+{
+	return neighbours->nearest[d] < SP_NEAR_DUPLICATES_MATCH_RATIO * SP_NEAR_DUPLICATES_MATCH_RATIO * neighbours->second[d];
+}
+
+/*
+ * The number of matching descriptors between images A and B. Every distance is computed once and
+ * offered to the neighbours of both descriptors.
+ */
+template <int DIM>
+static int countMatches(const double* const* descriptorsA, int nA, const double* const* descriptorsB, int nB,
+		int dim, NearDuplicatesNeighbours* neighboursA, NearDuplicatesNeighbours* neighboursB)
+{
+	for(int a = 0; a < nA; ++a)
+		neighboursA->nearest[a] = neighboursA->second[a] = DBL_MAX;
+	for(int b = 0; b < nB; ++b)
+		neighboursB->nearest[b] = neighboursB->second[b] = DBL_MAX;
+
+	for(int a = 0; a < nA; ++a)
+	{
+		for(int b = 0; b < nB; ++b)
+		{
+			double distance = descriptorDistance<DIM>(descriptorsA[a], descriptorsB[b], dim);
+			offerNeighbour(neighboursA, a, b, distance);
+			offerNeighbour(neighboursB, b, a, distance);
+		}
+	}
+
+	/*Matches are mutual nearest neighbours that pass the ratio test in both images*/
+	int nMatches = 0;
+	for(int a = 0; a < nA; ++a)
+	{
+		int b = neighboursA->nearestIndex[a];
+		if (neighboursB->nearestIndex[b] == a && isDistinctNeighbour(neighboursA, a) && isDistinctNeighbour(neighboursB, b))
+			++nMatches;
+	}
+
+	return nMatches;
+}
+
+/*The root of the cluster of an image, flattening the path to it*/
+static int findCluster(int* parent, int image)
+{
+	while (parent[image] != image)
+	{
+		parent[image] = parent[parent[image]];
+		image = parent[image];
+	}
+	return image;
+}
+
+/*Allocates the neighbours of up to n descriptors. Returns false on allocation failure*/
+static bool createNeighbours(NearDuplicatesNeighbours* neighbours, int n)
+{
+	if (n < 1)
+		n = 1;
+	neighbours->nearest = (double*)malloc(sizeof(double) * n);
+	neighbours->second = (double*)malloc(sizeof(double) * n);
+	neighbours->nearestIndex = (int*)malloc(sizeof(int) * n);
+	return neighbours->nearest != NULL && neighbours->second != NULL && neighbours->nearestIndex != NULL;
+}
+
+static void destroyNeighbours(NearDuplicatesNeighbours* neighbours)
+{
+	free(neighbours->nearest);
+	free(neighbours->second);
+	free(neighbours->nearestIndex);
+}
+
+int spNearDuplicatesFindClusters(SPPoint*** descriptors, const int* nDescriptors, int nImages,
+		double threshold, int* clusterOf)
+{
+	if (descriptors == NULL || nDescriptors == NULL || nImages < 1 || threshold <= 0 || threshold > 1 || clusterOf == NULL)
+		return -1;
+
+	/*The coordinates of all descriptors, image after image, so the inner loop doesn't go through the points*/
+	int* firstDescriptor = (int*)malloc(sizeof(int) * (nImages + 1));
+	int* parent = (int*)malloc(sizeof(int) * nImages);
+	if (firstDescriptor == NULL || parent == NULL)
+	{
+		free(firstDescriptor);
+		free(parent);
+		return -1;
+	}
+
+	int maxDescriptors = 0;
+	firstDescriptor[0] = 0;
+	for(int i = 0; i < nImages; ++i)
+	{
+		firstDescriptor[i + 1] = firstDescriptor[i] + (nDescriptors[i] > 0 ? nDescriptors[i] : 0);
+		if (nDescriptors[i] > maxDescriptors)
+			maxDescriptors = nDescriptors[i];
+		parent[i] = i;
+	}
+
+	const double** data = (const double**)malloc(sizeof(*data) * (firstDescriptor[nImages] > 0 ? firstDescriptor[nImages] : 1));
+	if (data == NULL)
+	{
+		free(firstDescriptor);
+		free(parent);
+		return -1;
+	}
+
+	int dim = 0;
+	for(int i = 0; i < nImages; ++i)
+	{
+		for(int j = 0; j < nDescriptors[i]; ++j)
+		{
+			SPPointView view = spPointGetView(descriptors[i][j]);
+			data[firstDescriptor[i] + j] = view.data;
+			dim = view.dim;
+		}
+	}
+
+	/*Every pair of blocks (blockA <= blockB) is a task, holding the pairs of images between them*/
+	int nBlocks = (nImages + SP_NEAR_DUPLICATES_BLOCK_SIZE - 1) / SP_NEAR_DUPLICATES_BLOCK_SIZE;
+	int nTasks = nBlocks * (nBlocks + 1) / 2;
+	std::mutex clustersMutex;
+	std::atomic<bool> isAllocationFailed(false);
+
+	spParallelFor(nTasks, 0, [&](int task) {
+		int blockA = 0;
+		while (task >= nBlocks - blockA)
+			task -= nBlocks - blockA++;
+		int blockB = blockA + task;
+
+		NearDuplicatesNeighbours neighboursA = {NULL, NULL, NULL}, neighboursB = {NULL, NULL, NULL};
+		bool isAllocated = createNeighbours(&neighboursA, maxDescriptors) && createNeighbours(&neighboursB, maxDescriptors);
+
+		int endA = std::min(nImages, (blockA + 1) * SP_NEAR_DUPLICATES_BLOCK_SIZE);
+		int endB = std::min(nImages, (blockB + 1) * SP_NEAR_DUPLICATES_BLOCK_SIZE);
+		for(int a = blockA * SP_NEAR_DUPLICATES_BLOCK_SIZE; isAllocated && a < endA; ++a)
+		{
+			for(int b = std::max(a + 1, blockB * SP_NEAR_DUPLICATES_BLOCK_SIZE); b < endB; ++b)
+			{
+				int nA = firstDescriptor[a + 1] - firstDescriptor[a];
+				int nB = firstDescriptor[b + 1] - firstDescriptor[b];
+				if (nA == 0 || nB == 0)
+					continue;
+
+				int nMatches = dim == SP_KERNEL_SIFT_DIMENSION ?
+					countMatches<SP_KERNEL_SIFT_DIMENSION>(data + firstDescriptor[a], nA, data + firstDescriptor[b], nB,
+						dim, &neighboursA, &neighboursB) :
+					countMatches<0>(data + firstDescriptor[a], nA, data + firstDescriptor[b], nB,
+						dim, &neighboursA, &neighboursB);
+
+				if (nMatches >= threshold * std::min(nA, nB))
+				{
+					/*Clusters are connected components, so the order pairs join them in doesn't matter*/
+					std::lock_guard<std::mutex> lock(clustersMutex);
+					int rootA = findCluster(parent, a);
+					int rootB = findCluster(parent, b);
+					parent[std::max(rootA, rootB)] = std::min(rootA, rootB);
+				}
+			}
+		}
+
+		if (!isAllocated)
+			isAllocationFailed = true;
+		destroyNeighbours(&neighboursA);
+		destroyNeighbours(&neighboursB);
+	});
+
+	free(data);
+	free(firstDescriptor);
+
+	if (isAllocationFailed)
+	{
+		free(parent);
+		return -1;
+	}
+
+	/*The root of a cluster is its lowest image - first mark the roots of clusters of more than one image*/
+	for(int i = 0; i < nImages; ++i)
+		clusterOf[i] = -1;
+	for(int i = 0; i < nImages; ++i)
+	{
+		int root = findCluster(parent, i);
+		if (root != i)
+			clusterOf[root] = 0;
+	}
+
+	int nClusters = 0;
+	for(int i = 0; i < nImages; ++i)
+	{
+		int root = findCluster(parent, i);
+		if (root == i && clusterOf[i] == 0)
+			clusterOf[i] = nClusters++;
+		else if (root != i)
+			clusterOf[i] = clusterOf[root];
+	}
+
+	free(parent);
+	return nClusters;
+}
@@ -0,0 +1,54 @@
+#ifndef SP_NEAR_DUPLICATES_H_
+#define SP_NEAR_DUPLICATES_H_
+
+extern "C"{
+	#include "SPPoint.h"
+}
+
+/**
+ * SPNearDuplicates Summary
+ * Finds the clusters of near-duplicate images among a set of images, by comparing
+ * the local descriptors of every pair of images - all of them, in parallel.
+ *
+ * The similarity of two images is the number of descriptors that match between
+ * them, out of the number of descriptors of the image with fewer. Two descriptors
+ * match if each is the other's nearest neighbour in the other image, and it's
+ * clearly nearer than the second nearest one - in both images (Lowe's ratio test).
+ * The similarity is symmetric, and it's 1 for an image and a copy of itself.
+ *
+ * Every pair's descriptor distances are computed once, serving both directions.
+ * The images are split into blocks, and every pair of blocks is a task of its own,
+ * so the descriptors of a block are reused from the cache across the pairs of it.
+ *
+ * Images whose similarity is at least the threshold are in the same cluster, and so
+ * are images connected through a chain of such pairs.
+ *
+ * The following functions are supported:
+ *
+ * spNearDuplicatesFindClusters	- Finds the clusters of near-duplicate images
+ *
+ */
+
+/** The ratio between the distances to the nearest and the second nearest descriptor a match has to be under **/
+#define SP_NEAR_DUPLICATES_MATCH_RATIO 0.8
+
+/** The number of images in a block of the all-pairs computation **/
+#define SP_NEAR_DUPLICATES_BLOCK_SIZE 8
+
+/**
+ * Finds the clusters of near-duplicate images.
+ *
+ * @param descriptors - The descriptors of every image, all of the same dimension
+ * @param nDescriptors - The number of descriptors of every image
+ * @param nImages - The number of images
+ * @param threshold - The similarity, in (0, 1], from which a pair of images is near-duplicate
+ * @param clusterOf - Set to the cluster of every image, an array of nImages. Clusters are numbered
+ * from 0 by their lowest image, and an image without near-duplicates is set to -1.
+ * @return
+ * -1 if an argument is invalid or allocation failure occurred.
+ * Otherwise, the number of clusters - each holding at least two images.
+ */
+int spNearDuplicatesFindClusters(SPPoint*** descriptors, const int* nDescriptors, int nImages,
+		double threshold, int* clusterOf);
+
+#endif /* SP_NEAR_DUPLICATES_H_ */
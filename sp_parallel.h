@@ -0,0 +1,55 @@
+#ifndef SP_PARALLEL_H_
+#define SP_PARALLEL_H_
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <system_error>
+
+/**
+ * Runs body(task) for every task in [0, nTasks), spreading the tasks over up to
+ * maxThreads threads (or the number of hardware threads if maxThreads <= 0).
+ * The calling thread takes part in the work, and the function returns only
+ * after all tasks were run.
+ *
+ * Tasks are handed out one at a time, so they may run in any order and body
+ * must be safe to call concurrently for different tasks.
+ * If no thread can be started, all tasks simply run on the calling thread.
+ *
+ * @param nTasks - The number of tasks to run
+ * @param maxThreads - The maximal number of threads to use
+ * @param body - A callable taking the (int) task index
+ */
+template <typename Body>
+void spParallelFor(int nTasks, int maxThreads, const Body& body)
+{
+	if (nTasks <= 0)
+		return;
+
+	int nThreads = maxThreads > 0 ? maxThreads : (int)std::thread::hardware_concurrency();
+	if (nThreads > nTasks)
+		nThreads = nTasks;
+
+	std::atomic<int> nextTask(0);
+	auto worker = [&]() {
+		for(int task = nextTask++; task < nTasks; task = nextTask++)
+			body(task);
+	};
+
+	std::vector<std::thread> threads;
+	for(int i = 1; i < nThreads; ++i)
+	{
+		try {
+			threads.push_back(std::thread(worker));
+		} catch (const std::system_error&) {
+			break; /*Couldn't start another thread - the started ones will do all the work*/
+		}
+	}
+
+	worker();
+
+	for(size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+}
+
+#endif /* SP_PARALLEL_H_ */
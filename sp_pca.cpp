@@ -0,0 +1,251 @@
+#include "sp_pca.h"
+#include "sp_parallel.h"
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+/*The number of samples each thread adds to the covariance matrix at a time*/
+#define PCA_COVARIANCE_CHUNK_SIZE 2048
+
+/*The maximal number of Jacobi sweeps over the covariance matrix*/
+#define PCA_MAX_JACOBI_SWEEPS 50
+
+/*Variances below this fraction of the largest one are treated as 0 when whitening*/
+#define PCA_WHITENING_EPSILON 1e-9
+
+/*
+ * Adds the outer products of the centered samples [start, end) to the upper triangle of cov.
+ */
+static void addCovariance(const SPPointView* samples, int start, int end, const double* mean, int dim,
+		double* centered, double* cov)
+{
+	for(int s = start; s < end; ++s)
+	{
+		for(int i = 0; i < dim; ++i)
+			centered[i] = samples[s].data[i] - mean[i];
+
+		for(int i = 0; i < dim; ++i)
+		{
+			double ci = centered[i];
+			double* row = cov + (size_t)i * dim;
+			for(int j = i; j < dim; ++j)
+				row[j] += ci * centered[j];
+		}
+	}
+}
+
+/*
+ * Diagonalizes the symmetric n x n matrix a with cyclic Jacobi rotations.
+ * On return, the diagonal of a holds the eigenvalues and column k of v the eigenvector of a[k][k].
+ */
+static void jacobiEigen(double* a, double* v, int n)
+{
+	for(int i = 0; i < n; ++i)
+		for(int j = 0; j < n; ++j)
+			v[i * n + j] = i == j ? 1 : 0;
+
+	for(int sweep = 0; sweep < PCA_MAX_JACOBI_SWEEPS; ++sweep)
+	{
+		double offDiagonal = 0;
+		double diagonal = 0;
+		for(int i = 0; i < n; ++i)
+		{
+			diagonal += a[i * n + i] * a[i * n + i];
+			for(int j = i + 1; j < n; ++j)
+				offDiagonal += a[i * n + j] * a[i * n + j];
+		}
+
+		if (offDiagonal <= 1e-24 * diagonal)
+			break;
+
+		for(int p = 0; p < n; ++p)
+			for(int q = p + 1; q < n; ++q)
+			{
+				double apq = a[p * n + q];
+				if (apq == 0)
+					continue;
+
+				/*The rotation that zeroes a[p][q]*/
+				double theta = (a[q * n + q] - a[p * n + p]) / (2 * apq);
+				double t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
+				double c = 1 / sqrt(t * t + 1);
+				double s = t * c;
+
+				for(int k = 0; k < n; ++k)
+				{
+					double akp = a[k * n + p];
+					double akq = a[k * n + q];
+					a[k * n + p] = c * akp - s * akq;
+					a[k * n + q] = s * akp + c * akq;
+				}
+				for(int k = 0; k < n; ++k)
+				{
+					double apk = a[p * n + k];
+					double aqk = a[q * n + k];
+					a[p * n + k] = c * apk - s * aqk;
+					a[q * n + k] = s * apk + c * aqk;
+				}
+				for(int k = 0; k < n; ++k)
+				{
+					double vkp = v[k * n + p];
+					double vkq = v[k * n + q];
+					v[k * n + p] = c * vkp - s * vkq;
+					v[k * n + q] = s * vkp + c * vkq;
+				}
+			}
+	}
+}
+
+SPPca* spPcaTrain(const SPPointView* samples, int nSamples, int nComponents, bool isWhitening)
+{
+	if (samples == NULL || nSamples < 2 || nComponents < 1 || nComponents > samples[0].dim)
+		return NULL;
+
+	int dim = samples[0].dim;
+	int nChunks = (nSamples + PCA_COVARIANCE_CHUNK_SIZE - 1) / PCA_COVARIANCE_CHUNK_SIZE;
+
+	SPPca* pca = (SPPca*)calloc(1, sizeof(*pca));
+	double* cov = (double*)calloc((size_t)dim * dim, sizeof(*cov));
+	double* eigenvectors = (double*)malloc(sizeof(*eigenvectors) * dim * dim);
+	double* chunkCovs = (double*)calloc((size_t)nChunks * dim * dim, sizeof(*chunkCovs));
+	double* centered = (double*)malloc(sizeof(*centered) * nChunks * dim);
+	int* order = (int*)malloc(sizeof(*order) * dim);
+
+	bool isAllocated = pca != NULL && cov != NULL && eigenvectors != NULL && chunkCovs != NULL &&
+		centered != NULL && order != NULL;
+
+	if (isAllocated)
+	{
+		pca->dim = dim;
+		pca->nComponents = nComponents;
+		pca->isWhitening = isWhitening;
+		pca->mean = (double*)calloc(dim, sizeof(*pca->mean));
+		pca->components = (double*)malloc(sizeof(*pca->components) * nComponents * dim);
+		pca->variances = (double*)malloc(sizeof(*pca->variances) * nComponents);
+		isAllocated = pca->mean != NULL && pca->components != NULL && pca->variances != NULL;
+	}
+
+	if (isAllocated)
+	{
+		for(int s = 0; s < nSamples; ++s)
+			for(int i = 0; i < dim; ++i)
+				pca->mean[i] += samples[s].data[i];
+		for(int i = 0; i < dim; ++i)
+			pca->mean[i] /= nSamples;
+
+		/*Every chunk has its own partial matrix, which are summed in chunk order - so the result
+		 * doesn't depend on how the chunks were spread over threads*/
+		spParallelFor(nChunks, 0, [&](int chunk) {
+			addCovariance(samples, chunk * PCA_COVARIANCE_CHUNK_SIZE,
+					std::min(nSamples, (chunk + 1) * PCA_COVARIANCE_CHUNK_SIZE), pca->mean, dim,
+					centered + (size_t)chunk * dim, chunkCovs + (size_t)chunk * dim * dim);
+		});
+
+		for(int chunk = 0; chunk < nChunks; ++chunk)
+			for(int i = 0; i < dim * dim; ++i)
+				cov[i] += chunkCovs[(size_t)chunk * dim * dim + i];
+
+		for(int i = 0; i < dim; ++i)
+			for(int j = i; j < dim; ++j)
+				cov[j * dim + i] = cov[i * dim + j] = cov[i * dim + j] / (nSamples - 1);
+
+		jacobiEigen(cov, eigenvectors, dim);
+
+		/*The components by decreasing variance*/
+		pca->totalVariance = 0;
+		for(int i = 0; i < dim; ++i)
+		{
+			order[i] = i;
+			pca->totalVariance += std::max(0.0, cov[i * dim + i]);
+		}
+		std::stable_sort(order, order + dim, [&](int a, int b) { return cov[a * dim + a] > cov[b * dim + b]; });
+
+		double largestVariance = std::max(0.0, cov[order[0] * dim + order[0]]);
+		for(int c = 0; c < nComponents; ++c)
+		{
+			int k = order[c];
+			double* component = pca->components + (size_t)c * dim;
+			pca->variances[c] = std::max(0.0, cov[k * dim + k]);
+
+			/*Eigenvectors are only defined up to their sign - fix it so the largest coordinate is positive*/
+			int largest = 0;
+			for(int i = 0; i < dim; ++i)
+			{
+				component[i] = eigenvectors[i * dim + k];
+				if (fabs(component[i]) > fabs(component[largest]))
+					largest = i;
+			}
+			double scale = component[largest] < 0 ? -1 : 1;
+
+			if (isWhitening && pca->variances[c] > PCA_WHITENING_EPSILON * largestVariance)
+				scale /= sqrt(pca->variances[c]);
+
+			for(int i = 0; i < dim; ++i)
+				component[i] *= scale;
+		}
+	}
+
+	free(cov);
+	free(eigenvectors);
+	free(chunkCovs);
+	free(centered);
+	free(order);
+
+	if (!isAllocated)
+	{
+		spPcaDestroy(pca);
+		return NULL;
+	}
+
+	return pca;
+}
+
+void spPcaProject(const SPPca* pca, const double* descriptor, double* res)
+{
+	assert(pca != NULL && descriptor != NULL && res != NULL);
+
+	for(int c = 0; c < pca->nComponents; ++c)
+	{
+		const double* component = pca->components + (size_t)c * pca->dim;
+		double value = 0;
+		for(int i = 0; i < pca->dim; ++i)
+			value += (descriptor[i] - pca->mean[i]) * component[i];
+		res[c] = value;
+	}
+}
+
+size_t spPcaGetMemoryUsage(const SPPca* pca)
+{
+	if (pca == NULL)
+		return 0;
+
+	return sizeof(*pca) + sizeof(*pca->mean) * (size_t)pca->dim +
+		sizeof(*pca->components) * (size_t)pca->nComponents * pca->dim + sizeof(*pca->variances) * (size_t)pca->nComponents;
+}
+
+double spPcaGetRetainedVariance(const SPPca* pca)
+{
+	assert(pca != NULL);
+
+	if (pca->totalVariance <= 0)
+		return 1;
+
+	double retainedVariance = 0;
+	for(int c = 0; c < pca->nComponents; ++c)
+		retainedVariance += pca->variances[c];
+
+	return retainedVariance / pca->totalVariance;
+}
+
+void spPcaDestroy(SPPca* pca)
+{
+	if (pca != NULL)
+	{
+		free(pca->mean);
+		free(pca->components);
+		free(pca->variances);
+		free(pca);
+	}
+}
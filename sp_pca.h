@@ -0,0 +1,84 @@
+#ifndef SP_PCA_H_
+#define SP_PCA_H_
+
+#include <stdbool.h>
+
+extern "C"{
+	#include "SPPoint.h"
+}
+
+/**
+ * SPPca Summary
+ * A principal component analysis of descriptors, used to project them to fewer
+ * dimensions. The components are the eigenvectors of the samples' covariance
+ * matrix with the largest eigenvalues, so the projection keeps as much of the
+ * descriptors' variance as any linear projection to that many dimensions can.
+ *
+ * With whitening, every projected coordinate is also divided by the standard
+ * deviation of its component, so all coordinates have unit variance.
+ *
+ * The following functions are supported:
+ *
+ * spPcaTrain			- Calculates the principal components of a sample of descriptors
+ * spPcaProject			- Projects a descriptor onto the principal components
+ * spPcaGetRetainedVariance	- The fraction of the samples' variance the components keep
+ * spPcaGetMemoryUsage		- The memory a PCA takes
+ * spPcaDestroy			- Free all resources associated with a PCA
+ *
+ */
+
+/** Type for defining the PCA **/
+typedef struct sp_pca_t {
+	int dim; /*The dimension of the original descriptors*/
+	int nComponents; /*The dimension of the projected descriptors*/
+	bool isWhitening; /*Whether projected coordinates are scaled to unit variance*/
+	double* mean; /*The mean of the samples, dim values*/
+	double* components; /*The principal axes, nComponents x dim - divided by their standard deviation if whitening*/
+	double* variances; /*The variance of the samples along each principal axis, in decreasing order*/
+	double totalVariance; /*The total variance of the samples*/
+} SPPca;
+
+/**
+ * Calculates the nComponents principal components of the given samples.
+ * The covariance matrix is accumulated in parallel and diagonalized with the
+ * Jacobi eigenvalue method.
+ *
+ * @param samples - The descriptors to train on, all of the same dimension
+ * @param nSamples - The number of samples
+ * @param nComponents - The dimension to project to, 1 <= nComponents <= the samples' dimension
+ * @param isWhitening - Whether projected coordinates should be scaled to unit variance
+ * @return
+ * NULL in case allocation failure ocurred, or samples is NULL, or nSamples < 2, or nComponents is invalid.
+ * Otherwise, the new PCA.
+ */
+SPPca* spPcaTrain(const SPPointView* samples, int nSamples, int nComponents, bool isWhitening);
+
+/**
+ * Projects a descriptor onto the principal components.
+ *
+ * @param pca - The PCA
+ * @param descriptor - pca->dim values
+ * @param res - OUTPUT parameter. Receives pca->nComponents values.
+ * @assert pca != NULL && descriptor != NULL && res != NULL
+ */
+void spPcaProject(const SPPca* pca, const double* descriptor, double* res);
+
+/**
+ * The fraction of the samples' total variance that the principal components keep.
+ *
+ * @assert pca != NULL
+ */
+double spPcaGetRetainedVariance(const SPPca* pca);
+
+/**
+ * The memory the PCA takes, in bytes. If pca is NULL, 0.
+ */
+size_t spPcaGetMemoryUsage(const SPPca* pca);
+
+/**
+ * Free all memory associated with the PCA.
+ * If pca is NULL nothing happens.
+ */
+void spPcaDestroy(SPPca* pca);
+
+#endif /* SP_PCA_H_ */
@@ -0,0 +1,503 @@
+#include "sp_search.h"
+#include "main_aux.h"
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <thread>
+#include <new>
+#include <system_error>
+
+/*The name the options are parsed after, as if they followed it on a command line*/
+#define SEARCH_PROGRAM_NAME "ex3"
+
+struct sp_search_database_t {
+	ImageDatabase* database;
+	int nArguments; /*The program name and the options*/
+	char** arguments; /*Copies, owned by the database - its options point into them*/
+	bool isBuilt;
+	pthread_rwlock_t lock; /*Held for reading by searches, and for writing by deletions and compactions - never across calls*/
+	unsigned long nCompactions; /*The number of compactions put in place, each of which moves the images' positions*/
+};
+
+/*
+ * A query runs as two independent chains - the global one (RGB hists extraction and search) on the
+ * calling thread, and the local one (local descriptors extraction and search) on localChain - so it
+ * takes as long as the longer of them. The chains write separate fields, until localChain is joined.
+ * Every search holds the database only while it runs, and keeps the image indices of its results,
+ * with their positions as of the compaction epoch it ran in, which the reports compare.
+ */
+struct sp_search_query_t {
+	SPSearchDatabase* database;
+	char* queryImagePath;
+	QueryFeatures features;
+	QueryStats stats;
+	int globalPositions[NUM_OF_CLOSEST_IMAGES_TO_PRINT]; /*The positions of the closest images by RGB hists*/
+	int globalIndices[NUM_OF_CLOSEST_IMAGES_TO_PRINT]; /*Their indices*/
+	int nGlobalIndices; /*-1 until searched*/
+	unsigned long globalEpoch; /*database->nCompactions when they were searched*/
+	int localPositions[NUM_OF_CLOSEST_IMAGES_TO_PRINT]; /*The positions of the closest images by local descriptors*/
+	int localIndices[NUM_OF_CLOSEST_IMAGES_TO_PRINT]; /*Their indices*/
+	int nLocalIndices; /*-1 until searched*/
+	unsigned long localEpoch; /*database->nCompactions when they were searched*/
+	std::thread localChain; /*Runs the local chain, until joined. Not joinable if it ran on the calling thread*/
+	SPSearchError localError; /*The error of the local chain, once it's done*/
+};
+
+/*The error of a program state that isn't PROGRAM_STATE_RUNNING*/
+static SPSearchError getError(PROGRAM_STATE programState)
+{
+	switch(programState)
+	{
+		case PROGRAM_STATE_RUNNING:
+		case PROGRAM_STATE_EXIT:
+			return SP_SEARCH_SUCCESS;
+		case PROGRAM_STATE_INVALID_N_IMAGES:
+			return SP_SEARCH_INVALID_NUM_OF_IMAGES;
+		case PROGRAM_STATE_INVALID_N_BINS:
+			return SP_SEARCH_INVALID_NUM_OF_BINS;
+		case PROGRAM_STATE_INVALID_N_FEATURES:
+			return SP_SEARCH_INVALID_NUM_OF_FEATURES;
+		case PROGRAM_STATE_INVALID_ARGUMENTS:
+			return SP_SEARCH_INVALID_ARGUMENT;
+		case PROGRAM_STATE_MEMORY_BUDGET_EXCEEDED:
+			return SP_SEARCH_MEMORY_BUDGET_EXCEEDED;
+		case PROGRAM_STATE_UNREADABLE_IMAGE:
+			return SP_SEARCH_UNREADABLE_IMAGE;
+		case PROGRAM_STATE_MEMORY_ERROR:
+			break;
+	}
+	return SP_SEARCH_OUT_OF_MEMORY;
+}
+
+/*Returns a heap copy of str, or NULL if failed to allocate memory*/
+static char* copyString(const char* str)
+{
+	char* res = (char*)malloc(strlen(str) + 1);
+	if (res != NULL)
+		strcpy(res, str);
+	return res;
+}
+
+/*The worker process shards answer one query at a time, so the local searches hold the database alone*/
+static bool isExclusive(const SPSearchDatabase* database)
+{
+	return database->database->options.nShards > 0;
+}
+
+/*Puts a compaction that finished in the background in place. The database is held alone*/
+static void finishCompaction(SPSearchDatabase* database)
+{
+	if (!IsDatabaseCompactionDone(database->database))
+		return;
+
+	FinishDatabaseCompaction(database->database);
+	database->nCompactions++;
+}
+
+/*
+ * Holds the database for a search - for reading, or alone if isAlone is set. A compaction that
+ * finished in the background is put in place first, holding the database alone only then, so
+ * searches don't wait for each other otherwise. The calling thread may not hold the database
+ * already - which no function does between calls.
+ */
+static void lockDatabase(SPSearchDatabase* database, bool isAlone)
+{
+	if (isAlone)
+	{
+		pthread_rwlock_wrlock(&database->lock);
+		finishCompaction(database);
+		return;
+	}
+
+	pthread_rwlock_rdlock(&database->lock);
+	if (!IsDatabaseCompactionDone(database->database))
+		return;
+
+	pthread_rwlock_unlock(&database->lock);
+	pthread_rwlock_wrlock(&database->lock);
+	finishCompaction(database);
+	pthread_rwlock_unlock(&database->lock);
+	pthread_rwlock_rdlock(&database->lock);
+}
+
+static void unlockDatabase(SPSearchDatabase* database)
+{
+	pthread_rwlock_unlock(&database->lock);
+}
+
+SPSearchError spSearchDatabaseCreate(int nOptions, const char* const* options, SPSearchDatabase** resDatabase)
+{
+	if (resDatabase == NULL)
+		return SP_SEARCH_INVALID_ARGUMENT;
+	*resDatabase = NULL;
+
+	if (nOptions < 0 || (options == NULL && nOptions > 0))
+		return SP_SEARCH_INVALID_ARGUMENT;
+
+	for(int i = 0; i < nOptions; ++i)
+		if (options[i] == NULL)
+			return SP_SEARCH_INVALID_ARGUMENT;
+
+	SPSearchDatabase* database = (SPSearchDatabase*)calloc(1, sizeof(*database));
+	if (database == NULL)
+		return SP_SEARCH_OUT_OF_MEMORY;
+
+	if (pthread_rwlock_init(&database->lock, NULL) != 0)
+	{
+		free(database);
+		return SP_SEARCH_OUT_OF_MEMORY;
+	}
+
+	database->database = (ImageDatabase*)calloc(1, sizeof(*database->database));
+	database->arguments = (char**)calloc(nOptions + 2, sizeof(*database->arguments));
+	SPSearchError error = database->database != NULL && database->arguments != NULL ?
+			SP_SEARCH_SUCCESS : SP_SEARCH_OUT_OF_MEMORY;
+
+	for(; error == SP_SEARCH_SUCCESS && database->nArguments <= nOptions; ++database->nArguments)
+	{
+		const char* argument = database->nArguments == 0 ? SEARCH_PROGRAM_NAME : options[database->nArguments - 1];
+		database->arguments[database->nArguments] = copyString(argument);
+		if (database->arguments[database->nArguments] == NULL)
+			error = SP_SEARCH_OUT_OF_MEMORY;
+	}
+
+	if (error == SP_SEARCH_SUCCESS)
+		error = getError(ParseCommandLineOptions(database->nArguments, database->arguments, &database->database->options));
+
+	if (error != SP_SEARCH_SUCCESS)
+	{
+		spSearchDatabaseDestroy(database);
+		return error;
+	}
+
+	*resDatabase = database;
+	return SP_SEARCH_SUCCESS;
+}
+
+SPSearchError spSearchDatabaseBuild(SPSearchDatabase* database, const SPSearchImages* images, int* resUnreadableImage)
+{
+	if (database == NULL || images == NULL || database->isBuilt || database->database->imgDirectory != NULL ||
+		images->imgDirectory == NULL || images->imgPrefix == NULL || images->imgSuffix == NULL)
+		return SP_SEARCH_INVALID_ARGUMENT;
+
+	if (images->nImages < 1)
+		return SP_SEARCH_INVALID_NUM_OF_IMAGES;
+	if (images->nBins < 1 || images->nBins > SP_SEARCH_MAX_NUM_OF_BINS)
+		return SP_SEARCH_INVALID_NUM_OF_BINS;
+	if (images->nFeaturesToExtract < 1)
+		return SP_SEARCH_INVALID_NUM_OF_FEATURES;
+
+	ImageDatabase* imageDatabase = database->database;
+	imageDatabase->imgDirectory = copyString(images->imgDirectory);
+	imageDatabase->imgPrefix = copyString(images->imgPrefix);
+	imageDatabase->imgSuffix = copyString(images->imgSuffix);
+	imageDatabase->nImages = images->nImages;
+	imageDatabase->nBins = images->nBins;
+	imageDatabase->nFeaturesToExtract = images->nFeaturesToExtract;
+
+	if (imageDatabase->imgDirectory == NULL || imageDatabase->imgPrefix == NULL || imageDatabase->imgSuffix == NULL)
+		return SP_SEARCH_OUT_OF_MEMORY;
+
+	PROGRAM_STATE programState = CalcImageDataBaseHistsAndDescriptors(imageDatabase);
+	if (programState == PROGRAM_STATE_UNREADABLE_IMAGE && resUnreadableImage != NULL)
+		*resUnreadableImage = imageDatabase->unreadableImage;
+
+	/*Reports the near-duplicate images instead of answering queries*/
+	if (programState == PROGRAM_STATE_RUNNING && imageDatabase->options.duplicatesThreshold > 0)
+		programState = PrintImageDatabaseDuplicates(imageDatabase);
+
+	database->isBuilt = programState == PROGRAM_STATE_RUNNING || programState == PROGRAM_STATE_EXIT;
+	return getError(programState);
+}
+
+bool spSearchDatabaseIsQueryable(const SPSearchDatabase* database)
+{
+	return database != NULL && database->isBuilt && database->database->options.duplicatesThreshold <= 0;
+}
+
+SPSearchError spSearchDatabaseDeleteImage(SPSearchDatabase* database, int imageIndex)
+{
+	if (!spSearchDatabaseIsQueryable(database))
+		return SP_SEARCH_INVALID_ARGUMENT;
+
+	double arrivalTime = GetMonotonicTime();
+
+	/*A compaction that finished in the background takes effect before the deletion*/
+	lockDatabase(database, true);
+	ImageDatabase* imageDatabase = database->database;
+
+	spWorkloadRecordDelete(imageDatabase->workloadRecorder, arrivalTime, imageIndex);
+	PROGRAM_STATE programState = DeleteDatabaseImage(imageDatabase, imageIndex);
+
+	unlockDatabase(database);
+
+	return programState == PROGRAM_STATE_INVALID_ARGUMENTS ? SP_SEARCH_IMAGE_NOT_DELETED : getError(programState);
+}
+
+void spSearchDatabaseDestroy(SPSearchDatabase* database)
+{
+	if (database == NULL)
+		return;
+
+	if (database->database != NULL)
+		DestroyImageDataBase(database->database);
+
+	if (database->arguments != NULL)
+		for(int i = 0; i < database->nArguments; ++i)
+			free(database->arguments[i]);
+	free(database->arguments);
+
+	pthread_rwlock_destroy(&database->lock);
+	free(database);
+}
+
+/*Searches the closest images to the query by RGB hists. The database is held*/
+static PROGRAM_STATE searchGlobalHeld(SPSearchQuery* query)
+{
+	const ImageDatabase* imageDatabase = query->database->database;
+
+	int nIndices = 0;
+	PROGRAM_STATE programState = GetClosestDatabaseImagesByRGBHists(query->features.RGBHists, imageDatabase,
+									query->globalPositions, &nIndices);
+	if (programState != PROGRAM_STATE_RUNNING)
+		return programState;
+
+	GetDatabaseImageIndices(imageDatabase, query->globalPositions, nIndices, query->globalIndices);
+	query->nGlobalIndices = nIndices;
+	query->globalEpoch = query->database->nCompactions;
+	return PROGRAM_STATE_RUNNING;
+}
+
+/*Searches the closest images to the query by local descriptors. The database is held*/
+static PROGRAM_STATE searchLocalHeld(SPSearchQuery* query)
+{
+	const ImageDatabase* imageDatabase = query->database->database;
+
+	int nIndices = 0;
+	PROGRAM_STATE programState = GetClosestDatabaseImagesByCascade(&query->features, imageDatabase,
+									query->localPositions, &nIndices, &query->stats);
+	if (programState != PROGRAM_STATE_RUNNING)
+		return programState;
+
+	GetDatabaseImageIndices(imageDatabase, query->localPositions, nIndices, query->localIndices);
+	query->nLocalIndices = nIndices;
+	query->localEpoch = query->database->nCompactions;
+	return PROGRAM_STATE_RUNNING;
+}
+
+/*
+ * The local chain of a query - extracts its local descriptors, and searches the closest images by them.
+ * Like the hists, the descriptors only depend on what a compaction never changes - the database is
+ * held by the search alone.
+ */
+static void runLocalChain(SPSearchQuery* query)
+{
+	PROGRAM_STATE programState = ExtractQueryLocalFeatures(query->queryImagePath, query->database->database,
+									&query->features);
+	if (programState == PROGRAM_STATE_RUNNING)
+	{
+		lockDatabase(query->database, isExclusive(query->database));
+		programState = searchLocalHeld(query);
+		unlockDatabase(query->database);
+	}
+
+	query->localError = getError(programState);
+}
+
+/*Starts the local chain of the query alongside the calling thread - or runs it right away, if no thread can be started*/
+static void startLocalChain(SPSearchQuery* query)
+{
+	try {
+		query->localChain = std::thread(runLocalChain, query);
+	} catch (const std::system_error&) {
+		runLocalChain(query);
+	}
+}
+
+SPSearchError spSearchQueryCreate(SPSearchDatabase* database, const char* queryImagePath, SPSearchQuery** resQuery)
+{
+	if (resQuery == NULL)
+		return SP_SEARCH_INVALID_ARGUMENT;
+	*resQuery = NULL;
+
+	if (!spSearchDatabaseIsQueryable(database) || queryImagePath == NULL)
+		return SP_SEARCH_INVALID_ARGUMENT;
+
+	/*The time budget of the query starts once it arrives*/
+	double arrivalTime = GetMonotonicTime();
+
+	SPSearchQuery* query = new (std::nothrow) SPSearchQuery;
+	if (query == NULL)
+		return SP_SEARCH_OUT_OF_MEMORY;
+
+	query->database = database;
+	memset(&query->features, 0, sizeof(query->features));
+	memset(&query->stats, 0, sizeof(query->stats));
+	query->localError = SP_SEARCH_SUCCESS;
+
+	query->queryImagePath = copyString(queryImagePath);
+	if (query->queryImagePath == NULL)
+	{
+		delete query;
+		return SP_SEARCH_OUT_OF_MEMORY;
+	}
+
+	const ImageDatabase* imageDatabase = database->database;
+	if (imageDatabase->options.deadlineMs > 0)
+		query->stats.deadline = arrivalTime + imageDatabase->options.deadlineMs / 1000.0;
+	query->stats.isSketchRecall = imageDatabase->options.isSketchReport;
+	query->nGlobalIndices = -1;
+	query->nLocalIndices = -1;
+
+	/*Recorded in the order of the deletions, which are recorded holding the database alone*/
+	pthread_rwlock_rdlock(&database->lock);
+	spWorkloadRecordQuery(imageDatabase->workloadRecorder, arrivalTime, queryImagePath);
+	unlockDatabase(database);
+
+	/*A shortlist is taken by RGB hists, so then the local chain starts once they're extracted*/
+	bool isShortlisted = imageDatabase->options.shortlistSize > 0;
+	if (!isShortlisted)
+		startLocalChain(query);
+
+	/*The hists only depend on the settings of the database, which never change - it isn't held*/
+	SPSearchError error = getError(ExtractQueryRGBHists(queryImagePath, imageDatabase, &query->features));
+	if (error == SP_SEARCH_SUCCESS && isShortlisted)
+		startLocalChain(query);
+
+	if (error != SP_SEARCH_SUCCESS)
+	{
+		spSearchQueryDestroy(query);
+		return error;
+	}
+
+	*resQuery = query;
+	return SP_SEARCH_SUCCESS;
+}
+
+/*Searches the closest images by RGB hists, if they weren't yet*/
+static SPSearchError searchGlobal(SPSearchQuery* query)
+{
+	if (query->nGlobalIndices >= 0)
+		return SP_SEARCH_SUCCESS;
+
+	lockDatabase(query->database, false);
+	PROGRAM_STATE programState = searchGlobalHeld(query);
+	unlockDatabase(query->database);
+
+	return getError(programState);
+}
+
+/*Waits for the local chain of the query, and returns its error*/
+static SPSearchError searchLocal(SPSearchQuery* query)
+{
+	if (query->localChain.joinable())
+		query->localChain.join();
+
+	return query->localError;
+}
+
+SPSearchError spSearchQueryGetGlobalResults(SPSearchQuery* query, int* resImages, int* nResImages)
+{
+	if (query == NULL || resImages == NULL || nResImages == NULL)
+		return SP_SEARCH_INVALID_ARGUMENT;
+
+	SPSearchError error = searchGlobal(query);
+	if (error != SP_SEARCH_SUCCESS)
+		return error;
+
+	memcpy(resImages, query->globalIndices, sizeof(*resImages) * query->nGlobalIndices);
+	*nResImages = query->nGlobalIndices;
+	return SP_SEARCH_SUCCESS;
+}
+
+SPSearchError spSearchQueryGetLocalResults(SPSearchQuery* query, int* resImages, int* nResImages)
+{
+	if (query == NULL || resImages == NULL || nResImages == NULL)
+		return SP_SEARCH_INVALID_ARGUMENT;
+
+	SPSearchError error = searchLocal(query);
+	if (error != SP_SEARCH_SUCCESS)
+		return error;
+
+	memcpy(resImages, query->localIndices, sizeof(*resImages) * query->nLocalIndices);
+	*nResImages = query->nLocalIndices;
+	return SP_SEARCH_SUCCESS;
+}
+
+SPSearchError spSearchQueryPrintReports(SPSearchQuery* query)
+{
+	if (query == NULL)
+		return SP_SEARCH_INVALID_ARGUMENT;
+
+	SPSearchError error = searchGlobal(query);
+	if (error == SP_SEARCH_SUCCESS)
+		error = searchLocal(query);
+	if (error != SP_SEARCH_SUCCESS)
+		return error;
+
+	/*The reports compare the results with searches of the database as it is now - results found
+	  before a compaction moved the images are searched again first*/
+	SPSearchDatabase* database = query->database;
+	lockDatabase(database, isExclusive(database));
+
+	PROGRAM_STATE programState = PROGRAM_STATE_RUNNING;
+	if (query->globalEpoch != database->nCompactions)
+		programState = searchGlobalHeld(query);
+
+	if (programState == PROGRAM_STATE_RUNNING && query->localEpoch != database->nCompactions)
+	{
+		QueryStats stats = query->stats;
+		memset(&query->stats, 0, sizeof(query->stats));
+		query->stats.deadline = stats.deadline;
+		query->stats.isSketchRecall = stats.isSketchRecall;
+		programState = searchLocalHeld(query);
+	}
+
+	if (programState == PROGRAM_STATE_RUNNING)
+		programState = PrintQueryReports(query->queryImagePath, &query->features, database->database,
+							&query->stats, query->globalPositions, query->nGlobalIndices,
+							query->localPositions, query->nLocalIndices);
+
+	unlockDatabase(database);
+	return getError(programState);
+}
+
+void spSearchQueryDestroy(SPSearchQuery* query)
+{
+	if (query == NULL)
+		return;
+
+	/*First, as the local chain reads the database and writes the features*/
+	if (query->localChain.joinable())
+		query->localChain.join();
+
+	DestroyQueryFeatures(&query->features);
+	free(query->queryImagePath);
+	delete query;
+}
+
+const char* spSearchGetErrorMessage(SPSearchError error)
+{
+	switch(error)
+	{
+		case SP_SEARCH_SUCCESS:
+			return "";
+		case SP_SEARCH_OUT_OF_MEMORY:
+			return MEMORY_ERROR_MSG;
+		case SP_SEARCH_INVALID_ARGUMENT:
+			return INVALID_ARGUMENTS_MSG;
+		case SP_SEARCH_INVALID_NUM_OF_IMAGES:
+			return INVALID_NUM_OF_IMAGES_MSG;
+		case SP_SEARCH_INVALID_NUM_OF_BINS:
+			return INVALID_NUM_OF_BINS_MSG;
+		case SP_SEARCH_INVALID_NUM_OF_FEATURES:
+			return INVALID_NUM_OF_FEATURES;
+		case SP_SEARCH_MEMORY_BUDGET_EXCEEDED:
+			return MEMORY_BUDGET_EXCEEDED_MSG;
+		case SP_SEARCH_UNREADABLE_IMAGE:
+			return UNREADABLE_IMAGE_MSG;
+		case SP_SEARCH_IMAGE_NOT_DELETED:
+			return IMAGE_NOT_DELETED_MSG;
+	}
+	return MEMORY_ERROR_MSG;
+}
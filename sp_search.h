@@ -0,0 +1,212 @@
+#ifndef SP_SEARCH_H_
+#define SP_SEARCH_H_
+
+#include <stdbool.h>
+
+/**
+ * SPSearch Summary
+ * The image search as a library - a database of images is built once, and then answers queries
+ * of the images closest to a query image, by RGB hists (global) and by local descriptors. It's
+ * what ex3 answers its input with, without reading the input, printing results or exiting: every
+ * failure is returned as an error code, and an image that can't be read is one of them.
+ *
+ * A database is configured by the options ex3 takes on its command line (see
+ * ParseCommandLineOptions), and built from its images. Reports that the options ask for are
+ * printed to the standard output, like ex3 prints them.
+ *
+ * Thread safety: separate databases are independent. Any number of threads may query one
+ * database at once, and hold any number of queries - no function holds the database between
+ * calls. Every search holds it for reading only while it runs, and deletions hold it alone,
+ * so they wait for the searches in flight. With worker process shards, which answer one query
+ * at a time, the local searches hold the database alone too. A query may be used by one thread
+ * at a time, which needn't be the one that created it.
+ *
+ * The following functions are supported:
+ *
+ * spSearchDatabaseCreate			- Creates a database with the given options
+ * spSearchDatabaseBuild			- Extracts the features of the images of a database
+ * spSearchDatabaseIsQueryable		- Whether a database answers queries
+ * spSearchDatabaseDeleteImage		- Deletes an image from a database
+ * spSearchDatabaseDestroy			- Free all resources associated with a database
+ * spSearchQueryCreate				- Starts a query of an image
+ * spSearchQueryGetGlobalResults	- The images closest to a query by RGB hists
+ * spSearchQueryGetLocalResults		- The images closest to a query by local descriptors
+ * spSearchQueryPrintReports		- Prints the reports the options ask for about a query
+ * spSearchQueryDestroy				- Free all resources associated with a query
+ * spSearchGetErrorMessage			- A message describing an error
+ *
+ */
+
+/** The most images a query's results hold **/
+#define SP_SEARCH_MAX_RESULTS 5
+
+/** The most bins of the RGB hists **/
+#define SP_SEARCH_MAX_NUM_OF_BINS 255
+
+/** Type used for returning error codes from search functions **/
+typedef enum sp_search_error_t {
+	SP_SEARCH_SUCCESS,
+	SP_SEARCH_OUT_OF_MEMORY,
+	SP_SEARCH_INVALID_ARGUMENT, /*A NULL or invalid argument, or options that are invalid or can't be combined*/
+	SP_SEARCH_INVALID_NUM_OF_IMAGES,
+	SP_SEARCH_INVALID_NUM_OF_BINS,
+	SP_SEARCH_INVALID_NUM_OF_FEATURES,
+	SP_SEARCH_MEMORY_BUDGET_EXCEEDED, /*The database doesn't fit in its memory budget*/
+	SP_SEARCH_UNREADABLE_IMAGE, /*An image couldn't be read or decoded*/
+	SP_SEARCH_IMAGE_NOT_DELETED, /*The image isn't in the database, it would leave fewer than 2 images, or the options don't support deletion*/
+} SPSearchError;
+
+/** The images of a database - <directory><prefix><index><suffix>, for every index below nImages **/
+typedef struct sp_search_images_t {
+	const char* imgDirectory;
+	const char* imgPrefix;
+	int nImages;
+	const char* imgSuffix;
+	int nBins; /*The number of bins of the RGB hists, up to SP_SEARCH_MAX_NUM_OF_BINS*/
+	int nFeaturesToExtract; /*The number of local descriptors to extract from every image*/
+} SPSearchImages;
+
+/** Type for defining the database **/
+typedef struct sp_search_database_t SPSearchDatabase;
+
+/** Type for defining a query **/
+typedef struct sp_search_query_t SPSearchQuery;
+
+/**
+ * Creates an empty database, with the given options. The options are copied.
+ *
+ * @param nOptions - The number of options
+ * @param options - The options, as ex3 takes them on its command line without its name
+ * @param resDatabase - OUTPUT parameter. Receives the new database, or NULL on error.
+ * @return
+ * SP_SEARCH_INVALID_ARGUMENT - An argument is NULL, or the options are invalid
+ * SP_SEARCH_OUT_OF_MEMORY - In case allocation failure ocurred
+ * SP_SEARCH_SUCCESS - Otherwise
+ */
+SPSearchError spSearchDatabaseCreate(int nOptions, const char* const* options, SPSearchDatabase** resDatabase);
+
+/**
+ * Extracts the RGB hists and local descriptors of the images of the database, and builds the
+ * structures its options ask for. If the options ask for near-duplicates, prints them instead
+ * of getting ready for queries. A database is built once, and isn't usable if it failed.
+ * No other thread may use the database meanwhile.
+ *
+ * @param database - The database
+ * @param images - The images of the database. They're copied.
+ * @param resUnreadableImage - OUTPUT parameter. If not NULL, receives the index of the image
+ * that couldn't be read, on SP_SEARCH_UNREADABLE_IMAGE.
+ * @return
+ * SP_SEARCH_INVALID_ARGUMENT - An argument is NULL, the database is already built, or its options
+ * don't fit the images (e.g. a PCA dimension that isn't lower than the descriptors')
+ * SP_SEARCH_INVALID_NUM_OF_IMAGES, SP_SEARCH_INVALID_NUM_OF_BINS, SP_SEARCH_INVALID_NUM_OF_FEATURES -
+ * If nImages < 1, nBins < 1 or > SP_SEARCH_MAX_NUM_OF_BINS, or nFeaturesToExtract < 1, in that order
+ * SP_SEARCH_MEMORY_BUDGET_EXCEEDED - An image doesn't fit in the memory budget
+ * SP_SEARCH_UNREADABLE_IMAGE - An image couldn't be read or decoded
+ * SP_SEARCH_OUT_OF_MEMORY - In case allocation failure ocurred
+ * SP_SEARCH_SUCCESS - Otherwise
+ */
+SPSearchError spSearchDatabaseBuild(SPSearchDatabase* database, const SPSearchImages* images, int* resUnreadableImage);
+
+/**
+ * Whether the database is built and answers queries - it doesn't if its options ask for
+ * near-duplicates instead.
+ * Returns false if database is NULL.
+ */
+bool spSearchDatabaseIsQueryable(const SPSearchDatabase* database);
+
+/**
+ * Deletes an image from the database - every search from now on skips it (see DeleteDatabaseImage).
+ * Waits for the searches in flight, but not for the queries that weren't destroyed yet.
+ *
+ * @param database - The database
+ * @param imageIndex - The index of the image
+ * @return
+ * SP_SEARCH_INVALID_ARGUMENT - database is NULL or doesn't answer queries
+ * SP_SEARCH_IMAGE_NOT_DELETED - The image isn't in the database, it would leave fewer than 2 images,
+ * or the database's options don't support deletion
+ * SP_SEARCH_OUT_OF_MEMORY - In case allocation failure ocurred
+ * SP_SEARCH_SUCCESS - Otherwise
+ */
+SPSearchError spSearchDatabaseDeleteImage(SPSearchDatabase* database, int imageIndex);
+
+/**
+ * Free all memory associated with the database. No query of it may be left.
+ * If database is NULL nothing happens.
+ */
+void spSearchDatabaseDestroy(SPSearchDatabase* database);
+
+/**
+ * Extracts the RGB hists of a query image, with the settings the database was built with, and
+ * starts the local chain of the query - extracting its local descriptors and searching by them -
+ * on a thread of its own, alongside the global one on the calling thread. So the global results
+ * are ready while the local search still runs, and a query takes as long as the longer chain.
+ * With a shortlist (OPTION_SHORTLIST), which is taken by RGB hists, the local chain starts once
+ * they're extracted.
+ * The time budget of the query (OPTION_DEADLINE) starts now.
+ * The database is held by the searches only while they run, not until the query is destroyed.
+ *
+ * @param database - The database to query
+ * @param queryImagePath - The path of the query image
+ * @param resQuery - OUTPUT parameter. Receives the new query, or NULL on error.
+ * @return
+ * SP_SEARCH_INVALID_ARGUMENT - An argument is NULL, or the database doesn't answer queries
+ * SP_SEARCH_UNREADABLE_IMAGE - The query image couldn't be read or decoded
+ * SP_SEARCH_OUT_OF_MEMORY - In case allocation failure ocurred
+ * SP_SEARCH_SUCCESS - Otherwise
+ */
+SPSearchError spSearchQueryCreate(SPSearchDatabase* database, const char* queryImagePath, SPSearchQuery** resQuery);
+
+/**
+ * Finds the images closest to the query by RGB hists, from the closest. Searched once - the
+ * following calls return the same images, even if images were deleted since.
+ *
+ * @param query - The query
+ * @param resImages - OUTPUT parameter. An array of at least SP_SEARCH_MAX_RESULTS image indices.
+ * @param nResImages - OUTPUT parameter. Receives the number of images stored in resImages.
+ * @return
+ * SP_SEARCH_INVALID_ARGUMENT - An argument is NULL
+ * SP_SEARCH_OUT_OF_MEMORY - In case allocation failure ocurred
+ * SP_SEARCH_SUCCESS - Otherwise
+ */
+SPSearchError spSearchQueryGetGlobalResults(SPSearchQuery* query, int* resImages, int* nResImages);
+
+/**
+ * Waits for the local chain of the query, and gets the images closest to it by local descriptors,
+ * from the closest - found with the cascade, index or file the database's options set.
+ *
+ * @param query - The query
+ * @param resImages - OUTPUT parameter. An array of at least SP_SEARCH_MAX_RESULTS image indices.
+ * @param nResImages - OUTPUT parameter. Receives the number of images stored in resImages.
+ * @return
+ * SP_SEARCH_INVALID_ARGUMENT - An argument is NULL
+ * SP_SEARCH_OUT_OF_MEMORY - In case allocation failure ocurred
+ * SP_SEARCH_SUCCESS - Otherwise
+ */
+SPSearchError spSearchQueryGetLocalResults(SPSearchQuery* query, int* resImages, int* nResImages);
+
+/**
+ * Prints the reports the database's options ask for about the query (see PrintQueryReports).
+ * Searches the query by RGB hists first if it wasn't yet, and waits for its local chain.
+ * The reports compare the query's results with searches of the database as it is now, so if a
+ * compaction moved its images since they were found, the query is searched again first.
+ *
+ * @return
+ * SP_SEARCH_INVALID_ARGUMENT - query is NULL
+ * SP_SEARCH_OUT_OF_MEMORY - In case allocation failure ocurred
+ * SP_SEARCH_SUCCESS - Otherwise
+ */
+SPSearchError spSearchQueryPrintReports(SPSearchQuery* query);
+
+/**
+ * Free all memory associated with the query. Waits for its local chain, if it still runs.
+ * If query is NULL nothing happens.
+ */
+void spSearchQueryDestroy(SPSearchQuery* query);
+
+/**
+ * A message describing the error, ending with a new line, as ex3 prints it on exit.
+ * The message is static - it shouldn't be freed.
+ */
+const char* spSearchGetErrorMessage(SPSearchError error);
+
+#endif /* SP_SEARCH_H_ */
@@ -0,0 +1,556 @@
+#include "sp_shard_pool.h"
+#include "sp_descriptor_file.h"
+#include "sp_kernels.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <cerrno>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+/*The status a shard answers a request with*/
+#define SHARD_STATUS_OK 1
+#define SHARD_STATUS_ERROR 0
+
+/*The requests the spawner answers*/
+#define SPAWN_START 1
+#define SPAWN_STOP 2
+
+/*A shard - a worker process and the socket the pool talks to it through*/
+typedef struct shard_t {
+	pid_t pid; /*The process of the shard, -1 if not running*/
+	int socket; /*The pool's end of the socket, -1 if not running*/
+	int firstImage; /*The first image of the shard's range*/
+	int endImage; /*One past the last image of the shard's range*/
+} Shard;
+
+struct sp_shard_pool_t {
+	char* path; /*The path of the descriptor file*/
+	int64_t blockSize; /*The size of the blocks the shards stream the file in*/
+	int dim; /*The dimension of the descriptors*/
+	int nShards; /*The number of shards*/
+	int nRestarts; /*The number of times shards were restarted*/
+	Shard* shards; /*The shards, by increasing image range*/
+	pid_t spawnerPid; /*The process that starts and stops the shards, -1 if not running*/
+	int spawnerSocket; /*The pool's end of the spawner's socket, -1 if not running*/
+};
+
+/*
+ * A request of the spawner - to start a shard over a range of images, answered with its process id
+ * and the pool's end of its socket, or to stop a shard, answered once it exited
+ */
+typedef struct spawn_request_t {
+	int32_t type; /*SPAWN_START or SPAWN_STOP*/
+	int32_t firstImage; /*The range of the shard to start*/
+	int32_t endImage;
+	int32_t pid; /*The shard to stop*/
+	int32_t isKilled; /*Whether the shard to stop is killed, or exits once its socket is closed*/
+} SpawnRequest;
+
+/*The header of a request - followed by nQueries * dim doubles*/
+typedef struct shard_request_t {
+	int32_t nQueries;
+	int32_t dim;
+	int32_t kClosest;
+} ShardRequest;
+
+/*Sends size bytes, resuming after partial sends. A closed peer fails the send instead of raising SIGPIPE*/
+static bool sendAll(int socket, const void* buffer, size_t size)
+{
+	const char* bytes = (const char*)buffer;
+	while (size > 0)
+	{
+		ssize_t sent = send(socket, bytes, size, MSG_NOSIGNAL);
+		if (sent <= 0)
+			return false;
+		bytes += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+/*Receives size bytes, resuming after partial receives. Returns false on error or a closed peer*/
+static bool recvAll(int socket, void* buffer, size_t size)
+{
+	char* bytes = (char*)buffer;
+	while (size > 0)
+	{
+		ssize_t received = recv(socket, bytes, size, 0);
+		if (received <= 0)
+			return false;
+		bytes += received;
+		size -= received;
+	}
+	return true;
+}
+
+/*
+ * The main loop of a shard process: answers requests on socket until it's closed.
+ */
+static void runShard(int socket, const char* path, int firstImage, int endImage, int64_t blockSize)
+{
+	SPDescriptorFile* file = spDescriptorFileOpen(path);
+	ShardRequest request;
+
+	while (file != NULL && recvAll(socket, &request, sizeof(request)))
+	{
+		int nQueries = request.nQueries;
+		int dim = request.dim;
+		int k = request.kClosest;
+
+		if (nQueries < 0 || dim != spDescriptorFileGetDimension(file) || k <= 0)
+			break; /*Not a request of this pool*/
+
+		double* queriesData = (double*)malloc(sizeof(double) * ((size_t)nQueries * dim + 1));
+		SPPointView* queries = (SPPointView*)malloc(sizeof(SPPointView) * (nQueries + 1));
+		int32_t* sizes = (int32_t*)malloc(sizeof(int32_t) * (nQueries + 1));
+		double* distances = (double*)malloc(sizeof(double) * ((size_t)nQueries * k + 1));
+		int32_t* images = (int32_t*)malloc(sizeof(int32_t) * ((size_t)nQueries * k + 1));
+
+		bool isReceived = queriesData != NULL && queries != NULL && sizes != NULL && distances != NULL && images != NULL &&
+			recvAll(socket, queriesData, sizeof(double) * nQueries * dim);
+
+		int32_t status = SHARD_STATUS_ERROR;
+		if (isReceived)
+		{
+			for(int q = 0; q < nQueries; ++q)
+				queries[q] = spPointViewCreate(queriesData + (size_t)q * dim, dim, q);
+
+			if (spDescriptorFileFindClosestInRange(file, firstImage, endImage, queries, nQueries, k, blockSize,
+					distances, images, sizes))
+				status = SHARD_STATUS_OK;
+		}
+
+		bool isAnswered = isReceived && sendAll(socket, &status, sizeof(status)) &&
+			(status != SHARD_STATUS_OK ||
+				(sendAll(socket, sizes, sizeof(int32_t) * nQueries) &&
+				 sendAll(socket, distances, sizeof(double) * nQueries * k) &&
+				 sendAll(socket, images, sizeof(int32_t) * nQueries * k)));
+
+		free(queriesData);
+		free(queries);
+		free(sizes);
+		free(distances);
+		free(images);
+
+		if (!isAnswered)
+			break;
+	}
+
+	spDescriptorFileClose(file);
+	close(socket);
+}
+
+/*
+ * Sends a process id, with a file descriptor attached unless it's negative.
+ * Returns false on error or a closed peer.
+ */
+static bool sendDescriptor(int socket, pid_t pid, int descriptor)
+{
+	int32_t value = pid;
+	struct iovec data;
+	data.iov_base = &value;
+	data.iov_len = sizeof(value);
+
+	union {
+		char buffer[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr alignment;
+	} control;
+	memset(&control, 0, sizeof(control));
+
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &data;
+	message.msg_iovlen = 1;
+
+	if (descriptor >= 0)
+	{
+		message.msg_control = control.buffer;
+		message.msg_controllen = sizeof(control.buffer);
+
+		struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+		header->cmsg_level = SOL_SOCKET;
+		header->cmsg_type = SCM_RIGHTS;
+		header->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(header), &descriptor, sizeof(int));
+	}
+
+	return sendmsg(socket, &message, MSG_NOSIGNAL) == (ssize_t)sizeof(value);
+}
+
+/*
+ * Receives a process id and the file descriptor attached to it.
+ * Returns false on error, a closed peer, or if no process or descriptor was sent.
+ */
+static bool recvDescriptor(int socket, pid_t* pid, int* descriptor)
+{
+	int32_t value = -1;
+	struct iovec data;
+	data.iov_base = &value;
+	data.iov_len = sizeof(value);
+
+	union {
+		char buffer[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr alignment;
+	} control;
+	memset(&control, 0, sizeof(control));
+
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &data;
+	message.msg_iovlen = 1;
+	message.msg_control = control.buffer;
+	message.msg_controllen = sizeof(control.buffer);
+
+	*descriptor = -1;
+	if (recvmsg(socket, &message, 0) != (ssize_t)sizeof(value))
+		return false;
+
+	struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+	if (header != NULL && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+		memcpy(descriptor, CMSG_DATA(header), sizeof(int));
+
+	*pid = value;
+	if (value <= 0 && *descriptor >= 0)
+	{
+		close(*descriptor);
+		*descriptor = -1;
+	}
+	return *descriptor >= 0;
+}
+
+/*
+ * The main loop of the spawner process: starts and stops shards by the requests on socket until
+ * it's closed, and then waits for the shards that are left. It runs no other threads, so it may
+ * fork at any time - the pool's process may not, once it runs threads of its own.
+ */
+static void runSpawner(int socket, const char* path, int64_t blockSize)
+{
+	SpawnRequest request;
+
+	while (recvAll(socket, &request, sizeof(request)))
+	{
+		bool isAnswered = false;
+
+		if (request.type == SPAWN_START)
+		{
+			int sockets[2] = {-1, -1};
+			pid_t pid = socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0 ? fork() : -1;
+
+			if (pid == 0)
+			{
+				/*The shard process - it only needs its own end of its own socket*/
+				close(socket);
+				close(sockets[0]);
+				runShard(sockets[1], path, request.firstImage, request.endImage, blockSize);
+				_exit(0); /*Never return into the coordinator's code, nor flush its buffers*/
+			}
+
+			if (sockets[1] >= 0)
+				close(sockets[1]);
+			isAnswered = sendDescriptor(socket, pid, pid > 0 ? sockets[0] : -1);
+			if (sockets[0] >= 0)
+				close(sockets[0]);
+		}
+		else if (request.type == SPAWN_STOP && request.pid > 0)
+		{
+			if (request.isKilled)
+				kill(request.pid, SIGKILL);
+			waitpid(request.pid, NULL, 0);
+
+			int32_t status = SHARD_STATUS_OK;
+			isAnswered = sendAll(socket, &status, sizeof(status));
+		}
+
+		if (!isAnswered)
+			break;
+	}
+
+	close(socket);
+	while (wait(NULL) > 0 || errno == EINTR)
+		; /*The shards exit once the pool's ends of their sockets are closed*/
+}
+
+/*Starts the spawner process. Returns false if it couldn't be started*/
+static bool startSpawner(SPShardPool* pool)
+{
+	int sockets[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+		return false;
+
+	fflush(NULL); /*Nothing buffered should be written twice*/
+	pid_t pid = fork();
+
+	if (pid < 0)
+	{
+		close(sockets[0]);
+		close(sockets[1]);
+		return false;
+	}
+
+	if (pid == 0)
+	{
+		close(sockets[0]);
+		runSpawner(sockets[1], pool->path, pool->blockSize);
+		_exit(0);
+	}
+
+	close(sockets[1]);
+	pool->spawnerPid = pid;
+	pool->spawnerSocket = sockets[0];
+	return true;
+}
+
+/*Starts the process of a shard, by the spawner. Returns false if it couldn't be started*/
+static bool startShard(SPShardPool* pool, int s)
+{
+	Shard* shard = &pool->shards[s];
+
+	SpawnRequest request;
+	memset(&request, 0, sizeof(request));
+	request.type = SPAWN_START;
+	request.firstImage = shard->firstImage;
+	request.endImage = shard->endImage;
+
+	return pool->spawnerSocket >= 0 && sendAll(pool->spawnerSocket, &request, sizeof(request)) &&
+		recvDescriptor(pool->spawnerSocket, &shard->pid, &shard->socket);
+}
+
+/*Stops the process of a shard, whether it's still running or not, and waits for it to exit*/
+static void stopShard(SPShardPool* pool, int s, bool isKilled)
+{
+	Shard* shard = &pool->shards[s];
+	if (shard->socket >= 0)
+		close(shard->socket); /*A running shard exits once its socket is closed*/
+
+	if (shard->pid > 0 && pool->spawnerSocket >= 0)
+	{
+		SpawnRequest request;
+		memset(&request, 0, sizeof(request));
+		request.type = SPAWN_STOP;
+		request.pid = shard->pid;
+		request.isKilled = isKilled;
+
+		int32_t status = SHARD_STATUS_ERROR;
+		if (sendAll(pool->spawnerSocket, &request, sizeof(request)))
+			recvAll(pool->spawnerSocket, &status, sizeof(status));
+	}
+
+	shard->socket = -1;
+	shard->pid = -1;
+}
+
+SPShardPool* spShardPoolCreate(const char* path, int nShards, int64_t blockSize)
+{
+	if (path == NULL || nShards < 1)
+		return NULL;
+
+	SPDescriptorFile* file = spDescriptorFileOpen(path);
+	if (file == NULL)
+		return NULL;
+
+	int nImages = spDescriptorFileGetNumOfImages(file);
+	if (nShards > nImages)
+		nShards = nImages;
+
+	SPShardPool* pool = (SPShardPool*)calloc(1, sizeof(*pool));
+	if (pool != NULL)
+	{
+		pool->spawnerPid = -1;
+		pool->spawnerSocket = -1;
+		pool->path = (char*)malloc(strlen(path) + 1);
+		pool->shards = (Shard*)malloc(sizeof(*pool->shards) * nShards);
+	}
+
+	if (pool == NULL || pool->path == NULL || pool->shards == NULL)
+	{
+		spDescriptorFileClose(file);
+		spShardPoolDestroy(pool);
+		return NULL;
+	}
+
+	strcpy(pool->path, path);
+	pool->blockSize = blockSize;
+	pool->dim = spDescriptorFileGetDimension(file);
+	pool->nShards = nShards;
+
+	/*Contiguous ranges with about the same number of descriptors, each of at least one image*/
+	int64_t total = spDescriptorFileGetTotalNumOfDescriptors(file);
+	int64_t accumulated = 0;
+	int image = 0;
+	for(int s = 0; s < nShards; ++s)
+	{
+		Shard* shard = &pool->shards[s];
+		shard->pid = -1;
+		shard->socket = -1;
+		shard->firstImage = image;
+
+		int64_t target = total * (s + 1) / nShards;
+		int lastEnd = nImages - (nShards - s - 1); /*Leave an image for every following shard*/
+
+		do {
+			accumulated += spDescriptorFileGetNumOfDescriptors(file, image++);
+		} while (image < lastEnd && (accumulated < target || s == nShards - 1));
+
+		shard->endImage = image;
+	}
+
+	spDescriptorFileClose(file);
+
+	if (!startSpawner(pool))
+	{
+		spShardPoolDestroy(pool);
+		return NULL;
+	}
+
+	for(int s = 0; s < nShards; ++s)
+		if (!startShard(pool, s))
+		{
+			spShardPoolDestroy(pool);
+			return NULL;
+		}
+
+	return pool;
+}
+
+/*Sends a request to a shard. Returns false if the shard didn't take it*/
+static bool sendRequest(const Shard* shard, const ShardRequest* request, const SPPointView* queries)
+{
+	if (shard->socket < 0 || !sendAll(shard->socket, request, sizeof(*request)))
+		return false;
+
+	for(int q = 0; q < request->nQueries; ++q)
+		if (!sendAll(shard->socket, queries[q].data, sizeof(double) * request->dim))
+			return false;
+
+	return true;
+}
+
+/*Receives the answer of a shard to a request. Returns false if the shard failed to answer*/
+static bool recvResponse(const Shard* shard, const ShardRequest* request, int32_t* sizes, double* distances, int32_t* images)
+{
+	int32_t status = SHARD_STATUS_ERROR;
+	int n = request->nQueries;
+	int k = request->kClosest;
+
+	return recvAll(shard->socket, &status, sizeof(status)) && status == SHARD_STATUS_OK &&
+		recvAll(shard->socket, sizes, sizeof(int32_t) * n) &&
+		recvAll(shard->socket, distances, sizeof(double) * n * k) &&
+		recvAll(shard->socket, images, sizeof(int32_t) * n * k);
+}
+
+bool spShardPoolFindClosest(SPShardPool* pool, const SPPointView* queries, int nQueries,
+		int kClosest, int* resImages, int* resSizes)
+{
+	if (pool == NULL || queries == NULL || nQueries < 0 || kClosest <= 0 || resImages == NULL || resSizes == NULL)
+		return false;
+
+	for(int q = 0; q < nQueries; ++q)
+		if (queries[q].dim != pool->dim)
+			return false;
+
+	ShardRequest request;
+	request.nQueries = nQueries;
+	request.dim = pool->dim;
+	request.kClosest = kClosest;
+
+	/*The answers of all shards, one after the other*/
+	size_t nLists = (size_t)pool->nShards * nQueries;
+	int32_t* sizes = (int32_t*)malloc(sizeof(*sizes) * (nLists + 1));
+	double* distances = (double*)malloc(sizeof(*distances) * (nLists * kClosest + 1));
+	int32_t* images = (int32_t*)malloc(sizeof(*images) * (nLists * kClosest + 1));
+	double* values = (double*)malloc(sizeof(*values) * ((size_t)nQueries * kClosest + 1));
+	bool* isAnswered = (bool*)malloc(sizeof(*isAnswered) * pool->nShards);
+
+	bool isOk = sizes != NULL && distances != NULL && images != NULL && values != NULL && isAnswered != NULL;
+
+	if (isOk)
+	{
+		/*Scatter - all shards work on the query at the same time*/
+		for(int s = 0; s < pool->nShards; ++s)
+			isAnswered[s] = sendRequest(&pool->shards[s], &request, queries);
+
+		/*Gather*/
+		for(int s = 0; s < pool->nShards; ++s)
+			if (isAnswered[s])
+				isAnswered[s] = recvResponse(&pool->shards[s], &request, sizes + (size_t)s * nQueries,
+						distances + (size_t)s * nQueries * kClosest, images + (size_t)s * nQueries * kClosest);
+
+		/*A shard that didn't answer is restarted, and asked again*/
+		for(int s = 0; s < pool->nShards && isOk; ++s)
+			if (!isAnswered[s])
+			{
+				stopShard(pool, s, true);
+				pool->nRestarts++;
+
+				isOk = startShard(pool, s) &&
+					sendRequest(&pool->shards[s], &request, queries) &&
+					recvResponse(&pool->shards[s], &request, sizes + (size_t)s * nQueries,
+						distances + (size_t)s * nQueries * kClosest, images + (size_t)s * nQueries * kClosest);
+			}
+	}
+
+	if (isOk)
+	{
+		/*Merge - the shards' lists are offered in image range order, so ties are still
+		 * broken in favour of the lower image index, as in a single scan*/
+		for(int q = 0; q < nQueries; ++q)
+		{
+			resSizes[q] = 0;
+			for(int s = 0; s < pool->nShards; ++s)
+			{
+				size_t list = (size_t)s * nQueries + q;
+				for(int j = 0; j < sizes[list]; ++j)
+					spKernelTopKOffer(values + (size_t)q * kClosest, resImages + (size_t)q * kClosest, &resSizes[q], kClosest,
+							images[list * kClosest + j], distances[list * kClosest + j]);
+			}
+		}
+	}
+
+	free(sizes);
+	free(distances);
+	free(images);
+	free(values);
+	free(isAnswered);
+	return isOk;
+}
+
+int spShardPoolGetNumOfShards(const SPShardPool* pool)
+{
+	assert(pool != NULL);
+	return pool->nShards;
+}
+
+pid_t spShardPoolGetShardProcess(const SPShardPool* pool, int shard)
+{
+	assert(pool != NULL && shard >= 0 && shard < pool->nShards);
+	return pool->shards[shard].pid;
+}
+
+int spShardPoolGetNumOfRestarts(const SPShardPool* pool)
+{
+	assert(pool != NULL);
+	return pool->nRestarts;
+}
+
+void spShardPoolDestroy(SPShardPool* pool)
+{
+	if (pool != NULL)
+	{
+		for(int s = 0; pool->shards != NULL && s < pool->nShards; ++s)
+			stopShard(pool, s, false);
+
+		if (pool->spawnerSocket >= 0)
+			close(pool->spawnerSocket); /*The spawner exits once its socket is closed*/
+		if (pool->spawnerPid > 0)
+			waitpid(pool->spawnerPid, NULL, 0);
+
+		free(pool->shards);
+		free(pool->path);
+		free(pool);
+	}
+}
@@ -0,0 +1,94 @@
+#ifndef SP_SHARD_POOL_H_
+#define SP_SHARD_POOL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+extern "C"{
+	#include "SPPoint.h"
+}
+
+/**
+ * SPShardPool Summary
+ * Splits the search of a descriptor file (see SPDescriptorFile) over several
+ * worker processes - shards - each owning a contiguous range of image indices.
+ * The ranges are balanced by their number of descriptors.
+ *
+ * A query is scattered to all shards over a local socket, every shard finds the
+ * closest descriptors to each query feature in its own range, and the per-feature
+ * lists are gathered and merged in range order - so the merged result is exactly
+ * that of a single scan over the whole file, ties included.
+ *
+ * Shards are independent processes: a shard that died (or was killed) is noticed
+ * when it fails to answer, and is restarted and asked again. Shards are forked by a
+ * spawner process, which the pool starts when it's created and which runs no other
+ * threads - so a shard is restarted without forking the calling process, which may
+ * run threads of its own by then.
+ *
+ * The following functions are supported:
+ *
+ * spShardPoolCreate			- Starts the shards of a descriptor file
+ * spShardPoolFindClosest		- Finds the closest descriptors to each of a set of queries
+ * spShardPoolGetNumOfShards	- A getter of the number of shards
+ * spShardPoolGetShardProcess	- A getter of the process id of a shard
+ * spShardPoolGetNumOfRestarts	- A getter of the number of times shards were restarted
+ * spShardPoolDestroy			- Stops all shards and frees all resources of a pool
+ *
+ */
+
+/** Type for defining the shard pool **/
+typedef struct sp_shard_pool_t SPShardPool;
+
+/**
+ * Starts the spawner, and nShards worker processes by it, over the descriptor file at path.
+ * Must be called while the calling process runs no other threads - the other functions needn't be.
+ *
+ * @param path - The path of a finished descriptor file. Every shard opens it on its own.
+ * @param nShards - The number of shards. If larger than the number of images, one shard per image.
+ * @param blockSize - The size of the blocks the shards stream the file in, in bytes
+ * @return
+ * NULL if the file can't be opened, nShards < 1, a shard couldn't be started or allocation failure ocurred.
+ * Otherwise, the pool.
+ */
+SPShardPool* spShardPoolCreate(const char* path, int nShards, int64_t blockSize);
+
+/**
+ * Finds the kClosest descriptors to each query over all shards, with the same contract
+ * and the same results as spDescriptorFileFindClosest over the whole file.
+ *
+ * @return
+ * false if a shard failed to answer even after it was restarted, allocation failure ocurred
+ * or any argument is invalid. Otherwise true.
+ */
+bool spShardPoolFindClosest(SPShardPool* pool, const SPPointView* queries, int nQueries,
+		int kClosest, int* resImages, int* resSizes);
+
+/**
+ * A getter for the number of shards
+ *
+ * @assert pool != NULL
+ */
+int spShardPoolGetNumOfShards(const SPShardPool* pool);
+
+/**
+ * A getter for the process id of a shard
+ *
+ * @assert pool != NULL && 0 <= shard < the number of shards
+ */
+pid_t spShardPoolGetShardProcess(const SPShardPool* pool, int shard);
+
+/**
+ * A getter for the number of times shards were restarted since the pool was created
+ *
+ * @assert pool != NULL
+ */
+int spShardPoolGetNumOfRestarts(const SPShardPool* pool);
+
+/**
+ * Stops all shards and frees all resources of the pool.
+ * If pool is NULL nothing happens.
+ */
+void spShardPoolDestroy(SPShardPool* pool);
+
+#endif /* SP_SHARD_POOL_H_ */
@@ -0,0 +1,254 @@
+#include "sp_shared_database.h"
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*Identifies complete segments. A segment that is still being written has a zeroed magic*/
+#define SHARED_DATABASE_MAGIC "SPSHMDB3"
+#define SHARED_DATABASE_MAGIC_LENGTH 8
+
+/*Every section of the segment starts at a multiple of this offset*/
+#define SHARED_DATABASE_SECTION_ALIGNMENT 64
+
+/*The header at the start of the segment. All positions are offsets from the start of the segment*/
+typedef struct shared_database_header_t {
+	char magic[SHARED_DATABASE_MAGIC_LENGTH];
+	int32_t nImages; /*The number of images*/
+	int32_t nBins; /*The number of bins of each channel hist*/
+	int32_t dim; /*The dimension of the descriptors*/
+	int32_t nFeaturesToExtract; /*The number of features that was asked of every image*/
+	int32_t decodeScale; /*The SPExtractionConfig the features were extracted with*/
+	int32_t maxImageSide;
+	int32_t memoryBudgetMB; /*The SPSharedDatabaseBudgets the descriptors were kept within*/
+	int32_t descriptorBudget;
+	int32_t descriptorCap;
+	uint64_t fingerprint; /*Identifies the images and settings the features were extracted from*/
+	int64_t histsOffset; /*The hist matrix, nImages rows of SP_HIST_MATRIX_NUM_OF_CHANNELS * nBins doubles*/
+	int64_t firstDescriptorOffset; /*The position of the first descriptor of every image, and the total at [nImages]*/
+	int64_t descriptorsOffset; /*All descriptors, rows of dim doubles*/
+	int64_t size; /*The size of the segment*/
+} SharedDatabaseHeader;
+
+struct sp_shared_database_t {
+	const char* base; /*The start of the mapped segment*/
+	const SharedDatabaseHeader* header;
+	const double* hists;
+	const int64_t* firstDescriptor;
+	const double* descriptors;
+};
+
+/*Rounds offset up to the alignment of a section*/
+static int64_t alignSection(int64_t offset)
+{
+	return (offset + SHARED_DATABASE_SECTION_ALIGNMENT - 1) / SHARED_DATABASE_SECTION_ALIGNMENT * SHARED_DATABASE_SECTION_ALIGNMENT;
+}
+
+bool spSharedDatabasePublish(const char* name, const SPHistMatrix* hists, SPPoint*** descriptors,
+		const int* nDescriptors, int nFeaturesToExtract, const SPExtractionConfig* extraction,
+		const SPSharedDatabaseBudgets* budgets, uint64_t fingerprint)
+{
+	if (name == NULL || hists == NULL || descriptors == NULL || nDescriptors == NULL)
+		return false;
+
+	int nImages = hists->nImages;
+	int64_t nTotalDescriptors = 0;
+	for(int i = 0; i < nImages; ++i)
+	{
+		if (nDescriptors[i] <= 0 || descriptors[i] == NULL)
+			return false;
+		nTotalDescriptors += nDescriptors[i];
+	}
+	int dim = spPointGetDimension(descriptors[0][0]);
+
+	SharedDatabaseHeader header;
+	memset(&header, 0, sizeof(header));
+	header.nImages = nImages;
+	header.nBins = hists->nBins;
+	header.dim = dim;
+	header.nFeaturesToExtract = nFeaturesToExtract;
+	header.decodeScale = extraction != NULL ? extraction->decodeScale : 1;
+	header.maxImageSide = extraction != NULL ? extraction->maxImageSide : 0;
+	if (budgets != NULL)
+	{
+		header.memoryBudgetMB = budgets->memoryBudgetMB;
+		header.descriptorBudget = budgets->descriptorBudget;
+		header.descriptorCap = budgets->descriptorCap;
+	}
+	header.fingerprint = fingerprint;
+	header.histsOffset = alignSection(sizeof(header));
+	header.firstDescriptorOffset = alignSection(header.histsOffset + (int64_t)sizeof(double) * nImages * hists->rowLength);
+	header.descriptorsOffset = alignSection(header.firstDescriptorOffset + (int64_t)sizeof(int64_t) * (nImages + 1));
+	header.size = header.descriptorsOffset + (int64_t)sizeof(double) * nTotalDescriptors * dim;
+
+	/*A new segment - processes attached to an old one under the same name keep it as is*/
+	shm_unlink(name);
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0)
+		return false;
+
+	char* base = NULL;
+	if (ftruncate(fd, header.size) == 0)
+	{
+		void* mapped = mmap(NULL, header.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		base = mapped != MAP_FAILED ? (char*)mapped : NULL;
+	}
+	close(fd); /*The mapping stays valid*/
+
+	if (base == NULL)
+	{
+		shm_unlink(name);
+		return false;
+	}
+
+	/*Everything but the magic, which is written last - the segment is complete only then*/
+	memcpy(base, &header, sizeof(header));
+	memcpy(base + header.histsOffset, hists->data, sizeof(double) * (size_t)nImages * hists->rowLength);
+
+	int64_t* firstDescriptor = (int64_t*)(base + header.firstDescriptorOffset);
+	double* row = (double*)(base + header.descriptorsOffset);
+	firstDescriptor[0] = 0;
+	for(int i = 0; i < nImages; ++i)
+	{
+		firstDescriptor[i + 1] = firstDescriptor[i] + nDescriptors[i];
+		for(int j = 0; j < nDescriptors[i]; ++j, row += dim)
+		{
+			SPPointView descriptor = spPointGetView(descriptors[i][j]);
+			memcpy(row, descriptor.data, sizeof(double) * dim);
+		}
+	}
+
+	__sync_synchronize();
+	memcpy(base, SHARED_DATABASE_MAGIC, SHARED_DATABASE_MAGIC_LENGTH);
+
+	munmap(base, header.size);
+	return true;
+}
+
+SPSharedDatabase* spSharedDatabaseAttach(const char* name)
+{
+	if (name == NULL)
+		return NULL;
+
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+
+	struct stat status;
+	void* mapped = MAP_FAILED;
+	if (fstat(fd, &status) == 0 && status.st_size >= (off_t)sizeof(SharedDatabaseHeader))
+		mapped = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (mapped == MAP_FAILED)
+		return NULL;
+
+	const char* base = (const char*)mapped;
+	const SharedDatabaseHeader* header = (const SharedDatabaseHeader*)base;
+
+	/*Only a complete segment, whose sections are all inside it*/
+	bool isValid = memcmp(header->magic, SHARED_DATABASE_MAGIC, SHARED_DATABASE_MAGIC_LENGTH) == 0 &&
+		header->size == (int64_t)status.st_size && header->nImages > 0 && header->nBins > 0 && header->dim > 0 &&
+		header->histsOffset >= (int64_t)sizeof(*header) &&
+		header->firstDescriptorOffset >= header->histsOffset + (int64_t)sizeof(double) * header->nImages *
+			SP_HIST_MATRIX_NUM_OF_CHANNELS * header->nBins &&
+		header->descriptorsOffset >= header->firstDescriptorOffset + (int64_t)sizeof(int64_t) * (header->nImages + 1) &&
+		header->descriptorsOffset <= header->size;
+
+	if (isValid)
+	{
+		const int64_t* firstDescriptor = (const int64_t*)(base + header->firstDescriptorOffset);
+		isValid = firstDescriptor[0] == 0 &&
+			header->descriptorsOffset + (int64_t)sizeof(double) * firstDescriptor[header->nImages] * header->dim == header->size;
+	}
+
+	SPSharedDatabase* database = isValid ? (SPSharedDatabase*)malloc(sizeof(*database)) : NULL;
+	if (database == NULL)
+	{
+		munmap(mapped, status.st_size);
+		return NULL;
+	}
+
+	database->base = base;
+	database->header = header;
+	database->hists = (const double*)(base + header->histsOffset);
+	database->firstDescriptor = (const int64_t*)(base + header->firstDescriptorOffset);
+	database->descriptors = (const double*)(base + header->descriptorsOffset);
+	return database;
+}
+
+bool spSharedDatabaseIsExtractedWith(const SPSharedDatabase* database, int nFeaturesToExtract,
+		const SPExtractionConfig* extraction, uint64_t fingerprint)
+{
+	assert(database != NULL);
+	int decodeScale = extraction != NULL ? extraction->decodeScale : 1;
+	int maxImageSide = extraction != NULL ? extraction->maxImageSide : 0;
+
+	return database->header->nFeaturesToExtract == nFeaturesToExtract &&
+		database->header->decodeScale == decodeScale && database->header->maxImageSide == maxImageSide &&
+		database->header->fingerprint == fingerprint;
+}
+
+SPSharedDatabaseBudgets spSharedDatabaseGetBudgets(const SPSharedDatabase* database)
+{
+	assert(database != NULL);
+	SPSharedDatabaseBudgets budgets;
+	budgets.memoryBudgetMB = database->header->memoryBudgetMB;
+	budgets.descriptorBudget = database->header->descriptorBudget;
+	budgets.descriptorCap = database->header->descriptorCap;
+	return budgets;
+}
+
+int spSharedDatabaseGetNumOfImages(const SPSharedDatabase* database)
+{
+	assert(database != NULL);
+	return database->header->nImages;
+}
+
+int spSharedDatabaseGetNumOfBins(const SPSharedDatabase* database)
+{
+	assert(database != NULL);
+	return database->header->nBins;
+}
+
+int spSharedDatabaseGetDimension(const SPSharedDatabase* database)
+{
+	assert(database != NULL);
+	return database->header->dim;
+}
+
+const double* spSharedDatabaseGetHists(const SPSharedDatabase* database)
+{
+	assert(database != NULL);
+	return database->hists;
+}
+
+int spSharedDatabaseGetNumOfDescriptors(const SPSharedDatabase* database, int imageIndex)
+{
+	assert(database != NULL && imageIndex >= 0 && imageIndex < database->header->nImages);
+	return (int)(database->firstDescriptor[imageIndex + 1] - database->firstDescriptor[imageIndex]);
+}
+
+const double* spSharedDatabaseGetDescriptors(const SPSharedDatabase* database, int imageIndex)
+{
+	assert(database != NULL && imageIndex >= 0 && imageIndex < database->header->nImages);
+	return database->descriptors + database->firstDescriptor[imageIndex] * database->header->dim;
+}
+
+size_t spSharedDatabaseGetSize(const SPSharedDatabase* database)
+{
+	assert(database != NULL);
+	return (size_t)database->header->size;
+}
+
+void spSharedDatabaseDetach(SPSharedDatabase* database)
+{
+	if (database != NULL)
+	{
+		munmap((void*)database->base, database->header->size);
+		free(database);
+	}
+}
@@ -0,0 +1,156 @@
+#ifndef SP_SHARED_DATABASE_H_
+#define SP_SHARED_DATABASE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sp_image_proc_util.h"
+#include "sp_hist_matrix.h"
+
+extern "C"{
+	#include "SPPoint.h"
+}
+
+/**
+ * SPSharedDatabase Summary
+ * Publishes the RGB hists and SIFT descriptors of a built database into a named
+ * POSIX shared-memory segment, so other processes on the host can attach to it
+ * read-only and search it without extracting - or holding - a copy of their own.
+ *
+ * The segment is position independent: a header, the hist matrix, the position of
+ * the first descriptor of every image, and all descriptors, image after image, as
+ * rows of doubles - located by offsets from the start of the segment only, so it
+ * can be mapped at any address.
+ *
+ * A segment is written once and only becomes valid when it is complete - attaching
+ * to a segment that is still being written fails. Publishing under a name that is in
+ * use replaces the segment for new attachments only; processes already attached keep
+ * the old one. A segment lives until it is replaced or removed (e.g. rm /dev/shm/<name>).
+ *
+ * The following functions are supported:
+ *
+ * spSharedDatabasePublish				- Writes a database into a new named segment
+ * spSharedDatabaseAttach				- Maps a published segment read-only
+ * spSharedDatabaseIsExtractedWith		- Whether a segment was extracted with given settings
+ * spSharedDatabaseGetBudgets			- A getter of the budgets a segment was published within
+ * spSharedDatabaseGetNumOfImages		- A getter of the number of images in a segment
+ * spSharedDatabaseGetNumOfBins			- A getter of the number of bins of the hists in a segment
+ * spSharedDatabaseGetDimension			- A getter of the descriptor dimension of a segment
+ * spSharedDatabaseGetHists				- A getter of the hist matrix data of a segment
+ * spSharedDatabaseGetNumOfDescriptors	- A getter of the number of descriptors of an image
+ * spSharedDatabaseGetDescriptors		- A getter of the descriptors of an image
+ * spSharedDatabaseGetSize				- A getter of the size of a segment
+ * spSharedDatabaseDetach				- Unmaps a segment
+ *
+ */
+
+/** Type for defining an attached shared database **/
+typedef struct sp_shared_database_t SPSharedDatabase;
+
+/** The budgets that decided which descriptors of the images were kept, 0 where none was set **/
+typedef struct sp_shared_database_budgets_t {
+	int memoryBudgetMB;
+	int descriptorBudget; /*Of every image*/
+	int descriptorCap; /*Of all images together*/
+} SPSharedDatabaseBudgets;
+
+/**
+ * Writes the hists and descriptors of a database into a new shared-memory segment.
+ *
+ * @param name - The name of the segment, starting with '/' (see shm_open)
+ * @param hists - The RGB hists of the images
+ * @param descriptors - The descriptors of every image, all of the same dimension
+ * @param nDescriptors - The number of descriptors of every image, at least 1
+ * @param nFeaturesToExtract - The number of features that was asked of every image
+ * @param extraction - The resolution the hists and descriptors were extracted at (NULL for full)
+ * @param budgets - The budgets the descriptors were kept within (NULL for none). They're recorded,
+ * not compared - they decide which descriptors were kept, not which images they're of.
+ * @param fingerprint - Identifies the images and the rest of the settings they were extracted
+ * with - attaching processes compare it with their own
+ * @return
+ * false if the segment can't be created or written, or any argument is invalid. Otherwise true.
+ */
+bool spSharedDatabasePublish(const char* name, const SPHistMatrix* hists, SPPoint*** descriptors,
+		const int* nDescriptors, int nFeaturesToExtract, const SPExtractionConfig* extraction,
+		const SPSharedDatabaseBudgets* budgets, uint64_t fingerprint);
+
+/**
+ * Maps a published segment read-only.
+ *
+ * @return
+ * NULL if there's no such segment, it isn't a complete database segment, or allocation failure ocurred.
+ * Otherwise, the attached database.
+ */
+SPSharedDatabase* spSharedDatabaseAttach(const char* name);
+
+/**
+ * Whether the segment holds the features of images extracted with the given settings, and was
+ * published with the given fingerprint
+ *
+ * @assert database != NULL
+ */
+bool spSharedDatabaseIsExtractedWith(const SPSharedDatabase* database, int nFeaturesToExtract,
+		const SPExtractionConfig* extraction, uint64_t fingerprint);
+
+/**
+ * A getter for the budgets the descriptors of the segment were kept within
+ *
+ * @assert database != NULL
+ */
+SPSharedDatabaseBudgets spSharedDatabaseGetBudgets(const SPSharedDatabase* database);
+
+/**
+ * A getter for the number of images in the segment
+ *
+ * @assert database != NULL
+ */
+int spSharedDatabaseGetNumOfImages(const SPSharedDatabase* database);
+
+/**
+ * A getter for the number of bins of each channel hist in the segment
+ *
+ * @assert database != NULL
+ */
+int spSharedDatabaseGetNumOfBins(const SPSharedDatabase* database);
+
+/**
+ * A getter for the dimension of the descriptors in the segment
+ *
+ * @assert database != NULL
+ */
+int spSharedDatabaseGetDimension(const SPSharedDatabase* database);
+
+/**
+ * A getter for the hists of the segment, laid out like the data of an SPHistMatrix
+ *
+ * @assert database != NULL
+ */
+const double* spSharedDatabaseGetHists(const SPSharedDatabase* database);
+
+/**
+ * A getter for the number of descriptors of an image
+ *
+ * @assert database != NULL && 0 <= imageIndex < the number of images
+ */
+int spSharedDatabaseGetNumOfDescriptors(const SPSharedDatabase* database, int imageIndex);
+
+/**
+ * A getter for the descriptors of an image, one row of dim values after the other
+ *
+ * @assert database != NULL && 0 <= imageIndex < the number of images
+ */
+const double* spSharedDatabaseGetDescriptors(const SPSharedDatabase* database, int imageIndex);
+
+/**
+ * A getter for the size of the segment in bytes - memory shared by all attached processes
+ *
+ * @assert database != NULL
+ */
+size_t spSharedDatabaseGetSize(const SPSharedDatabase* database);
+
+/**
+ * Unmaps the segment and frees all resources of the attached database.
+ * If database is NULL nothing happens.
+ */
+void spSharedDatabaseDetach(SPSharedDatabase* database);
+
+#endif /* SP_SHARED_DATABASE_H_ */
@@ -0,0 +1,293 @@
+#include "sp_sketch_index.h"
+#include "sp_kernels.h"
+#include "sp_parallel.h"
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+
+/*The seed the random hyperplanes are drawn from*/
+#define SKETCH_INDEX_SEED 0x5eed5ce7c4ULL
+
+/*The number of images each thread sketches at a time*/
+#define SKETCH_INDEX_CHUNK_SIZE 64
+
+struct sp_sketch_index_t {
+	int nImages; /*The number of images*/
+	int dim; /*The dimension of a descriptor*/
+	int nBits; /*The number of bits of a sketch*/
+	int nWords; /*The number of words of a sketch*/
+	double* mean; /*The mean of all descriptors, the hyperplanes pass through*/
+	double* normals; /*The normal of every hyperplane, nBits rows of dim coordinates*/
+	int64_t* firstDescriptor; /*The first descriptor of every image, and the end of the last one*/
+	uint64_t* sketches; /*The sketches of all descriptors, image after image*/
+};
+
+/*A candidate of a search - a descriptor of an image*/
+struct SketchCandidate {
+	int image;
+	int descriptor;
+};
+
+/*The next number of a splitmix64 sequence*/
+static uint64_t nextRandom(uint64_t* state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+/*A standard normal number, by the Box-Muller transform*/
+static double nextGaussian(uint64_t* state)
+{
+	/*Uniform in (0, 1], so the log is defined*/
+	double u1 = ((nextRandom(state) >> 11) + 1) * (1.0 / 9007199254740992.0);
+	double u2 = (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+	return sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+/*Stores the sketch of a descriptor in sketch - a bit per hyperplane, set if it's on the side of its normal*/
+static void sketchDescriptor(const SPSketchIndex* index, const double* descriptor, uint64_t* sketch)
+{
+	memset(sketch, 0, sizeof(*sketch) * index->nWords);
+	for(int b = 0; b < index->nBits; ++b)
+	{
+		const double* normal = index->normals + (size_t)b * index->dim;
+		double dot = 0;
+		for(int i = 0; i < index->dim; ++i)
+			dot += normal[i] * (descriptor[i] - index->mean[i]);
+
+		if (dot > 0)
+			sketch[b / 64] |= 1ULL << (b % 64);
+	}
+}
+
+SPSketchIndex* spSketchIndexCreate(SPPoint*** descriptors, const int* nDescriptors, int nImages, int nBits)
+{
+	if (descriptors == NULL || nDescriptors == NULL || nImages <= 0 ||
+		(nBits != SP_SKETCH_INDEX_SMALL_BITS && nBits != SP_SKETCH_INDEX_LARGE_BITS))
+		return NULL;
+
+	int64_t nTotal = 0;
+	for(int i = 0; i < nImages; ++i)
+	{
+		if (descriptors[i] == NULL || nDescriptors[i] < 0)
+			return NULL;
+		nTotal += nDescriptors[i];
+	}
+	if (nTotal == 0)
+		return NULL;
+
+	int firstImage = 0;
+	while (nDescriptors[firstImage] == 0)
+		++firstImage;
+	int dim = spPointGetDimension(descriptors[firstImage][0]);
+
+	SPSketchIndex* index = (SPSketchIndex*)malloc(sizeof(*index));
+	if (index == NULL)
+		return NULL;
+
+	index->nImages = nImages;
+	index->dim = dim;
+	index->nBits = nBits;
+	index->nWords = nBits / 64;
+	index->mean = (double*)calloc(dim, sizeof(*index->mean));
+	index->normals = (double*)malloc(sizeof(*index->normals) * nBits * dim);
+	index->firstDescriptor = (int64_t*)malloc(sizeof(*index->firstDescriptor) * ((size_t)nImages + 1));
+	index->sketches = (uint64_t*)malloc(sizeof(*index->sketches) * index->nWords * nTotal);
+
+	if (index->mean == NULL || index->normals == NULL || index->firstDescriptor == NULL || index->sketches == NULL)
+	{
+		spSketchIndexDestroy(index);
+		return NULL;
+	}
+
+	index->firstDescriptor[0] = 0;
+	for(int i = 0; i < nImages; ++i)
+	{
+		index->firstDescriptor[i + 1] = index->firstDescriptor[i] + nDescriptors[i];
+		for(int j = 0; j < nDescriptors[i]; ++j)
+		{
+			SPPointView view = spPointGetView(descriptors[i][j]);
+			for(int d = 0; d < dim; ++d)
+				index->mean[d] += view.data[d];
+		}
+	}
+	for(int d = 0; d < dim; ++d)
+		index->mean[d] /= nTotal;
+
+	uint64_t state = SKETCH_INDEX_SEED;
+	for(int i = 0; i < nBits * dim; ++i)
+		index->normals[i] = nextGaussian(&state);
+
+	int nChunks = (nImages + SKETCH_INDEX_CHUNK_SIZE - 1) / SKETCH_INDEX_CHUNK_SIZE;
+	spParallelFor(nChunks, 0, [&](int chunk) {
+		int end = chunk * SKETCH_INDEX_CHUNK_SIZE + SKETCH_INDEX_CHUNK_SIZE;
+		for(int i = chunk * SKETCH_INDEX_CHUNK_SIZE; i < end && i < nImages; ++i)
+			for(int j = 0; j < nDescriptors[i]; ++j)
+				sketchDescriptor(index, spPointGetView(descriptors[i][j]).data,
+						index->sketches + (index->firstDescriptor[i] + j) * index->nWords);
+	});
+
+	return index;
+}
+
+/*
+ * Calls visit(image, descriptor, distance) for every descriptor of the searched images (all of
+ * them, or the candidates), in order, with the Hamming distance of its sketch to the query's -
+ * for a number of words known at compile time
+ */
+template <int WORDS, typename Visit>
+static void scanSketches(const SPSketchIndex* index, const uint64_t* query, const int* candidateImages,
+		int nCandidateImages, const Visit& visit)
+{
+	int nSearched = candidateImages == NULL ? index->nImages : nCandidateImages;
+	for(int c = 0; c < nSearched; ++c)
+	{
+		int image = candidateImages == NULL ? c : candidateImages[c];
+		const uint64_t* sketch = index->sketches + index->firstDescriptor[image] * WORDS;
+		int nDescriptors = (int)(index->firstDescriptor[image + 1] - index->firstDescriptor[image]);
+
+		for(int j = 0; j < nDescriptors; ++j, sketch += WORDS)
+			visit(image, j, spKernelHammingDistance<WORDS>(sketch, query));
+	}
+}
+
+/*
+ * Collects the nCandidates descriptors with the closest sketches to the query's, in the order
+ * of the images - all those closer than a threshold distance, and the first of those at it.
+ * The threshold is found from a histogram of the distances, so the scan doesn't sort anything.
+ * Returns the number of candidates collected.
+ */
+template <int WORDS>
+static int collectCandidates(const SPSketchIndex* index, const uint64_t* query, int nCandidates,
+		const int* candidateImages, int nCandidateImages, SketchCandidate* candidates)
+{
+	int64_t histogram[SP_SKETCH_INDEX_LARGE_BITS + 1] = {0};
+	scanSketches<WORDS>(index, query, candidateImages, nCandidateImages,
+			[&](int, int, int distance) { ++histogram[distance]; });
+
+	int threshold = 0;
+	int64_t nBelow = 0;
+	while (threshold < index->nBits && nBelow + histogram[threshold] < nCandidates)
+		nBelow += histogram[threshold++];
+
+	int nAtThreshold = (int)(nCandidates - nBelow);
+	int nCollected = 0;
+	scanSketches<WORDS>(index, query, candidateImages, nCandidateImages,
+			[&](int image, int descriptor, int distance) {
+		if (distance < threshold || (distance == threshold && nAtThreshold-- > 0))
+		{
+			candidates[nCollected].image = image;
+			candidates[nCollected++].descriptor = descriptor;
+		}
+	});
+	return nCollected;
+}
+
+/*Offers the candidates to closest by their exact distance to the query - for a dimension known at compile time, or any for DIM 0*/
+template <int DIM, typename TopK>
+static void rankCandidates(SPPoint*** descriptors, const SPPointView* query, const SketchCandidate* candidates,
+		int nCollected, TopK& closest)
+{
+	for(int c = 0; c < nCollected; ++c)
+	{
+		SPPoint* descriptor = descriptors[candidates[c].image][candidates[c].descriptor];
+		closest.offer(candidates[c].image, DIM > 0 ?
+				spKernelL2SquaredDistance<DIM>(spPointGetView(descriptor).data, query->data) :
+				spPointL2SquaredDistanceToView(descriptor, query));
+	}
+}
+
+int spSketchIndexFindClosest(const SPSketchIndex* index, SPPoint*** descriptors, const SPPointView* query,
+		int kClosest, int nCandidates, const int* candidateImages, int nCandidateImages, int* resImages)
+{
+	if (index == NULL || descriptors == NULL || query == NULL || query->dim != index->dim ||
+		kClosest <= 0 || nCandidates < kClosest || resImages == NULL)
+		return -1;
+
+	uint64_t querySketch[SP_SKETCH_INDEX_LARGE_BITS / 64];
+	sketchDescriptor(index, query->data, querySketch);
+
+	/*There are never more candidates than descriptors*/
+	if (nCandidates > index->firstDescriptor[index->nImages])
+		nCandidates = (int)index->firstDescriptor[index->nImages];
+
+	SketchCandidate* candidates = (SketchCandidate*)malloc(sizeof(*candidates) * nCandidates);
+	if (candidates == NULL)
+		return -1;
+
+	int nCollected = index->nWords == 1 ?
+		collectCandidates<1>(index, querySketch, nCandidates, candidateImages, nCandidateImages, candidates) :
+		collectCandidates<2>(index, querySketch, nCandidates, candidateImages, nCandidateImages, candidates);
+
+	int nFound = -1;
+	if (kClosest == SP_KERNEL_SIFT_K)
+	{
+		/*The common case of the local search has its own kernel*/
+		SPKernelTopK<SP_KERNEL_SIFT_K> closest;
+		if (index->dim == SP_KERNEL_SIFT_DIMENSION)
+			rankCandidates<SP_KERNEL_SIFT_DIMENSION>(descriptors, query, candidates, nCollected, closest);
+		else
+			rankCandidates<0>(descriptors, query, candidates, nCollected, closest);
+
+		for(int i = 0; i < closest.size; ++i)
+			resImages[i] = closest.indices[i];
+		nFound = closest.size;
+	}
+	else
+	{
+		double* distances = (double*)malloc(sizeof(*distances) * kClosest);
+		if (distances != NULL)
+		{
+			SPKernelTopKList<double> closest(distances, resImages, kClosest);
+			rankCandidates<0>(descriptors, query, candidates, nCollected, closest);
+			nFound = closest.size;
+		}
+		free(distances);
+	}
+
+	free(candidates);
+	return nFound;
+}
+
+int spSketchIndexGetNumOfBits(const SPSketchIndex* index)
+{
+	assert(index != NULL);
+	return index->nBits;
+}
+
+size_t spSketchIndexGetMemoryUsage(const SPSketchIndex* index)
+{
+	if (index == NULL)
+		return 0;
+
+	return sizeof(*index) +
+		sizeof(*index->mean) * index->dim +
+		sizeof(*index->normals) * index->nBits * (size_t)index->dim +
+		sizeof(*index->firstDescriptor) * ((size_t)index->nImages + 1) +
+		sizeof(*index->sketches) * index->nWords * (size_t)index->firstDescriptor[index->nImages];
+}
+
+size_t spSketchIndexGetQueryMemoryUsage(const SPSketchIndex* index, int nCandidates)
+{
+	if (index == NULL)
+		return 0;
+
+	if (nCandidates > index->firstDescriptor[index->nImages])
+		nCandidates = (int)index->firstDescriptor[index->nImages];
+	return sizeof(SketchCandidate) * (size_t)nCandidates;
+}
+
+void spSketchIndexDestroy(SPSketchIndex* index)
+{
+	if (index == NULL)
+		return;
+
+	free(index->mean);
+	free(index->normals);
+	free(index->firstDescriptor);
+	free(index->sketches);
+	free(index);
+}
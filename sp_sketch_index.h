@@ -0,0 +1,109 @@
+#ifndef SP_SKETCH_INDEX_H_
+#define SP_SKETCH_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+extern "C"{
+	#include "SPPoint.h"
+}
+
+/**
+ * SPSketchIndex Summary
+ * Short binary sketches of the local descriptors of a database of images, used to
+ * prefilter the search for the descriptors closest to a query descriptor.
+ *
+ * The sketch of a descriptor holds a bit per random hyperplane through the mean of
+ * the descriptors - the side of the hyperplane the descriptor is on. The fraction of
+ * bits two sketches differ in estimates the angle between their descriptors (around
+ * the mean), so descriptors with close sketches tend to be close.
+ *
+ * A search first scans the sketches by Hamming distance - one or two words per
+ * descriptor, instead of its coordinates - and keeps the nCandidates descriptors with
+ * the closest sketches. Only those are compared exactly, by L2-squared distance.
+ * The result is approximate: a descriptor whose sketch isn't among the candidates is
+ * missed. With at least as many candidates as descriptors, it's exact.
+ *
+ * The projections are drawn from a fixed seed, so an index built from the same
+ * descriptors is always the same.
+ *
+ * The following functions are supported:
+ *
+ * spSketchIndexCreate				- Sketches the descriptors of a database
+ * spSketchIndexFindClosest			- Finds the images of the descriptors closest to a query descriptor
+ * spSketchIndexGetNumOfBits		- A getter of the number of bits of a sketch
+ * spSketchIndexGetMemoryUsage		- The memory an index takes
+ * spSketchIndexGetQueryMemoryUsage	- The memory a search of a query descriptor takes
+ * spSketchIndexDestroy				- Free all resources associated with an index
+ *
+ */
+
+/** The number of bits a sketch may have - one 64-bit word, or two **/
+#define SP_SKETCH_INDEX_SMALL_BITS 64
+#define SP_SKETCH_INDEX_LARGE_BITS 128
+
+/** Type for defining the index **/
+typedef struct sp_sketch_index_t SPSketchIndex;
+
+/**
+ * Sketches the descriptors of every image, in parallel.
+ *
+ * @param descriptors - The descriptors of every image, all of the same dimension
+ * @param nDescriptors - The number of descriptors of every image
+ * @param nImages - The number of images
+ * @param nBits - The number of bits of a sketch, SP_SKETCH_INDEX_SMALL_BITS or SP_SKETCH_INDEX_LARGE_BITS
+ * @return
+ * NULL in case allocation failure ocurred, or an argument is invalid, or there are no descriptors.
+ * Otherwise, the new index.
+ */
+SPSketchIndex* spSketchIndexCreate(SPPoint*** descriptors, const int* nDescriptors, int nImages, int nBits);
+
+/**
+ * Finds the kClosest descriptors to a query descriptor among the nCandidates descriptors with
+ * the closest sketches to its sketch, and stores the index of the image of each in resImages,
+ * from the closest. Candidates whose sketches are as close are taken by the lower image index,
+ * and exact ties are broken by the lower image index, like spBestSIFTL2SquaredDistance.
+ *
+ * @param index - The index
+ * @param descriptors - The descriptors the index was created from
+ * @param query - The query descriptor, of the dimension of the descriptors
+ * @param kClosest - The number of descriptors to find
+ * @param nCandidates - The number of descriptors compared exactly, >= kClosest
+ * @param candidateImages - If not NULL, only the descriptors of these images are searched,
+ * given in increasing order
+ * @param nCandidateImages - The number of candidate images
+ * @param resImages - OUTPUT parameter. An array of at least kClosest images.
+ * @return
+ * -1 if an argument is NULL or invalid, or allocation error occurred.
+ * Otherwise, the number of images stored in resImages (fewer than kClosest only if the
+ * searched images hold fewer descriptors)
+ */
+int spSketchIndexFindClosest(const SPSketchIndex* index, SPPoint*** descriptors, const SPPointView* query,
+		int kClosest, int nCandidates, const int* candidateImages, int nCandidateImages, int* resImages);
+
+/**
+ * A getter for the number of bits of a sketch
+ *
+ * @assert index != NULL
+ */
+int spSketchIndexGetNumOfBits(const SPSketchIndex* index);
+
+/**
+ * The memory the index takes, in bytes - its struct and every array it owns.
+ * Returns 0 if index is NULL.
+ */
+size_t spSketchIndexGetMemoryUsage(const SPSketchIndex* index);
+
+/**
+ * The memory a search with nCandidates candidates takes, in bytes.
+ * Returns 0 if index is NULL.
+ */
+size_t spSketchIndexGetQueryMemoryUsage(const SPSketchIndex* index, int nCandidates);
+
+/**
+ * Free all memory associated with the index.
+ * If index is NULL nothing happens.
+ */
+void spSketchIndexDestroy(SPSketchIndex* index);
+
+#endif /* SP_SKETCH_INDEX_H_ */
@@ -0,0 +1,252 @@
+#include "sp_workload.h"
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+
+/*The first line of a workload file*/
+#define WORKLOAD_MAGIC "ex3-workload"
+#define WORKLOAD_VERSION 1
+
+/*The keywords that start the lines of a workload file*/
+#define WORKLOAD_DATABASE "database"
+#define WORKLOAD_OPTIONS "options"
+#define WORKLOAD_QUERY "query"
+#define WORKLOAD_DELETE "delete"
+
+/*The number of entries the entries of a loaded workload have room for at first*/
+#define WORKLOAD_INITIAL_CAPACITY 64
+
+struct sp_workload_recorder_t {
+	FILE* file;
+	double startTime; /*The time entries are recorded relative to*/
+};
+
+/*Whether str can be written as a single token - not empty, short enough and without whitespace*/
+static bool isToken(const char* str)
+{
+	if (str == NULL || *str == '\0' || strlen(str) >= SP_WORKLOAD_MAX_TOKEN_LENGTH)
+		return false;
+
+	for(; *str != '\0'; ++str)
+		if (isspace((unsigned char)*str))
+			return false;
+	return true;
+}
+
+/*Flushes the line just written, so the file holds every recorded entry. Returns false on error*/
+static bool endLine(SPWorkloadRecorder* recorder, int nPrinted)
+{
+	return nPrinted > 0 && fflush(recorder->file) == 0;
+}
+
+SPWorkloadRecorder* spWorkloadRecorderOpen(const char* path, const SPWorkloadDatabase* database,
+		int nArguments, char** arguments, const char* skippedOption, double startTime)
+{
+	if (path == NULL || database == NULL || (arguments == NULL && nArguments > 0) ||
+		!isToken(database->imgDirectory) || !isToken(database->imgPrefix) || !isToken(database->imgSuffix))
+		return NULL;
+
+	int nRecorded = 0;
+	for(int i = 0; i < nArguments; ++i)
+	{
+		if (skippedOption != NULL && strcmp(arguments[i], skippedOption) == 0)
+		{
+			++i; /*And its value*/
+			continue;
+		}
+		if (!isToken(arguments[i]))
+			return NULL;
+		nRecorded++;
+	}
+
+	SPWorkloadRecorder* recorder = (SPWorkloadRecorder*)malloc(sizeof(*recorder));
+	if (recorder == NULL)
+		return NULL;
+
+	recorder->startTime = startTime;
+	recorder->file = fopen(path, "w");
+	if (recorder->file == NULL)
+	{
+		free(recorder);
+		return NULL;
+	}
+
+	bool isWritten = fprintf(recorder->file, "%s %d\n%s %s %s %d %s %d %d\n%s %d", WORKLOAD_MAGIC, WORKLOAD_VERSION,
+						WORKLOAD_DATABASE, database->imgDirectory, database->imgPrefix, database->nImages,
+						database->imgSuffix, database->nBins, database->nFeaturesToExtract,
+						WORKLOAD_OPTIONS, nRecorded) > 0;
+
+	for(int i = 0; i < nArguments && isWritten; ++i)
+	{
+		if (skippedOption != NULL && strcmp(arguments[i], skippedOption) == 0)
+			++i;
+		else
+			isWritten = fprintf(recorder->file, " %s", arguments[i]) > 0;
+	}
+
+	if (!isWritten || !endLine(recorder, fprintf(recorder->file, "\n")))
+	{
+		spWorkloadRecorderClose(recorder);
+		return NULL;
+	}
+
+	return recorder;
+}
+
+bool spWorkloadRecordQuery(SPWorkloadRecorder* recorder, double time, const char* queryPath)
+{
+	if (recorder == NULL || !isToken(queryPath))
+		return false;
+
+	return endLine(recorder, fprintf(recorder->file, "%s %.6f %s\n", WORKLOAD_QUERY, time - recorder->startTime, queryPath));
+}
+
+bool spWorkloadRecordDelete(SPWorkloadRecorder* recorder, double time, int imageIndex)
+{
+	if (recorder == NULL)
+		return false;
+
+	return endLine(recorder, fprintf(recorder->file, "%s %.6f %d\n", WORKLOAD_DELETE, time - recorder->startTime, imageIndex));
+}
+
+void spWorkloadRecorderClose(SPWorkloadRecorder* recorder)
+{
+	if (recorder == NULL)
+		return;
+
+	fclose(recorder->file);
+	free(recorder);
+}
+
+/*Reads the next token of file into a new string. Returns NULL at the end of the file, or on allocation failure*/
+static char* readToken(FILE* file, char* buffer)
+{
+	if (fscanf(file, "%1023s", buffer) != 1)
+		return NULL;
+
+	char* token = (char*)malloc(strlen(buffer) + 1);
+	if (token != NULL)
+		strcpy(token, buffer);
+	return token;
+}
+
+/*Reads the header of a workload file - up to and including its options. Returns false if it isn't one*/
+static bool readHeader(FILE* file, SPWorkload* workload, char* buffer)
+{
+	int version = 0;
+	if (fscanf(file, "%1023s %d", buffer, &version) != 2 || strcmp(buffer, WORKLOAD_MAGIC) != 0 ||
+		version != WORKLOAD_VERSION)
+		return false;
+
+	SPWorkloadDatabase* database = &workload->database;
+	if (fscanf(file, "%1023s", buffer) != 1 || strcmp(buffer, WORKLOAD_DATABASE) != 0 ||
+		(database->imgDirectory = readToken(file, buffer)) == NULL ||
+		(database->imgPrefix = readToken(file, buffer)) == NULL ||
+		fscanf(file, "%d", &database->nImages) != 1 ||
+		(database->imgSuffix = readToken(file, buffer)) == NULL ||
+		fscanf(file, "%d %d", &database->nBins, &database->nFeaturesToExtract) != 2)
+		return false;
+
+	int nArguments = 0;
+	if (fscanf(file, "%1023s %d", buffer, &nArguments) != 2 || strcmp(buffer, WORKLOAD_OPTIONS) != 0 ||
+		nArguments < 0 || nArguments > SP_WORKLOAD_MAX_TOKEN_LENGTH)
+		return false;
+
+	workload->arguments = (char**)calloc(nArguments + 1, sizeof(*workload->arguments));
+	if (workload->arguments == NULL)
+		return false;
+
+	for(; workload->nArguments < nArguments; ++workload->nArguments)
+		if ((workload->arguments[workload->nArguments] = readToken(file, buffer)) == NULL)
+			return false;
+
+	return true;
+}
+
+/*Reads the entries of a workload file, after its header. Returns false if one isn't valid*/
+static bool readEntries(FILE* file, SPWorkload* workload, char* buffer)
+{
+	int capacity = 0;
+	while (fscanf(file, "%1023s", buffer) == 1)
+	{
+		if (workload->nEntries == capacity)
+		{
+			capacity = capacity > 0 ? capacity * 2 : WORKLOAD_INITIAL_CAPACITY;
+			SPWorkloadEntry* entries = (SPWorkloadEntry*)realloc(workload->entries, sizeof(*entries) * capacity);
+			if (entries == NULL)
+				return false;
+			workload->entries = entries;
+		}
+
+		SPWorkloadEntry* entry = &workload->entries[workload->nEntries];
+		entry->queryPath = NULL;
+		entry->imageIndex = -1;
+
+		if (strcmp(buffer, WORKLOAD_QUERY) == 0)
+		{
+			entry->type = SP_WORKLOAD_QUERY;
+			if (fscanf(file, "%lf", &entry->time) != 1 || (entry->queryPath = readToken(file, buffer)) == NULL)
+				return false;
+			workload->nQueries++;
+		}
+		else if (strcmp(buffer, WORKLOAD_DELETE) == 0)
+		{
+			entry->type = SP_WORKLOAD_DELETE;
+			if (fscanf(file, "%lf %d", &entry->time, &entry->imageIndex) != 2)
+				return false;
+		}
+		else
+			return false;
+
+		workload->nEntries++;
+	}
+
+	return feof(file) != 0;
+}
+
+SPWorkload* spWorkloadLoad(const char* path)
+{
+	if (path == NULL)
+		return NULL;
+
+	FILE* file = fopen(path, "r");
+	if (file == NULL)
+		return NULL;
+
+	SPWorkload* workload = (SPWorkload*)calloc(1, sizeof(*workload));
+	char* buffer = (char*)malloc(SP_WORKLOAD_MAX_TOKEN_LENGTH);
+
+	bool isLoaded = workload != NULL && buffer != NULL &&
+		readHeader(file, workload, buffer) && readEntries(file, workload, buffer);
+
+	free(buffer);
+	fclose(file);
+
+	if (!isLoaded)
+	{
+		spWorkloadDestroy(workload);
+		return NULL;
+	}
+
+	return workload;
+}
+
+void spWorkloadDestroy(SPWorkload* workload)
+{
+	if (workload == NULL)
+		return;
+
+	free(workload->database.imgDirectory);
+	free(workload->database.imgPrefix);
+	free(workload->database.imgSuffix);
+
+	if (workload->arguments != NULL)
+		for(int i = 0; i < workload->nArguments; ++i)
+			free(workload->arguments[i]);
+	free(workload->arguments);
+
+	for(int i = 0; i < workload->nEntries; ++i)
+		free(workload->entries[i].queryPath);
+	free(workload->entries);
+	free(workload);
+}
@@ -0,0 +1,130 @@
+#ifndef SP_WORKLOAD_H_
+#define SP_WORKLOAD_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/**
+ * SPWorkload Summary
+ * A recorded query workload - the database the queries were asked of, the command line
+ * options it was built and searched with, and the stream of queries and deletions with
+ * the time each arrived at. It's recorded by ex3 (OPTION_RECORD) and replayed by ex3-load.
+ *
+ * A workload is a text file, a line per entry, every field a single whitespace-free token:
+ *
+ * ex3-workload 1
+ * database <directory> <prefix> <number of images> <suffix> <number of bins> <number of features>
+ * options <number of arguments> <argument>...
+ * query <seconds> <query image path>
+ * delete <seconds> <image index>
+ *
+ * Times are in seconds since the recording started. Every entry is flushed as it's recorded,
+ * so the workload of a process that was killed is kept up to its last query.
+ *
+ * The following functions are supported:
+ *
+ * spWorkloadRecorderOpen		- Starts recording a workload to a file
+ * spWorkloadRecordQuery		- Records a query
+ * spWorkloadRecordDelete		- Records a deletion
+ * spWorkloadRecorderClose		- Stops recording
+ * spWorkloadLoad				- Reads a recorded workload
+ * spWorkloadDestroy			- Free all resources associated with a workload
+ *
+ */
+
+/** The longest token of a workload, with its terminating null **/
+#define SP_WORKLOAD_MAX_TOKEN_LENGTH 1024
+
+/** The database a workload's queries were asked of, as ex3 asks for it **/
+typedef struct sp_workload_database_t {
+	char* imgDirectory;
+	char* imgPrefix;
+	int nImages;
+	char* imgSuffix;
+	int nBins;
+	int nFeaturesToExtract;
+} SPWorkloadDatabase;
+
+/** The kinds of entries of a workload **/
+typedef enum sp_workload_entry_type_t {
+	SP_WORKLOAD_QUERY,
+	SP_WORKLOAD_DELETE
+} SPWorkloadEntryType;
+
+/** An entry of a workload **/
+typedef struct sp_workload_entry_t {
+	SPWorkloadEntryType type;
+	double time; /*The seconds since the recording started*/
+	char* queryPath; /*The path of the query image of a query. NULL for a deletion*/
+	int imageIndex; /*The index of the image a deletion deleted*/
+} SPWorkloadEntry;
+
+/** A recorded workload **/
+typedef struct sp_workload_t {
+	SPWorkloadDatabase database;
+	int nArguments; /*The command line options, without the program name*/
+	char** arguments;
+	int nEntries;
+	int nQueries; /*The number of entries that are queries*/
+	SPWorkloadEntry* entries; /*By increasing time*/
+} SPWorkload;
+
+/** Type for defining the recorder **/
+typedef struct sp_workload_recorder_t SPWorkloadRecorder;
+
+/**
+ * Creates the workload file at path (replacing it), writes its header and starts recording.
+ *
+ * @param path - The path of the workload file
+ * @param database - The database the queries are asked of
+ * @param nArguments - The number of command line options
+ * @param arguments - The command line options, without the program name. Tokens equal to
+ * skippedOption, with the token after each, aren't written.
+ * @param skippedOption - An option not to record (the one that started the recording), or NULL
+ * @param startTime - The time the recording starts at, on the clock entries are recorded by
+ * @return
+ * NULL if the file couldn't be created or written, an argument is NULL or a token is too long
+ * or holds whitespace. Otherwise, the new recorder.
+ */
+SPWorkloadRecorder* spWorkloadRecorderOpen(const char* path, const SPWorkloadDatabase* database,
+		int nArguments, char** arguments, const char* skippedOption, double startTime);
+
+/**
+ * Records a query that arrived at time (on the clock of startTime).
+ *
+ * @return
+ * false if recorder or queryPath is NULL, queryPath isn't a valid token or the file couldn't be written.
+ * Otherwise true.
+ */
+bool spWorkloadRecordQuery(SPWorkloadRecorder* recorder, double time, const char* queryPath);
+
+/**
+ * Records the deletion of an image that arrived at time (on the clock of startTime).
+ *
+ * @return
+ * false if recorder is NULL or the file couldn't be written. Otherwise true.
+ */
+bool spWorkloadRecordDelete(SPWorkloadRecorder* recorder, double time, int imageIndex);
+
+/**
+ * Closes the workload file and frees the recorder.
+ * If recorder is NULL nothing happens.
+ */
+void spWorkloadRecorderClose(SPWorkloadRecorder* recorder);
+
+/**
+ * Reads the workload recorded at path.
+ *
+ * @return
+ * NULL if the file couldn't be read, isn't a workload, or allocation failure ocurred.
+ * Otherwise, the workload.
+ */
+SPWorkload* spWorkloadLoad(const char* path);
+
+/**
+ * Free all memory associated with the workload.
+ * If workload is NULL nothing happens.
+ */
+void spWorkloadDestroy(SPWorkload* workload);
+
+#endif /* SP_WORKLOAD_H_ */